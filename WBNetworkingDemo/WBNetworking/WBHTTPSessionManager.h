@@ -0,0 +1,173 @@
+//
+//  WBHTTPSessionManager.h
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/14.
+//
+
+#import <Foundation/Foundation.h>
+#import "WBURLRequestSeriailzation.h"
+#import "WBSecurityPolicy.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ `WBHTTPSessionManager` executes requests built by a `WBHTTPRequestSerializer` on one shared `NSURLSession`, so requests to the same host reuse its keep-alive connections instead of each call site opening its own session.
+ WBHTTPSessionManager 使用一个共享的 NSURLSession 执行 WBHTTPRequestSerializer 创建的请求，同一个域名的请求复用 keep-alive 连接，不需要每个调用的地方各自创建 session。
+
+ Tasks are not resumed as soon as they are created. They wait in a priority queue, highest `priority` first and in creation order within the same priority, until both the global limit `maximumConcurrentRequests` and the per-host limit `maximumConcurrentRequestsPerHost` allow them to run. A host that has reached its limit does not block tasks for other hosts.
+ 创建的 task 不会立即 resume，而是放入优先级队列（priority 高的优先，相同 priority 按创建顺序），直到全局并发数和单个域名的并发数都允许时才开始。某个域名达到上限时不影响其他域名的 task。
+
+ Server trust challenges are evaluated with `securityPolicy`.
+ 服务器证书的验证使用 securityPolicy。
+
+ @warning The session retains the manager as its delegate. Call `-invalidateSessionCancelingTasks:` when a manager that is not shared is no longer needed.
+ session 会强引用作为 delegate 的 manager，不再使用非共享的 manager 时需要调用 invalidateSessionCancelingTasks:。
+ */
+@interface WBHTTPSessionManager : NSObject <NSURLSessionDelegate, NSURLSessionTaskDelegate>
+
+/**
+ The URL used to construct requests from relative paths. 用来拼接相对路径的 URL
+ */
+@property (readonly, nonatomic, strong, nullable) NSURL *baseURL;
+
+/**
+ The shared session that executes every task. 执行所有 task 的 session
+ */
+@property (readonly, nonatomic, strong) NSURLSession *session;
+
+/**
+ Creates requests for the convenience methods. `WBHTTPRequestSerializer` by default.
+ 便捷方法使用的请求序列化对象，默认为 WBHTTPRequestSerializer。
+ */
+@property (nonatomic, strong) WBHTTPRequestSerializer <WBURLRequestSerialization> *requestSerializer;
+
+/**
+ Evaluates server trust for secure connections. `+[WBSecurityPolicy defaultPolicy]` by default.
+ 验证服务器证书的安全策略，默认为 WBSecurityPolicy 的 defaultPolicy。
+ */
+@property (nonatomic, strong) WBSecurityPolicy *securityPolicy;
+
+/**
+ The maximum number of tasks running at once across all hosts. `16` by default.
+ 所有域名同时执行的最大 task 数量，默认 16。
+ */
+@property (atomic, assign) NSUInteger maximumConcurrentRequests;
+
+/**
+ The maximum number of tasks running at once for a single host and port. `6` by default. It is clamped to the session configuration's `HTTPMaximumConnectionsPerHost`, which is fixed when the session is created.
+ 单个域名（和端口）同时执行的最大 task 数量，默认 6。不会超过 session 配置的每个域名最大连接数，这个连接数在创建 session 时就已经确定。
+ */
+@property (atomic, assign) NSUInteger maximumConcurrentRequestsPerHost;
+
+/**
+ The queue on which completion handlers are called. The main queue by default.
+ 调用完成回调的队列，默认为主队列。
+ */
+@property (nonatomic, strong, nullable) dispatch_queue_t completionQueue;
+
+/**
+ The number of tasks that have been resumed and have not completed. 已经开始、还没有完成的 task 数量
+ */
+@property (readonly, nonatomic, assign) NSUInteger numberOfRunningTasks;
+
+/**
+ The number of tasks waiting for a free slot. 等待执行的 task 数量
+ */
+@property (readonly, nonatomic, assign) NSUInteger numberOfPendingTasks;
+
+///---------------------
+/// @name Initialization
+///---------------------
+
+/**
+ Returns a manager shared by the whole app, with no base URL and the default session configuration.
+ 返回全局共享的 manager，没有 baseURL，使用默认的 session 配置。
+ */
++ (instancetype)sharedManager;
+
+/**
+ Creates and returns a manager with no base URL and the default session configuration.
+ 创建一个没有 baseURL、使用默认 session 配置的 manager。
+ */
++ (instancetype)manager;
+
+/**
+ Initializes a manager with the specified base URL and session configuration.
+ 根据 baseURL 和 session 配置初始化 manager。
+
+ NS_DESIGNATED_INITIALIZER 表示指定此方法为初始化方法
+
+ @param url The base URL for relative paths. 拼接相对路径的 URL
+ @param configuration The configuration of the shared session, or `nil` for the default configuration. Its `HTTPMaximumConnectionsPerHost` is kept and caps `maximumConcurrentRequestsPerHost`. session 的配置，为 nil 时使用默认配置；配置的每个域名最大连接数保持不变，作为 maximumConcurrentRequestsPerHost 的上限
+ */
+- (instancetype)initWithBaseURL:(nullable NSURL *)url sessionConfiguration:(nullable NSURLSessionConfiguration *)configuration NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)initWithBaseURL:(nullable NSURL *)url;
+
+///---------------------------
+/// @name Running Data Tasks
+///---------------------------
+
+/**
+ Creates a data task for `request` and queues it. The task is resumed by the manager when a slot is free; do not call `-resume` on it. Cancelling the task removes it from the queue.
+ 为 request 创建 data task 并放入队列，有空闲的位置时由 manager resume，不要自己调用 resume。取消 task 时从队列中移除。
+
+ @param request The request to run. 要执行的请求
+ @param priority The task priority, from `0` to `1` (`NSURLSessionTaskPriorityDefault` is `0.5`). Higher priorities run first and are passed on to the task. task 的优先级，0 到 1，高优先级先执行
+ @param completionHandler Called on `completionQueue` when the task completes. 完成时在 completionQueue 中调用
+ */
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request
+                                     priority:(float)priority
+                            completionHandler:(nullable void (^)(NSURLResponse * _Nullable response, NSData * _Nullable data, NSError * _Nullable error))completionHandler;
+
+/**
+ Creates a request with `requestSerializer` and queues a data task for it with the default priority. Returns `nil` and calls `completionHandler` with the serialization error if the request cannot be created.
+ 使用 requestSerializer 创建请求，并以默认优先级放入队列。创建请求失败时返回 nil，并在完成回调中返回错误。
+
+ @param method The HTTP method, such as `GET`, `HEAD`, `POST`, `PUT` or `DELETE`. 请求方法
+ @param URLString A URL string, relative to `baseURL` if it is not absolute. 请求的地址，不是完整地址时拼接在 baseURL 后面
+ @param parameters The parameters encoded by `requestSerializer`. 由 requestSerializer 编码的参数
+ */
+- (nullable NSURLSessionDataTask *)dataTaskWithHTTPMethod:(NSString *)method
+                                                URLString:(NSString *)URLString
+                                               parameters:(nullable id)parameters
+                                        completionHandler:(nullable void (^)(NSURLResponse * _Nullable response, NSData * _Nullable data, NSError * _Nullable error))completionHandler;
+
+/**
+ Queues a `GET` data task. 发起 GET 请求
+
+ @see -dataTaskWithHTTPMethod:URLString:parameters:completionHandler:
+ */
+- (nullable NSURLSessionDataTask *)GET:(NSString *)URLString
+                            parameters:(nullable id)parameters
+                     completionHandler:(nullable void (^)(NSURLResponse * _Nullable response, NSData * _Nullable data, NSError * _Nullable error))completionHandler;
+
+/**
+ Queues a `POST` data task. 发起 POST 请求
+
+ @see -dataTaskWithHTTPMethod:URLString:parameters:completionHandler:
+ */
+- (nullable NSURLSessionDataTask *)POST:(NSString *)URLString
+                             parameters:(nullable id)parameters
+                      completionHandler:(nullable void (^)(NSURLResponse * _Nullable response, NSData * _Nullable data, NSError * _Nullable error))completionHandler;
+
+/**
+ Queues a multipart `POST` data task whose body is built by `block`. 发起 multipart 的 POST 请求，body 由 block 构建
+
+ @see -[WBHTTPRequestSerializer multipartFormRequestWithMethod:URLString:parameters:constructingBodyWithBlock:error:]
+ */
+- (nullable NSURLSessionDataTask *)POST:(NSString *)URLString
+                             parameters:(nullable NSDictionary <NSString *, id> *)parameters
+              constructingBodyWithBlock:(nullable void (^)(id <WBMultipartFormData> formData))block
+                      completionHandler:(nullable void (^)(NSURLResponse * _Nullable response, NSData * _Nullable data, NSError * _Nullable error))completionHandler;
+
+/**
+ Invalidates the session, optionally cancelling running tasks. Pending tasks are cancelled in either case.
+ 使 session 失效，可以选择是否取消正在执行的 task。等待中的 task 都会被取消。
+ */
+- (void)invalidateSessionCancelingTasks:(BOOL)cancelPendingTasks;
+
+@end
+
+NS_ASSUME_NONNULL_END
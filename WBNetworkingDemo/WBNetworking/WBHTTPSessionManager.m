@@ -0,0 +1,442 @@
+//
+//  WBHTTPSessionManager.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/14.
+//
+
+#import "WBHTTPSessionManager.h"
+
+#import <os/lock.h>
+
+static NSUInteger const kWBHTTPSessionManagerDefaultMaximumConcurrentRequests = 16;
+static NSUInteger const kWBHTTPSessionManagerDefaultMaximumConcurrentRequestsPerHost = 6;
+
+typedef void (^WBHTTPSessionDataTaskCompletionHandler)(NSURLResponse *response, NSData *data, NSError *error);
+
+//一个等待或正在执行的 task
+@interface WBHTTPSessionTaskRecord : NSObject
+@property (nonatomic, strong) NSURLSessionDataTask *task;
+@property (nonatomic, copy) NSString *hostKey;
+@property (nonatomic, assign) float priority;
+//创建顺序，相同 priority 时先创建的先执行
+@property (nonatomic, assign) NSUInteger sequence;
+@property (nonatomic, assign, getter=isRunning) BOOL running;
+//还在队列中时就已经完成（被取消），出队时跳过
+@property (nonatomic, assign, getter=isFinished) BOOL finished;
+@end
+
+@implementation WBHTTPSessionTaskRecord
+@end
+
+//record1 是否应该比 record2 先执行
+static BOOL WBHTTPSessionTaskRecordPrecedes(WBHTTPSessionTaskRecord *record1, WBHTTPSessionTaskRecord *record2) {
+    if (record1.priority != record2.priority) {
+        return record1.priority > record2.priority;
+    }
+    return record1.sequence < record2.sequence;
+}
+
+//一个域名的等待队列（二叉堆）和正在执行的 task 数量
+@interface WBHTTPSessionHostQueue : NSObject
+@property (nonatomic, assign) NSUInteger runningCount;
+- (BOOL)isEmpty;
+- (void)pushRecord:(WBHTTPSessionTaskRecord *)record;
+- (WBHTTPSessionTaskRecord *)firstRecord;
+- (WBHTTPSessionTaskRecord *)popFirstRecord;
+- (NSArray <WBHTTPSessionTaskRecord *> *)allRecords;
+@end
+
+@implementation WBHTTPSessionHostQueue {
+    NSMutableArray <WBHTTPSessionTaskRecord *> *_heap;
+}
+
+- (instancetype)init{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    _heap = [NSMutableArray array];
+    return self;
+}
+
+- (BOOL)isEmpty{
+    return [_heap count] == 0;
+}
+
+- (void)pushRecord:(WBHTTPSessionTaskRecord *)record{
+    [_heap addObject:record];
+    //上浮
+    NSUInteger index = [_heap count] - 1;
+    while (index > 0) {
+        NSUInteger parent = (index - 1) / 2;
+        if (!WBHTTPSessionTaskRecordPrecedes(_heap[index], _heap[parent])) {
+            break;
+        }
+        [_heap exchangeObjectAtIndex:index withObjectAtIndex:parent];
+        index = parent;
+    }
+}
+
+//跳过已经完成的 record，返回最先执行的 record
+- (WBHTTPSessionTaskRecord *)firstRecord{
+    while ([_heap count] > 0 && [_heap[0] isFinished]) {
+        [self popFirstRecord];
+    }
+    return [_heap firstObject];
+}
+
+- (WBHTTPSessionTaskRecord *)popFirstRecord{
+    NSUInteger count = [_heap count];
+    if (count == 0) {
+        return nil;
+    }
+    WBHTTPSessionTaskRecord *first = _heap[0];
+    [_heap exchangeObjectAtIndex:0 withObjectAtIndex:count - 1];
+    [_heap removeLastObject];
+    count -= 1;
+    //下沉
+    NSUInteger index = 0;
+    while (YES) {
+        NSUInteger left = index * 2 + 1;
+        NSUInteger right = left + 1;
+        NSUInteger next = index;
+        if (left < count && WBHTTPSessionTaskRecordPrecedes(_heap[left], _heap[next])) {
+            next = left;
+        }
+        if (right < count && WBHTTPSessionTaskRecordPrecedes(_heap[right], _heap[next])) {
+            next = right;
+        }
+        if (next == index) {
+            break;
+        }
+        [_heap exchangeObjectAtIndex:index withObjectAtIndex:next];
+        index = next;
+    }
+    return first;
+}
+
+- (NSArray<WBHTTPSessionTaskRecord *> *)allRecords{
+    return [_heap copy];
+}
+
+@end
+
+//同一个域名和端口的请求共用连接，作为单个域名并发数的 key
+static NSString * WBHTTPSessionHostKeyForURL(NSURL *url) {
+    NSString *scheme = [url.scheme lowercaseString] ?: @"";
+    NSNumber *port = url.port ?: ([scheme isEqualToString:@"http"] ? @80 : @443);
+    return [NSString stringWithFormat:@"%@://%@:%@", scheme, [url.host lowercaseString] ?: @"", port];
+}
+
+@interface WBHTTPSessionManager()
+@property (readwrite, nonatomic, strong) NSURL *baseURL;
+@property (readwrite, nonatomic, strong) NSURLSession *session;
+@end
+
+@implementation WBHTTPSessionManager {
+    //下面的实例变量都在锁中访问
+    os_unfair_lock _lock;
+    NSUInteger _maximumConcurrentRequests;
+    NSUInteger _maximumConcurrentRequestsPerHost;
+    //session 每个域名的最大连接数，创建 session 后不能再修改
+    NSUInteger _maximumConnectionsPerHost;
+    NSMutableDictionary <NSString *, WBHTTPSessionHostQueue *> *_hostQueues;
+    NSMutableDictionary <NSNumber *, WBHTTPSessionTaskRecord *> *_recordsByTaskIdentifier;
+    NSUInteger _numberOfRunningTasks;
+    NSUInteger _numberOfPendingTasks;
+    NSUInteger _nextSequence;
+}
+
++ (instancetype)sharedManager{
+    static WBHTTPSessionManager *_sharedManager = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedManager = [self manager];
+    });
+    return _sharedManager;
+}
+
++ (instancetype)manager{
+    return [[self alloc]initWithBaseURL:nil];
+}
+
+- (instancetype)init{
+    return [self initWithBaseURL:nil];
+}
+
+- (instancetype)initWithBaseURL:(NSURL *)url{
+    return [self initWithBaseURL:url sessionConfiguration:nil];
+}
+
+- (instancetype)initWithBaseURL:(NSURL *)url sessionConfiguration:(NSURLSessionConfiguration *)configuration{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    // Ensure terminal slash for baseURL path, so that NSURL +URLWithString:relativeToURL: works as expected
+    //baseURL 的路径以 / 结尾，URLWithString:relativeToURL: 才会拼接而不是替换最后一段路径
+    if ([[url path] length] > 0 && ![[url absoluteString] hasSuffix:@"/"]) {
+        url = [url URLByAppendingPathComponent:@""];
+    }
+    self.baseURL = url;
+
+    //所有 task 共用一个 session，同一个域名复用 keep-alive 连接。保留调用方配置的每个域名最大连接数
+    NSURLSessionConfiguration *sessionConfiguration = [configuration copy] ?: [NSURLSessionConfiguration defaultSessionConfiguration];
+    NSInteger maximumConnectionsPerHost = sessionConfiguration.HTTPMaximumConnectionsPerHost;
+    if (maximumConnectionsPerHost <= 0) {
+        maximumConnectionsPerHost = (NSInteger)kWBHTTPSessionManagerDefaultMaximumConcurrentRequestsPerHost;
+        sessionConfiguration.HTTPMaximumConnectionsPerHost = maximumConnectionsPerHost;
+    }
+
+    _lock = OS_UNFAIR_LOCK_INIT;
+    _maximumConcurrentRequests = kWBHTTPSessionManagerDefaultMaximumConcurrentRequests;
+    _maximumConnectionsPerHost = (NSUInteger)maximumConnectionsPerHost;
+    _maximumConcurrentRequestsPerHost = MIN(kWBHTTPSessionManagerDefaultMaximumConcurrentRequestsPerHost, _maximumConnectionsPerHost);
+    _hostQueues = [NSMutableDictionary dictionary];
+    _recordsByTaskIdentifier = [NSMutableDictionary dictionary];
+
+    self.requestSerializer = [WBHTTPRequestSerializer serializer];
+    self.securityPolicy = [WBSecurityPolicy defaultPolicy];
+
+    NSOperationQueue *delegateQueue = [[NSOperationQueue alloc]init];
+    delegateQueue.maxConcurrentOperationCount = 1;
+    self.session = [NSURLSession sessionWithConfiguration:sessionConfiguration delegate:self delegateQueue:delegateQueue];
+
+    return self;
+}
+
+#pragma mark - 并发数
+
+- (NSUInteger)maximumConcurrentRequests{
+    os_unfair_lock_lock(&_lock);
+    NSUInteger maximumConcurrentRequests = _maximumConcurrentRequests;
+    os_unfair_lock_unlock(&_lock);
+    return maximumConcurrentRequests;
+}
+
+- (void)setMaximumConcurrentRequests:(NSUInteger)maximumConcurrentRequests{
+    os_unfair_lock_lock(&_lock);
+    _maximumConcurrentRequests = MAX(maximumConcurrentRequests, 1);
+    NSArray *runnableRecords = [self dequeueRunnableRecordsLocked];
+    os_unfair_lock_unlock(&_lock);
+    [self resumeRecords:runnableRecords];
+}
+
+- (NSUInteger)maximumConcurrentRequestsPerHost{
+    os_unfair_lock_lock(&_lock);
+    NSUInteger maximumConcurrentRequestsPerHost = _maximumConcurrentRequestsPerHost;
+    os_unfair_lock_unlock(&_lock);
+    return maximumConcurrentRequestsPerHost;
+}
+
+- (void)setMaximumConcurrentRequestsPerHost:(NSUInteger)maximumConcurrentRequestsPerHost{
+    os_unfair_lock_lock(&_lock);
+    //超过 session 的连接数时多出来的 task 只会在 session 内部排队，没有意义
+    _maximumConcurrentRequestsPerHost = MIN(MAX(maximumConcurrentRequestsPerHost, 1), _maximumConnectionsPerHost);
+    NSArray *runnableRecords = [self dequeueRunnableRecordsLocked];
+    os_unfair_lock_unlock(&_lock);
+    [self resumeRecords:runnableRecords];
+}
+
+- (NSUInteger)numberOfRunningTasks{
+    os_unfair_lock_lock(&_lock);
+    NSUInteger numberOfRunningTasks = _numberOfRunningTasks;
+    os_unfair_lock_unlock(&_lock);
+    return numberOfRunningTasks;
+}
+
+- (NSUInteger)numberOfPendingTasks{
+    os_unfair_lock_lock(&_lock);
+    NSUInteger numberOfPendingTasks = _numberOfPendingTasks;
+    os_unfair_lock_unlock(&_lock);
+    return numberOfPendingTasks;
+}
+
+#pragma mark - 调度
+
+//在锁中调用。从没有达到上限的域名中，依次取出最先执行的 record，直到达到全局上限
+- (NSArray <WBHTTPSessionTaskRecord *> *)dequeueRunnableRecordsLocked{
+
+    NSMutableArray <WBHTTPSessionTaskRecord *> *runnableRecords = [NSMutableArray array];
+    while (_numberOfRunningTasks < _maximumConcurrentRequests) {
+        WBHTTPSessionHostQueue *bestHostQueue = nil;
+        WBHTTPSessionTaskRecord *bestRecord = nil;
+        for (WBHTTPSessionHostQueue *hostQueue in [_hostQueues objectEnumerator]) {
+            if (hostQueue.runningCount >= _maximumConcurrentRequestsPerHost) {
+                continue;
+            }
+            WBHTTPSessionTaskRecord *record = [hostQueue firstRecord];
+            if (record && (!bestRecord || WBHTTPSessionTaskRecordPrecedes(record, bestRecord))) {
+                bestHostQueue = hostQueue;
+                bestRecord = record;
+            }
+        }
+        if (!bestRecord) {
+            break;
+        }
+        [bestHostQueue popFirstRecord];
+        bestHostQueue.runningCount += 1;
+        bestRecord.running = YES;
+        _numberOfPendingTasks -= 1;
+        _numberOfRunningTasks += 1;
+        [runnableRecords addObject:bestRecord];
+    }
+    return runnableRecords;
+}
+
+- (void)resumeRecords:(NSArray <WBHTTPSessionTaskRecord *> *)records{
+    for (WBHTTPSessionTaskRecord *record in records) {
+        [record.task resume];
+    }
+}
+
+- (void)enqueueRecord:(WBHTTPSessionTaskRecord *)record{
+
+    os_unfair_lock_lock(&_lock);
+    record.sequence = _nextSequence++;
+    WBHTTPSessionHostQueue *hostQueue = _hostQueues[record.hostKey];
+    if (!hostQueue) {
+        hostQueue = [[WBHTTPSessionHostQueue alloc]init];
+        _hostQueues[record.hostKey] = hostQueue;
+    }
+    [hostQueue pushRecord:record];
+    _recordsByTaskIdentifier[@(record.task.taskIdentifier)] = record;
+    _numberOfPendingTasks += 1;
+    NSArray *runnableRecords = [self dequeueRunnableRecordsLocked];
+    os_unfair_lock_unlock(&_lock);
+
+    [self resumeRecords:runnableRecords];
+}
+
+//task 完成（包括在队列中被取消）时调用，释放位置并开始等待的 task
+- (void)taskDidCompleteWithIdentifier:(NSUInteger)taskIdentifier{
+
+    os_unfair_lock_lock(&_lock);
+    WBHTTPSessionTaskRecord *record = _recordsByTaskIdentifier[@(taskIdentifier)];
+    [_recordsByTaskIdentifier removeObjectForKey:@(taskIdentifier)];
+    WBHTTPSessionHostQueue *hostQueue = record ? _hostQueues[record.hostKey] : nil;
+    if (record.isRunning) {
+        hostQueue.runningCount -= 1;
+        _numberOfRunningTasks -= 1;
+    }else if (record && !record.isFinished) {
+        //还在队列中，出队时跳过
+        _numberOfPendingTasks -= 1;
+    }
+    record.finished = YES;
+    if (hostQueue && hostQueue.runningCount == 0 && ![hostQueue firstRecord]) {
+        [_hostQueues removeObjectForKey:record.hostKey];
+    }
+    NSArray *runnableRecords = [self dequeueRunnableRecordsLocked];
+    os_unfair_lock_unlock(&_lock);
+
+    [self resumeRecords:runnableRecords];
+}
+
+#pragma mark - Data Tasks
+
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request priority:(float)priority completionHandler:(void (^)(NSURLResponse * _Nullable, NSData * _Nullable, NSError * _Nullable))completionHandler{
+
+    __block NSUInteger taskIdentifier = 0;
+    __weak __typeof(self) weakSelf = self;
+    NSURLSessionDataTask *task = [self.session dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+
+        __strong __typeof(weakSelf) strongSelf = weakSelf;
+        [strongSelf taskDidCompleteWithIdentifier:taskIdentifier];
+        if (completionHandler) {
+            dispatch_async(strongSelf.completionQueue ?: dispatch_get_main_queue(), ^{
+                completionHandler(response, data, error);
+            });
+        }
+    }];
+    taskIdentifier = task.taskIdentifier;
+    task.priority = MIN(MAX(priority, 0), 1);
+
+    WBHTTPSessionTaskRecord *record = [[WBHTTPSessionTaskRecord alloc]init];
+    record.task = task;
+    record.hostKey = WBHTTPSessionHostKeyForURL(request.URL);
+    record.priority = task.priority;
+    [self enqueueRecord:record];
+
+    return task;
+}
+
+- (NSURLSessionDataTask *)dataTaskWithHTTPMethod:(NSString *)method URLString:(NSString *)URLString parameters:(id)parameters completionHandler:(void (^)(NSURLResponse * _Nullable, NSData * _Nullable, NSError * _Nullable))completionHandler{
+
+    NSError *serializationError = nil;
+    NSMutableURLRequest *request = [self.requestSerializer requestWithMethod:method URLString:[[NSURL URLWithString:URLString relativeToURL:self.baseURL] absoluteString] parameters:parameters error:&serializationError];
+    if (!request) {
+        [self failWithSerializationError:serializationError completionHandler:completionHandler];
+        return nil;
+    }
+    return [self dataTaskWithRequest:request priority:NSURLSessionTaskPriorityDefault completionHandler:completionHandler];
+}
+
+- (NSURLSessionDataTask *)GET:(NSString *)URLString parameters:(id)parameters completionHandler:(void (^)(NSURLResponse * _Nullable, NSData * _Nullable, NSError * _Nullable))completionHandler{
+    return [self dataTaskWithHTTPMethod:@"GET" URLString:URLString parameters:parameters completionHandler:completionHandler];
+}
+
+- (NSURLSessionDataTask *)POST:(NSString *)URLString parameters:(id)parameters completionHandler:(void (^)(NSURLResponse * _Nullable, NSData * _Nullable, NSError * _Nullable))completionHandler{
+    return [self dataTaskWithHTTPMethod:@"POST" URLString:URLString parameters:parameters completionHandler:completionHandler];
+}
+
+- (NSURLSessionDataTask *)POST:(NSString *)URLString parameters:(NSDictionary<NSString *,id> *)parameters constructingBodyWithBlock:(void (^)(id<WBMultipartFormData> _Nonnull))block completionHandler:(void (^)(NSURLResponse * _Nullable, NSData * _Nullable, NSError * _Nullable))completionHandler{
+
+    NSError *serializationError = nil;
+    NSMutableURLRequest *request = [self.requestSerializer multipartFormRequestWithMethod:@"POST" URLString:[[NSURL URLWithString:URLString relativeToURL:self.baseURL] absoluteString] parameters:parameters constructingBodyWithBlock:block error:&serializationError];
+    if (!request) {
+        [self failWithSerializationError:serializationError completionHandler:completionHandler];
+        return nil;
+    }
+    return [self dataTaskWithRequest:request priority:NSURLSessionTaskPriorityDefault completionHandler:completionHandler];
+}
+
+- (void)failWithSerializationError:(NSError *)error completionHandler:(WBHTTPSessionDataTaskCompletionHandler)completionHandler{
+    if (completionHandler) {
+        dispatch_async(self.completionQueue ?: dispatch_get_main_queue(), ^{
+            completionHandler(nil, nil, error);
+        });
+    }
+}
+
+- (void)invalidateSessionCancelingTasks:(BOOL)cancelPendingTasks{
+
+    //先取消还在队列中的 task，它们的完成回调会把自己从队列中移除
+    os_unfair_lock_lock(&_lock);
+    NSMutableArray <NSURLSessionTask *> *pendingTasks = [NSMutableArray array];
+    for (WBHTTPSessionHostQueue *hostQueue in [_hostQueues objectEnumerator]) {
+        for (WBHTTPSessionTaskRecord *record in [hostQueue allRecords]) {
+            if (!record.isFinished) {
+                [pendingTasks addObject:record.task];
+            }
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+    [pendingTasks makeObjectsPerformSelector:@selector(cancel)];
+
+    if (cancelPendingTasks) {
+        [self.session invalidateAndCancel];
+    }else{
+        [self.session finishTasksAndInvalidate];
+    }
+}
+
+#pragma mark - NSURLSessionDelegate
+
+- (void)URLSession:(NSURLSession *)session didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential * _Nullable))completionHandler{
+
+    //服务器证书使用 securityPolicy 验证，其他类型的验证使用系统默认的处理
+    if (![challenge.protectionSpace.authenticationMethod isEqualToString:NSURLAuthenticationMethodServerTrust]) {
+        completionHandler(NSURLSessionAuthChallengePerformDefaultHandling, nil);
+        return;
+    }
+    SecTrustRef serverTrust = challenge.protectionSpace.serverTrust;
+    if ([self.securityPolicy evaluateServerTrust:serverTrust forDomain:challenge.protectionSpace.host]) {
+        completionHandler(NSURLSessionAuthChallengeUseCredential, [NSURLCredential credentialForTrust:serverTrust]);
+    }else{
+        completionHandler(NSURLSessionAuthChallengeCancelAuthenticationChallenge, nil);
+    }
+}
+
+@end
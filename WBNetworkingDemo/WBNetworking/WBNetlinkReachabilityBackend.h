@@ -0,0 +1,39 @@
+//
+//  WBNetlinkReachabilityBackend.h
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/13.
+//
+
+#import <Foundation/Foundation.h>
+#import "WBNetworkReachabilityMonitor.h"
+
+//只在 Linux 上编译，苹果平台使用 WBSCNetworkReachabilityBackend
+#if defined(__linux__)
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A `WBNetworkReachabilityBackend` for Linux that listens for link, IPv4 route and IPv6 route changes on an `AF_NETLINK` socket. A dedicated thread blocks in `epoll_wait`, so no CPU is used while the network is idle. Each burst of netlink messages is drained at once, and the status of every observed target is then computed once.
+ Linux 上的 WBNetworkReachabilityBackend。通过 AF_NETLINK socket 监听网卡、IPv4 路由和 IPv6 路由的变化，单独的线程阻塞在 epoll_wait 中，网络没有变化时不占用 CPU。一次读完一批 netlink 消息后，每个 target 的状态只计算一次。
+
+ The status of a target is derived from the kernel route to it, the same lookup as `ip route get`, without sending any traffic:
+ target 的状态根据内核中到它的路由得到（和 ip route get 相同），不发送任何数据：
+
+ - Address targets use the route to the address. The unspecified address (`+[WBNetworkReachabilityTarget defaultRouteTarget]`) and host targets use the default IPv4 and IPv6 routes; host names are not resolved.
+   地址类型的 target 查询到这个地址的路由。未指定的地址和域名类型的 target 查询 IPv4 和 IPv6 的默认路由，不解析域名。
+ - The target is reachable when the route's output interface is up and has a carrier (`IFF_UP` and `IFF_RUNNING`). Interfaces named `wwan*` or `rmnet*` are reported as `WBNetworkReachabilityStatusReachableViaWWAN`, all others as `WBNetworkReachabilityStatusReachableWiFi`.
+   路由的出口网卡已启用且已连接时可达。wwan* 和 rmnet* 网卡为移动网络，其他网卡为 Wi-Fi。
+ */
+@interface WBNetlinkReachabilityBackend : NSObject <WBNetworkReachabilityBackend>
+
+/**
+ The number of netlink messages received. 收到的 netlink 消息数量
+ */
+@property (readonly, nonatomic, assign) NSUInteger numberOfNetlinkMessages;
+
+@end
+
+NS_ASSUME_NONNULL_END
+
+#endif
@@ -0,0 +1,397 @@
+//
+//  WBNetlinkReachabilityBackend.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/13.
+//
+
+#import "WBNetlinkReachabilityBackend.h"
+
+//只在 Linux 上编译，苹果平台使用 WBSCNetworkReachabilityBackend
+#if defined(__linux__)
+
+#import <errno.h>
+#import <string.h>
+#import <unistd.h>
+#import <pthread.h>
+#import <stdatomic.h>
+#import <net/if.h>
+#import <sys/ioctl.h>
+#import <sys/socket.h>
+#import <sys/epoll.h>
+#import <sys/eventfd.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <linux/netlink.h>
+#import <linux/rtnetlink.h>
+
+typedef void (^WBNetworkReachabilityStatusBlock)(WBNetworkReachabilityStatus status);
+
+//查询默认路由时使用的文档地址（RFC 5737、RFC 3849），只查询路由，不会发送数据
+static const uint8_t kWBNetlinkDefaultRouteProbeIPv4[4] = {192, 0, 2, 1};
+static const uint8_t kWBNetlinkDefaultRouteProbeIPv6[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+
+//根据网卡的 index 得到状态：网卡已启用且已连接时可达，wwan* 和 rmnet* 为移动网络
+static WBNetworkReachabilityStatus WBNetlinkStatusForInterface(int interfaceIndex) {
+    char name[IF_NAMESIZE];
+    if (!if_indextoname((unsigned int)interfaceIndex, name)) {
+        return WBNetworkReachabilityStatusNotReachable;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return WBNetworkReachabilityStatusNotReachable;
+    }
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, name, IF_NAMESIZE - 1);
+    int result = ioctl(fd, SIOCGIFFLAGS, &request);
+    close(fd);
+
+    if (result < 0 || (request.ifr_flags & (IFF_UP | IFF_RUNNING)) != (IFF_UP | IFF_RUNNING)) {
+        return WBNetworkReachabilityStatusNotReachable;
+    }
+    if (strncmp(name, "wwan", 4) == 0 || strncmp(name, "rmnet", 5) == 0) {
+        return WBNetworkReachabilityStatusReachableViaWWAN;
+    }
+    return WBNetworkReachabilityStatusReachableWiFi;
+}
+
+//和 ip route get 相同，向内核查询到 address 的路由，返回出口网卡的状态。没有路由时内核返回 ENETUNREACH
+static WBNetworkReachabilityStatus WBNetlinkStatusForDestination(int family, const void *address, size_t addressLength) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        return WBNetworkReachabilityStatusNotReachable;
+    }
+    //内核会立即回复，设置超时只是为了避免异常情况下阻塞监听线程
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct {
+        struct nlmsghdr header;
+        struct rtmsg message;
+        char attributes[RTA_SPACE(sizeof(struct in6_addr))];
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    request.header.nlmsg_type = RTM_GETROUTE;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = 1;
+    request.message.rtm_family = (unsigned char)family;
+    request.message.rtm_dst_len = (unsigned char)(addressLength * 8);
+
+    struct rtattr *attribute = (struct rtattr *)((char *)&request + NLMSG_ALIGN(request.header.nlmsg_len));
+    attribute->rta_type = RTA_DST;
+    attribute->rta_len = RTA_LENGTH(addressLength);
+    memcpy(RTA_DATA(attribute), address, addressLength);
+    request.header.nlmsg_len = NLMSG_ALIGN(request.header.nlmsg_len) + RTA_ALIGN(attribute->rta_len);
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+
+    WBNetworkReachabilityStatus status = WBNetworkReachabilityStatusNotReachable;
+    char buffer[4096];
+    ssize_t length = -1;
+    if (sendto(fd, &request, request.header.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) >= 0) {
+        length = recv(fd, buffer, sizeof(buffer), 0);
+    }
+    close(fd);
+
+    int remaining = (int)length;
+    for (struct nlmsghdr *header = (struct nlmsghdr *)buffer; length > 0 && NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+        if (header->nlmsg_type != RTM_NEWROUTE) {
+            continue;
+        }
+        struct rtmsg *route = NLMSG_DATA(header);
+        //unreachable、blackhole、prohibit 等类型的路由都是不可达
+        if (route->rtm_type != RTN_UNICAST && route->rtm_type != RTN_LOCAL) {
+            continue;
+        }
+        int attributesLength = (int)RTM_PAYLOAD(header);
+        for (struct rtattr *routeAttribute = RTM_RTA(route); RTA_OK(routeAttribute, attributesLength); routeAttribute = RTA_NEXT(routeAttribute, attributesLength)) {
+            if (routeAttribute->rta_type == RTA_OIF) {
+                status = WBNetlinkStatusForInterface(*(int *)RTA_DATA(routeAttribute));
+            }
+        }
+    }
+    return status;
+}
+
+//计算 target 的状态。未指定的地址和域名使用 IPv4、IPv6 默认路由，有一个可达即可
+static WBNetworkReachabilityStatus WBNetlinkStatusForTarget(WBNetworkReachabilityTarget *target) {
+    const struct sockaddr *address = target.address ? (const struct sockaddr *)[target.address bytes] : NULL;
+    if (address && address->sa_family == AF_INET) {
+        const struct sockaddr_in *address4 = (const struct sockaddr_in *)address;
+        if (address4->sin_addr.s_addr != htonl(INADDR_ANY)) {
+            return WBNetlinkStatusForDestination(AF_INET, &address4->sin_addr, sizeof(address4->sin_addr));
+        }
+    }else if (address && address->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *address6 = (const struct sockaddr_in6 *)address;
+        if (!IN6_IS_ADDR_UNSPECIFIED(&address6->sin6_addr)) {
+            return WBNetlinkStatusForDestination(AF_INET6, &address6->sin6_addr, sizeof(address6->sin6_addr));
+        }
+    }
+
+    WBNetworkReachabilityStatus status = WBNetlinkStatusForDestination(AF_INET, kWBNetlinkDefaultRouteProbeIPv4, sizeof(kWBNetlinkDefaultRouteProbeIPv4));
+    if (status == WBNetworkReachabilityStatusNotReachable) {
+        status = WBNetlinkStatusForDestination(AF_INET6, kWBNetlinkDefaultRouteProbeIPv6, sizeof(kWBNetlinkDefaultRouteProbeIPv6));
+    }
+    return status;
+}
+
+#pragma mark -
+
+//一个 target 的监控
+@interface WBNetlinkReachabilityObservation : NSObject
+@property (nonatomic, strong) WBNetworkReachabilityTarget *target;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) WBNetworkReachabilityStatusBlock handler;
+//已经发出过 netlink 事件计算出的状态，只在 queue 中访问
+@property (nonatomic, assign) BOOL receivedEvent;
+- (void)cancel;
+- (void)notifyStatus:(WBNetworkReachabilityStatus)status;
+- (void)notifyInitialStatus:(WBNetworkReachabilityStatus)status;
+@end
+
+@implementation WBNetlinkReachabilityObservation {
+    atomic_bool _cancelled;
+}
+
+- (void)cancel{
+    atomic_store(&_cancelled, true);
+}
+
+- (void)notifyStatus:(WBNetworkReachabilityStatus)status{
+    dispatch_async(self.queue, ^{
+        //停止监控之后不再调用
+        if (!atomic_load(&self->_cancelled)) {
+            self.receivedEvent = YES;
+            self.handler(status);
+        }
+    });
+}
+
+//初始状态可能比之后的 netlink 事件晚到达，这时已经过期，丢弃
+- (void)notifyInitialStatus:(WBNetworkReachabilityStatus)status{
+    dispatch_async(self.queue, ^{
+        if (!atomic_load(&self->_cancelled) && !self.receivedEvent) {
+            self.handler(status);
+        }
+    });
+}
+
+@end
+
+//监听线程使用的文件描述符
+typedef struct {
+    int netlinkSocket;
+    int epoll;
+    int wakeEvent;
+    void *backend;
+} WBNetlinkEventLoop;
+
+@interface WBNetlinkReachabilityBackend()
+- (void)netlinkEventLoopDidReceiveMessages:(NSUInteger)count;
+@end
+
+//监听线程：阻塞在 epoll_wait 中，网络变化时读完所有消息再统一计算一次状态，收到 wakeEvent 时退出
+static void * WBNetlinkEventLoopRun(void *info) {
+    WBNetlinkEventLoop *loop = info;
+    //线程运行期间持有 backend
+    WBNetlinkReachabilityBackend *backend = (__bridge_transfer WBNetlinkReachabilityBackend *)loop->backend;
+
+    char buffer[8192];
+    BOOL stopped = NO;
+    while (!stopped) {
+        struct epoll_event events[2];
+        int count = epoll_wait(loop->epoll, events, 2, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        NSUInteger messageCount = 0;
+        BOOL changed = NO;
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == loop->wakeEvent) {
+                stopped = YES;
+                continue;
+            }
+            while (YES) {
+                ssize_t length = recv(loop->netlinkSocket, buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (length < 0) {
+                    //ENOBUFS 表示内核丢弃了部分消息，同样需要重新计算
+                    changed = changed || errno == ENOBUFS;
+                    if (errno == EINTR || errno == ENOBUFS) {
+                        continue;
+                    }
+                    break;
+                }
+                int remaining = (int)length;
+                for (struct nlmsghdr *header = (struct nlmsghdr *)buffer; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+                    messageCount += 1;
+                }
+                changed = YES;
+            }
+        }
+        if (changed && !stopped) {
+            @autoreleasepool {
+                [backend netlinkEventLoopDidReceiveMessages:messageCount];
+            }
+        }
+    }
+
+    close(loop->netlinkSocket);
+    close(loop->epoll);
+    close(loop->wakeEvent);
+    free(loop);
+    backend = nil;
+    return NULL;
+}
+
+@implementation WBNetlinkReachabilityBackend {
+    NSLock *_lock;
+    NSMutableArray <WBNetlinkReachabilityObservation *> *_observations;
+    //正在运行的监听线程，没有监控的 target 时停止
+    WBNetlinkEventLoop *_eventLoop;
+    pthread_t _eventLoopThread;
+    atomic_ulong _numberOfNetlinkMessages;
+}
+
+- (instancetype)init{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    _lock = [[NSLock alloc]init];
+    _observations = [NSMutableArray array];
+    return self;
+}
+
+- (NSUInteger)numberOfNetlinkMessages{
+    return (NSUInteger)atomic_load_explicit(&_numberOfNetlinkMessages, memory_order_relaxed);
+}
+
+//在 _lock 中调用。打开订阅了网卡和路由变化的 netlink socket，开始监听线程
+- (BOOL)startEventLoop{
+
+    int netlinkSocket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    int wakeEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    struct sockaddr_nl local;
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+
+    struct epoll_event netlinkEvent = {.events = EPOLLIN, .data.fd = netlinkSocket};
+    struct epoll_event wakeEventEvent = {.events = EPOLLIN, .data.fd = wakeEvent};
+
+    WBNetlinkEventLoop *loop = NULL;
+    if (netlinkSocket >= 0 && epoll >= 0 && wakeEvent >= 0 &&
+        bind(netlinkSocket, (struct sockaddr *)&local, sizeof(local)) == 0 &&
+        epoll_ctl(epoll, EPOLL_CTL_ADD, netlinkSocket, &netlinkEvent) == 0 &&
+        epoll_ctl(epoll, EPOLL_CTL_ADD, wakeEvent, &wakeEventEvent) == 0) {
+        loop = calloc(1, sizeof(WBNetlinkEventLoop));
+    }
+    if (loop) {
+        loop->netlinkSocket = netlinkSocket;
+        loop->epoll = epoll;
+        loop->wakeEvent = wakeEvent;
+        loop->backend = (__bridge_retained void *)self;
+        if (pthread_create(&_eventLoopThread, NULL, WBNetlinkEventLoopRun, loop) == 0) {
+            _eventLoop = loop;
+            return YES;
+        }
+        (void)(__bridge_transfer id)loop->backend;
+        free(loop);
+    }
+
+    if (netlinkSocket >= 0) {
+        close(netlinkSocket);
+    }
+    if (epoll >= 0) {
+        close(epoll);
+    }
+    if (wakeEvent >= 0) {
+        close(wakeEvent);
+    }
+    return NO;
+}
+
+//在监听线程中调用
+- (void)netlinkEventLoopDidReceiveMessages:(NSUInteger)count{
+
+    atomic_fetch_add_explicit(&_numberOfNetlinkMessages, count, memory_order_relaxed);
+
+    [_lock lock];
+    NSArray *observations = [_observations copy];
+    [_lock unlock];
+
+    //相同的 target 只计算一次
+    NSMutableDictionary <WBNetworkReachabilityTarget *, NSNumber *> *statuses = [NSMutableDictionary dictionary];
+    for (WBNetlinkReachabilityObservation *observation in observations) {
+        NSNumber *status = statuses[observation.target];
+        if (!status) {
+            status = @(WBNetlinkStatusForTarget(observation.target));
+            statuses[observation.target] = status;
+        }
+        [observation notifyStatus:[status integerValue]];
+    }
+}
+
+#pragma mark - WBNetworkReachabilityBackend
+
+- (id)startObservingTarget:(WBNetworkReachabilityTarget *)target queue:(dispatch_queue_t)queue handler:(void (^)(WBNetworkReachabilityStatus))handler{
+
+    WBNetlinkReachabilityObservation *observation = [[WBNetlinkReachabilityObservation alloc]init];
+    observation.target = target;
+    observation.queue = queue;
+    observation.handler = handler;
+
+    [_lock lock];
+    BOOL isRunning = _eventLoop != NULL || [self startEventLoop];
+    if (isRunning) {
+        [_observations addObject:observation];
+    }
+    [_lock unlock];
+    if (!isRunning) {
+        return nil;
+    }
+
+    //初始状态在后台队列中计算
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        [observation notifyInitialStatus:WBNetlinkStatusForTarget(target)];
+    });
+    return observation;
+}
+
+- (void)stopObservingWithToken:(id)token{
+
+    WBNetlinkReachabilityObservation *observation = token;
+    [observation cancel];
+
+    [_lock lock];
+    [_observations removeObjectIdenticalTo:observation];
+    WBNetlinkEventLoop *loop = NULL;
+    pthread_t thread = _eventLoopThread;
+    if ([_observations count] == 0 && _eventLoop) {
+        loop = _eventLoop;
+        _eventLoop = NULL;
+    }
+    [_lock unlock];
+
+    //最后一个 target，通知监听线程退出。在锁外等待，监听线程计算状态时也需要获取锁
+    if (loop) {
+        uint64_t value = 1;
+        ssize_t __unused written = write(loop->wakeEvent, &value, sizeof(value));
+        pthread_join(thread, NULL);
+    }
+}
+
+@end
+
+#endif
@@ -6,11 +6,8 @@
 //
 
 #import <Foundation/Foundation.h>
-//只有在不是watchos的条件下进行编译
-#if !TARGET_OS_WATCH
-#import <SystemConfiguration/SystemConfiguration.h>
 
-//定义网络状态的枚举
+//定义网络状态的枚举。不依赖 SystemConfiguration，Linux 上的 WBNetlinkReachabilityBackend 也使用
 typedef NS_ENUM(NSInteger, WBNetworkReachabilityStatus) {
     WBNetworkReachabilityStatusUnknown          = -1, //不明的状态
     WBNetworkReachabilityStatusNotReachable     = 0,  //网络连接不可用
@@ -18,6 +15,18 @@ typedef NS_ENUM(NSInteger, WBNetworkReachabilityStatus) {
     WBNetworkReachabilityStatusReachableWiFi    = 2,  //Wi-Fi
 };
 
+//链路质量的等级，根据探测得到的往返时间和丢包率计算
+typedef NS_ENUM(NSInteger, WBNetworkPathQuality) {
+    WBNetworkPathQualityUnknown  = 0, //没有探测或还没有结果
+    WBNetworkPathQualityPoor     = 1, //延迟高或丢包多
+    WBNetworkPathQualityModerate = 2, //一般
+    WBNetworkPathQualityGood     = 3, //延迟低且基本不丢包
+};
+
+//只有在不是watchos且有 SystemConfiguration（苹果平台）的条件下进行编译
+#if !TARGET_OS_WATCH && defined(__APPLE__)
+#import <SystemConfiguration/SystemConfiguration.h>
+
 
 NS_ASSUME_NONNULL_BEGIN
 /**
@@ -150,6 +159,91 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)setReeachabilityStatusChangeBlock:(nullable void(^)(WBNetworkReachabilityStatus status))block;
 
+///------------------------------------
+/// @name Coalescing Reachability Events
+///------------------------------------
+
+/**
+ The window, in seconds, used to coalesce reachability changes. Callbacks whose status matches the last delivered status are always dropped. A change that arrives within this window after the previous delivery is held until the window ends, and only the latest status is delivered, so a connection that flaps during a network handover produces at most one change per window. `0.25` by default; `0` delivers every change immediately.
+ 合并网络状态变化的时间窗口（秒）。和上次发出的状态相同的回调总是被丢弃；距离上次发出不到这个时间的变化会等到窗口结束，只发出最新的状态。默认 0.25 秒，设为 0 时每次变化立即发出。
+ */
+@property (atomic, assign) NSTimeInterval statusChangeCoalescingInterval;
+
+/**
+ The number of callbacks received from `SCNetworkReachability`, including the initial probe.
+ 收到的 SCNetworkReachability 回调次数，包括开始监控时的第一次查询。
+ */
+@property (readonly, nonatomic, assign) NSUInteger rawReachabilityEventCount;
+
+/**
+ The number of status changes delivered to the status block, the notification and observers.
+ 实际发出的状态变化次数。
+ */
+@property (readonly, nonatomic, assign) NSUInteger deliveredReachabilityEventCount;
+
+/**
+ Adds an observer that is called on `queue` whenever a coalesced status change is delivered. Unlike the status block and `WBNetworkingReachabilityDidChangeNotification`, which are always delivered on the main queue, observers do not hop to the main thread unless they ask for it.
+ 添加一个观察者，状态变化时在 queue 中调用 block。状态 block 和通知总是在主线程发出，观察者只在自己指定的 queue 中调用。
+
+ @param queue The queue to call `block` on. If `nil`, a private serial queue is used. 调用 block 的队列，为 nil 时使用内部的串行队列
+ @param block The block to call with the new status. 状态变化时调用的 block
+
+ @return An opaque observer to pass to `-removeReachabilityStatusObserver:`. 用于移除观察者的对象
+ */
+- (id)addReachabilityStatusObserverWithQueue:(nullable dispatch_queue_t)queue usingBlock:(void (^)(WBNetworkReachabilityStatus status))block;
+
+/**
+ Removes an observer added with `-addReachabilityStatusObserverWithQueue:usingBlock:`. The block is not called again after this method returns.
+ 移除观察者，返回后 block 不会再被调用。
+ */
+- (void)removeReachabilityStatusObserver:(id)observer;
+
+///-----------------------------
+/// @name Probing Path Quality
+///-----------------------------
+
+/**
+ The URLs whose hosts are probed to measure path quality while monitoring. Each probe is a timed TCP connect to the URL's host and port (default 80 for `http`, 443 otherwise); no request is sent. `nil` or empty disables probing. Changing the URLs while monitoring restarts the probes.
+ 监控期间用来测量链路质量的 URL。每次探测只对 URL 的域名和端口（http 默认 80，其他默认 443）进行一次 TCP 连接并计时，不发送请求。nil 或空数组时不探测。监控期间修改会重新开始探测。
+ */
+@property (atomic, copy, nullable) NSArray <NSURL *> *pathQualityProbeURLs;
+
+/**
+ The interval between successful probes of a host, in seconds. After a failed probe the interval for that host doubles, up to eight times this value, and resets on the next success. `30` by default.
+ 探测成功时两次探测的间隔（秒）。探测失败时这个域名的间隔加倍，最多为 8 倍，下次成功时恢复。默认 30 秒。
+ */
+@property (atomic, assign) NSTimeInterval pathQualityProbeInterval;
+
+/**
+ How long a probe waits for the connection before counting it as lost. `3` seconds by default.
+ 探测等待连接的时间，超时算作丢包。默认 3 秒。
+ */
+@property (atomic, assign) NSTimeInterval pathQualityProbeTimeout;
+
+/**
+ The quality tier of the best probed host, derived from its smoothed round-trip time and loss rate. `WBNetworkPathQualityUnknown` until the first probe finishes, and again after the reachability status changes, because the path has changed. Key-value observable; updated on the main queue.
+ 探测结果最好的域名的链路质量，根据平滑后的往返时间和丢包率计算。第一次探测完成前，以及网络状态变化后（链路已经改变）为 WBNetworkPathQualityUnknown。支持 KVO，在主线程更新。
+ */
+@property (readonly, nonatomic, assign) WBNetworkPathQuality pathQuality;
+
+/**
+ The exponentially weighted moving average of the connect time to the best probed host, in seconds. `0` when unknown.
+ 探测结果最好的域名的连接时间的指数加权移动平均（秒），未知时为 0。
+ */
+@property (readonly, atomic, assign) NSTimeInterval smoothedRoundTripTime;
+
+/**
+ The exponentially weighted moving average of the probe loss rate of the best probed host, from `0` to `1`.
+ 探测结果最好的域名的丢包率的指数加权移动平均，0 到 1。
+ */
+@property (readonly, atomic, assign) double pathLossRate;
+
+/**
+ Sets a block to be executed on the main queue when `pathQuality` changes.
+ 设置 pathQuality 变化时在主线程中调用的 block。
+ */
+- (void)setPathQualityChangeBlock:(nullable void(^)(WBNetworkPathQuality quality))block;
+
 @end
 
 /**
@@ -175,6 +269,13 @@ NS_ASSUME_NONNULL_BEGIN
 FOUNDATION_EXPORT NSString * const WBNetworkingReachabilityDidChangeNotification;
 FOUNDATION_EXPORT NSString * const WBNetworkingReachabilityNotificationStatusItem;
 
+/**
+ Posted on the main queue when `pathQuality` changes. The notification object is the manager, and the `userInfo` dictionary contains an `NSNumber` under `WBNetworkingPathQualityNotificationQualityItem` with the new `WBNetworkPathQuality`.
+ pathQuality 变化时在主线程发出，object 为 manager，userInfo 中 WBNetworkingPathQualityNotificationQualityItem 对应新的 WBNetworkPathQuality。
+ */
+FOUNDATION_EXPORT NSString * const WBNetworkingPathQualityDidChangeNotification;
+FOUNDATION_EXPORT NSString * const WBNetworkingPathQualityNotificationQualityItem;
+
 
 /**
  Returns a localized string representation of an `AFNetworkReachabilityStatus` value.
@@ -182,6 +283,12 @@ FOUNDATION_EXPORT NSString * const WBNetworkingReachabilityNotificationStatusIte
  */
 FOUNDATION_EXPORT NSString * WBStringFromNetworkReachabilityStatus(WBNetworkReachabilityStatus status);
 
+/**
+ Returns the `WBNetworkReachabilityStatus` derived from `SCNetworkReachabilityFlags`.
+ 根据 SCNetworkReachabilityFlags 返回对应的 WBNetworkReachabilityStatus
+ */
+FOUNDATION_EXPORT WBNetworkReachabilityStatus WBNetworkReachabilityStatusForFlags(SCNetworkReachabilityFlags flags);
+
 NS_ASSUME_NONNULL_END
 
 #endif
@@ -7,21 +7,38 @@
 
 #import "WBNetworkReachabilityManager.h"
 
-//只有在不是watchos的条件下进行编译
-#if !TARGET_OS_WATCH
+//只有在不是watchos且有 SystemConfiguration（苹果平台）的条件下进行编译
+#if !TARGET_OS_WATCH && defined(__APPLE__)
 
 #import <netinet/in.h>
 #import <netinet6/in6.h>
 #import <arpa/inet.h>
 #import <ifaddrs.h>
 #import <netdb.h>
+#import <stdatomic.h>
+#import <fcntl.h>
+#import <poll.h>
+#import <unistd.h>
 
 
 NSString * const WBNetworkingReachabilityDidChangeNotification = @"com.alamofire.networking.reachability.change";
 NSString * const WBNetworkingReachabilityNotificationStatusItem = @"WBNetworkingReachabilityNotificationStatusItem";
+NSString * const WBNetworkingPathQualityDidChangeNotification = @"com.wbnetworking.reachability.pathquality.change";
+NSString * const WBNetworkingPathQualityNotificationQualityItem = @"WBNetworkingPathQualityNotificationQualityItem";
 
 typedef void (^WBNetworkReachabilityStatusBlock)(WBNetworkReachabilityStatus status);
-typedef WBNetworkReachabilityManager * (^WBNetworkReachabilityStatusCallback)(WBNetworkReachabilityStatus status);
+typedef void (^WBNetworkReachabilityFlagsCallback)(SCNetworkReachabilityFlags flags);
+typedef void (^WBNetworkPathQualityBlock)(WBNetworkPathQuality quality);
+
+//默认的状态合并窗口
+static NSTimeInterval const kWBNetworkReachabilityDefaultCoalescingInterval = 0.25;
+
+//链路质量探测的默认间隔、超时，失败时间隔最多增加到的倍数
+static NSTimeInterval const kWBNetworkPathQualityDefaultProbeInterval = 30;
+static NSTimeInterval const kWBNetworkPathQualityDefaultProbeTimeout = 3;
+static double const kWBNetworkPathQualityMaximumBackoff = 8;
+//指数加权移动平均中新样本的权重
+static double const kWBNetworkPathQualitySmoothingFactor = 0.2;
 
 /*
  四种本地化语言文件的方法：
@@ -56,7 +73,7 @@ NSString *WBStringFormNetworkReachabilityStatus(WBNetworkReachabilityStatus stat
     }
 }
 
-static WBNetworkReachabilityStatus WBNetworkReachabilityStatusForFlags(SCNetworkReachabilityFlags flags){
+WBNetworkReachabilityStatus WBNetworkReachabilityStatusForFlags(SCNetworkReachabilityFlags flags){
     /*
      typedef CF_OPTIONS(uint32_t, SCNetworkReachabilityFlags) {
          kSCNetworkReachabilityFlagsTransientConnection        = 1<<0,
@@ -107,35 +124,12 @@ static WBNetworkReachabilityStatus WBNetworkReachabilityStatusForFlags(SCNetwork
 }
 
 /**
- * Queue a status change notification for the main thread.
- *
- * This is done to ensure that the notifications are received in the same order
- * as they are sent. If notifications are sent directly, it is possible that
- * a queued notification (for an earlier status condition) is processed after
- * the later update, resulting in the listener being left in the wrong state.
- 
- * 这样做是为了确保接收通知的顺序与发送通知的顺序相同。 如果直接发送通知，则可能会在稍后更新后处理排队的通知（针对较早的状态条件），从而导致侦听器处于错误状态。
+ * SCNetworkReachability 的回调和开始监控时的查询都在同一个串行队列中处理，
+ * 保证状态按发生的顺序处理，不会出现较早的状态在较晚的状态之后发出，导致监听者停留在错误的状态。
  */
-static void WBPostReachablilityStatusChange(SCNetworkReachabilityFlags flags, WBNetworkReachabilityStatusCallback block){
-    
-    WBNetworkReachabilityStatus status = WBNetworkReachabilityStatusForFlags(flags);
-    dispatch_async(dispatch_get_main_queue(), ^{
-       
-        WBNetworkReachabilityManager *manager = nil;
-        if (block) {
-            manager = block(status);
-        }
-        NSNotificationCenter *notificationCenter = [NSNotificationCenter defaultCenter];
-        NSDictionary *userInfo = @{WBNetworkingReachabilityNotificationStatusItem : @(status)};
-        [notificationCenter postNotificationName:WBNetworkingReachabilityDidChangeNotification object:manager userInfo:userInfo];
-        
-    });
-    
-}
-
 static void WBNetworkReachabilityCallback(SCNetworkReachabilityRef __unused target, SCNetworkReachabilityFlags flags, void *info){
     
-    WBPostReachablilityStatusChange(flags, (__bridge WBNetworkReachabilityStatusCallback)info);
+    ((__bridge WBNetworkReachabilityFlagsCallback)info)(flags);
     
 }
 
@@ -148,14 +142,167 @@ static void WBNetworkReachabilityReleaseCallback(const void *info){
         Block_release(info);
     }
 }
+
+//向一个地址发起非阻塞的 TCP 连接，返回建立连接的时间（秒），失败或超时返回 -1
+static NSTimeInterval WBTCPConnectAddressRoundTripTime(const struct addrinfo *address, int timeoutMilliseconds) {
+    int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) {
+        return -1;
+    }
+    int noSigPipe = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    NSTimeInterval roundTripTime = -1;
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    int result = connect(fd, address->ai_addr, address->ai_addrlen);
+    if (result < 0 && errno == EINPROGRESS) {
+        struct pollfd pollDescriptor = {fd, POLLOUT, 0};
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        if (poll(&pollDescriptor, 1, timeoutMilliseconds) == 1 &&
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && error == 0) {
+            result = 0;
+        }
+    }
+    if (result == 0) {
+        roundTripTime = (NSTimeInterval)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / NSEC_PER_SEC;
+    }
+    close(fd);
+    return roundTripTime;
+}
+
+/*
+ 一次 TCP 连接探测，返回建立连接的时间（秒），失败或超时返回 -1。域名解析的时间不计算在内。
+ 依次尝试解析出的每个地址，第一个地址（通常是 IPv6）不可达时仍可以用后面的地址，所有地址共用 timeout
+ */
+static NSTimeInterval WBTCPConnectRoundTripTime(NSString *host, NSNumber *port, NSTimeInterval timeout) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = NULL;
+    if (getaddrinfo([host UTF8String], [[port stringValue] UTF8String], &hints, &addresses) != 0 || !addresses) {
+        return -1;
+    }
+
+    NSTimeInterval roundTripTime = -1;
+    uint64_t deadline = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) + (uint64_t)(MAX(timeout, 0) * NSEC_PER_SEC);
+    for (struct addrinfo *address = addresses; address && roundTripTime < 0; address = address->ai_next) {
+        uint64_t now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        if (now >= deadline) {
+            break;
+        }
+        roundTripTime = WBTCPConnectAddressRoundTripTime(address, (int)((deadline - now) / NSEC_PER_MSEC));
+    }
+    freeaddrinfo(addresses);
+    return roundTripTime;
+}
+
+//根据往返时间和丢包率得到链路质量。没有成功过的域名为 Poor
+static WBNetworkPathQuality WBNetworkPathQualityForMetrics(NSTimeInterval roundTripTime, double lossRate) {
+    if (roundTripTime <= 0) {
+        return WBNetworkPathQualityPoor;
+    }
+    if (roundTripTime <= 0.15 && lossRate < 0.05) {
+        return WBNetworkPathQualityGood;
+    }
+    if (roundTripTime <= 0.6 && lossRate < 0.2) {
+        return WBNetworkPathQualityModerate;
+    }
+    return WBNetworkPathQualityPoor;
+}
+
+//一个域名的探测状态，只在 probeQueue 中访问
+@interface WBNetworkPathProbe : NSObject
+@property (nonatomic, copy) NSString *host;
+@property (nonatomic, strong) NSNumber *port;
+@property (nonatomic, assign) NSTimeInterval smoothedRoundTripTime;
+@property (nonatomic, assign) double lossRate;
+@property (nonatomic, assign) NSUInteger sampleCount;
+//下次探测前等待的时间，失败时加倍
+@property (nonatomic, assign) NSTimeInterval backoff;
+- (void)recordRoundTripTime:(NSTimeInterval)roundTripTime interval:(NSTimeInterval)interval;
+@end
+
+@implementation WBNetworkPathProbe
+
+- (void)recordRoundTripTime:(NSTimeInterval)roundTripTime interval:(NSTimeInterval)interval{
+    double alpha = self.sampleCount == 0 ? 1 : kWBNetworkPathQualitySmoothingFactor;
+    BOOL isLost = roundTripTime < 0;
+    self.lossRate = (1 - alpha) * self.lossRate + alpha * (isLost ? 1 : 0);
+    if (!isLost) {
+        self.smoothedRoundTripTime = self.smoothedRoundTripTime > 0 ? (1 - kWBNetworkPathQualitySmoothingFactor) * self.smoothedRoundTripTime + kWBNetworkPathQualitySmoothingFactor * roundTripTime : roundTripTime;
+    }
+    self.sampleCount += 1;
+    //指数退避：失败时间隔加倍，成功时恢复
+    self.backoff = isLost ? MIN(MAX(self.backoff, interval) * 2, interval * kWBNetworkPathQualityMaximumBackoff) : interval;
+}
+
+@end
+
+//通过 addReachabilityStatusObserverWithQueue:usingBlock: 添加的观察者
+@interface WBNetworkReachabilityObserver : NSObject
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) WBNetworkReachabilityStatusBlock block;
+- (void)cancel;
+- (void)notifyStatus:(WBNetworkReachabilityStatus)status;
+@end
+
+@implementation WBNetworkReachabilityObserver {
+    atomic_bool _cancelled;
+}
+
+- (void)cancel{
+    atomic_store(&_cancelled, true);
+}
+
+- (void)notifyStatus:(WBNetworkReachabilityStatus)status{
+    dispatch_async(self.queue, ^{
+        //移除之后不再调用
+        if (!atomic_load(&self->_cancelled)) {
+            self.block(status);
+        }
+    });
+}
+
+@end
+
 @interface WBNetworkReachabilityManager()
 
 @property (nonatomic, readonly, assign) SCNetworkReachabilityRef networkReachability;
 @property (nonatomic, readwrite, assign) WBNetworkReachabilityStatus networkReachabilityStatus;
 @property (nonatomic, readwrite, copy) WBNetworkReachabilityStatusBlock networkReachabilityStatusBlock;
+//处理回调、合并状态的串行队列，下面的实例变量只在这个队列中访问
+@property (nonatomic, strong) dispatch_queue_t reachabilityQueue;
+//链路质量探测的状态只在这个串行队列中访问，探测本身在全局队列中进行
+@property (nonatomic, strong) dispatch_queue_t probeQueue;
+@property (nonatomic, readwrite, assign) WBNetworkPathQuality pathQuality;
+@property (readwrite, atomic, assign) NSTimeInterval smoothedRoundTripTime;
+@property (readwrite, atomic, assign) double pathLossRate;
+@property (nonatomic, readwrite, copy) WBNetworkPathQualityBlock networkPathQualityBlock;
 @end
 
-@implementation WBNetworkReachabilityManager
+@implementation WBNetworkReachabilityManager {
+    NSMutableArray <WBNetworkReachabilityObserver *> *_observers;
+    //最后发出的状态，等待窗口结束后发出的状态
+    WBNetworkReachabilityStatus _deliveredStatus;
+    WBNetworkReachabilityStatus _pendingStatus;
+    uint64_t _lastDeliveryTime;
+    BOOL _deliveryScheduled;
+    //每次开始、停止监控时加一，用来丢弃上一次监控中延迟发出的状态
+    NSUInteger _monitoringGeneration;
+    BOOL _monitoring;
+    
+    //probeQueue 中访问。每次重新开始探测时加一，用来丢弃之前的探测结果
+    NSArray <NSURL *> *_pathQualityProbeURLs;
+    NSArray <WBNetworkPathProbe *> *_probes;
+    NSUInteger _probeGeneration;
+    WBNetworkPathQuality _probedQuality;
+    
+    atomic_ulong _rawReachabilityEventCount;
+    atomic_ulong _deliveredReachabilityEventCount;
+}
 
 
 + (instancetype)shareManager{
@@ -213,6 +360,14 @@ static void WBNetworkReachabilityReleaseCallback(const void *info){
     }
     _networkReachability = CFRetain(reachability);
     self.networkReachabilityStatus = WBNetworkReachabilityStatusUnknown;
+    self.statusChangeCoalescingInterval = kWBNetworkReachabilityDefaultCoalescingInterval;
+    self.reachabilityQueue = dispatch_queue_create("com.wbnetworking.reachability", DISPATCH_QUEUE_SERIAL);
+    _observers = [NSMutableArray array];
+    _deliveredStatus = WBNetworkReachabilityStatusUnknown;
+    _pendingStatus = WBNetworkReachabilityStatusUnknown;
+    self.probeQueue = dispatch_queue_create("com.wbnetworking.reachability.probe", DISPATCH_QUEUE_SERIAL);
+    self.pathQualityProbeInterval = kWBNetworkPathQualityDefaultProbeInterval;
+    self.pathQualityProbeTimeout = kWBNetworkPathQualityDefaultProbeTimeout;
     
     return self;
 }
@@ -224,8 +379,10 @@ static void WBNetworkReachabilityReleaseCallback(const void *info){
 
 - (void)dealloc{
     
-    [self stopMonitoring];
+    //dealloc 中不再同步到 reachabilityQueue，只停止回调；延迟发出的状态持有的是 weakSelf，不会再执行
     if (_networkReachability != NULL) {
+        SCNetworkReachabilitySetDispatchQueue(_networkReachability, NULL);
+        SCNetworkReachabilitySetCallback(_networkReachability, NULL, NULL);
         CFRelease(_networkReachability);
     }
 }
@@ -252,27 +409,33 @@ static void WBNetworkReachabilityReleaseCallback(const void *info){
     }
     
     __weak __typeof(self) weakSelf = self;
-    WBNetworkReachabilityStatusCallback callback = ^(WBNetworkReachabilityStatus status){
-
-
+    WBNetworkReachabilityFlagsCallback callback = ^(SCNetworkReachabilityFlags flags){
+        
         __strong __typeof(weakSelf) strongSelf = weakSelf;
-        strongSelf.networkReachabilityStatus = status;
-        if (strongSelf.networkReachabilityStatusBlock) {
-            strongSelf.networkReachabilityStatusBlock(status);
-        }
+        [strongSelf handleReachabilityFlags:flags];
         
-        return strongSelf;
-
     };
     
+    //重新开始监听时总是发出第一次查询到的状态，不和上次监听时发出的状态比较
+    dispatch_sync(self.reachabilityQueue, ^{
+        self->_monitoringGeneration += 1;
+        self->_monitoring = YES;
+        self->_pendingStatus = WBNetworkReachabilityStatusUnknown;
+        self->_deliveredStatus = WBNetworkReachabilityStatusUnknown;
+        self->_lastDeliveryTime = 0;
+    });
+    
+    //回调直接在串行队列中执行，不再每次都切换到主线程
     SCNetworkReachabilityContext context = {0,(__bridge  void *)callback,WBNetworkReachabilityRetainCallback,WBNetworkReachabilityReleaseCallback,NULL};
     SCNetworkReachabilitySetCallback(self.networkReachability, WBNetworkReachabilityCallback, &context);
-    SCNetworkReachabilityScheduleWithRunLoop(self.networkReachability, CFRunLoopGetMain(), kCFRunLoopCommonModes);
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+    SCNetworkReachabilitySetDispatchQueue(self.networkReachability, self.reachabilityQueue);
+    
+    //第一次查询也在同一个队列中进行，和后续的回调一起合并
+    dispatch_async(self.reachabilityQueue, ^{
         
         SCNetworkReachabilityFlags flags;
         if (SCNetworkReachabilityGetFlags(self.networkReachability, &flags)) {
-            WBPostReachablilityStatusChange(flags, callback);
+            callback(flags);
         }
     });
 }
@@ -282,7 +445,237 @@ static void WBNetworkReachabilityReleaseCallback(const void *info){
     if (!self.networkReachability) {
         return;
     }
-    SCNetworkReachabilityUnscheduleFromRunLoop(self.networkReachability, CFRunLoopGetMain(), kCFRunLoopCommonModes);
+    SCNetworkReachabilitySetDispatchQueue(self.networkReachability, NULL);
+    SCNetworkReachabilitySetCallback(self.networkReachability, NULL, NULL);
+    
+    //丢弃还在等待合并窗口结束的状态
+    dispatch_sync(self.reachabilityQueue, ^{
+        self->_monitoringGeneration += 1;
+        self->_deliveryScheduled = NO;
+        self->_pendingStatus = self->_deliveredStatus;
+        self->_monitoring = NO;
+        [self restartPathQualityProbingWithStatus:WBNetworkReachabilityStatusUnknown];
+    });
+}
+
+#pragma mark - 合并状态变化
+
+//在 reachabilityQueue 中执行
+- (void)handleReachabilityFlags:(SCNetworkReachabilityFlags)flags{
+    
+    atomic_fetch_add_explicit(&_rawReachabilityEventCount, 1, memory_order_relaxed);
+    _pendingStatus = WBNetworkReachabilityStatusForFlags(flags);
+    
+    //已经在等待窗口结束时，只记录最新的状态
+    if (_deliveryScheduled) {
+        return;
+    }
+    //和上次发出的状态相同，直接丢弃
+    if (_pendingStatus == _deliveredStatus) {
+        return;
+    }
+    
+    uint64_t interval = (uint64_t)(MAX(self.statusChangeCoalescingInterval, 0) * NSEC_PER_SEC);
+    uint64_t now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    if (_lastDeliveryTime == 0 || now - _lastDeliveryTime >= interval) {
+        [self deliverPendingStatus];
+        return;
+    }
+    
+    //距离上次发出不到一个窗口，等窗口结束后发出最新的状态
+    _deliveryScheduled = YES;
+    NSUInteger generation = _monitoringGeneration;
+    __weak __typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_lastDeliveryTime + interval - now)), self.reachabilityQueue, ^{
+        __strong __typeof(weakSelf) strongSelf = weakSelf;
+        if (!strongSelf || strongSelf->_monitoringGeneration != generation) {
+            return;
+        }
+        strongSelf->_deliveryScheduled = NO;
+        //窗口内又变回了原来的状态，不需要发出
+        if (strongSelf->_pendingStatus != strongSelf->_deliveredStatus) {
+            [strongSelf deliverPendingStatus];
+        }
+    });
+}
+
+//在 reachabilityQueue 中执行
+- (void)deliverPendingStatus{
+    
+    WBNetworkReachabilityStatus status = _pendingStatus;
+    _deliveredStatus = status;
+    _lastDeliveryTime = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    atomic_fetch_add_explicit(&_deliveredReachabilityEventCount, 1, memory_order_relaxed);
+    
+    for (WBNetworkReachabilityObserver *observer in _observers) {
+        [observer notifyStatus:status];
+    }
+    
+    //链路已经改变，之前的探测结果不再有效
+    [self restartPathQualityProbingWithStatus:status];
+    
+    //状态属性、状态 block 和通知保持原来的行为，在主线程中发出
+    __weak __typeof(self) weakSelf = self;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        
+        __strong __typeof(weakSelf) strongSelf = weakSelf;
+        strongSelf.networkReachabilityStatus = status;
+        if (strongSelf.networkReachabilityStatusBlock) {
+            strongSelf.networkReachabilityStatusBlock(status);
+        }
+        NSNotificationCenter *notificationCenter = [NSNotificationCenter defaultCenter];
+        NSDictionary *userInfo = @{WBNetworkingReachabilityNotificationStatusItem : @(status)};
+        [notificationCenter postNotificationName:WBNetworkingReachabilityDidChangeNotification object:strongSelf userInfo:userInfo];
+        
+    });
+}
+
+- (NSUInteger)rawReachabilityEventCount{
+    return (NSUInteger)atomic_load_explicit(&_rawReachabilityEventCount, memory_order_relaxed);
+}
+
+- (NSUInteger)deliveredReachabilityEventCount{
+    return (NSUInteger)atomic_load_explicit(&_deliveredReachabilityEventCount, memory_order_relaxed);
+}
+
+- (id)addReachabilityStatusObserverWithQueue:(dispatch_queue_t)queue usingBlock:(void (^)(WBNetworkReachabilityStatus))block{
+    
+    WBNetworkReachabilityObserver *observer = [[WBNetworkReachabilityObserver alloc]init];
+    observer.queue = queue ?: dispatch_queue_create("com.wbnetworking.reachability.observer", DISPATCH_QUEUE_SERIAL);
+    observer.block = block;
+    dispatch_async(self.reachabilityQueue, ^{
+        [self->_observers addObject:observer];
+    });
+    return observer;
+}
+
+- (void)removeReachabilityStatusObserver:(id)observer{
+    
+    if (![observer isKindOfClass:[WBNetworkReachabilityObserver class]]) {
+        return;
+    }
+    [(WBNetworkReachabilityObserver *)observer cancel];
+    dispatch_async(self.reachabilityQueue, ^{
+        [self->_observers removeObjectIdenticalTo:observer];
+    });
+}
+
+#pragma mark - 链路质量探测
+
+- (void)setPathQualityProbeURLs:(NSArray<NSURL *> *)pathQualityProbeURLs{
+    @synchronized (self) {
+        _pathQualityProbeURLs = [pathQualityProbeURLs copy];
+    }
+    dispatch_async(self.reachabilityQueue, ^{
+        if (self->_monitoring) {
+            [self restartPathQualityProbingWithStatus:self->_deliveredStatus];
+        }
+    });
+}
+
+- (NSArray<NSURL *> *)pathQualityProbeURLs{
+    @synchronized (self) {
+        return _pathQualityProbeURLs;
+    }
+}
+
+- (void)setPathQualityChangeBlock:(void (^)(WBNetworkPathQuality))block{
+    self.networkPathQualityBlock = block;
+}
+
+//在 reachabilityQueue 中执行。网络可用且设置了探测的 URL 时重新开始探测，否则停止探测
+- (void)restartPathQualityProbingWithStatus:(WBNetworkReachabilityStatus)status{
+    
+    BOOL isReachable = status == WBNetworkReachabilityStatusReachableViaWWAN || status == WBNetworkReachabilityStatusReachableWiFi;
+    NSArray <NSURL *> *URLs = isReachable ? self.pathQualityProbeURLs : nil;
+    
+    dispatch_async(self.probeQueue, ^{
+        self->_probeGeneration += 1;
+        
+        NSMutableArray <WBNetworkPathProbe *> *probes = [NSMutableArray arrayWithCapacity:[URLs count]];
+        for (NSURL *URL in URLs) {
+            if (!URL.host) {
+                continue;
+            }
+            WBNetworkPathProbe *probe = [[WBNetworkPathProbe alloc]init];
+            probe.host = URL.host;
+            probe.port = URL.port ?: ([[URL.scheme lowercaseString] isEqualToString:@"http"] ? @80 : @443);
+            [probes addObject:probe];
+            [self scheduleProbe:probe afterDelay:0];
+        }
+        self->_probes = probes;
+        [self updatePathQuality];
+    });
+}
+
+//在 probeQueue 中执行
+- (void)scheduleProbe:(WBNetworkPathProbe *)probe afterDelay:(NSTimeInterval)delay{
+    
+    NSUInteger generation = _probeGeneration;
+    __weak __typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.probeQueue, ^{
+        
+        __strong __typeof(weakSelf) strongSelf = weakSelf;
+        if (!strongSelf || strongSelf->_probeGeneration != generation) {
+            return;
+        }
+        NSTimeInterval timeout = strongSelf.pathQualityProbeTimeout;
+        //连接可能要等到超时，不在 probeQueue 中进行
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+            
+            NSTimeInterval roundTripTime = WBTCPConnectRoundTripTime(probe.host, probe.port, timeout);
+            __strong __typeof(weakSelf) manager = weakSelf;
+            if (!manager) {
+                return;
+            }
+            dispatch_async(manager.probeQueue, ^{
+                
+                if (manager->_probeGeneration != generation) {
+                    return;
+                }
+                [probe recordRoundTripTime:roundTripTime interval:MAX(manager.pathQualityProbeInterval, 1)];
+                [manager updatePathQuality];
+                [manager scheduleProbe:probe afterDelay:probe.backoff];
+            });
+        });
+    });
+}
+
+//在 probeQueue 中执行。使用结果最好的域名的质量，单个域名不可用不影响整体的链路质量
+- (void)updatePathQuality{
+    
+    WBNetworkPathQuality quality = WBNetworkPathQualityUnknown;
+    WBNetworkPathProbe *bestProbe = nil;
+    for (WBNetworkPathProbe *probe in _probes) {
+        if (probe.sampleCount == 0) {
+            continue;
+        }
+        WBNetworkPathQuality probeQuality = WBNetworkPathQualityForMetrics(probe.smoothedRoundTripTime, probe.lossRate);
+        if (probeQuality > quality || (probeQuality == quality && probe.smoothedRoundTripTime < bestProbe.smoothedRoundTripTime)) {
+            quality = probeQuality;
+            bestProbe = probe;
+        }
+    }
+    self.smoothedRoundTripTime = bestProbe.smoothedRoundTripTime;
+    self.pathLossRate = bestProbe.lossRate;
+    
+    if (quality == _probedQuality) {
+        return;
+    }
+    _probedQuality = quality;
+    
+    __weak __typeof(self) weakSelf = self;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        
+        __strong __typeof(weakSelf) strongSelf = weakSelf;
+        strongSelf.pathQuality = quality;
+        if (strongSelf.networkPathQualityBlock) {
+            strongSelf.networkPathQualityBlock(quality);
+        }
+        NSDictionary *userInfo = @{WBNetworkingPathQualityNotificationQualityItem : @(quality)};
+        [[NSNotificationCenter defaultCenter] postNotificationName:WBNetworkingPathQualityDidChangeNotification object:strongSelf userInfo:userInfo];
+        
+    });
 }
 
 #pragma mark -
@@ -0,0 +1,146 @@
+//
+//  WBNetworkReachabilityMonitor.h
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/12.
+//
+
+#import <Foundation/Foundation.h>
+#import "WBNetworkReachabilityManager.h"
+
+//只有在不是watchos的条件下进行编译
+#if !TARGET_OS_WATCH
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A host name or socket address whose reachability is monitored. Targets with the same host name (compared case-insensitively) or the same socket address are equal, so a monitor shares one underlying source between them.
+ 被监控的域名或 socket 地址。域名相同（不区分大小写）或地址相同的 target 相等，monitor 为它们共用一个底层的监控源。
+ */
+@interface WBNetworkReachabilityTarget : NSObject <NSCopying>
+
+/**
+ The host name, or `nil` for address targets. 域名，地址类型的 target 为 nil
+ */
+@property (readonly, nonatomic, copy, nullable) NSString *host;
+
+/**
+ The socket address (`struct sockaddr`), or `nil` for host targets. socket 地址，域名类型的 target 为 nil
+ */
+@property (readonly, nonatomic, copy, nullable) NSData *address;
+
+/**
+ Returns a target for the specified host name. 根据域名创建 target
+ */
++ (instancetype)targetWithHost:(NSString *)host;
+
+/**
+ Returns a target for the specified socket address (`sockaddr_in` or `sockaddr_in6`). 根据 socket 地址创建 target
+ */
++ (instancetype)targetWithAddress:(const struct sockaddr *)address;
+
+/**
+ Returns a target for the default route, the same address `+[WBNetworkReachabilityManager manager]` monitors. 默认路由的 target，和 WBNetworkReachabilityManager 的 manager 方法监控的地址相同
+ */
++ (instancetype)defaultRouteTarget;
+
++ (instancetype)new NS_UNAVAILABLE;
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+/**
+ A backend observes the reachability of individual targets for a `WBNetworkReachabilityMonitor`. The monitor starts at most one observation per unique target, and calls both methods on its private serial queue.
+ 为 WBNetworkReachabilityMonitor 监控单个 target 的后端。每个不同的 target 最多开始一次监控，两个方法都在 monitor 的串行队列中调用。
+ */
+@protocol WBNetworkReachabilityBackend <NSObject>
+
+/**
+ Starts observing `target`. `handler` must be called on `queue` with the initial status and after every change; it may be called with an unchanged status.
+ 开始监控 target。必须在 queue 中调用 handler，通知初始状态和之后的每次变化，状态没有变化时也可以调用。
+
+ @return An opaque token passed back to `-stopObservingWithToken:`, or `nil` if the target cannot be observed. 传给 stopObservingWithToken: 的对象，无法监控时返回 nil
+ */
+- (nullable id)startObservingTarget:(WBNetworkReachabilityTarget *)target queue:(dispatch_queue_t)queue handler:(void (^)(WBNetworkReachabilityStatus status))handler;
+
+/**
+ Stops the observation started with `token`. `handler` must not be called after this method returns.
+ 停止监控，返回之后不能再调用 handler。
+ */
+- (void)stopObservingWithToken:(id)token;
+
+@end
+
+#if defined(__APPLE__)
+/**
+ The default backend, which observes each target with an `SCNetworkReachabilityRef` scheduled on the monitor's queue. Host names are resolved asynchronously, and the initial probe runs on a background queue so a slow lookup never blocks the monitor or the main thread.
+ 默认的后端，每个 target 使用一个 SCNetworkReachabilityRef，在 monitor 的队列中接收回调。域名异步解析，第一次查询在后台队列中进行，解析慢时不会阻塞 monitor 和主线程。
+ */
+@interface WBSCNetworkReachabilityBackend : NSObject <WBNetworkReachabilityBackend>
+@end
+#endif
+
+/**
+ `WBNetworkReachabilityMonitor` multiplexes reachability observers for many hosts. Observers of equal targets share one backend observation, which starts with the first observer and stops when the last one is removed. Status changes are delivered to each observer on its own queue; unchanged statuses are dropped.
+ WBNetworkReachabilityMonitor 为多个域名的观察者复用底层的监控源。相同 target 的观察者共用一个后端监控，第一个观察者添加时开始，最后一个移除时停止。状态变化在观察者自己的队列中通知，状态没有变化时不通知。
+
+ Prefer a monitor over one `WBNetworkReachabilityManager` per host when watching many hosts.
+ 需要监控很多域名时，使用 monitor 代替为每个域名创建一个 WBNetworkReachabilityManager。
+ */
+@interface WBNetworkReachabilityMonitor : NSObject
+
+/**
+ The backend that observes targets. 监控 target 的后端
+ */
+@property (readonly, nonatomic, strong) id <WBNetworkReachabilityBackend> backend;
+
+/**
+ The number of unique targets currently observed by the backend. 后端正在监控的不同 target 的数量
+ */
+@property (readonly, nonatomic, assign) NSUInteger numberOfObservedTargets;
+
+/**
+ Returns the shared monitor, which uses `WBSCNetworkReachabilityBackend` on Apple platforms and `WBNetlinkReachabilityBackend` on Linux.
+ 返回单例，苹果平台使用 WBSCNetworkReachabilityBackend，Linux 使用 WBNetlinkReachabilityBackend
+ */
++ (instancetype)sharedMonitor;
+
+/**
+ Initializes a monitor with the specified backend. 根据后端初始化 monitor
+
+ NS_DESIGNATED_INITIALIZER 表示指定此方法为初始化方法
+ */
+- (instancetype)initWithBackend:(id <WBNetworkReachabilityBackend>)backend NS_DESIGNATED_INITIALIZER;
+
++ (instancetype)new NS_UNAVAILABLE;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Adds an observer for `target`. If the status of the target is already known, `block` is called with it right away; afterwards it is called on every change.
+ 添加 target 的观察者。已经知道 target 的状态时立即通知当前状态，之后每次变化时通知。
+
+ @param target The target to observe. 监控的 target
+ @param queue The queue to call `block` on. If `nil`, the main queue is used. 调用 block 的队列，为 nil 时使用主队列
+ @param block The block to call with the status of the target. 通知状态的 block
+
+ @return An opaque observer to pass to `-removeObserver:`. 用于移除观察者的对象
+ */
+- (id)addObserverForTarget:(WBNetworkReachabilityTarget *)target queue:(nullable dispatch_queue_t)queue usingBlock:(void (^)(WBNetworkReachabilityStatus status))block;
+
+/**
+ Removes an observer. The block is not called again after this method returns, and the backend observation stops with the last observer of its target.
+ 移除观察者，返回后 block 不会再被调用。target 的最后一个观察者移除时停止后端的监控。
+ */
+- (void)removeObserver:(id)observer;
+
+/**
+ Returns the last status reported for `target`, or `WBNetworkReachabilityStatusUnknown` if it is not observed.
+ 返回 target 最后的状态，没有监控时返回 WBNetworkReachabilityStatusUnknown。
+ */
+- (WBNetworkReachabilityStatus)statusForTarget:(WBNetworkReachabilityTarget *)target;
+
+@end
+
+NS_ASSUME_NONNULL_END
+
+#endif
@@ -0,0 +1,381 @@
+//
+//  WBNetworkReachabilityMonitor.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/12.
+//
+
+#import "WBNetworkReachabilityMonitor.h"
+#import "WBNetlinkReachabilityBackend.h"
+
+//只有在不是watchos的条件下进行编译
+#if !TARGET_OS_WATCH
+
+#import <netinet/in.h>
+#import <stdatomic.h>
+
+typedef void (^WBNetworkReachabilityStatusBlock)(WBNetworkReachabilityStatus status);
+
+#pragma mark - WBNetworkReachabilityTarget
+
+@interface WBNetworkReachabilityTarget()
+@property (readwrite, nonatomic, copy) NSString *host;
+@property (readwrite, nonatomic, copy) NSData *address;
+@end
+
+@implementation WBNetworkReachabilityTarget
+
++ (instancetype)targetWithHost:(NSString *)host{
+    WBNetworkReachabilityTarget *target = [[self alloc]initWithHost:[host lowercaseString] address:nil];
+    return target;
+}
+
++ (instancetype)targetWithAddress:(const struct sockaddr *)address{
+    //只比较地址本身的长度，IPv4 和 IPv6 的长度不同
+    NSUInteger length = address->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    WBNetworkReachabilityTarget *target = [[self alloc]initWithHost:nil address:[NSData dataWithBytes:address length:length]];
+    return target;
+}
+
++ (instancetype)defaultRouteTarget{
+    struct sockaddr_in6 address;
+    bzero(&address, sizeof(address));
+#if defined(__APPLE__)
+    address.sin6_len = sizeof(address);
+#endif
+    address.sin6_family = AF_INET6;
+    return [self targetWithAddress:(const struct sockaddr *)&address];
+}
+
+- (instancetype)initWithHost:(NSString *)host address:(NSData *)address{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.host = host;
+    self.address = address;
+    return self;
+}
+
+- (instancetype)init{
+    @throw [NSException exceptionWithName:NSGenericException reason:@"`-init` unavailable. Use `+targetWithHost:` or `+targetWithAddress:` instead" userInfo:nil];
+}
+
+- (BOOL)isEqual:(id)object{
+    if (self == object) {
+        return YES;
+    }
+    if (![object isKindOfClass:[WBNetworkReachabilityTarget class]]) {
+        return NO;
+    }
+    WBNetworkReachabilityTarget *target = object;
+    return (self.host == target.host || [self.host isEqualToString:target.host]) && (self.address == target.address || [self.address isEqualToData:target.address]);
+}
+
+- (NSUInteger)hash{
+    return [self.host hash] ^ [self.address hash];
+}
+
+- (instancetype)copyWithZone:(NSZone *)zone{
+    //不可变对象，直接返回自身
+    return self;
+}
+
+- (NSString *)description{
+    return [NSString stringWithFormat:@"<%@: %p, host: %@, address: %@>", NSStringFromClass([self class]), self, self.host, self.address];
+}
+
+@end
+
+#if defined(__APPLE__)
+#pragma mark - WBSCNetworkReachabilityBackend
+
+//一个 target 的 SCNetworkReachability 监控
+@interface WBSCNetworkReachabilityObservation : NSObject
+@property (nonatomic, assign) SCNetworkReachabilityRef networkReachability;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) WBNetworkReachabilityStatusBlock handler;
+//已经收到过 SC 的回调，只在 queue 中访问
+@property (nonatomic, assign) BOOL receivedCallback;
+- (BOOL)isCancelled;
+- (void)cancel;
+@end
+
+@implementation WBSCNetworkReachabilityObservation {
+    atomic_bool _cancelled;
+}
+
+- (BOOL)isCancelled{
+    return atomic_load(&_cancelled);
+}
+
+- (void)cancel{
+    atomic_store(&_cancelled, true);
+}
+
+- (void)dealloc{
+    if (_networkReachability != NULL) {
+        CFRelease(_networkReachability);
+    }
+}
+
+@end
+
+static void WBSCNetworkReachabilityBackendCallback(SCNetworkReachabilityRef __unused target, SCNetworkReachabilityFlags flags, void *info){
+
+    WBSCNetworkReachabilityObservation *observation = (__bridge WBSCNetworkReachabilityObservation *)info;
+    if (![observation isCancelled]) {
+        observation.receivedCallback = YES;
+        observation.handler(WBNetworkReachabilityStatusForFlags(flags));
+    }
+
+}
+
+static const void *WBSCNetworkReachabilityBackendRetainCallback(const void *info){
+    return CFRetain(info);
+}
+
+static void WBSCNetworkReachabilityBackendReleaseCallback(const void *info){
+    if (info) {
+        CFRelease(info);
+    }
+}
+
+@implementation WBSCNetworkReachabilityBackend
+
+- (id)startObservingTarget:(WBNetworkReachabilityTarget *)target queue:(dispatch_queue_t)queue handler:(void (^)(WBNetworkReachabilityStatus))handler{
+
+    SCNetworkReachabilityRef networkReachability = NULL;
+    if (target.host) {
+        //只创建对象，不会在这里解析域名
+        networkReachability = SCNetworkReachabilityCreateWithName(kCFAllocatorDefault, [target.host UTF8String]);
+    }else{
+        networkReachability = SCNetworkReachabilityCreateWithAddress(kCFAllocatorDefault, (const struct sockaddr *)[target.address bytes]);
+    }
+    if (!networkReachability) {
+        return nil;
+    }
+
+    WBSCNetworkReachabilityObservation *observation = [[WBSCNetworkReachabilityObservation alloc]init];
+    observation.networkReachability = networkReachability;
+    observation.queue = queue;
+    observation.handler = handler;
+
+    SCNetworkReachabilityContext context = {0,(__bridge void *)observation,WBSCNetworkReachabilityBackendRetainCallback,WBSCNetworkReachabilityBackendReleaseCallback,NULL};
+    if (!SCNetworkReachabilitySetCallback(networkReachability, WBSCNetworkReachabilityBackendCallback, &context) ||
+        !SCNetworkReachabilitySetDispatchQueue(networkReachability, queue)) {
+        SCNetworkReachabilitySetCallback(networkReachability, NULL, NULL);
+        return nil;
+    }
+
+    //域名的第一次查询可能要等待 DNS 解析，放在后台队列中进行，不阻塞 monitor 的队列
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+
+        SCNetworkReachabilityFlags flags;
+        if (!SCNetworkReachabilityGetFlags(observation.networkReachability, &flags)) {
+            return;
+        }
+        dispatch_async(queue, ^{
+            //查询期间已经收到了更新的回调时丢弃这次的结果
+            if (![observation isCancelled] && !observation.receivedCallback) {
+                observation.handler(WBNetworkReachabilityStatusForFlags(flags));
+            }
+        });
+    });
+
+    return observation;
+}
+
+- (void)stopObservingWithToken:(id)token{
+
+    WBSCNetworkReachabilityObservation *observation = token;
+    [observation cancel];
+    SCNetworkReachabilitySetDispatchQueue(observation.networkReachability, NULL);
+    SCNetworkReachabilitySetCallback(observation.networkReachability, NULL, NULL);
+}
+
+@end
+#endif
+
+#pragma mark - WBNetworkReachabilityMonitor
+
+//通过 addObserverForTarget:queue:usingBlock: 添加的观察者
+@interface WBNetworkReachabilityMonitorObserver : NSObject
+@property (nonatomic, strong) WBNetworkReachabilityTarget *target;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) WBNetworkReachabilityStatusBlock block;
+- (void)cancel;
+- (void)notifyStatus:(WBNetworkReachabilityStatus)status;
+@end
+
+@implementation WBNetworkReachabilityMonitorObserver {
+    atomic_bool _cancelled;
+}
+
+- (void)cancel{
+    atomic_store(&_cancelled, true);
+}
+
+- (void)notifyStatus:(WBNetworkReachabilityStatus)status{
+    dispatch_async(self.queue, ^{
+        //移除之后不再调用
+        if (!atomic_load(&self->_cancelled)) {
+            self.block(status);
+        }
+    });
+}
+
+@end
+
+//一个 target 的后端监控和它的所有观察者
+@interface WBNetworkReachabilityMonitorEntry : NSObject
+@property (nonatomic, strong) id token;
+@property (nonatomic, assign) WBNetworkReachabilityStatus status;
+@property (nonatomic, strong) NSMutableArray <WBNetworkReachabilityMonitorObserver *> *observers;
+@end
+
+@implementation WBNetworkReachabilityMonitorEntry
+@end
+
+@interface WBNetworkReachabilityMonitor()
+@property (readwrite, nonatomic, strong) id <WBNetworkReachabilityBackend> backend;
+//所有 entry 只在这个串行队列中访问，后端的回调也在这个队列中执行
+@property (nonatomic, strong) dispatch_queue_t monitorQueue;
+@property (nonatomic, strong) NSMutableDictionary <WBNetworkReachabilityTarget *, WBNetworkReachabilityMonitorEntry *> *entries;
+@end
+
+@implementation WBNetworkReachabilityMonitor
+
++ (instancetype)sharedMonitor{
+    static WBNetworkReachabilityMonitor *_sharedMonitor = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+#if defined(__APPLE__)
+        _sharedMonitor = [[self alloc]initWithBackend:[[WBSCNetworkReachabilityBackend alloc]init]];
+#else
+        _sharedMonitor = [[self alloc]initWithBackend:[[WBNetlinkReachabilityBackend alloc]init]];
+#endif
+    });
+    return _sharedMonitor;
+}
+
+- (instancetype)initWithBackend:(id<WBNetworkReachabilityBackend>)backend{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.backend = backend;
+    self.monitorQueue = dispatch_queue_create("com.wbnetworking.reachability.monitor", DISPATCH_QUEUE_SERIAL);
+    self.entries = [NSMutableDictionary dictionary];
+    return self;
+}
+
+- (instancetype)init{
+    @throw [NSException exceptionWithName:NSGenericException reason:@"`-init` unavailable. Use `-initWithBackend:` instead" userInfo:nil];
+}
+
+- (void)dealloc{
+    //dealloc 中不再同步到 monitorQueue，后端的回调持有的是 weakSelf
+    for (WBNetworkReachabilityMonitorEntry *entry in [_entries allValues]) {
+        if (entry.token) {
+            [_backend stopObservingWithToken:entry.token];
+        }
+    }
+}
+
+#pragma mark -
+
+- (id)addObserverForTarget:(WBNetworkReachabilityTarget *)target queue:(dispatch_queue_t)queue usingBlock:(void (^)(WBNetworkReachabilityStatus))block{
+
+    WBNetworkReachabilityMonitorObserver *observer = [[WBNetworkReachabilityMonitorObserver alloc]init];
+    observer.target = target;
+    observer.queue = queue ?: dispatch_get_main_queue();
+    observer.block = block;
+
+    dispatch_async(self.monitorQueue, ^{
+
+        WBNetworkReachabilityMonitorEntry *entry = self.entries[target];
+        if (!entry) {
+            //第一个观察者，开始后端的监控
+            entry = [[WBNetworkReachabilityMonitorEntry alloc]init];
+            entry.status = WBNetworkReachabilityStatusUnknown;
+            entry.observers = [NSMutableArray array];
+            self.entries[target] = entry;
+
+            __weak __typeof(self) weakSelf = self;
+            entry.token = [self.backend startObservingTarget:target queue:self.monitorQueue handler:^(WBNetworkReachabilityStatus status) {
+                __strong __typeof(weakSelf) strongSelf = weakSelf;
+                [strongSelf target:target didChangeStatus:status];
+            }];
+        }
+        [entry.observers addObject:observer];
+
+        //已经知道状态时立即通知
+        if (entry.status != WBNetworkReachabilityStatusUnknown) {
+            [observer notifyStatus:entry.status];
+        }
+    });
+
+    return observer;
+}
+
+- (void)removeObserver:(id)observer{
+
+    if (![observer isKindOfClass:[WBNetworkReachabilityMonitorObserver class]]) {
+        return;
+    }
+    WBNetworkReachabilityMonitorObserver *monitorObserver = observer;
+    [monitorObserver cancel];
+
+    dispatch_async(self.monitorQueue, ^{
+
+        WBNetworkReachabilityMonitorEntry *entry = self.entries[monitorObserver.target];
+        [entry.observers removeObjectIdenticalTo:monitorObserver];
+        if (entry && [entry.observers count] == 0) {
+            //最后一个观察者，停止后端的监控
+            if (entry.token) {
+                [self.backend stopObservingWithToken:entry.token];
+            }
+            [self.entries removeObjectForKey:monitorObserver.target];
+        }
+    });
+}
+
+//在 monitorQueue 中执行
+- (void)target:(WBNetworkReachabilityTarget *)target didChangeStatus:(WBNetworkReachabilityStatus)status{
+
+    WBNetworkReachabilityMonitorEntry *entry = self.entries[target];
+    //状态没有变化时不通知
+    if (!entry || entry.status == status) {
+        return;
+    }
+    entry.status = status;
+    for (WBNetworkReachabilityMonitorObserver *observer in entry.observers) {
+        [observer notifyStatus:status];
+    }
+}
+
+- (WBNetworkReachabilityStatus)statusForTarget:(WBNetworkReachabilityTarget *)target{
+
+    __block WBNetworkReachabilityStatus status = WBNetworkReachabilityStatusUnknown;
+    dispatch_sync(self.monitorQueue, ^{
+        WBNetworkReachabilityMonitorEntry *entry = self.entries[target];
+        if (entry) {
+            status = entry.status;
+        }
+    });
+    return status;
+}
+
+- (NSUInteger)numberOfObservedTargets{
+
+    __block NSUInteger count = 0;
+    dispatch_sync(self.monitorQueue, ^{
+        count = [self.entries count];
+    });
+    return count;
+}
+
+@end
+
+#endif
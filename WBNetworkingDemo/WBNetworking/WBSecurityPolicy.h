@@ -90,6 +90,30 @@ typedef NS_ENUM(NSInteger,WBSSLPinningMode) {
  */
 @property (nonatomic, assign) BOOL validatesDomainName;
 
+/**
+ How long, in seconds, a successful evaluation of a certificate chain for a domain is reused by `evaluateServerTrust:forDomain:` before the chain is evaluated again. `300` by default. Set to `0` to evaluate every challenge.
+ 评估成功的结果缓存多久（秒）。同一个域名再次收到相同的证书链时直接使用缓存的结果，不再调用 SecTrustEvaluate。默认 300 秒，设为 0 时不缓存。
+
+ @discussion Only successful evaluations are cached, keyed by the domain and a SHA-256 digest of the whole certificate chain presented by the server. An entry never outlives the earliest `notAfter` of the certificates in the chain, and chains whose validity cannot be read are not cached. At most 64 chains are cached, and the cache is cleared whenever the pinning mode, pinned certificates, `allowInvalidCertificates` or `validatesDomainName` change.
+ 只缓存评估成功的结果，key 为域名和整个证书链的 SHA-256；缓存的有效期不超过链上证书中最早的 notAfter，无法读取有效期的证书链不缓存；最多缓存 64 条，修改 pinning 模式、证书、allowInvalidCertificates 或 validatesDomainName 时清空缓存。
+ */
+@property (nonatomic, assign) NSTimeInterval trustEvaluationCacheTTL;
+
+/**
+ The number of evaluations answered from the cache. 命中缓存的次数。
+ */
+@property (readonly, nonatomic, assign) NSUInteger trustEvaluationCacheHitCount;
+
+/**
+ The number of evaluations that were not in the cache and were performed with `SecTrustEvaluate`. 没有命中缓存、实际进行评估的次数。
+ */
+@property (readonly, nonatomic, assign) NSUInteger trustEvaluationCacheMissCount;
+
+/**
+ Removes all cached evaluations. 清空缓存的评估结果。
+ */
+- (void)removeAllCachedTrustEvaluations;
+
 /**
  Returns any certificates included in the bundle. If you are using AFNetworking as an embedded framework, you must use this method to find the certificates you have included in your app bundle, and use them when creating your security policy by calling `policyWithPinningMode:withPinnedCertificates`.
 
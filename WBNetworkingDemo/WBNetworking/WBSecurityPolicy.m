@@ -8,124 +8,155 @@
 #import "WBSecurityPolicy.h"
 
 #import <AssertMacros.h>
-
-/*
- *    +---------------------------------------------------------------------+
- *    |                            TARGET_OS_MAC                            |
- *    | +---+ +-----------------------------------------------+ +---------+ |
- *    | |   | |               TARGET_OS_IPHONE                | |         | |
- *    | |   | | +---------------+ +----+ +-------+ +--------+ | |         | |
- *    | |   | | |      IOS      | |    | |       | |        | | |         | |
- *    | |OSX| | |+-------------+| | TV | | WATCH | | BRIDGE | | |DRIVERKIT| |
- *    | |   | | || MACCATALYST || |    | |       | |        | | |         | |
- *    | |   | | |+-------------+| |    | |       | |        | | |         | |
- *    | |   | | +---------------+ +----+ +-------+ +--------+ | |         | |
- *    | +---+ +-----------------------------------------------+ +---------+ |
- *    +---------------------------------------------------------------------+
- *  TARGET_OS_*
- *  These conditionals specify in which Operating System the generated code will
- *  run.  Indention is used to show which conditionals are evolutionary subclasses.
- *  这些条件指定生成的代码将在哪个操作系统中运行。 缩进用于显示子类。
- *  The MAC/WIN32/UNIX conditionals are mutually exclusive. MAC/WIN32/UNIX 条件是互斥的。
- *  The IOS/TV/WATCH conditionals are mutually exclusive.   IOS/TV/WATCH 条件是互斥的。
- *      TARGET_OS_WIN32           - Generated code will run under 32-bit Windows 生成的代码将在 32 位 Windows 下运行
- *      TARGET_OS_UNIX            - Generated code will run under some Unix (not OSX) 生成的代码将在某些 Unix 下运行
- *      TARGET_OS_MAC             - Generated code will run under Mac OS X variant 生成的代码将在 Mac OS X 变体下运行
- *         TARGET_OS_OSX          - Generated code will run under OS X devices  生成的代码将在 OS X 设备下运行
- *         TARGET_OS_IPHONE          - Generated code for firmware, devices, or simulator 为固件、设备或模拟器生成的代码
- *            TARGET_OS_IOS             - Generated code will run under iOS  生成的代码会在iOS下运行
- *            TARGET_OS_TV              - Generated code will run under Apple TV OS 生成的代码将在 Apple TV OS 下运行
- *            TARGET_OS_WATCH           - Generated code will run under Apple Watch OS 生成的代码将在 Apple Watch OS 下运行
- *            TARGET_OS_BRIDGE          - Generated code will run under Bridge devices 生成的代码将在 Bridge 设备下运行
- *            TARGET_OS_MACCATALYST     - Generated code will run under macOS  生成的代码将在 macOS 下运行（所以可以生成在macOS上运行的手机app？？？）
- *         TARGET_OS_SIMULATOR      - Generated code will run under a simulator 生成的代码将在模拟器下运行
- *
- *      TARGET_OS_EMBEDDED        - DEPRECATED: Use TARGET_OS_IPHONE and/or TARGET_OS_SIMULATOR instead
- *      TARGET_IPHONE_SIMULATOR   - DEPRECATED: Same as TARGET_OS_SIMULATOR
- *      TARGET_OS_NANO            - DEPRECATED: Same as TARGET_OS_WATCH
- */
-#if !TARGET_OS_IOS && !TARGET_OS_WATCH && !TARGET_OS_TV
-
-/*
- —般情况下,C语言源程序中的每一行代码.都要参加编译。但有时候出于对程序代码优化的考虑.希望只对其中一部分内容进行编译.此时就需要在程序中加上条件，让编译器只对满足条件的代码进行编译，将不满足条件的代码舍弃，这就是条件编译（conditional compile）。
- */
-//如果不在iOS且不在watch且不在tv上运行，则编译代码
-//将 SecKeyRef key 转换为二进制 NSData
-static NSData * WBSecKeyGetData(SecKeyRef key) {
-    CFDataRef data = NULL;
-
-    __Require_noErr_Quiet(SecItemExport(key, kSecFormatUnknown, kSecItemPemArmour, NULL, &data), _out);
-
-    return (__bridge_transfer NSData *)data;
-
-_out:
-    if (data) {
-        CFRelease(data);
+#import <CommonCrypto/CommonDigest.h>
+#import <os/lock.h>
+#import <time.h>
+
+//读取一个 DER 元素的头部，得到内容的位置和长度。只支持单字节 tag 和不超过 4 字节的长度
+static BOOL WBDERReadElement(const uint8_t **cursor, const uint8_t *end, uint8_t expectedTag, const uint8_t **content, size_t *contentLength) {
+    const uint8_t *p = *cursor;
+    if (end - p < 2 || (expectedTag && *p != expectedTag)) {
+        return NO;
     }
-
-    return nil;
+    p += 1;
+    size_t length = *p++;
+    if (length & 0x80) {
+        size_t lengthByteCount = length & 0x7f;
+        if (lengthByteCount == 0 || lengthByteCount > 4 || (size_t)(end - p) < lengthByteCount) {
+            return NO;
+        }
+        length = 0;
+        for (size_t i = 0; i < lengthByteCount; i++) {
+            length = (length << 8) | *p++;
+        }
+    }
+    if ((size_t)(end - p) < length) {
+        return NO;
+    }
+    *content = p;
+    *contentLength = length;
+    *cursor = p + length;
+    return YES;
 }
-#endif
 
-//判断两个key是否相等
-static BOOL WBSecKeyIsEqualToKey(SecKeyRef key1, SecKeyRef key2) {
-#if TARGET_OS_IOS || TARGET_OS_WATCH || TARGET_OS_TV
-    return [(__bridge id)key1 isEqual:(__bridge id)key2];
-#else
-    return [WBSecKeyGetData(key1) isEqual:WBSecKeyGetData(key2)];
-#endif
+//进入证书的 TBSCertificate 并跳过可选的 version，cursor 指向 serialNumber，end 为 TBSCertificate 的结尾
+static BOOL WBDERReadTBSCertificate(NSData *certificateData, const uint8_t **cursor, const uint8_t **end) {
+    const uint8_t *content = NULL;
+    size_t contentLength = 0;
+    *cursor = [certificateData bytes];
+    *end = *cursor + [certificateData length];
+    
+    //Certificate ::= SEQUENCE { tbsCertificate, signatureAlgorithm, signatureValue }
+    if (!WBDERReadElement(cursor, *end, 0x30, &content, &contentLength)) {
+        return NO;
+    }
+    *cursor = content;
+    *end = content + contentLength;
+    //TBSCertificate ::= SEQUENCE { [0] version 可选, serialNumber, signature, issuer, validity, subject, subjectPublicKeyInfo, ... }
+    if (!WBDERReadElement(cursor, *end, 0x30, &content, &contentLength)) {
+        return NO;
+    }
+    *cursor = content;
+    *end = content + contentLength;
+    if (*cursor < *end && **cursor == 0xa0 && !WBDERReadElement(cursor, *end, 0xa0, &content, &contentLength)) {
+        return NO;
+    }
+    return YES;
 }
 
-//二进制证书转换为公钥
-static id WBPublicKeyForCertificate(NSData *certificate) {
-    id allowedPublicKey = nil; //允许的公钥
-    SecCertificateRef allowedCertificate; //证书
-    SecPolicyRef policy = nil; //策略对象
-    SecTrustRef allowedTrust = nil; //信任的证书
-    SecTrustResultType result;
-
-    //根据certificate 创建 SecCertificateRef
-    allowedCertificate = SecCertificateCreateWithData(NULL, (__bridge CFDataRef)certificate);
-    //__Require_Quiet  _out 是一个标记，如果条件不成立，即allowedCertificate == NULL，就会跳到我们打标记的地方，_out:的地方
-    __Require_Quiet(allowedCertificate != NULL, _out);
-
-    //获取一个策略对象
-    policy = SecPolicyCreateBasicX509();
+//计算证书中 subjectPublicKeyInfo（包括算法和公钥）的 SHA-256，和 HPKP 的 pin-sha256 相同。
+//直接解析证书的 DER 数据，不需要为每个证书创建 SecTrustRef 并评估
+static NSData * WBSubjectPublicKeyInfoHashForCertificateData(NSData *certificateData) {
+    const uint8_t *cursor = NULL;
+    const uint8_t *end = NULL;
+    const uint8_t *content = NULL;
+    size_t contentLength = 0;
     
-    //__Require_noErr_Quiet  如果发生异常，就跳转到标记的地方
-    __Require_noErr_Quiet(SecTrustCreateWithCertificates(allowedCertificate, policy, &allowedTrust), _out);
-//#pragma clang diagnostic push
-//#pragma clang diagnostic ignored "-相关命令"
-////需要操作的代码
-//#pragma clang diagnostic pop
-#pragma clang diagnostic push
-    //-Wdeprecated-declarations 方法启用警告
-    //-Wincompatible-pointer-types 不兼容指针类型
-    //-Warc-retain-cycles 循环引用
-    //-Wunused-variable 未使用变量
-    //-Wcovered-switch-default 未使用defalut
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-    __Require_noErr_Quiet(SecTrustEvaluate(allowedTrust, &result), _out);
-#pragma clang diagnostic pop
-
-    allowedPublicKey = (__bridge_transfer id)SecTrustCopyPublicKey(allowedTrust);
-
-_out:
-    //释放各个对象资源
-    if (allowedTrust) {
-        CFRelease(allowedTrust);
+    if (!WBDERReadTBSCertificate(certificateData, &cursor, &end)) {
+        return nil;
     }
-
-    if (policy) {
-        CFRelease(policy);
+    //跳过 serialNumber、signature、issuer、validity、subject
+    for (NSUInteger i = 0; i < 5; i++) {
+        if (!WBDERReadElement(&cursor, end, 0, &content, &contentLength)) {
+            return nil;
+        }
     }
+    const uint8_t *subjectPublicKeyInfo = cursor;
+    if (!WBDERReadElement(&cursor, end, 0x30, &content, &contentLength)) {
+        return nil;
+    }
+    
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(subjectPublicKeyInfo, (CC_LONG)(cursor - subjectPublicKeyInfo), digest);
+    return [NSData dataWithBytes:digest length:sizeof(digest)];
+}
 
-    if (allowedCertificate) {
-        CFRelease(allowedCertificate);
+//解析 UTCTime（YYMMDDHHMMSSZ）或 GeneralizedTime（YYYYMMDDHHMMSSZ），RFC 5280 要求证书中的时间使用 UTC 并包含秒
+static BOOL WBDERParseTime(uint8_t tag, const uint8_t *content, size_t contentLength, time_t *result) {
+    size_t yearLength = tag == 0x17 ? 2 : 4;
+    if ((tag != 0x17 && tag != 0x18) || contentLength != yearLength + 11 || content[contentLength - 1] != 'Z') {
+        return NO;
     }
+    //年、月、日、时、分、秒
+    int fields[6];
+    const uint8_t *p = content;
+    for (NSUInteger i = 0; i < 6; i++) {
+        size_t digitCount = i == 0 ? yearLength : 2;
+        int value = 0;
+        for (size_t j = 0; j < digitCount; j++, p++) {
+            if (*p < '0' || *p > '9') {
+                return NO;
+            }
+            value = value * 10 + (*p - '0');
+        }
+        fields[i] = value;
+    }
+    if (tag == 0x17) {
+        //UTCTime 的年份小于 50 时为 20xx，否则为 19xx
+        fields[0] += fields[0] < 50 ? 2000 : 1900;
+    }
+    
+    struct tm components = {0};
+    components.tm_year = fields[0] - 1900;
+    components.tm_mon = fields[1] - 1;
+    components.tm_mday = fields[2];
+    components.tm_hour = fields[3];
+    components.tm_min = fields[4];
+    components.tm_sec = fields[5];
+    *result = timegm(&components);
+    return YES;
+}
 
-    //return allowedPublicKey
-    return allowedPublicKey;
+//读取证书 validity 中的 notAfter
+static BOOL WBCertificateNotAfter(NSData *certificateData, time_t *notAfter) {
+    const uint8_t *cursor = NULL;
+    const uint8_t *end = NULL;
+    const uint8_t *content = NULL;
+    size_t contentLength = 0;
+    
+    if (!WBDERReadTBSCertificate(certificateData, &cursor, &end)) {
+        return NO;
+    }
+    //跳过 serialNumber、signature、issuer
+    for (NSUInteger i = 0; i < 3; i++) {
+        if (!WBDERReadElement(&cursor, end, 0, &content, &contentLength)) {
+            return NO;
+        }
+    }
+    //Validity ::= SEQUENCE { notBefore Time, notAfter Time }
+    if (!WBDERReadElement(&cursor, end, 0x30, &content, &contentLength)) {
+        return NO;
+    }
+    cursor = content;
+    end = content + contentLength;
+    if (!WBDERReadElement(&cursor, end, 0, &content, &contentLength) || cursor >= end) {
+        return NO;
+    }
+    uint8_t tag = *cursor;
+    if (!WBDERReadElement(&cursor, end, 0, &content, &contentLength)) {
+        return NO;
+    }
+    return WBDERParseTime(tag, content, contentLength, notAfter);
 }
 
 //服务信任是否无效
@@ -156,63 +187,104 @@ static NSArray * WBCertificateTrustChainForServerTrust(SecTrustRef serverTrust)
     return [NSArray arrayWithArray:trustChain];
 }
 
-//从serverTrust 获取公钥
-static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
-    SecPolicyRef policy = SecPolicyCreateBasicX509();
+//评估结果缓存的默认有效期和最大数量
+static NSTimeInterval const kWBTrustEvaluationCacheDefaultTTL = 300;
+static NSUInteger const kWBTrustEvaluationCacheCountLimit = 64;
+
+//域名和整个证书链的 SHA-256，作为评估结果缓存的 key。每个证书前写入长度，避免不同的拆分得到相同的摘要。
+//earliestNotAfter 为链上最早的 notAfter，有证书无法解析时为 0
+static NSData * WBTrustEvaluationCacheKey(SecTrustRef serverTrust, NSString *domain, time_t *earliestNotAfter) {
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    
+    NSData *domainData = [domain ?: @"" dataUsingEncoding:NSUTF8StringEncoding];
+    uint32_t length = (uint32_t)[domainData length];
+    CC_SHA256_Update(&context, &length, sizeof(length));
+    CC_SHA256_Update(&context, [domainData bytes], length);
+    
+    *earliestNotAfter = 0;
+    BOOL parsesNotAfter = YES;
     CFIndex certificateCount = SecTrustGetCertificateCount(serverTrust);
-    NSMutableArray *trustChain = [NSMutableArray arrayWithCapacity:(NSUInteger)certificateCount];
     for (CFIndex i = 0; i < certificateCount; i++) {
         SecCertificateRef certificate = SecTrustGetCertificateAtIndex(serverTrust, i);
-
-        SecCertificateRef someCertificates[] = {certificate};
-        CFArrayRef certificates = CFArrayCreate(NULL, (const void **)someCertificates, 1, NULL);
-
-        SecTrustRef trust;
-        __Require_noErr_Quiet(SecTrustCreateWithCertificates(certificates, policy, &trust), _out);
-        SecTrustResultType result;
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-        __Require_noErr_Quiet(SecTrustEvaluate(trust, &result), _out);
-#pragma clang diagnostic pop
-        [trustChain addObject:(__bridge_transfer id)SecTrustCopyPublicKey(trust)];
-
-    _out:
-        if (trust) {
-            CFRelease(trust);
-        }
-
-        if (certificates) {
-            CFRelease(certificates);
+        NSData *certificateData = (__bridge_transfer NSData *)SecCertificateCopyData(certificate);
+        length = (uint32_t)[certificateData length];
+        CC_SHA256_Update(&context, &length, sizeof(length));
+        CC_SHA256_Update(&context, [certificateData bytes], length);
+        
+        time_t notAfter = 0;
+        if (!parsesNotAfter || !WBCertificateNotAfter(certificateData, &notAfter)) {
+            parsesNotAfter = NO;
+            *earliestNotAfter = 0;
+        }else if (i == 0 || notAfter < *earliestNotAfter) {
+            *earliestNotAfter = notAfter;
         }
-
-        continue;
     }
-    CFRelease(policy);
-
-    return [NSArray arrayWithArray:trustChain];
     
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &context);
+    return [NSData dataWithBytes:digest length:sizeof(digest)];
 }
 
-
 @interface WBSecurityPolicy()
 @property (readwrite, nonatomic, assign) WBSSLPinningMode SSLPinningMode; //SSL的链接模式
-@property (readwrite, nonatomic, strong) NSSet *pinnedPublicKeys;//稳定的公钥集合
+@property (readonly, nonatomic, strong) NSSet <NSData *> *pinnedPublicKeyHashes;//固定证书的 subjectPublicKeyInfo SHA-256 集合
+@property (readonly, nonatomic, copy) NSArray *pinnedCertificateRefs;//预先创建好的 SecCertificateRef，作为 certificate 模式的根证书
 @end
 
-@implementation WBSecurityPolicy
+@implementation WBSecurityPolicy {
+    os_unfair_lock _trustEvaluationCacheLock;
+    //key -> 过期时间（纳秒，CLOCK_MONOTONIC_RAW）
+    NSMutableDictionary <NSData *, NSNumber *> *_trustEvaluationCache;
+    //按插入顺序排列的 key，满了之后先淘汰最早的
+    NSMutableArray <NSData *> *_trustEvaluationCacheKeys;
+    NSUInteger _trustEvaluationCacheHitCount;
+    NSUInteger _trustEvaluationCacheMissCount;
+    //每次清空缓存时加 1，评估期间配置改变过的结果不再放入缓存
+    NSUInteger _trustEvaluationCacheGeneration;
+    
+    //pinnedCertificateRefs 和 pinnedPublicKeyHashes 在后台队列中生成，完成后在锁内一起发布
+    os_unfair_lock _pinnedCertificatesLock;
+    dispatch_group_t _pinnedCertificatesGroup;
+    NSUInteger _pinnedCertificatesGeneration;
+    NSArray *_pinnedCertificateRefs;
+    NSSet <NSData *> *_pinnedPublicKeyHashes;
+}
 
 /// 从目录bundle 获取所有以.cer 结尾的证书，并将证书专为二进制数据，放在数组中返回
+/// bundle 中的文件在运行时不会变化，每个 bundle 只扫描一次，之后返回缓存的结果
 /// @param bundle  目录
 + (NSSet *)certificatesInBundle:(NSBundle *)bundle {
+    static os_unfair_lock lock = OS_UNFAIR_LOCK_INIT;
+    static NSMutableDictionary <NSString *, NSSet *> *certificatesByBundlePath = nil;
+    NSString *bundlePath = [bundle bundlePath] ?: @"";
+    
+    os_unfair_lock_lock(&lock);
+    NSSet *cachedCertificates = certificatesByBundlePath[bundlePath];
+    os_unfair_lock_unlock(&lock);
+    if (cachedCertificates) {
+        return cachedCertificates;
+    }
+    
     NSArray *paths = [bundle pathsForResourcesOfType:@"cer" inDirectory:@"."];
 
     NSMutableSet *certificates = [NSMutableSet setWithCapacity:[paths count]];
     for (NSString *path in paths) {
         NSData *certificateData = [NSData dataWithContentsOfFile:path];
-        [certificates addObject:certificateData];
+        if (certificateData) {
+            [certificates addObject:certificateData];
+        }
+    }
+    NSSet *bundleCertificates = [NSSet setWithSet:certificates];
+    
+    os_unfair_lock_lock(&lock);
+    if (!certificatesByBundlePath) {
+        certificatesByBundlePath = [NSMutableDictionary dictionary];
     }
+    certificatesByBundlePath[bundlePath] = bundleCertificates;
+    os_unfair_lock_unlock(&lock);
 
-    return [NSSet setWithSet:certificates];
+    return bundleCertificates;
 }
 
 /// 获取一个默认的安全策略 securityPolicy
@@ -250,33 +322,192 @@ static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
     if (!self) {
         return  nil;
     }
+    _trustEvaluationCacheLock = OS_UNFAIR_LOCK_INIT;
+    _trustEvaluationCache = [NSMutableDictionary dictionary];
+    _trustEvaluationCacheKeys = [NSMutableArray array];
+    _pinnedCertificatesLock = OS_UNFAIR_LOCK_INIT;
+    self.trustEvaluationCacheTTL = kWBTrustEvaluationCacheDefaultTTL;
     //默认需要验证证书中的域名
     self.validatesDomainName = YES;
     return self;
 }
 
 
-/// 设置证书数据，得到pinnedPublicKeys
+/// 设置证书数据，在后台队列中并发生成 pinnedCertificateRefs 和 pinnedPublicKeyHashes，不阻塞调用的线程（通常是启动时的主线程）
 /// @param pinnedCertificates 所有证书的二进制数据集合
 - (void)setPinnedCertificates:(NSSet<NSData *> *)pinnedCertificates{
     
     _pinnedCertificates = pinnedCertificates;
+    [self removeAllCachedTrustEvaluations];
+    
+    dispatch_group_t group = dispatch_group_create();
+    os_unfair_lock_lock(&_pinnedCertificatesLock);
+    NSUInteger generation = ++_pinnedCertificatesGeneration;
+    _pinnedCertificatesGroup = group;
+    _pinnedCertificateRefs = nil;
+    _pinnedPublicKeyHashes = nil;
+    os_unfair_lock_unlock(&_pinnedCertificatesLock);
+    
+    if (!pinnedCertificates) {
+        return;
+    }
     
-    if (self.pinnedCertificates) {
+    NSArray <NSData *> *certificates = [pinnedCertificates allObjects];
+    dispatch_group_async(group, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NSUInteger count = [certificates count];
+        CFTypeRef *certificateRefs = calloc(MAX(count, 1), sizeof(CFTypeRef));
+        CFTypeRef *publicKeyHashes = calloc(MAX(count, 1), sizeof(CFTypeRef));
+        
+        //每个证书的结果写入自己的下标，不需要加锁
+        dispatch_apply(count, DISPATCH_APPLY_AUTO, ^(size_t i) {
+            NSData *certificateData = certificates[i];
+            certificateRefs[i] = SecCertificateCreateWithData(NULL, (__bridge CFDataRef)certificateData);
+            publicKeyHashes[i] = CFBridgingRetain(WBSubjectPublicKeyInfoHashForCertificateData(certificateData));
+        });
+        
         //setWithCapacity 会根据后边的count创建set，可以提高内存效率。注：指定为3，实际上也是可以大于3的。NSDictionary和NSArray也是一样
-        NSMutableSet *mutablePinnedPublickeys = [NSMutableSet setWithCapacity:[self.pinnedCertificates count]];
-        for (NSData *certificate in self.pinnedCertificates) {
-            id publicKey = WBPublicKeyForCertificate(certificate);
-            if (!publicKey) {
-                continue;
+        NSMutableArray *mutablePinnedCertificateRefs = [NSMutableArray arrayWithCapacity:count];
+        NSMutableSet *mutablePinnedPublicKeyHashes = [NSMutableSet setWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            if (certificateRefs[i]) {
+                [mutablePinnedCertificateRefs addObject:(__bridge_transfer id)certificateRefs[i]];
+            }
+            if (publicKeyHashes[i]) {
+                [mutablePinnedPublicKeyHashes addObject:(__bridge_transfer NSData *)publicKeyHashes[i]];
             }
-            [mutablePinnedPublickeys addObject:publicKey];
         }
-        self.pinnedPublicKeys = [NSSet setWithSet:mutablePinnedPublickeys];
+        free(certificateRefs);
+        free(publicKeyHashes);
         
+        //期间又设置了新的证书时丢弃这次的结果
+        os_unfair_lock_lock(&self->_pinnedCertificatesLock);
+        if (self->_pinnedCertificatesGeneration == generation) {
+            self->_pinnedCertificateRefs = [mutablePinnedCertificateRefs copy];
+            self->_pinnedPublicKeyHashes = [mutablePinnedPublicKeyHashes copy];
+        }
+        os_unfair_lock_unlock(&self->_pinnedCertificatesLock);
+    });
+}
+
+//等待最近一次设置的证书处理完成。只有在后台生成结束前收到 challenge 时才会真正等待
+- (void)waitForPinnedCertificates{
+    dispatch_group_t waitedGroup = nil;
+    while (YES) {
+        os_unfair_lock_lock(&_pinnedCertificatesLock);
+        dispatch_group_t group = _pinnedCertificatesGroup;
+        os_unfair_lock_unlock(&_pinnedCertificatesLock);
+        if (!group || group == waitedGroup) {
+            return;
+        }
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+        waitedGroup = group;
+    }
+}
+
+- (NSArray *)pinnedCertificateRefs{
+    [self waitForPinnedCertificates];
+    os_unfair_lock_lock(&_pinnedCertificatesLock);
+    NSArray *pinnedCertificateRefs = _pinnedCertificateRefs;
+    os_unfair_lock_unlock(&_pinnedCertificatesLock);
+    return pinnedCertificateRefs;
+}
+
+- (NSSet<NSData *> *)pinnedPublicKeyHashes{
+    [self waitForPinnedCertificates];
+    os_unfair_lock_lock(&_pinnedCertificatesLock);
+    NSSet *pinnedPublicKeyHashes = _pinnedPublicKeyHashes;
+    os_unfair_lock_unlock(&_pinnedCertificatesLock);
+    return pinnedPublicKeyHashes;
+}
+
+#pragma mark - 评估结果缓存
+
+//修改影响评估结果的配置时清空缓存
+- (void)setSSLPinningMode:(WBSSLPinningMode)SSLPinningMode{
+    _SSLPinningMode = SSLPinningMode;
+    [self removeAllCachedTrustEvaluations];
+}
+
+- (void)setAllowInvalidCertificates:(BOOL)allowInvalidCertificates{
+    _allowInvalidCertificates = allowInvalidCertificates;
+    [self removeAllCachedTrustEvaluations];
+}
+
+- (void)setValidatesDomainName:(BOOL)validatesDomainName{
+    _validatesDomainName = validatesDomainName;
+    [self removeAllCachedTrustEvaluations];
+}
+
+- (NSUInteger)trustEvaluationCacheHitCount{
+    os_unfair_lock_lock(&_trustEvaluationCacheLock);
+    NSUInteger hitCount = _trustEvaluationCacheHitCount;
+    os_unfair_lock_unlock(&_trustEvaluationCacheLock);
+    return hitCount;
+}
+
+- (NSUInteger)trustEvaluationCacheMissCount{
+    os_unfair_lock_lock(&_trustEvaluationCacheLock);
+    NSUInteger missCount = _trustEvaluationCacheMissCount;
+    os_unfair_lock_unlock(&_trustEvaluationCacheLock);
+    return missCount;
+}
+
+- (void)removeAllCachedTrustEvaluations{
+    os_unfair_lock_lock(&_trustEvaluationCacheLock);
+    [_trustEvaluationCache removeAllObjects];
+    [_trustEvaluationCacheKeys removeAllObjects];
+    _trustEvaluationCacheGeneration += 1;
+    os_unfair_lock_unlock(&_trustEvaluationCacheLock);
+}
+
+- (NSUInteger)trustEvaluationCacheGeneration{
+    os_unfair_lock_lock(&_trustEvaluationCacheLock);
+    NSUInteger generation = _trustEvaluationCacheGeneration;
+    os_unfair_lock_unlock(&_trustEvaluationCacheLock);
+    return generation;
+}
+
+//缓存中有没过期的成功结果时返回 YES，过期的结果顺便删除
+- (BOOL)hasCachedTrustEvaluationForKey:(NSData *)key{
+    uint64_t now = clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW);
+    os_unfair_lock_lock(&_trustEvaluationCacheLock);
+    NSNumber *expiration = _trustEvaluationCache[key];
+    BOOL isCached = expiration && [expiration unsignedLongLongValue] > now;
+    if (expiration && !isCached) {
+        [_trustEvaluationCache removeObjectForKey:key];
+        [_trustEvaluationCacheKeys removeObject:key];
+    }
+    if (isCached) {
+        _trustEvaluationCacheHitCount += 1;
     }else{
-        self.pinnedPublicKeys = nil;
+        _trustEvaluationCacheMissCount += 1;
+    }
+    os_unfair_lock_unlock(&_trustEvaluationCacheLock);
+    return isCached;
+}
+
+//generation 是评估开始前的值，评估期间清空过缓存（配置改变）时丢弃这次的结果。
+//缓存的结果不会超过证书链上最早的 notAfter，链上的证书过期后一定重新评估
+- (void)cacheTrustEvaluationForKey:(NSData *)key generation:(NSUInteger)generation notAfter:(time_t)notAfter{
+    NSTimeInterval lifetime = MIN(self.trustEvaluationCacheTTL, difftime(notAfter, time(NULL)));
+    if (lifetime <= 0) {
+        return;
+    }
+    uint64_t expiration = clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW) + (uint64_t)(lifetime * NSEC_PER_SEC);
+    os_unfair_lock_lock(&_trustEvaluationCacheLock);
+    if (_trustEvaluationCacheGeneration != generation) {
+        os_unfair_lock_unlock(&_trustEvaluationCacheLock);
+        return;
+    }
+    if (!_trustEvaluationCache[key]) {
+        if ([_trustEvaluationCacheKeys count] >= kWBTrustEvaluationCacheCountLimit) {
+            [_trustEvaluationCache removeObjectForKey:[_trustEvaluationCacheKeys firstObject]];
+            [_trustEvaluationCacheKeys removeObjectAtIndex:0];
+        }
+        [_trustEvaluationCacheKeys addObject:key];
     }
+    _trustEvaluationCache[key] = @(expiration);
+    os_unfair_lock_unlock(&_trustEvaluationCacheLock);
 }
 
 #pragma mark -
@@ -290,6 +521,26 @@ static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
         return NO;
     }
     
+    if (self.trustEvaluationCacheTTL <= 0) {
+        return [self evaluateUncachedServerTrust:serverTrust forDomain:domain];
+    }
+    
+    //同一个域名收到同样的证书链时直接使用之前成功的结果，跳过 SecTrustEvaluate
+    time_t notAfter = 0;
+    NSData *cacheKey = WBTrustEvaluationCacheKey(serverTrust, domain, &notAfter);
+    if ([self hasCachedTrustEvaluationForKey:cacheKey]) {
+        return YES;
+    }
+    NSUInteger generation = [self trustEvaluationCacheGeneration];
+    BOOL isTrusted = [self evaluateUncachedServerTrust:serverTrust forDomain:domain];
+    if (isTrusted) {
+        [self cacheTrustEvaluationForKey:cacheKey generation:generation notAfter:notAfter];
+    }
+    return isTrusted;
+}
+
+- (BOOL)evaluateUncachedServerTrust:(SecTrustRef)serverTrust forDomain:(NSString *)domain{
+    
     NSMutableArray *policies = [NSMutableArray array];
     
     //需要验证域名时，添加一个域名验证策略
@@ -315,12 +566,8 @@ static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
     switch (self.SSLPinningMode) {
         case WBSSLPinningModeCertificate:{
             // AFSSLPinningModeCertificate 是直接将本地证书设置为信任的根证书，然后来进行判断，并且比较本地证书内容和服务器证书内容是否一致，如果有一个相同则返回YES
-            NSMutableArray *pinnedCertificates = [NSMutableArray array];
-            for (NSData *certificateData in self.pinnedCertificates) {
-                [pinnedCertificates addObject:(__bridge_transfer  id)SecCertificateCreateWithData(NULL, (__bridge  CFDataRef)certificateData)];
-            }
             //设置本地证书为根证书
-            SecTrustSetAnchorCertificates(serverTrust, (__bridge  CFArrayRef)pinnedCertificates);
+            SecTrustSetAnchorCertificates(serverTrust, (__bridge  CFArrayRef)self.pinnedCertificateRefs);
             
             //通过本地证书来判断服务器证书是否可信，不可信则不通过
             if (!WBServerTrustIsValid(serverTrust)) {
@@ -340,19 +587,16 @@ static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
             return NO;
 
         case WBSSLPinningModePublicKey:{
-            //是通过比较证书中公钥部分来进行校验。通过SecTrustCopyPublicKey方法获取本地证书和服务器证书，进行比较，如果有一个相同则验证通过
-            NSInteger trustedPublicKeyCount = 0;
-            NSArray *publicKeys = WBPublicKeyTrustChainForServerTrust(serverTrust);
-            for (id trustChainPublicKey in publicKeys) {
-                
-                for (id pinnedPublicKey in self.pinnedPublicKeys) {
-                    if (WBSecKeyIsEqualToKey((__bridge  SecKeyRef)trustChainPublicKey, (__bridge SecKeyRef)pinnedPublicKey)) {
-                        trustedPublicKeyCount += 1;
-                    }
+            //是通过比较证书中公钥部分来进行校验。计算服务器证书链中每个证书 subjectPublicKeyInfo 的 SHA-256，在本地证书的哈希集合中查找，如果有一个相同则验证通过
+            CFIndex certificateCount = SecTrustGetCertificateCount(serverTrust);
+            for (CFIndex i = 0; i < certificateCount; i++) {
+                SecCertificateRef certificate = SecTrustGetCertificateAtIndex(serverTrust, i);
+                NSData *certificateData = (__bridge_transfer NSData *)SecCertificateCopyData(certificate);
+                NSData *publicKeyHash = WBSubjectPublicKeyInfoHashForCertificateData(certificateData);
+                if (publicKeyHash && [self.pinnedPublicKeyHashes containsObject:publicKeyHash]) {
+                    return YES;
                 }
             }
-            return trustedPublicKeyCount > 0;
-            
             
         }
             return NO;
@@ -365,8 +609,8 @@ static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
 
 #pragma mark - NSKeyValueObserving
 
-//用kvo监听pinnedPublicKeys，当pinnedCertificates发生改变时，观察者也会收到通知。
-+ (NSSet *)keyPathsForValuesAffectingPinnedPublicKeys{
+//用kvo监听pinnedPublicKeyHashes，当pinnedCertificates发生改变时，观察者也会收到通知。
++ (NSSet *)keyPathsForValuesAffectingPinnedPublicKeyHashes{
     return [NSSet setWithObject:@"pinnedCertificates"];
 }
 
@@ -383,10 +627,19 @@ static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
     if (!self) {
         return  nil;
     }
+    _trustEvaluationCacheLock = OS_UNFAIR_LOCK_INIT;
+    _trustEvaluationCache = [NSMutableDictionary dictionary];
+    _trustEvaluationCacheKeys = [NSMutableArray array];
+    _pinnedCertificatesLock = OS_UNFAIR_LOCK_INIT;
     self.SSLPinningMode = [[coder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(SSLPinningMode))] unsignedIntegerValue];
     self.allowInvalidCertificates = [coder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(allowInvalidCertificates))];
     self.validatesDomainName = [coder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(validatesDomainName))];
     self.pinnedCertificates = [coder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(pinnedCertificates))];
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(trustEvaluationCacheTTL))]) {
+        self.trustEvaluationCacheTTL = [coder decodeDoubleForKey:NSStringFromSelector(@selector(trustEvaluationCacheTTL))];
+    }else{
+        self.trustEvaluationCacheTTL = kWBTrustEvaluationCacheDefaultTTL;
+    }
     return self;
     
 }
@@ -398,6 +651,7 @@ static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
     [coder encodeBool:self.allowInvalidCertificates forKey:NSStringFromSelector(@selector(allowInvalidCertificates))];
     [coder encodeBool:self.validatesDomainName forKey:NSStringFromSelector(@selector(validatesDomainName))];
     [coder encodeObject:self.pinnedCertificates forKey:NSStringFromSelector(@selector(pinnedCertificates))];
+    [coder encodeDouble:self.trustEvaluationCacheTTL forKey:NSStringFromSelector(@selector(trustEvaluationCacheTTL))];
     
 }
 
@@ -412,6 +666,7 @@ static NSArray * WBPublicKeyTrustChainForServerTrust(SecTrustRef serverTrust) {
     securityPolicy.allowInvalidCertificates = self.allowInvalidCertificates;
     securityPolicy.validatesDomainName = self.validatesDomainName;
     securityPolicy.pinnedCertificates = [self.pinnedCertificates copyWithZone:zone];
+    securityPolicy.trustEvaluationCacheTTL = self.trustEvaluationCacheTTL;
     
     return securityPolicy;
 }
@@ -7,7 +7,9 @@
 
 #import <Foundation/Foundation.h>
 
+#if defined(__APPLE__)
 #import <TargetConditionals.h>
+#endif
 
 #if TARGET_OS_IOS || TARGET_OS_TV
 #import <UIKit/UIKit.h>
@@ -15,6 +17,10 @@
 #import <WatchKit/WatchKit.h>
 #endif
 
+#if !TARGET_OS_WATCH
+#import "WBNetworkReachabilityManager.h"
+#endif
+
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -59,6 +65,14 @@ FOUNDATION_EXPORT NSString *WBPercentEscapedStringFromString(NSString *string);
 
 FOUNDATION_EXPORT NSString *WBQueryStringFromParameters(NSDictionary *parameters);
 
+/**
+ Query string serialization caches the sorted key order of recently seen dictionary key sets, so repeated parameter shapes skip sorting. These return how many dictionary key sorts were served from that cache and how many had to sort.
+
+ 查询字符串序列化时会缓存最近用到的字典 key 集合排序后的顺序，相同结构的参数不再重复排序。这两个方法返回缓存命中和未命中的次数。
+ */
+FOUNDATION_EXPORT NSUInteger WBQueryStringSortedKeysCacheHitCount(void);
+FOUNDATION_EXPORT NSUInteger WBQueryStringSortedKeysCacheMissCount(void);
+
 @protocol WBURLRequestSerialization <NSObject, NSSecureCoding, NSCopying>
 /**
  The `AFURLRequestSerialization` protocol is adopted by an object that encodes parameters for a specified HTTP requests. Request serializers may encode parameters as query strings, HTTP bodies, setting the appropriate HTTP header fields as necessary.
@@ -84,14 +98,60 @@ FOUNDATION_EXPORT NSString *WBQueryStringFromParameters(NSDictionary *parameters
 
 @end
 
+/**
+ Styles used to encode nested parameters into a query string.
+ 查询字符串的编码风格
+
+ - `WBHTTPRequestQueryStringSerializationDefaultStyle`: `a[]=1&a[]=2&b[c]=3`
+ - `WBHTTPRequestQueryStringSerializationRepeatedKeyStyle`: arrays repeat the key, `a=1&a=2&b[c]=3`
+ - `WBHTTPRequestQueryStringSerializationCommaSeparatedStyle`: arrays of plain values are joined with commas, `a=1,2&b[c]=3`. Arrays that contain collections fall back to the default style.
+ - `WBHTTPRequestQueryStringSerializationDottedKeyStyle`: nested keys are joined with dots and arrays repeat the key, `a=1&a=2&b.c=3`
+ */
 typedef NS_ENUM(NSInteger, WBHTTPRequestQueryStringSerializationStyle) {
     
     WBHTTPRequestQueryStringSerializationDefaultStyle = 0,
+    WBHTTPRequestQueryStringSerializationRepeatedKeyStyle = 1,
+    WBHTTPRequestQueryStringSerializationCommaSeparatedStyle = 2,
+    WBHTTPRequestQueryStringSerializationDottedKeyStyle = 3,
 };
 
+/**
+ Compression applied to request bodies by `WBHTTPRequestSerializer`.
+ 请求体的压缩方式。
+
+ - WBHTTPRequestBodyCompressionNone: Bodies are sent as is. 不压缩。
+ - WBHTTPRequestBodyCompressionGzip: Bodies at or above `bodyCompressionThreshold` are gzip-compressed and sent with `Content-Encoding: gzip`. 使用 gzip 压缩。
+ */
+typedef NS_ENUM(NSUInteger, WBHTTPRequestBodyCompression) {
+    WBHTTPRequestBodyCompressionNone = 0,
+    WBHTTPRequestBodyCompressionGzip,
+};
+
+/**
+ The default value of `bodyCompressionThreshold`, 1 KB.
+ bodyCompressionThreshold 的默认值。
+ */
+FOUNDATION_EXPORT NSUInteger const kWBHTTPRequestBodyCompressionDefaultThreshold;
+
+/**
+ Generates an encoded query string from the parameters using the specified serialization style.
+
+ 按照指定的风格将查询参数编码为查询字符串
+ @param parameters A dictionary of key/values to be encoded.
+ @param style The serialization style.
+
+ @return A url encoded query string
+ */
+FOUNDATION_EXPORT NSString *WBQueryStringFromParametersWithStyle(NSDictionary *parameters, WBHTTPRequestQueryStringSerializationStyle style);
+
 // 声明一个协议
 @protocol WBMultipartFormData;//WBMultipartFormData
 
+@class WBHTTPRequestPrototype;
+@class WBUploadRateLimiter;
+@class WBMultipartFormPartChecksum;
+@class WBMultipartFormFileBatchReport;
+
 
 @interface WBHTTPRequestSerializer :NSObject<WBURLRequestSerialization>
 
@@ -242,6 +302,21 @@ forHTTPHeaderField:(NSString *)field;
  */
 @property (nonatomic, strong) NSSet <NSString *> *HTTPMethodsEncodingParametersInURI;
 
+/**
+ The compression applied to request bodies. `WBHTTPRequestBodyCompressionNone` by default.
+ 请求体的压缩方式，默认不压缩。
+
+ @discussion The server must accept `Content-Encoding: gzip` request bodies. In-memory bodies are compressed in one pass, and are left uncompressed if that does not make them smaller. Body streams, including multipart form bodies, are wrapped in a stream that compresses as the body is read, so the request is sent with `Transfer-Encoding: chunked`. Smaller bodies use a higher compression level. Requests that already have a `Content-Encoding` header are not modified.
+ 服务端需要支持 gzip 编码的请求体。内存中的 body 一次性压缩，压缩后没有变小时发送原始数据；body stream（包括 multipart）在读取时边读边压缩，使用 chunked 传输。body 越小使用的压缩级别越高。已经设置了 Content-Encoding 的请求不会被修改。
+ */
+@property (nonatomic, assign) WBHTTPRequestBodyCompression bodyCompression;
+
+/**
+ The minimum body length, in bytes, that is compressed. Body streams of unknown length are always compressed. `kWBHTTPRequestBodyCompressionDefaultThreshold` by default.
+ 需要压缩的 body 的最小长度，长度未知的 body stream 总是压缩。
+ */
+@property (nonatomic, assign) NSUInteger bodyCompressionThreshold;
+
 /**
  Set the method of query string serialization according to one of the pre-defined styles.
 
@@ -277,6 +352,19 @@ forHTTPHeaderField:(NSString *)field;
                                          parameters:(nullable id)parameters
                                               error:(NSError * _Nullable __autoreleasing *)error;
 
+/**
+ Creates a prototype request for the specified base URL, with the cache policy, timeout interval, cellular access, cookie handling and default HTTP headers of the serializer already applied.
+ 根据 baseURL 创建一个请求原型，缓存策略、超时时间、蜂窝数据、cookie 以及默认请求头都已经设置好，之后每个请求只需要拷贝原型并填入 path、参数。
+
+ Request configuration and headers are captured when this method is called; later changes to the serializer are not reflected in the prototype. Parameters are still encoded with the serializer's current query string serialization.
+ 原型创建之后再修改 serializer 的属性和请求头不会影响原型，参数仍然使用 serializer 当前的查询字符串编码方式。
+
+ @param baseURL The URL that request paths are resolved against. This parameter must not be `nil`.
+
+ @return A new request prototype.
+ */
+- (WBHTTPRequestPrototype *)requestPrototypeWithBaseURL:(NSURL *)baseURL;
+
 
 /**
  Creates an `NSMutableURLRequest` object with the specified HTTP method and URLString, and constructs a `multipart/form-data` HTTP body, using the specified parameters and multipart form data block. See http://www.w3.org/TR/html4/interact/forms.html#h-17.13.4.2
@@ -312,6 +400,77 @@ forHTTPHeaderField:(NSString *)field;
                              writingStreamContentsToFile:(NSURL *)fileURL
                                        completionHandler:(nullable void (^)(NSError * _Nullable error))handler;
 
+/**
+ Creates an `NSMutableURLRequest` by removing the `HTTPBodyStream` from a request, and asynchronously writing its contents into the specified file with a pair of large buffers, so that reading the next chunk overlaps writing the previous one.
+ 移除 request 的 HTTPBodyStream，并异步地把内容写入文件。使用两块较大的缓冲区，读取下一块数据的同时写入上一块数据。
+
+ @param request The multipart form request. The `HTTPBodyStream` property of `request` must not be `nil`.
+ @param fileURL The file URL to write multipart form contents to. A partially written file is removed if writing fails or is cancelled.
+ @param bufferSize The size of each of the two buffers, in bytes. Pass `0` for the default of 256 KB.
+ @param progressBlock A block called once on the calling thread before writing starts, and then on a background queue after each chunk is written. The progress's `totalUnitCount` is the request's `Content-Length`, or `-1` if it is unknown. Call `-cancel` on the progress to stop writing; the completion handler then receives an `NSURLErrorCancelled` error.
+ @param handler A handler block to execute on the main queue.
+ */
+- (NSMutableURLRequest *)requestWithMultipartFormRequest:(NSURLRequest *)request
+                             writingStreamContentsToFile:(NSURL *)fileURL
+                                              bufferSize:(NSUInteger)bufferSize
+                                                progress:(nullable void (^)(NSProgress *progress))progressBlock
+                                       completionHandler:(nullable void (^)(NSError * _Nullable error))handler;
+
+/**
+ Creates a copy of a multipart form request whose body starts at `offset` instead of byte zero, so that an interrupted upload can be resumed from the last offset acknowledged by the server.
+ 从 offset 处继续上传 multipart 请求：返回的请求的 body 从 offset 开始，用于上传中断后从服务端确认的位置继续上传。
+
+ @param request A request created by `multipartFormRequestWithMethod:URLString:parameters:constructingBodyWithBlock:error:`, without body compression.
+ @param offset The offset in the full multipart body to resume from. Must not be greater than the full body length.
+ @param error The error that occurred if the request cannot be resumed.
+
+ @discussion The returned request has a `Content-Length` of the remaining bytes. No header describing the offset is added, because servers disagree on how a resumed upload is announced (`Content-Range` on a request is non-standard and often rejected); set the one your server's resume protocol expects, such as `Upload-Offset`. The offset is mapped to a body part and a position within it when the stream is opened. File parts are resumed with a seek. Parts appended with an input stream can only be resumed if their stream has not been opened yet. Bodies containing a part of unknown length cannot be resumed.
+ 返回的请求 Content-Length 为剩余的长度。不添加表示 offset 的请求头（请求中使用 Content-Range 不是标准用法，很多服务端会拒绝），由调用方按服务端的续传协议设置，比如 Upload-Offset。打开 stream 时才把 offset 映射到对应的 part 和 part 内的位置，文件直接 seek；通过输入流添加的 part 只有在输入流还没有被打开时才能继续上传；有长度未知的 part 时不能继续上传。
+
+ @return The resumable request, or `nil` if the request does not have a resumable multipart body.
+ */
+- (nullable NSMutableURLRequest *)requestWithMultipartFormRequest:(NSURLRequest *)request
+                                               resumingFromOffset:(unsigned long long)offset
+                                                            error:(NSError * _Nullable __autoreleasing *)error;
+
+@end
+
+
+/**
+ `WBHTTPRequestPrototype` is a frozen request built by `-[WBHTTPRequestSerializer requestPrototypeWithBaseURL:]`. Each request is created by cloning the prototype and filling in the method, path and parameters only.
+ 请求原型，每次创建请求时只拷贝原型并设置 method、path 和参数，不再重复解析配置和合并请求头。
+ */
+@interface WBHTTPRequestPrototype : NSObject
+
+/**
+ The URL that request paths are resolved against.
+ */
+@property (readonly, nonatomic, strong) NSURL *baseURL;
+
+/**
+ The prototype request, with configuration and default headers already applied.
+ */
+@property (readonly, nonatomic, copy) NSURLRequest *request;
+
+- (instancetype)init NS_UNAVAILABLE;
++ (instancetype)new NS_UNAVAILABLE;
+
+/**
+ Creates an `NSMutableURLRequest` by cloning the prototype request.
+ 拷贝原型并创建一个请求
+
+ @param method The HTTP method for the request. This parameter must not be `nil`.
+ @param path The path, relative to `baseURL`, of the request. If `nil` or empty, `baseURL` is used.
+ @param parameters The parameters to be either set as a query string or the request HTTP body.
+ @param error The error that occurred while constructing the request.
+
+ @return An `NSMutableURLRequest` object.
+ */
+- (nullable NSMutableURLRequest *)requestWithMethod:(NSString *)method
+                                               path:(nullable NSString *)path
+                                         parameters:(nullable id)parameters
+                                              error:(NSError * _Nullable __autoreleasing *)error;
+
 @end
 
 
@@ -329,6 +488,24 @@ forHTTPHeaderField:(NSString *)field;
                      mimeType:(NSString *)mimeType
                         error:(NSError * _Nullable __autoreleasing *)error;
 
+/**
+ Appends a part for each file, in order, with the same form `name`. The file name and MIME type come from each URL, as in `-appendPartWithFileURL:name:error:`. All files are examined concurrently on at most `maxConcurrentFileCount` workers, and this method returns once every part has been appended.
+ 批量拼接文件：在最多 maxConcurrentFileCount 个线程上并发获取所有文件的长度（以及可选的 SHA-256），全部完成后按顺序拼接，返回时表单已经准备好。
+
+ @param fileURLs The file URLs to append.
+ @param name The name associated with every file part.
+ @param computesSHA256 Whether to read each file and compute its SHA-256 digest while its length is determined.
+ @param maxConcurrentFileCount The maximum number of files examined at the same time. Pass `0` to use the number of active processors.
+ @param error If a file cannot be read, the error of the first such file in `fileURLs`. No part is appended in that case.
+
+ @return A report with the lengths, digests and timings, or `nil` if a file cannot be read.
+ */
+- (nullable WBMultipartFormFileBatchReport *)appendPartsWithFileURLs:(NSArray <NSURL *> *)fileURLs
+                                                                name:(NSString *)name
+                                                      computesSHA256:(BOOL)computesSHA256
+                                              maxConcurrentFileCount:(NSUInteger)maxConcurrentFileCount
+                                                               error:(NSError * _Nullable __autoreleasing *)error;
+
 //直接拼接输入流
 - (void)appendPartWithInputStream:(nullable NSInputStream *)inputStream
                              name:(NSString *)name
@@ -352,10 +529,23 @@ forHTTPHeaderField:(NSString *)field;
                          body:(NSData *)body;
 
 
-//通过限制数据包大小并为从上传流读取的每个块添加延迟来限制请求带宽。
+//限制请求带宽：每 delay 秒最多上传 numberOfBytes 字节。
+//现在等价于使用一个速率为 numberOfBytes / delay、突发量为 numberOfBytes 的 WBUploadRateLimiter，读取线程不再 sleep
 - (void)throttleBandwidthWithPacketSize:(NSUInteger)numberOfBytes
                                   delay:(NSTimeInterval)delay;
 
+/**
+ Throttles the upload of the request body with a token bucket rate limiter. Pass a shared limiter to several requests to cap their combined upload rate, or `nil` to remove throttling.
+ 使用令牌桶限制上传速率。多个请求使用同一个 limiter 时共享同一个带宽上限，传 nil 取消限速。
+ */
+- (void)throttleBandwidthWithRateLimiter:(nullable WBUploadRateLimiter *)rateLimiter;
+
+/**
+ Computes a CRC32C and a SHA-256 digest of each part body while the body is streamed, and calls `handler` with them once each part body has been read. The handler is called on the thread reading the request body, and is kept by requests resumed with `-requestWithMultipartFormRequest:resumingFromOffset:error:`. When a resumed upload starts inside a part body, the skipped bytes are hashed again so that the digests always cover the whole part body.
+ 在上传的同时计算每个 part body 的 CRC32C 和 SHA-256，每个 part 读完后在读取 body 的线程上回调。继续上传时如果从某个 part 的中间开始，会重新计算跳过的部分，保证摘要覆盖整个 part。
+ */
+- (void)computePartChecksumsWithHandler:(nullable void (^)(WBMultipartFormPartChecksum *checksum))handler;
+
 
 @end
 
@@ -387,6 +577,15 @@ forHTTPHeaderField:(NSString *)field;
 
 @property (nonatomic, assign) NSJSONWritingOptions writingOptions;
 
+/**
+ Whether requests with an array or dictionary body write their JSON into an `HTTPBodyStream` incrementally as the body is read, instead of serializing the whole document into `HTTPBody` first. `NO` by default.
+ 是否边读边生成 JSON。为 YES 时，顶层为数组或字典的参数会以 HTTPBodyStream 的方式发送，不会先在内存中生成完整的 JSON 数据，默认为 NO。
+
+ @discussion Streamed bodies have no known length, so the request is sent with `Transfer-Encoding: chunked`. Parameters are read while the request is sent and must not be mutated until the request completes.
+ 流式生成的 body 长度未知，请求会使用 chunked 传输。发送过程中才读取参数，请求完成之前不要修改参数。
+ */
+@property (nonatomic, assign) BOOL streamsHTTPBody;
+
 
 /**
  Creates and returns a JSON serializer with specified reading and writing options.
@@ -405,6 +604,25 @@ forHTTPHeaderField:(NSString *)field;
 
  `AFPropertyListRequestSerializer` 是 `AFHTTPRequestSerializer` 的子类，它使用 `NSPropertyListSerializer` 将参数编码为 JSON，将编码请求的 `Content-Type` 设置为 `application/x-plist`。
  */
+/**
+ How `WBPropertyListRequestSerializer` encodes the request body.
+ 请求体的编码方式。
+
+ - WBPropertyListRequestEncodingPropertyList: Encodes with `NSPropertyListSerialization` in the serializer's `format`. 使用 format 指定的属性列表格式。
+ - WBPropertyListRequestEncodingMessagePack: Encodes as MessagePack with `application/msgpack`. Strings, numbers, `NSNull`, `NSData`, `NSDate` (timestamp extension), arrays and dictionaries are supported. 使用 MessagePack 编码。
+ */
+typedef NS_ENUM(NSUInteger, WBPropertyListRequestEncoding) {
+    WBPropertyListRequestEncodingPropertyList = 0,
+    WBPropertyListRequestEncodingMessagePack,
+};
+
+/**
+ Returns the MessagePack encoding of `object`, or `nil` if it contains a value that cannot be encoded.
+ The encoded size is computed in a first pass, then the object is written in a second pass into a single buffer of exactly that size.
+ 先计算编码后的长度，再一次性写入刚好这么大的 buffer，编码过程中不会为每个值分配临时对象。
+ */
+FOUNDATION_EXPORT NSData * _Nullable WBMessagePackDataFromObject(id object, NSError * _Nullable __autoreleasing * _Nullable error);
+
 @interface WBPropertyListRequestSerializer : WBHTTPRequestSerializer
 
 
@@ -428,6 +646,12 @@ forHTTPHeaderField:(NSString *)field;
  */
 @property (nonatomic, assign) NSPropertyListWriteOptions writeOptions;
 
+/**
+ The body encoding. `WBPropertyListRequestEncodingPropertyList` by default, in which case `format` applies.
+ 请求体的编码方式，默认为属性列表；使用 MessagePack 时忽略 format。
+ */
+@property (nonatomic, assign) WBPropertyListRequestEncoding encoding;
+
 /**
  Creates and returns a property list serializer with a specified format, read options, and write options.
 
@@ -439,6 +663,12 @@ forHTTPHeaderField:(NSString *)field;
 + (instancetype)serializerWithFormat:(NSPropertyListFormat)format
                         writeOptions:(NSPropertyListWriteOptions)writeOptions;
 
+/**
+ Creates and returns a serializer that encodes request bodies as MessagePack.
+ 创建使用 MessagePack 编码的 serializer。
+ */
++ (instancetype)messagePackSerializer;
+
 
 @end
 
@@ -474,6 +704,138 @@ FOUNDATION_EXPORT NSString * const WBURLRequestSerializationErrorDomain;
  */
 FOUNDATION_EXPORT NSString * const WBNetworkingOperationFailingURLRequestErrorKey;
 
+#pragma mark -
+
+/**
+ Checksums of one multipart body part, reported by `-[WBMultipartFormData computePartChecksumsWithHandler:]`.
+ 一个 multipart part 的校验和。
+ */
+@interface WBMultipartFormPartChecksum : NSObject
+
+/**
+ The index of the part in the multipart body. part 的下标。
+ */
+@property (readonly, nonatomic, assign) NSUInteger index;
+
+/**
+ The headers of the part. part 的头信息。
+ */
+@property (readonly, nonatomic, copy) NSDictionary <NSString *, NSString *> *headers;
+
+/**
+ The offset of the first byte of the part body in the full multipart body. part body 第一个字节在整个 body 中的位置。
+ */
+@property (readonly, nonatomic, assign) unsigned long long bodyOffset;
+
+/**
+ The number of bytes in the part body. part body 的长度。
+ */
+@property (readonly, nonatomic, assign) unsigned long long bodyLength;
+
+/**
+ The CRC32C (Castagnoli) checksum of the part body.
+ */
+@property (readonly, nonatomic, assign) uint32_t CRC32C;
+
+/**
+ The SHA-256 digest of the part body.
+ */
+@property (readonly, nonatomic, copy) NSData *SHA256;
+
+@end
+
+/**
+ The result of `-[WBMultipartFormData appendPartsWithFileURLs:name:computesSHA256:maxConcurrentFileCount:error:]`.
+ 批量拼接文件的结果。
+ */
+@interface WBMultipartFormFileBatchReport : NSObject
+
+/**
+ The length of each file, in the order of the file URLs. 每个文件的长度。
+ */
+@property (readonly, nonatomic, copy) NSArray <NSNumber *> *fileLengths;
+
+/**
+ The SHA-256 digest of each file, in the order of the file URLs, or `nil` if digests were not computed. 每个文件的 SHA-256。
+ */
+@property (readonly, nonatomic, copy, nullable) NSArray <NSData *> *SHA256Digests;
+
+/**
+ The sum of the file lengths. 文件的总长度。
+ */
+@property (readonly, nonatomic, assign) unsigned long long totalLength;
+
+/**
+ The wall-clock time from the call until every part was appended. 从调用到拼接完成的时间。
+ */
+@property (readonly, nonatomic, assign) NSTimeInterval elapsedTime;
+
+/**
+ The time spent examining files, summed over all workers. Compare with `elapsedTime` to see the effect of concurrency. 所有线程处理文件的时间之和。
+ */
+@property (readonly, nonatomic, assign) NSTimeInterval cumulativeFileTime;
+
+@end
+
+#pragma mark -
+
+/**
+ `WBUploadRateLimiter` is a token bucket that limits how fast multipart request bodies are uploaded. Tokens, in bytes, are added at `bytesPerSecond` up to `burstSize`, and every body stream throttled by the limiter draws from the same bucket.
+ 令牌桶限速器。令牌（字节数）以 bytesPerSecond 的速度增加，最多累积 burstSize 个；使用同一个 limiter 的所有 body stream 从同一个桶中取令牌。
+
+ When the bucket is empty, a throttled stream reports that no bytes are available and notifies `NSURLSession` once tokens have been refilled, so the thread reading the stream never sleeps. Tokens found by `-hasBytesAvailable` or by the refill notification are reserved for that stream until its next read, so another stream sharing the limiter cannot take them in between. Readers that register no stream callback and call `-read:maxLength:` directly are blocked until tokens are available.
+ 桶空时 body stream 返回没有可读数据，令牌补充后再通知 NSURLSession 读取，读取线程不会 sleep。hasBytesAvailable 或者补充通知时取到的令牌会为这个 stream 预留到下一次读取，不会被共用 limiter 的其他 stream 取走；没有注册回调、直接同步读取的调用方会被阻塞到有令牌为止。
+ */
+@interface WBUploadRateLimiter : NSObject
+
+/**
+ A limiter shared by the whole app. It does not limit the rate until `bytesPerSecond` is set.
+ 全局共享的 limiter，设置 bytesPerSecond 之前不限速。
+ */
++ (instancetype)sharedLimiter;
+
+/**
+ Creates a limiter.
+
+ @param bytesPerSecond The sustained upload rate. `0` means unlimited.
+ @param burstSize The number of bytes that may be sent at once after the link has been idle. `0` means a quarter of a second at `bytesPerSecond`.
+ */
+- (instancetype)initWithBytesPerSecond:(NSUInteger)bytesPerSecond burstSize:(NSUInteger)burstSize NS_DESIGNATED_INITIALIZER;
+
+/**
+ The sustained upload rate in bytes per second. `0` means unlimited. Changing the rate wakes any waiting streams.
+ 每秒上传的字节数，0 表示不限速。
+ */
+@property (atomic, assign) NSUInteger bytesPerSecond;
+
+/**
+ The bucket capacity in bytes. `0` means a quarter of a second at `bytesPerSecond`.
+ 桶的容量，0 表示 bytesPerSecond 的四分之一。
+ */
+@property (atomic, assign) NSUInteger burstSize;
+
+#if !TARGET_OS_WATCH
+/**
+ Sets the rate that is applied when a reachability manager passed to `-adaptToReachabilityManager:` reports `status`.
+ 设置网络状态为 status 时使用的速率。
+ */
+- (void)setBytesPerSecond:(NSUInteger)bytesPerSecond forReachabilityStatus:(WBNetworkReachabilityStatus)status;
+
+/**
+ Sets the rate that is applied when a reachability manager passed to `-adaptToReachabilityManager:` reports path quality `quality`. A rate configured for the current path quality takes precedence over the rate for the current reachability status.
+ 设置链路质量为 quality 时使用的速率，优先于网络状态对应的速率。
+ */
+- (void)setBytesPerSecond:(NSUInteger)bytesPerSecond forPathQuality:(WBNetworkPathQuality)quality;
+
+/**
+ Updates `bytesPerSecond` whenever the reachability status or path quality of `manager` changes, using the rates configured with `-setBytesPerSecond:forPathQuality:` and `-setBytesPerSecond:forReachabilityStatus:`. When neither has a rate configured, the rate is left unchanged. Pass `nil` to stop adapting.
+ 跟随 manager 的网络状态和链路质量变化调整速率，都没有设置速率时保持当前速率不变。传 nil 停止跟随。
+ */
+- (void)adaptToReachabilityManager:(nullable WBNetworkReachabilityManager *)manager;
+#endif
+
+@end
+
 /**
  ## Throttling Bandwidth for HTTP Request Input Streams
 
@@ -6,19 +6,315 @@
 //
 
 #import "WBURLRequestSeriailzation.h"
+#import "WBCompatibilityMacros.h"
 
 #if TARGET_OS_IOS || TARGET_OS_WATCH || TARGET_OS_TV
 #import <MobileCoreServices/MobileCoreServices.h>
-#else
+#elif defined(__APPLE__)
 #import <CoreServices/CoreServices.h>
 #endif
 
+#import <errno.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+#import <zlib.h>
+#import <stdatomic.h>
+
+#if defined(__APPLE__)
+#import <os/lock.h>
+#import <CommonCrypto/CommonDigest.h>
+#else
+#import <pthread.h>
+#import <time.h>
+#import <dispatch/dispatch.h>
+#endif
+
+#if defined(__aarch64__)
+#import <arm_neon.h>
+#elif defined(__SSE2__)
+#import <emmintrin.h>
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#import <arm_acle.h>
+#endif
+
+#pragma mark - Portability
+
+/*
+ 锁、单调时钟和 SHA-256 在 Apple 平台上使用 os_unfair_lock、clock_gettime_nsec_np 和 CommonCrypto，
+ 其它平台（Linux）使用 pthread_mutex、clock_gettime(CLOCK_MONOTONIC) 和下面的 SHA-256 实现。
+ glibc 默认属性的 mutex 不持有额外的资源，不需要 pthread_mutex_destroy。
+ */
+#if defined(__APPLE__)
+
+typedef os_unfair_lock WBLock;
+#define WB_LOCK_INIT OS_UNFAIR_LOCK_INIT
+#define WBLockInit(lock) (*(lock) = OS_UNFAIR_LOCK_INIT)
+#define WBLockLock(lock) WBLockLock(lock)
+#define WBLockUnlock(lock) WBLockUnlock(lock)
+
+static inline uint64_t WBMonotonicTimeNanoseconds(void) {
+    return WBMonotonicTimeNanoseconds();
+}
+
+#define WB_SHA256_DIGEST_LENGTH CC_SHA256_DIGEST_LENGTH
+typedef WBSHA256Context WBSHA256Context;
+
+static inline void WBSHA256Init(WBSHA256Context *context) {
+    CC_SHA256_Init(context);
+}
+
+static inline void WBSHA256Update(WBSHA256Context *context, const void *bytes, size_t length) {
+    //CC_SHA256_Update 的长度参数是 32 位的
+    while (length > 0) {
+        CC_LONG chunkLength = (CC_LONG)MIN(length, (size_t)UINT32_MAX);
+        CC_SHA256_Update(context, bytes, chunkLength);
+        bytes = (const uint8_t *)bytes + chunkLength;
+        length -= chunkLength;
+    }
+}
+
+static inline void WBSHA256Final(WBSHA256Context *context, unsigned char *digest) {
+    CC_SHA256_Final(digest, context);
+}
+
+#else
+
+typedef pthread_mutex_t WBLock;
+#define WB_LOCK_INIT PTHREAD_MUTEX_INITIALIZER
+#define WBLockInit(lock) pthread_mutex_init(lock, NULL)
+#define WBLockLock(lock) pthread_mutex_lock(lock)
+#define WBLockUnlock(lock) pthread_mutex_unlock(lock)
+
+static inline uint64_t WBMonotonicTimeNanoseconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * NSEC_PER_SEC + (uint64_t)time.tv_nsec;
+}
+
+#define WB_SHA256_DIGEST_LENGTH 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[64];
+    size_t bufferLength;
+} WBSHA256Context;
+
+//FIPS 180-4 中的 SHA-256
+static const uint32_t WBSHA256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t WBSHA256RotateRight(uint32_t value, unsigned int count) {
+    return (value >> count) | (value << (32 - count));
+}
+
+static void WBSHA256ProcessBlock(uint32_t state[8], const uint8_t *block) {
+    uint32_t schedule[64];
+    for (int i = 0; i < 16; i++) {
+        schedule[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = WBSHA256RotateRight(schedule[i - 15], 7) ^ WBSHA256RotateRight(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+        uint32_t s1 = WBSHA256RotateRight(schedule[i - 2], 17) ^ WBSHA256RotateRight(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+        schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (WBSHA256RotateRight(e, 6) ^ WBSHA256RotateRight(e, 11) ^ WBSHA256RotateRight(e, 25)) + ((e & f) ^ (~e & g)) + WBSHA256RoundConstants[i] + schedule[i];
+        uint32_t t2 = (WBSHA256RotateRight(a, 2) ^ WBSHA256RotateRight(a, 13) ^ WBSHA256RotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void WBSHA256Init(WBSHA256Context *context) {
+    static const uint32_t initialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(context->state, initialState, sizeof(initialState));
+    context->length = 0;
+    context->bufferLength = 0;
+}
+
+static void WBSHA256Update(WBSHA256Context *context, const void *bytes, size_t length) {
+    const uint8_t *cursor = bytes;
+    context->length += length;
+    if (context->bufferLength > 0) {
+        size_t count = MIN(length, sizeof(context->buffer) - context->bufferLength);
+        memcpy(context->buffer + context->bufferLength, cursor, count);
+        context->bufferLength += count;
+        cursor += count;
+        length -= count;
+        if (context->bufferLength < sizeof(context->buffer)) {
+            return;
+        }
+        WBSHA256ProcessBlock(context->state, context->buffer);
+        context->bufferLength = 0;
+    }
+    //整块直接处理，不经过缓冲区
+    while (length >= sizeof(context->buffer)) {
+        WBSHA256ProcessBlock(context->state, cursor);
+        cursor += sizeof(context->buffer);
+        length -= sizeof(context->buffer);
+    }
+    memcpy(context->buffer, cursor, length);
+    context->bufferLength = length;
+}
+
+static void WBSHA256Final(WBSHA256Context *context, unsigned char *digest) {
+    uint64_t bitLength = context->length * 8;
+    context->buffer[context->bufferLength++] = 0x80;
+    if (context->bufferLength > 56) {
+        memset(context->buffer + context->bufferLength, 0, sizeof(context->buffer) - context->bufferLength);
+        WBSHA256ProcessBlock(context->state, context->buffer);
+        context->bufferLength = 0;
+    }
+    memset(context->buffer + context->bufferLength, 0, 56 - context->bufferLength);
+    for (int i = 0; i < 8; i++) {
+        context->buffer[56 + i] = (uint8_t)(bitLength >> (56 - i * 8));
+    }
+    WBSHA256ProcessBlock(context->state, context->buffer);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(context->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(context->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(context->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)context->state[i];
+    }
+}
+
+#endif
+
 NSString * const WBURLRequestSerializationErrorDomain = @"com.alamofire.error.serialization.request";
 NSString * const WBNetworkingOperationFailingURLRequestErrorKey = @"com.alamofire.serialization.request.error.response";
 
 //定义查询request的Block
 typedef NSString * (^WBQueryStringSerializationBlock)(NSURLRequest *request, id parameters, NSError *__autoreleasing *error);
 
+/*
+ 查询字符串中允许不转义的字符：URLQueryAllowedCharacterSet 去掉通用分隔符 ":#[]@" 和子分隔符 "!$&'()*+,;="，
+ 即 ALPHA / DIGIT / "-" / "." / "_" / "~" / "/" / "?"。其余字节（包括所有非 ASCII 的 UTF-8 字节）都需要转义。
+ */
+static const uint8_t WBPercentEscapeAllowedTable[256] = {
+    ['A' ... 'Z'] = 1,
+    ['a' ... 'z'] = 1,
+    ['0' ... '9'] = 1,
+    ['-'] = 1, ['.'] = 1, ['_'] = 1, ['~'] = 1,
+    ['/'] = 1, ['?'] = 1,
+};
+
+static const char WBPercentEscapeHexDigits[16] = "0123456789ABCDEF";
+
+//从 bytes 开头起连续不需要转义的字节数，每次用 SIMD 判断 16 个字节
+static inline size_t WBPercentEscapeAllowedPrefixLength(const uint8_t *bytes, size_t length) {
+    size_t index = 0;
+#if defined(__aarch64__)
+    //"-" "." "/" 和数字是连续的 0x2D ~ 0x39；字母统一转为小写后判断
+    const uint8x16_t lowerCaseBit = vdupq_n_u8(0x20);
+    while (index + 16 <= length) {
+        uint8x16_t chunk = vld1q_u8(bytes + index);
+        uint8x16_t lower = vorrq_u8(chunk, lowerCaseBit);
+        uint8x16_t allowed = vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')), vcleq_u8(lower, vdupq_n_u8('z')));
+        allowed = vorrq_u8(allowed, vandq_u8(vcgeq_u8(chunk, vdupq_n_u8('-')), vcleq_u8(chunk, vdupq_n_u8('9'))));
+        allowed = vorrq_u8(allowed, vceqq_u8(chunk, vdupq_n_u8('?')));
+        allowed = vorrq_u8(allowed, vceqq_u8(chunk, vdupq_n_u8('_')));
+        allowed = vorrq_u8(allowed, vceqq_u8(chunk, vdupq_n_u8('~')));
+        if (vminvq_u8(allowed) != 0xFF) {
+            break;
+        }
+        index += 16;
+    }
+#elif defined(__SSE2__)
+    //SSE2 只有有符号比较，>= 0x80 的字节是负数，不会落在任何允许的区间内
+    const __m128i lowerCaseBit = _mm_set1_epi8(0x20);
+    while (index + 16 <= length) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(bytes + index));
+        __m128i lower = _mm_or_si128(chunk, lowerCaseBit);
+        __m128i allowed = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        allowed = _mm_or_si128(allowed, _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('-' - 1)), _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1))));
+        allowed = _mm_or_si128(allowed, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('?')));
+        allowed = _mm_or_si128(allowed, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')));
+        allowed = _mm_or_si128(allowed, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('~')));
+        int mask = _mm_movemask_epi8(allowed);
+        if (mask != 0xFFFF) {
+            return index + (size_t)__builtin_ctz((unsigned int)~mask);
+        }
+        index += 16;
+    }
+#endif
+    while (index < length && WBPercentEscapeAllowedTable[bytes[index]]) {
+        index++;
+    }
+    return index;
+}
+
+/*
+ 将 UTF-8 字节转义后写入 buffer，buffer 的长度至少为 length * 3，返回写入的字节数。
+ 连续不需要转义的字节整段拷贝。
+ */
+static size_t WBPercentEscapeBytes(const uint8_t *bytes, size_t length, uint8_t *buffer) {
+    size_t index = 0;
+    uint8_t *position = buffer;
+    while (index < length) {
+        size_t run = WBPercentEscapeAllowedPrefixLength(bytes + index, length - index);
+        if (run > 0) {
+            memcpy(position, bytes + index, run);
+            position += run;
+            index += run;
+        }
+        while (index < length && !WBPercentEscapeAllowedTable[bytes[index]]) {
+            uint8_t byte = bytes[index++];
+            *position++ = '%';
+            *position++ = (uint8_t)WBPercentEscapeHexDigits[byte >> 4];
+            *position++ = (uint8_t)WBPercentEscapeHexDigits[byte & 0x0F];
+        }
+    }
+    return (size_t)(position - buffer);
+}
+
+/*
+ 尽量直接拿到 NSString 内部的 UTF-8 buffer，拿不到时才转换一次；无法转为 UTF-8 时返回 NULL。
+ 转换出的 data 通过 storage 交给调用方持有，返回的指针只在 storage 存活期间有效，
+ 所以调用方要用 NS_VALID_UNTIL_END_OF_SCOPE 声明 storage，避免 ARC 在最后一次使用变量之后提前释放。
+ 字符串中可能包含 U+0000，长度不能用 strlen 计算
+ */
+static inline const uint8_t * WBUTF8BytesForString(NSString *string, size_t *length, NSData * __strong *storage) {
+    const char *UTF8String = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingUTF8);
+    if (UTF8String) {
+        *length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        return (const uint8_t *)UTF8String;
+    }
+    NSData *UTF8Data = [string dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:NO];
+    if (!UTF8Data) {
+        return NULL;
+    }
+    *storage = UTF8Data;
+    *length = [UTF8Data length];
+    return [UTF8Data length] > 0 ? (const uint8_t *)[UTF8Data bytes] : (const uint8_t *)"";
+}
+
 /*
  Returns a percent-escaped string following RFC 3986 for a query string key or value.
  RFC 3986 states that the following characters are "reserved" characters.
@@ -42,35 +338,35 @@ typedef NSString * (^WBQueryStringSerializationBlock)(NSURLRequest *request, id
  百分号编码通俗解释：就是将保留字符转换成带百分号的转义字符
  */
 NSString * WBPercentEscapedStringFromString(NSString *string) {
-    static NSString * const kAFCharactersGeneralDelimitersToEncode = @":#[]@"; // does not include "?" or "/" due to RFC 3986 - Section 3.4
-    static NSString * const kAFCharactersSubDelimitersToEncode = @"!$&'()*+,;=";
-
-    NSMutableCharacterSet * allowedCharacterSet = [[NSCharacterSet URLQueryAllowedCharacterSet] mutableCopy];
-    [allowedCharacterSet removeCharactersInString:[kAFCharactersGeneralDelimitersToEncode stringByAppendingString:kAFCharactersSubDelimitersToEncode]];
-
-    // FIXME: https://github.com/AFNetworking/AFNetworking/pull/3028
-    // return [string stringByAddingPercentEncodingWithAllowedCharacters:allowedCharacterSet];
-
-    static NSUInteger const batchSize = 50;
-
-    NSUInteger index = 0;
-    NSMutableString *escaped = @"".mutableCopy;
-
-    while (index < string.length) {
-        NSUInteger length = MIN(string.length - index, batchSize);
-        NSRange range = NSMakeRange(index, length);
-
-        // To avoid breaking up character sequences such as 👴🏻👮🏽
-        range = [string rangeOfComposedCharacterSequencesForRange:range];
-
-        NSString *substring = [string substringWithRange:range];
-        NSString *encoded = [substring stringByAddingPercentEncodingWithAllowedCharacters:allowedCharacterSet];
-        [escaped appendString:encoded];
-
-        index += range.length;
+    
+    size_t length = 0;
+    NS_VALID_UNTIL_END_OF_SCOPE NSData *UTF8Data = nil;
+    const uint8_t *bytes = WBUTF8BytesForString(string, &length, &UTF8Data);
+    if (!bytes) {
+        //包含不成对的代理字符等无法转为 UTF-8 的情况，交给系统处理
+        static NSCharacterSet *allowedCharacterSet = nil;
+        static dispatch_once_t onceToken;
+        dispatch_once(&onceToken, ^{
+            NSMutableCharacterSet *mutableCharacterSet = [[NSCharacterSet URLQueryAllowedCharacterSet] mutableCopy];
+            [mutableCharacterSet removeCharactersInString:@":#[]@!$&'()*+,;="];
+            allowedCharacterSet = [mutableCharacterSet copy];
+        });
+        return [string stringByAddingPercentEncodingWithAllowedCharacters:allowedCharacterSet] ?: @"";
     }
-
-    return escaped;
+    
+    //不需要转义时不分配新的内存
+    if (WBPercentEscapeAllowedPrefixLength(bytes, length) == length) {
+        return [string copy];
+    }
+    
+    //每个字节最多转义为 3 个字节，一次分配足够的内存，并直接交给 NSString 持有
+    uint8_t *buffer = malloc(length * 3);
+    if (!buffer) {
+        return @"";
+    }
+    size_t escapedLength = WBPercentEscapeBytes(bytes, length, buffer);
+    
+    return [[NSString alloc] initWithBytesNoCopy:buffer length:escapedLength encoding:NSASCIIStringEncoding freeWhenDone:YES];
 }
 #pragma mark -
 
@@ -109,13 +405,286 @@ NSString * WBPercentEscapedStringFromString(NSString *string) {
 FOUNDATION_EXPORT NSArray * WBQueryStringPairsFromDictionary(NSDictionary *dictionary);
 FOUNDATION_EXPORT NSArray * WBQueryStringPairsFromKeyAndValue(NSString *key, id value);
 
-NSString * AFQueryStringFromParameters(NSDictionary *parameters) {
-    NSMutableArray *mutablePairs = [NSMutableArray array];
-    for (WBQueryStringPair *pair in WBQueryStringPairsFromDictionary(parameters)) {
-        [mutablePairs addObject:[pair URLEncodedStringValue]];
+#pragma mark - WBQueryStringBuffer
+
+//可增长的字节缓冲区，查询字符串直接以转义后的字节写入，不生成中间的 WBQueryStringPair 和 NSString
+typedef struct {
+    uint8_t *bytes;
+    size_t length;
+    size_t capacity;
+} WBQueryStringBuffer;
+
+static void WBQueryStringBufferReserve(WBQueryStringBuffer *buffer, size_t additionalLength) {
+    if (buffer->length + additionalLength <= buffer->capacity) {
+        return;
+    }
+    size_t capacity = MAX(buffer->capacity * 2, MAX(buffer->length + additionalLength, (size_t)256));
+    uint8_t *bytes = reallocf(buffer->bytes, capacity);
+    if (!bytes) {
+        buffer->length = buffer->capacity = 0;
+        buffer->bytes = NULL;
+        [NSException raise:NSMallocException format:@"Unable to allocate %zu bytes for query string", capacity];
+    }
+    buffer->bytes = bytes;
+    buffer->capacity = capacity;
+}
+
+static inline void WBQueryStringBufferAppendBytes(WBQueryStringBuffer *buffer, const void *bytes, size_t length) {
+    WBQueryStringBufferReserve(buffer, length);
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+static void WBQueryStringBufferAppendPercentEscapedString(WBQueryStringBuffer *buffer, NSString *string) {
+    size_t length = 0;
+    NS_VALID_UNTIL_END_OF_SCOPE NSData *UTF8Data = nil;
+    const uint8_t *bytes = WBUTF8BytesForString(string, &length, &UTF8Data);
+    if (!bytes) {
+        NSString *escaped = WBPercentEscapedStringFromString(string);
+        WBQueryStringBufferAppendBytes(buffer, [escaped UTF8String], [escaped length]);
+        return;
+    }
+    WBQueryStringBufferReserve(buffer, length * 3);
+    buffer->length += WBPercentEscapeBytes(bytes, length, buffer->bytes + buffer->length);
+}
+
+//转为 NSString 后由 NSString 持有 buffer 的内存
+static NSString * WBQueryStringBufferCopyString(WBQueryStringBuffer *buffer) {
+    if (buffer->length == 0) {
+        free(buffer->bytes);
+        *buffer = (WBQueryStringBuffer){0};
+        return @"";
+    }
+    NSString *string = [[NSString alloc] initWithBytesNoCopy:buffer->bytes length:buffer->length encoding:NSASCIIStringEncoding freeWhenDone:YES];
+    *buffer = (WBQueryStringBuffer){0};
+    return string;
+}
+
+#pragma mark -
+
+//按 description 排序字典的 key 或者 NSSet 中的元素，保证查询字符串的顺序稳定
+static NSArray * WBSortedQueryStringKeys(id<NSFastEnumeration> keys, NSUInteger count) {
+    static NSArray *sortDescriptors = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"description" ascending:YES selector:@selector(compare:)]];
+    });
+    
+    NSMutableArray *mutableKeys = [NSMutableArray arrayWithCapacity:count];
+    BOOL allStrings = YES;
+    for (id key in keys) {
+        allStrings = allStrings && [key isKindOfClass:[NSString class]];
+        [mutableKeys addObject:key];
+    }
+    //NSString 的 description 就是自身，直接用 compare: 排序，避免每次比较都通过 KVC 取 description
+    if (allStrings) {
+        [mutableKeys sortUsingSelector:@selector(compare:)];
+    }else{
+        [mutableKeys sortUsingDescriptors:sortDescriptors];
+    }
+    return mutableKeys;
+}
+
+#pragma mark - WBQueryStringSortedKeysCache
+
+/*
+ 同样结构的参数会被反复序列化，只是 value 不同。这里用一个小的 LRU 缓存保存 key 集合排序后的顺序，
+ 缓存的 key 是字典所有 key 的 hash 之和（与顺序无关），命中后还要确认 key 的数量相同并且缓存的 key 都在字典中，
+ 即两个 key 集合完全相同，才使用缓存的顺序。
+ */
+static NSUInteger const kWBQueryStringSortedKeysCacheCapacity = 128;
+
+static WBLock WBQueryStringSortedKeysCacheLock = WB_LOCK_INIT;
+static NSMutableDictionary <NSNumber *, NSArray *> *WBQueryStringSortedKeysCacheEntries = nil;
+//最近使用的缓存 key 在最后面
+static NSMutableOrderedSet <NSNumber *> *WBQueryStringSortedKeysCacheRecency = nil;
+static NSUInteger WBQueryStringSortedKeysCacheHits = 0;
+static NSUInteger WBQueryStringSortedKeysCacheMisses = 0;
+
+NSUInteger WBQueryStringSortedKeysCacheHitCount(void) {
+    WBLockLock(&WBQueryStringSortedKeysCacheLock);
+    NSUInteger hits = WBQueryStringSortedKeysCacheHits;
+    WBLockUnlock(&WBQueryStringSortedKeysCacheLock);
+    return hits;
+}
+
+NSUInteger WBQueryStringSortedKeysCacheMissCount(void) {
+    WBLockLock(&WBQueryStringSortedKeysCacheLock);
+    NSUInteger misses = WBQueryStringSortedKeysCacheMisses;
+    WBLockUnlock(&WBQueryStringSortedKeysCacheLock);
+    return misses;
+}
+
+static NSArray * WBSortedQueryStringDictionaryKeys(NSDictionary *dictionary) {
+    
+    NSUInteger count = [dictionary count];
+    if (count < 2) {
+        return [dictionary allKeys];
+    }
+    
+    NSUInteger keySetHash = count;
+    for (id key in dictionary) {
+        keySetHash += [key hash];
+    }
+    NSNumber *cacheKey = @(keySetHash);
+    
+    WBLockLock(&WBQueryStringSortedKeysCacheLock);
+    NSArray *sortedKeys = WBQueryStringSortedKeysCacheEntries[cacheKey];
+    WBLockUnlock(&WBQueryStringSortedKeysCacheLock);
+    
+    BOOL hit = (sortedKeys && [sortedKeys count] == count);
+    for (NSUInteger idx = 0; hit && idx < count; idx++) {
+        hit = (dictionary[sortedKeys[idx]] != nil);
+    }
+    if (!hit) {
+        sortedKeys = WBSortedQueryStringKeys(dictionary, count);
+    }
+    
+    WBLockLock(&WBQueryStringSortedKeysCacheLock);
+    if (!WBQueryStringSortedKeysCacheEntries) {
+        WBQueryStringSortedKeysCacheEntries = [NSMutableDictionary dictionaryWithCapacity:kWBQueryStringSortedKeysCacheCapacity];
+        WBQueryStringSortedKeysCacheRecency = [NSMutableOrderedSet orderedSetWithCapacity:kWBQueryStringSortedKeysCacheCapacity];
+    }
+    if (hit) {
+        WBQueryStringSortedKeysCacheHits++;
+    }else{
+        WBQueryStringSortedKeysCacheMisses++;
+        WBQueryStringSortedKeysCacheEntries[cacheKey] = sortedKeys;
+    }
+    [WBQueryStringSortedKeysCacheRecency removeObject:cacheKey];
+    [WBQueryStringSortedKeysCacheRecency addObject:cacheKey];
+    if ([WBQueryStringSortedKeysCacheRecency count] > kWBQueryStringSortedKeysCacheCapacity) {
+        [WBQueryStringSortedKeysCacheEntries removeObjectForKey:[WBQueryStringSortedKeysCacheRecency firstObject]];
+        [WBQueryStringSortedKeysCacheRecency removeObjectAtIndex:0];
+    }
+    WBLockUnlock(&WBQueryStringSortedKeysCacheLock);
+    
+    return sortedKeys;
+}
+
+static void WBQueryStringAppendPair(WBQueryStringBuffer *query, WBQueryStringBuffer *key, id value) {
+    if (query->length > 0) {
+        WBQueryStringBufferAppendBytes(query, "&", 1);
+    }
+    if (key->length > 0) {
+        WBQueryStringBufferAppendBytes(query, key->bytes, key->length);
+    }
+    if (value && ![value isEqual:[NSNull null]]) {
+        WBQueryStringBufferAppendBytes(query, "=", 1);
+        WBQueryStringBufferAppendPercentEscapedString(query, [value description]);
+    }
+}
+
+static inline BOOL WBQueryStringValueIsCollection(id value) {
+    return [value isKindOfClass:[NSDictionary class]] || [value isKindOfClass:[NSArray class]] || [value isKindOfClass:[NSSet class]];
+}
+
+/*
+ 一次遍历参数，默认风格和 WBQueryStringPairsFromKeyAndValue 的输出一致。
+ key 中保存已经转义过的当前 key 前缀，进入下一层时在尾部追加 "[nestedKey]"（点分风格为 ".nestedKey"）或 "[]"，
+ 返回时截断回原来的长度，整个遍历只复用这一个 key 缓冲区。各种风格只在这里的分支上不同，都写入同一个缓冲区。
+ */
+static void WBQueryStringAppendKeyAndValue(WBQueryStringBuffer *query, WBQueryStringBuffer *key, BOOL hasKey, id value, WBHTTPRequestQueryStringSerializationStyle style) {
+    
+    size_t keyLength = key->length;
+    
+    if ([value isKindOfClass:[NSDictionary class]]) {
+        NSDictionary *dictionary = value;
+        // Sort dictionary keys to ensure consistent ordering in query string, which is important when deserializing potentially ambiguous sequences, such as an array of dictionaries
+        for (id nestedKey in WBSortedQueryStringDictionaryKeys(dictionary)) {
+            id nestedValue = dictionary[nestedKey];
+            if (!nestedValue) {
+                continue;
+            }
+            if (!hasKey) {
+                WBQueryStringBufferAppendPercentEscapedString(key, [nestedKey description]);
+            }else if (style == WBHTTPRequestQueryStringSerializationDottedKeyStyle) {
+                WBQueryStringBufferAppendBytes(key, ".", 1);
+                WBQueryStringBufferAppendPercentEscapedString(key, [nestedKey description]);
+            }else{
+                WBQueryStringBufferAppendBytes(key, "%5B", 3);
+                WBQueryStringBufferAppendPercentEscapedString(key, [nestedKey description]);
+                WBQueryStringBufferAppendBytes(key, "%5D", 3);
+            }
+            WBQueryStringAppendKeyAndValue(query, key, YES, nestedValue, style);
+            key->length = keyLength;
+        }
+    } else if ([value isKindOfClass:[NSArray class]]) {
+        NSArray *array = value;
+        switch (style) {
+            case WBHTTPRequestQueryStringSerializationCommaSeparatedStyle: {
+                //只包含普通值的数组写成 key=v1,v2，每个值单独转义，分隔用的逗号不转义
+                BOOL containsCollection = NO;
+                for (id nestedValue in array) {
+                    if (WBQueryStringValueIsCollection(nestedValue)) {
+                        containsCollection = YES;
+                        break;
+                    }
+                }
+                if (!containsCollection) {
+                    if ([array count] > 0) {
+                        WBQueryStringAppendPair(query, key, nil);
+                        WBQueryStringBufferAppendBytes(query, "=", 1);
+                        [array enumerateObjectsUsingBlock:^(id nestedValue, NSUInteger idx, BOOL *stop) {
+                            if (idx > 0) {
+                                WBQueryStringBufferAppendBytes(query, ",", 1);
+                            }
+                            if (![nestedValue isEqual:[NSNull null]]) {
+                                WBQueryStringBufferAppendPercentEscapedString(query, [nestedValue description]);
+                            }
+                        }];
+                    }
+                    break;
+                }
+                //数组中有嵌套的集合时无法用逗号表示，按默认风格处理
+                WBQueryStringBufferAppendBytes(key, "%5B%5D", 6);
+                for (id nestedValue in array) {
+                    WBQueryStringAppendKeyAndValue(query, key, YES, nestedValue, style);
+                }
+                break;
+            }
+            case WBHTTPRequestQueryStringSerializationRepeatedKeyStyle:
+            case WBHTTPRequestQueryStringSerializationDottedKeyStyle:
+                for (id nestedValue in array) {
+                    WBQueryStringAppendKeyAndValue(query, key, hasKey, nestedValue, style);
+                }
+                break;
+            case WBHTTPRequestQueryStringSerializationDefaultStyle:
+            default:
+                WBQueryStringBufferAppendBytes(key, "%5B%5D", 6);
+                for (id nestedValue in array) {
+                    WBQueryStringAppendKeyAndValue(query, key, YES, nestedValue, style);
+                }
+                break;
+        }
+        key->length = keyLength;
+    } else if ([value isKindOfClass:[NSSet class]]) {
+        for (id obj in WBSortedQueryStringKeys(value, [(NSSet *)value count])) {
+            WBQueryStringAppendKeyAndValue(query, key, hasKey, obj, style);
+        }
+    } else {
+        WBQueryStringAppendPair(query, key, value);
+    }
+}
+
+NSString * WBQueryStringFromParametersWithStyle(NSDictionary *parameters, WBHTTPRequestQueryStringSerializationStyle style) {
+    
+    WBQueryStringBuffer query = {0};
+    WBQueryStringBuffer key = {0};
+    @try {
+        WBQueryStringAppendKeyAndValue(&query, &key, NO, parameters, style);
+    } @catch (NSException *exception) {
+        free(query.bytes);
+        @throw;
+    } @finally {
+        free(key.bytes);
     }
+    return WBQueryStringBufferCopyString(&query);
+}
 
-    return [mutablePairs componentsJoinedByString:@"&"];
+NSString * WBQueryStringFromParameters(NSDictionary *parameters) {
+    
+    return WBQueryStringFromParametersWithStyle(parameters, WBHTTPRequestQueryStringSerializationDefaultStyle);
 }
 
 NSArray * WBQueryStringPairsFromDictionary(NSDictionary *dictionary) {
@@ -125,12 +694,10 @@ NSArray * WBQueryStringPairsFromDictionary(NSDictionary *dictionary) {
 NSArray * WBQueryStringPairsFromKeyAndValue(NSString *key, id value) {
     NSMutableArray *mutableQueryStringComponents = [NSMutableArray array];
 
-    NSSortDescriptor *sortDescriptor = [NSSortDescriptor sortDescriptorWithKey:@"description" ascending:YES selector:@selector(compare:)];
-
     if ([value isKindOfClass:[NSDictionary class]]) {
         NSDictionary *dictionary = value;
         // Sort dictionary keys to ensure consistent ordering in query string, which is important when deserializing potentially ambiguous sequences, such as an array of dictionaries
-        for (id nestedKey in [dictionary.allKeys sortedArrayUsingDescriptors:@[ sortDescriptor ]]) {
+        for (id nestedKey in WBSortedQueryStringDictionaryKeys(dictionary)) {
             id nestedValue = dictionary[nestedKey];
             if (nestedValue) {
                 [mutableQueryStringComponents addObjectsFromArray:WBQueryStringPairsFromKeyAndValue((key ? [NSString stringWithFormat:@"%@[%@]", key, nestedKey] : nestedKey), nestedValue)];
@@ -143,7 +710,7 @@ NSArray * WBQueryStringPairsFromKeyAndValue(NSString *key, id value) {
         }
     } else if ([value isKindOfClass:[NSSet class]]) {
         NSSet *set = value;
-        for (id obj in [set sortedArrayUsingDescriptors:@[ sortDescriptor ]]) {
+        for (id obj in WBSortedQueryStringKeys(set, [set count])) {
             [mutableQueryStringComponents addObjectsFromArray:WBQueryStringPairsFromKeyAndValue(key, obj)];
         }
     } else {
@@ -152,672 +719,3656 @@ NSArray * WBQueryStringPairsFromKeyAndValue(NSString *key, id value) {
 
     return mutableQueryStringComponents;
 }
-#pragma mark - WBStreamingMultipartFormData
-@interface WBStreamingMultipartFormData : NSObject<WBMultipartFormData>
+#pragma mark -
 
-- (instancetype)initWithURLRequest:(NSMutableURLRequest *)urlRequest
-                    stringEncoding:(NSStringEncoding)encoding;
+/*
+ 把已经转义好的查询字符串拼接到 URL 上。
+ 直接在 URL 已经解析好的原始字节上操作：用 CFURLGetByteRangeForComponent 找到 fragment 的位置，把 "?query" 或 "&query"
+ 插到 fragment 之前，最后只用 CFURLCreateWithBytes 构造一次 URL，
+ 不再经过 absoluteString -> stringByAppendingFormat: -> URLWithString: 的序列化再解析。
+ 相对 URL 仍然保持相对于原来的 baseURL。
+ */
+static NSURL * WBURLByAppendingPercentEscapedQuery(NSURL *URL, NSString *query) {
+    
+    CFURLRef url = (__bridge CFURLRef)URL;
+    CFIndex URLLength = CFURLGetBytes(url, NULL, 0);
+    size_t queryLength = 0;
+    NS_VALID_UNTIL_END_OF_SCOPE NSData *queryData = nil;
+    const uint8_t *queryBytes = WBUTF8BytesForString(query, &queryLength, &queryData);
+    if (URLLength < 0 || !queryBytes) {
+        return [NSURL URLWithString:[[URL absoluteString] stringByAppendingFormat:URL.query ? @"&%@" : @"?%@", query]];
+    }
+    
+    CFRange queryRangeIncludingSeparators;
+    CFRange queryRange = CFURLGetByteRangeForComponent(url, kCFURLComponentQuery, &queryRangeIncludingSeparators);
+    //fragment 不存在时，rangeIncludingSeparators 的 location 就是 fragment 应该插入的位置
+    CFRange fragmentRangeIncludingSeparators;
+    CFURLGetByteRangeForComponent(url, kCFURLComponentFragment, &fragmentRangeIncludingSeparators);
+    size_t insertionIndex = (size_t)fragmentRangeIncludingSeparators.location;
+    
+    size_t length = (size_t)URLLength + 1 + queryLength;
+    uint8_t stackBuffer[1024];
+    uint8_t *buffer = length <= sizeof(stackBuffer) ? stackBuffer : malloc(length);
+    if (!buffer) {
+        return nil;
+    }
+    CFURLGetBytes(url, buffer, URLLength);
+    memmove(buffer + insertionIndex + 1 + queryLength, buffer + insertionIndex, (size_t)URLLength - insertionIndex);
+    buffer[insertionIndex] = (queryRange.location != kCFNotFound) ? '&' : '?';
+    memcpy(buffer + insertionIndex + 1, queryBytes, queryLength);
+    
+    CFURLRef appendedURL = CFURLCreateWithBytes(kCFAllocatorDefault, buffer, (CFIndex)length, kCFStringEncodingUTF8, CFURLGetBaseURL(url));
+    if (buffer != stackBuffer) {
+        free(buffer);
+    }
+    return (__bridge_transfer NSURL *)appendedURL;
+}
 
-- (NSMutableURLRequest *)requestByFinalizingMultipartFormData;
+#pragma mark -
 
-@end
+static NSUInteger const kWBMultipartFormSpoolDefaultBufferSize = 256 * 1024;
 
-#pragma mark -
-static NSArray *WBHTTPRequestSerializerObservedKeyPaths(){
-    static NSArray *_WBHTTPRequestSerializerObservedKeyPaths = nil;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        _WBHTTPRequestSerializerObservedKeyPaths = @[NSStringFromSelector(@selector(allowsCellularAccess)),NSStringFromSelector(@selector(cachePolicy)),NSStringFromSelector(@selector(HTTPShouldHandleCookies)),NSStringFromSelector(@selector(HTTPShouldUsePipelining)),NSStringFromSelector(@selector(networkServiceType)),NSStringFromSelector(@selector(timeoutInterval))];
-    });
+NSUInteger const kWBHTTPRequestBodyCompressionDefaultThreshold = 1024;
+
+/*
+ 把输入流的内容写到文件中，在调用线程上同步执行。
+ 使用两块缓冲区：一块交给串行的写队列写入文件时，当前线程继续把数据读到另一块中，读和写互相重叠。
+ WBMultipartBodyStream 中文件类型的 part 会直接用 read(2) 读到缓冲区中，不经过额外的拷贝。
+ progress 被取消时停止读取，返回 NSURLErrorCancelled；出错或取消时删除写了一半的文件。
+ */
+static NSError * WBSpoolInputStreamToFile(NSInputStream *inputStream, NSURL *fileURL, NSUInteger bufferSize, NSProgress *progress, void (^progressBlock)(NSProgress *progress)) {
     
-    return _WBHTTPRequestSerializerObservedKeyPaths;
+    int fileDescriptor = open([[fileURL path] fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fileDescriptor < 0) {
+        return [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey : fileURL}];
+    }
+    
+    uint8_t *buffers[2] = {malloc(bufferSize), malloc(bufferSize)};
+    if (!buffers[0] || !buffers[1]) {
+        free(buffers[0]);
+        free(buffers[1]);
+        close(fileDescriptor);
+        unlink([[fileURL path] fileSystemRepresentation]);
+        return [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:@{NSURLErrorKey : fileURL}];
+    }
+    
+    dispatch_queue_t writeQueue = dispatch_queue_create("com.wbnetworking.multipart.spool.write", DISPATCH_QUEUE_SERIAL);
+    //空闲缓冲区的数量
+    dispatch_semaphore_t freeBuffers = dispatch_semaphore_create(2);
+    __block NSError *writeError = nil;
+    NSError *error = nil;
+    
+    [inputStream open];
+    for (NSUInteger index = 0; ; index ^= 1) {
+        dispatch_semaphore_wait(freeBuffers, DISPATCH_TIME_FOREVER);
+        
+        //写队列在 signal 之前设置 writeError，这里 wait 返回后可以安全读取
+        if (writeError) {
+            dispatch_semaphore_signal(freeBuffers);
+            break;
+        }
+        if (progress.isCancelled) {
+            error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:@{NSURLErrorKey : fileURL}];
+            dispatch_semaphore_signal(freeBuffers);
+            break;
+        }
+        
+        uint8_t *buffer = buffers[index];
+        NSInteger numberOfBytesRead = [inputStream read:buffer maxLength:bufferSize];
+        if (numberOfBytesRead < 0) {
+            error = inputStream.streamError ?: [NSError errorWithDomain:NSPOSIXErrorDomain code:EIO userInfo:nil];
+            dispatch_semaphore_signal(freeBuffers);
+            break;
+        }
+        if (numberOfBytesRead == 0) {
+            dispatch_semaphore_signal(freeBuffers);
+            break;
+        }
+        
+        dispatch_async(writeQueue, ^{
+            
+            size_t numberOfBytesWritten = 0;
+            while (!writeError && numberOfBytesWritten < (size_t)numberOfBytesRead) {
+                ssize_t result = write(fileDescriptor, buffer + numberOfBytesWritten, (size_t)numberOfBytesRead - numberOfBytesWritten);
+                if (result < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    writeError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey : fileURL}];
+                    break;
+                }
+                numberOfBytesWritten += (size_t)result;
+            }
+            
+            if (!writeError) {
+                progress.completedUnitCount += numberOfBytesRead;
+                if (progressBlock) {
+                    progressBlock(progress);
+                }
+            }
+            dispatch_semaphore_signal(freeBuffers);
+        });
+    }
+    [inputStream close];
     
+    //等待所有写入完成
+    dispatch_sync(writeQueue, ^{});
+    error = error ?: writeError;
+    
+    free(buffers[0]);
+    free(buffers[1]);
+    if (close(fileDescriptor) != 0 && !error) {
+        error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey : fileURL}];
+    }
+    if (error) {
+        unlink([[fileURL path] fileSystemRepresentation]);
+    }
+    return error;
 }
 
-static void *WBHTTPRequestSerializerObserverContext = &WBHTTPRequestSerializerObserverContext;
+#pragma mark - WBUploadRateLimiter
 
-@interface WBHTTPRequestSerializer()
+//令牌不足这么多时不发放，避免每次只读到几个字节
+static NSUInteger const kWBUploadRateLimiterMinimumGrant = 4 * 1024;
 
-@property (readwrite, nonatomic, strong) NSMutableSet *mutableObservedChangedKeyPaths;
+@interface WBUploadRateLimiter ()
 
-@property (readwrite, nonatomic, strong) NSMutableDictionary *mutableHTTPRequestHeaders;
+@property (readwrite, nonatomic, strong) dispatch_queue_t wakeQueue;
 
-@property (readwrite, nonatomic, strong) dispatch_queue_t requestHeaderModificationQueue;
+//从桶中取出最多 length 个令牌，不会阻塞；令牌不足时返回 0
+- (NSUInteger)consumeBytesUpTo:(NSUInteger)length;
 
-@property (readwrite, nonatomic, assign) WBHTTPRequestQueryStringSerializationStyle queryStringSerializationStyle;
+//把取出但没有用完的令牌放回桶中
+- (void)returnBytes:(NSUInteger)length;
 
-@property (readwrite, nonatomic, copy) WBQueryStringSerializationBlock queryStringSerialization;
+//桶中有足够的令牌时在 wakeQueue 上调用 block，只调用一次
+- (void)notifyWhenBytesAvailable:(dispatch_block_t)block;
+
+//阻塞当前线程直到取到令牌，只用于不检查 hasBytesAvailable 就直接读取的调用方
+- (NSUInteger)waitForBytesUpTo:(NSUInteger)length;
 
 @end
 
-@implementation WBHTTPRequestSerializer
+@implementation WBUploadRateLimiter {
+    WBLock _lock;
+    NSUInteger _bytesPerSecond;
+    NSUInteger _burstSize;
+    double _tokens;
+    uint64_t _lastRefillTime;
+    NSMutableArray <dispatch_block_t> *_waiters;
+    BOOL _wakeScheduled;
+#if !TARGET_OS_WATCH
+    NSMutableDictionary <NSNumber *, NSNumber *> *_bytesPerSecondByReachabilityStatus;
+    NSMutableDictionary <NSNumber *, NSNumber *> *_bytesPerSecondByPathQuality;
+#endif
+}
 
-+ (instancetype)serializer{
-    
-    return [[self alloc]init];
++ (instancetype)sharedLimiter{
+    static WBUploadRateLimiter *_sharedLimiter = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedLimiter = [[self alloc] initWithBytesPerSecond:0 burstSize:0];
+    });
+    return _sharedLimiter;
 }
 
 - (instancetype)init{
-    
+    return [self initWithBytesPerSecond:0 burstSize:0];
+}
+
+- (instancetype)initWithBytesPerSecond:(NSUInteger)bytesPerSecond burstSize:(NSUInteger)burstSize{
     self = [super init];
     if (!self) {
-        return  nil;
+        return nil;
     }
-    
-    self.stringEncoding = NSUTF8StringEncoding;
-    self.mutableHTTPRequestHeaders = [NSMutableDictionary dictionary];
-    self.requestHeaderModificationQueue = dispatch_queue_create("rquestHeaderModificationQueue", DISPATCH_QUEUE_CONCURRENT);
-    NSMutableArray *acceptLanguagesComponents = [NSMutableArray array];
-    [[NSLocale preferredLanguages] enumerateObjectsUsingBlock:^(NSString * _Nonnull obj, NSUInteger idx, BOOL * _Nonnull stop) {
-        float q = 1.0f - (idx * 0.1f);
-        [acceptLanguagesComponents addObject:[NSString stringWithFormat:@"%@;q=%0.1g",obj,q]];
-        *stop = q <= 0.5f;
-        
-    }];
-    [self setValue:[acceptLanguagesComponents componentsJoinedByString:@", "] forHTTPHeaderField:@"Accept-Language"];
-    
-    NSString *userAgent = nil;
-    
-#if TARGET_OS_IOS
-    userAgent = [NSString stringWithFormat:@"%@/%@ (%@; iOS %@; Scale/%0.2f)", [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleExecutableKey] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleIdentifierKey], [[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleVersionKey], [[UIDevice currentDevice] model], [[UIDevice currentDevice] systemVersion], [[UIScreen mainScreen] scale]];
-#elif TARGET_OS_TV
-    userAgent = [NSString stringWithFormat:@"%@/%@ (%@; tvOS %@; Scale/%0.2f)", [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleExecutableKey] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleIdentifierKey], [[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleVersionKey], [[UIDevice currentDevice] model], [[UIDevice currentDevice] systemVersion], [[UIScreen mainScreen] scale]];
-#elif TARGET_OS_WATCH
-    userAgent = [NSString stringWithFormat:@"%@/%@ (%@; watchOS %@; Scale/%0.2f)", [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleExecutableKey] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleIdentifierKey], [[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleVersionKey], [[WKInterfaceDevice currentDevice] model], [[WKInterfaceDevice currentDevice] systemVersion], [[WKInterfaceDevice currentDevice] screenScale]];
-#elif defined(__MAC_OS_X_VERSION_MIN_REQUIRED)
-    userAgent = [NSString stringWithFormat:@"%@/%@ (Mac OS X %@)", [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleExecutableKey] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleIdentifierKey], [[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleVersionKey], [[NSProcessInfo processInfo] operatingSystemVersionString]];
+    WBLockInit(&_lock);
+    _bytesPerSecond = bytesPerSecond;
+    _burstSize = burstSize;
+    _lastRefillTime = WBMonotonicTimeNanoseconds();
+    _tokens = [self capacityLocked];
+    _waiters = [NSMutableArray array];
+#if !TARGET_OS_WATCH
+    _bytesPerSecondByReachabilityStatus = [NSMutableDictionary dictionary];
+    _bytesPerSecondByPathQuality = [NSMutableDictionary dictionary];
 #endif
-    if (userAgent) {
-        if (![userAgent canBeConvertedToEncoding:NSASCIIStringEncoding]) {
-            NSMutableString *mutableUserAgent = [userAgent mutableCopy];
-            if (CFStringTransform((__bridge  CFMutableStringRef)(mutableUserAgent), NULL, (__bridge  CFStringRef)@"Any-Latin; Latin-ASCII; [:^ASCII:] Remove", false)) {
-                userAgent = mutableUserAgent;
-            }
-        }
-        [self setValue:userAgent forHTTPHeaderField:@"User-Agent"];
-    }
-    
-    self.HTTPMethodsEncodingParametersInURI = [NSSet setWithObjects:@"",@"",@"", nil];
-    self.mutableObservedChangedKeyPaths = [NSMutableSet set];
-    
-    for (NSString *keyPath in WBHTTPRequestSerializerObservedKeyPaths()) {
-        if ([self respondsToSelector:@selector(keyPath)]) {
-            [self addObserver:self forKeyPath:keyPath options:NSKeyValueObservingOptionNew context:WBHTTPRequestSerializerObserverContext];
-        }
-    }
-    return  self;
+    self.wakeQueue = dispatch_queue_create("com.wbnetworking.upload.ratelimiter", DISPATCH_QUEUE_SERIAL);
+    return self;
 }
 
 - (void)dealloc{
-    for (NSString *keyPath in WBHTTPRequestSerializerObservedKeyPaths()) {
-        if ([self respondsToSelector:NSSelectorFromString(keyPath)]) {
-            [self removeObserver:self forKeyPath:keyPath context:WBHTTPRequestSerializerObserverContext];
-        }
-    }
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
 }
 
 #pragma mark -
-// 注意：如果手动调用了kvo，则必须实现 automaticallyNotifiesObserversForKey 方法，不然会产生crash
-//一般不会手动去调用willChangeValueForKey、didChangeValueForKey 所以automaticallyNotifiesObserversForKey也不必实现
-- (void)setAllowsCellularAccess:(BOOL)allowsCellularAccess {
-    [self willChangeValueForKey:NSStringFromSelector(@selector(allowsCellularAccess))];
-    _allowsCellularAccess = allowsCellularAccess;
-    [self didChangeValueForKey:NSStringFromSelector(@selector(allowsCellularAccess))];
+
+- (NSUInteger)bytesPerSecond{
+    WBLockLock(&_lock);
+    NSUInteger bytesPerSecond = _bytesPerSecond;
+    WBLockUnlock(&_lock);
+    return bytesPerSecond;
 }
 
-- (void)setCachePolicy:(NSURLRequestCachePolicy)cachePolicy {
-    [self willChangeValueForKey:NSStringFromSelector(@selector(cachePolicy))];
-    _cachePolicy = cachePolicy;
-    [self didChangeValueForKey:NSStringFromSelector(@selector(cachePolicy))];
+- (void)setBytesPerSecond:(NSUInteger)bytesPerSecond{
+    WBLockLock(&_lock);
+    [self refillLocked];
+    _bytesPerSecond = bytesPerSecond;
+    _tokens = MIN(_tokens, [self capacityLocked]);
+    WBLockUnlock(&_lock);
+    
+    //速率变化后等待中的 stream 重新计算，不需要等到之前算好的唤醒时间
+    dispatch_async(self.wakeQueue, ^{
+        [self wakeWaiters];
+    });
 }
 
-- (void)setHTTPShouldHandleCookies:(BOOL)HTTPShouldHandleCookies {
-    [self willChangeValueForKey:NSStringFromSelector(@selector(HTTPShouldHandleCookies))];
-    _HTTPShouldHandleCookies = HTTPShouldHandleCookies;
-    [self didChangeValueForKey:NSStringFromSelector(@selector(HTTPShouldHandleCookies))];
+- (NSUInteger)burstSize{
+    WBLockLock(&_lock);
+    NSUInteger burstSize = _burstSize;
+    WBLockUnlock(&_lock);
+    return burstSize;
 }
 
-- (void)setHTTPShouldUsePipelining:(BOOL)HTTPShouldUsePipelining {
-    [self willChangeValueForKey:NSStringFromSelector(@selector(HTTPShouldUsePipelining))];
-    _HTTPShouldUsePipelining = HTTPShouldUsePipelining;
-    [self didChangeValueForKey:NSStringFromSelector(@selector(HTTPShouldUsePipelining))];
+- (void)setBurstSize:(NSUInteger)burstSize{
+    WBLockLock(&_lock);
+    [self refillLocked];
+    _burstSize = burstSize;
+    _tokens = MIN(_tokens, [self capacityLocked]);
+    WBLockUnlock(&_lock);
 }
 
-- (void)setNetworkServiceType:(NSURLRequestNetworkServiceType)networkServiceType {
-    [self willChangeValueForKey:NSStringFromSelector(@selector(networkServiceType))];
-    _networkServiceType = networkServiceType;
-    [self didChangeValueForKey:NSStringFromSelector(@selector(networkServiceType))];
+- (double)capacityLocked{
+    if (_burstSize > 0) {
+        return (double)_burstSize;
+    }
+    return MAX((double)_bytesPerSecond / 4.0, (double)kWBUploadRateLimiterMinimumGrant);
 }
 
-- (void)setTimeoutInterval:(NSTimeInterval)timeoutInterval {
-    [self willChangeValueForKey:NSStringFromSelector(@selector(timeoutInterval))];
-    _timeoutInterval = timeoutInterval;
-    [self didChangeValueForKey:NSStringFromSelector(@selector(timeoutInterval))];
+- (void)refillLocked{
+    uint64_t now = WBMonotonicTimeNanoseconds();
+    double elapsed = (double)(now - _lastRefillTime) / NSEC_PER_SEC;
+    _lastRefillTime = now;
+    _tokens = MIN(_tokens + elapsed * (double)_bytesPerSecond, [self capacityLocked]);
 }
 
-- (NSDictionary *)HTTPRequestHeaders{
-    
-    NSDictionary __block *value;
+- (NSUInteger)consumeBytesUpTo:(NSUInteger)length{
     
-    //同步执行并行队列
-    dispatch_sync(self.requestHeaderModificationQueue, ^{
-        value = [NSDictionary dictionaryWithDictionary:self.mutableHTTPRequestHeaders];
-    });
-    return  value;
+    WBLockLock(&_lock);
+    if (_bytesPerSecond == 0) {
+        WBLockUnlock(&_lock);
+        return length;
+    }
+    [self refillLocked];
+    NSUInteger available = (NSUInteger)_tokens;
+    NSUInteger granted = 0;
+    if (available >= MIN(length, kWBUploadRateLimiterMinimumGrant)) {
+        granted = MIN(length, available);
+        _tokens -= (double)granted;
+    }
+    WBLockUnlock(&_lock);
+    return granted;
 }
 
-- (void)setValue:(NSString *)value forHTTPHeaderField:(NSString *)field{
-    
-    dispatch_barrier_sync(self.requestHeaderModificationQueue, ^{
-        [self.mutableHTTPRequestHeaders setValue:value forKey:field];
-        
-    });
+- (void)returnBytes:(NSUInteger)length{
+    if (length == 0) {
+        return;
+    }
+    WBLockLock(&_lock);
+    _tokens = MIN(_tokens + (double)length, [self capacityLocked]);
+    WBLockUnlock(&_lock);
 }
 
-- (NSString *)valueForHTTPHeaderField:(NSString *)field{
+- (void)notifyWhenBytesAvailable:(dispatch_block_t)block{
     
-    NSString __block *value;
-    dispatch_sync(self.requestHeaderModificationQueue, ^{
-        
-        value = [self.mutableHTTPRequestHeaders valueForKey:field];
-    });
-    return value;
+    WBLockLock(&_lock);
+    [_waiters addObject:[block copy]];
+    BOOL needsSchedule = !_wakeScheduled;
+    _wakeScheduled = YES;
+    NSTimeInterval delay = 0;
+    if (_bytesPerSecond > 0) {
+        [self refillLocked];
+        double missing = MIN((double)kWBUploadRateLimiterMinimumGrant, [self capacityLocked]) - _tokens;
+        delay = MAX(missing, 0) / (double)_bytesPerSecond;
+    }
+    WBLockUnlock(&_lock);
+    
+    if (needsSchedule) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.wakeQueue, ^{
+            [self wakeWaiters];
+        });
+    }
 }
 
-- (void)setAuthorizationHeaderFieldWithUsername:(NSString *)username password:(NSString *)password{
+//唤醒所有等待的 stream，它们各自重新去取令牌，没取到的会重新排队
+- (void)wakeWaiters{
     
-    NSData *basicAuthCredentials = [[NSString stringWithFormat:@"%@:%@",username,password] dataUsingEncoding:NSUTF8StringEncoding];
-    NSString *base64AuthCredentials = [basicAuthCredentials base64EncodedStringWithOptions:(NSDataBase64EncodingOptions)0];
-    [self setValue:[NSString stringWithFormat:@"Basic %@",base64AuthCredentials] forHTTPHeaderField:@"Authorization"];
+    WBLockLock(&_lock);
+    NSArray <dispatch_block_t> *waiters = [_waiters copy];
+    [_waiters removeAllObjects];
+    _wakeScheduled = NO;
+    WBLockUnlock(&_lock);
     
+    for (dispatch_block_t waiter in waiters) {
+        waiter();
+    }
+}
+
+- (NSUInteger)waitForBytesUpTo:(NSUInteger)length{
     
+    NSUInteger granted = [self consumeBytesUpTo:length];
+    while (granted == 0) {
+        dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+        [self notifyWhenBytesAvailable:^{
+            dispatch_semaphore_signal(semaphore);
+        }];
+        dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+        granted = [self consumeBytesUpTo:length];
+    }
+    return granted;
 }
 
-- (void)clearAuthorizationHeader{
-    dispatch_barrier_sync(self.requestHeaderModificationQueue, ^{
-       
-        [self.mutableHTTPRequestHeaders removeObjectForKey:@"Authorization"];
-    });
+#pragma mark - Reachability
+
+#if !TARGET_OS_WATCH
+- (void)setBytesPerSecond:(NSUInteger)bytesPerSecond forReachabilityStatus:(WBNetworkReachabilityStatus)status{
+    WBLockLock(&_lock);
+    _bytesPerSecondByReachabilityStatus[@(status)] = @(bytesPerSecond);
+    WBLockUnlock(&_lock);
 }
 
-#pragma mark -
-- (void)setQueryStringSerializationStyle:(WBHTTPRequestQueryStringSerializationStyle)queryStringSerializationStyle{
-    
-    self.queryStringSerializationStyle = queryStringSerializationStyle;
-    self.queryStringSerialization = nil;
-    
+- (void)setBytesPerSecond:(NSUInteger)bytesPerSecond forPathQuality:(WBNetworkPathQuality)quality{
+    WBLockLock(&_lock);
+    _bytesPerSecondByPathQuality[@(quality)] = @(bytesPerSecond);
+    WBLockUnlock(&_lock);
 }
 
-- (void)setQueryStringSerializationWithBlock:(NSString * _Nullable (^)(NSURLRequest * _Nonnull, id _Nonnull, NSError *__autoreleasing  _Nullable * _Nullable))block{
+- (void)adaptToReachabilityManager:(WBNetworkReachabilityManager *)manager{
     
-    self.queryStringSerialization = block;
+    NSNotificationCenter *notificationCenter = [NSNotificationCenter defaultCenter];
+    [notificationCenter removeObserver:self name:WBNetworkingReachabilityDidChangeNotification object:nil];
+    [notificationCenter removeObserver:self name:WBNetworkingPathQualityDidChangeNotification object:nil];
+    if (!manager) {
+        return;
+    }
+    [notificationCenter addObserver:self selector:@selector(reachabilityDidChange:) name:WBNetworkingReachabilityDidChangeNotification object:manager];
+    [notificationCenter addObserver:self selector:@selector(reachabilityDidChange:) name:WBNetworkingPathQualityDidChangeNotification object:manager];
+    [self applyRatesOfReachabilityManager:manager];
 }
 
-#pragma mark -
-- (NSMutableURLRequest *)requestWithMethod:(NSString *)method
-                                 URLString:(NSString *)URLString
-                                parameters:(id)parameters
-                                     error:(NSError * _Nullable __autoreleasing *)error{
-    //断言评估一个条件，如果条件为 false ，调用当前线程的断点句柄。
-    NSParameterAssert(method);
-    NSParameterAssert(URLString);
-    NSURL *url = [NSURL URLWithString:URLString];
-    NSParameterAssert(url);
-    NSMutableURLRequest *mutableRequest = [[NSMutableURLRequest alloc]initWithURL:url];
-    mutableRequest.HTTPMethod = method;
-    for (NSString *keyPath in self.mutableObservedChangedKeyPaths) {
-        [mutableRequest setValue:[self valueForKey:keyPath] forKey:keyPath];
+//两个通知都在主线程中发出，发出前 manager 的属性已经更新
+- (void)reachabilityDidChange:(NSNotification *)notification{
+    [self applyRatesOfReachabilityManager:notification.object];
+}
+
+- (void)applyRatesOfReachabilityManager:(WBNetworkReachabilityManager *)manager{
+    if (!manager) {
+        return;
+    }
+    WBNetworkPathQuality quality = manager.pathQuality;
+    WBNetworkReachabilityStatus status = manager.networkReachabilityStatus;
+    WBLockLock(&_lock);
+    NSNumber *bytesPerSecond = _bytesPerSecondByPathQuality[@(quality)] ?: _bytesPerSecondByReachabilityStatus[@(status)];
+    WBLockUnlock(&_lock);
+    if (bytesPerSecond) {
+        self.bytesPerSecond = [bytesPerSecond unsignedIntegerValue];
     }
-    
-    //mutableCopy 不管copy的对象是可变还是不可变，都会重新拷贝一份内存
-    //copy 只有当为可变对象时，才会考呗内存，否则，则只会拷贝地址
-    mutableRequest = [[self requestBySerializingRequest:mutableRequest withParameters:parameters error:error] mutableCopy];
-    return  mutableRequest;
 }
+#endif
 
-- (NSMutableURLRequest *)multipartFormRequestWithMethod:(NSString *)method
-                                              URLString:(NSString *)URLString
-                                             parameters:(NSDictionary<NSString *,id> *)parameters
-                              constructingBodyWithBlock:(void (^)(id<WBMultipartFormData> _Nonnull))block
-                                                  error:(NSError * _Nullable __autoreleasing *)error{
-    NSParameterAssert(method);
-    NSParameterAssert(![method isEqualToString:@"GET"] &&![method isEqualToString:@"HEAD"]);
-    NSMutableURLRequest *mutableRequest = [self requestWithMethod:method URLString:URLString parameters:nil error:error];
-    __block WBStreamingMultipartFormData *fromData = [[WBStreamingMultipartFormData alloc]initWithURLRequest:mutableRequest stringEncoding:NSUTF8StringEncoding];
-    if (parameters) {
-        for (WBQueryStringPair *pair in WBQueryStringPairsFromDictionary(parameters)) {
-            
-            NSData *data = nil;
-            
-            if ([pair.value isKindOfClass:[NSData class]]) {
-                
-                data = pair.value;
-                
-            }else if ([pair.value isEqual:[NSNull null]]){
-                
-                data = [NSData data];
-            }
-            else{
-                
-                data = [[pair.value description] dataUsingEncoding:self.stringEncoding];
-            }
-            if (data) {
-                [fromData appendPartWithFormData:data name:[pair.field description]];
-            }
-        }
+@end
+
+#pragma mark - WBInputStreamClient
+
+/*
+ 记录 CFNetwork 通过 _setCFClientFlags:callback:context: 注册的回调以及 stream 被调度到的 run loop。
+ 限速的 stream 在没有可读数据时返回 hasBytesAvailable == NO，令牌补充后通过这里在对应的 run loop 上发送 kCFStreamEventHasBytesAvailable。
+ */
+@interface WBInputStreamClient : NSObject
+
+@property (readonly, nonatomic, assign) BOOL hasCallback;
+
+- (BOOL)setClientFlags:(CFOptionFlags)flags callback:(CFReadStreamClientCallBack)callback context:(CFStreamClientContext *)context;
+
+- (void)scheduleInRunLoop:(CFRunLoopRef)runLoop forMode:(CFStringRef)mode;
+
+- (void)unscheduleFromRunLoop:(CFRunLoopRef)runLoop forMode:(CFStringRef)mode;
+
+- (void)signalEvent:(CFStreamEventType)event forStream:(NSStream *)stream;
+
+@end
+
+@implementation WBInputStreamClient {
+    WBLock _lock;
+    CFOptionFlags _flags;
+    CFReadStreamClientCallBack _callback;
+    CFStreamClientContext _context;
+    //交替存放 run loop 和 mode
+    NSMutableArray *_runLoopsAndModes;
+}
+
+- (instancetype)init{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    WBLockInit(&_lock);
+    _runLoopsAndModes = [NSMutableArray array];
+    return self;
+}
+
+- (void)dealloc{
+    if (_context.release && _context.info) {
+        _context.release(_context.info);
     }
+}
+
+- (BOOL)hasCallback{
+    WBLockLock(&_lock);
+    BOOL hasCallback = (_callback != NULL);
+    WBLockUnlock(&_lock);
+    return hasCallback;
+}
+
+- (BOOL)setClientFlags:(CFOptionFlags)flags callback:(CFReadStreamClientCallBack)callback context:(CFStreamClientContext *)context{
     
-    return  [fromData requestByFinalizingMultipartFormData];
+    CFStreamClientContext newContext = {0};
+    if (callback && context) {
+        newContext = *context;
+        if (newContext.retain && newContext.info) {
+            newContext.info = (void *)newContext.retain(newContext.info);
+        }
+    }
     
+    WBLockLock(&_lock);
+    CFStreamClientContext oldContext = _context;
+    _flags = callback ? flags : 0;
+    _callback = callback;
+    _context = newContext;
+    WBLockUnlock(&_lock);
     
+    if (oldContext.release && oldContext.info) {
+        oldContext.release(oldContext.info);
+    }
+    return YES;
 }
 
-- (NSMutableURLRequest *)requestWithMultipartFormRequest:(NSURLRequest *)request writingStreamContentsToFile:(NSURL *)fileURL completionHandler:(void (^)(NSError * _Nullable))handler{
-    NSParameterAssert(request.HTTPBodyStream);
-    NSParameterAssert([fileURL isFileURL]);
-    NSInputStream *inputStream = request.HTTPBodyStream;
-    NSOutputStream *outputStream = [[NSOutputStream alloc]initWithURL:fileURL append:NO];
-    __block NSError *error = nil;
+- (void)scheduleInRunLoop:(CFRunLoopRef)runLoop forMode:(CFStringRef)mode{
+    WBLockLock(&_lock);
+    [_runLoopsAndModes addObject:(__bridge id)runLoop];
+    [_runLoopsAndModes addObject:(__bridge NSString *)mode];
+    WBLockUnlock(&_lock);
+}
+
+- (void)unscheduleFromRunLoop:(CFRunLoopRef)runLoop forMode:(CFStringRef)mode{
+    WBLockLock(&_lock);
+    for (NSUInteger index = 0; index + 1 < [_runLoopsAndModes count]; index += 2) {
+        if (_runLoopsAndModes[index] == (__bridge id)runLoop && [_runLoopsAndModes[index + 1] isEqualToString:(__bridge NSString *)mode]) {
+            [_runLoopsAndModes removeObjectsInRange:NSMakeRange(index, 2)];
+            break;
+        }
+    }
+    WBLockUnlock(&_lock);
+}
+
+- (void)signalEvent:(CFStreamEventType)event forStream:(NSStream *)stream{
     
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        
-        [inputStream scheduleInRunLoop:[NSRunLoop currentRunLoop] forMode:NSDefaultRunLoopMode];
-        [outputStream scheduleInRunLoop:[NSRunLoop currentRunLoop] forMode:NSDefaultRunLoopMode];
+    WBLockLock(&_lock);
+    NSArray *runLoopsAndModes = [_runLoopsAndModes copy];
+    WBLockUnlock(&_lock);
+    
+    void (^deliver)(void) = ^{
+        WBLockLock(&self->_lock);
+        CFReadStreamClientCallBack callback = (self->_flags & event) ? self->_callback : NULL;
+        void *info = self->_context.info;
+        if (callback && self->_context.retain && info) {
+            info = (void *)self->_context.retain(info);
+        }
+        CFStreamClientContext context = self->_context;
+        WBLockUnlock(&self->_lock);
         
-        [inputStream open];
-        [outputStream open];
-        while ([inputStream  hasBytesAvailable] && [outputStream hasSpaceAvailable]) {
-            uint8_t bufffer[1024];
-            
-            NSInteger bytesRead = [inputStream read:bufffer maxLength:1024];
-            if (inputStream.streamError || bytesRead < 0) {
-                error = inputStream.streamError;
-                break;
-            }
-            
-            NSInteger bytesWritten = [outputStream write:bufffer maxLength:(NSInteger)bytesRead];
-            if (outputStream.streamError || bytesWritten < 0) {
-                error = outputStream.streamError;
-                break;
-            }
-            if (bytesRead == 0 && bytesWritten == 0) {
-                break;
+        if (callback) {
+            callback((__bridge CFReadStreamRef)stream, event, info);
+            if (context.release && info) {
+                context.release(info);
             }
         }
-        
-        [outputStream close];
-        [inputStream close];
-        
-        if (handler) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-               
-                handler(error);
-            });
+        id<NSStreamDelegate> delegate = stream.delegate;
+        if (delegate && delegate != (id<NSStreamDelegate>)stream && [delegate respondsToSelector:@selector(stream:handleEvent:)]) {
+            [delegate stream:stream handleEvent:(NSStreamEvent)event];
         }
-        
-    });
-    
-    NSMutableURLRequest *mutableRequest = [request mutableCopy];
-    mutableRequest.HTTPBodyStream = nil;
+    };
     
-    return  mutableRequest;
+    if ([runLoopsAndModes count] == 0) {
+        deliver();
+        return;
+    }
+    for (NSUInteger index = 0; index + 1 < [runLoopsAndModes count]; index += 2) {
+        CFRunLoopRef runLoop = (__bridge CFRunLoopRef)runLoopsAndModes[index];
+        CFRunLoopPerformBlock(runLoop, (__bridge CFStringRef)runLoopsAndModes[index + 1], deliver);
+        CFRunLoopWakeUp(runLoop);
+    }
 }
 
-#pragma mark - WBURLRequestSerialization
-- (NSURLRequest *)requestBySerializingRequest:(NSURLRequest *)request withParameters:(id)parameters error:(NSError * _Nullable __autoreleasing *)error{
+@end
+
+/*
+ 受 WBUploadRateLimiter 限速的 stream。令牌补充后除了通知自己的 client，还会调用 bytesAvailableHandler，
+ 包装它的 stream（比如 WBGzipBodyStream）通过这个 block 把可读事件转发给自己的 client。
+ */
+@protocol WBRateLimitedInputStream <NSObject>
+
+@property (nonatomic, copy) dispatch_block_t bytesAvailableHandler;
+
+//当前是否限速，不限速时不会发送可读事件
+@property (nonatomic, readonly, getter=isRateLimited) BOOL rateLimited;
+
+@end
+
+#pragma mark - WBGzipBodyStream
+
+//压缩流每次从原始输入流中读取的大小
+static NSUInteger const kWBGzipBodyStreamInputBufferSize = 64 * 1024;
+
+//越小的 body 压缩越快，可以使用更高的压缩级别；长度未知时按大 body 处理
+static int WBGzipCompressionLevelForLength(unsigned long long length, BOOL lengthIsKnown) {
+    if (lengthIsKnown && length <= 64 * 1024) {
+        return Z_BEST_COMPRESSION;
+    }else if (lengthIsKnown && length <= 1024 * 1024) {
+        return Z_DEFAULT_COMPRESSION;
+    }
+    return Z_BEST_SPEED;
+}
+
+//一次性压缩内存中的 body，按 deflateBound 预先分配好输出缓冲区；压缩失败时返回 nil
+static NSData * WBGzipCompressedData(NSData *data, int level) {
     
+    if ([data length] > UINT_MAX) {
+        return nil;
+    }
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    //windowBits 加 16 表示输出 gzip 格式而不是 zlib 格式
+    if (deflateInit2(&stream, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nil;
+    }
     
-    NSParameterAssert(request);
+    uLong capacity = deflateBound(&stream, (uLong)[data length]);
+    uint8_t *bytes = malloc(capacity);
+    if (!bytes) {
+        deflateEnd(&stream);
+        return nil;
+    }
+    stream.next_in = (Bytef *)[data bytes];
+    stream.avail_in = (uInt)[data length];
+    stream.next_out = bytes;
+    stream.avail_out = (uInt)capacity;
+    int status = deflate(&stream, Z_FINISH);
+    uLong length = stream.total_out;
+    deflateEnd(&stream);
+    
+    if (status != Z_STREAM_END) {
+        free(bytes);
+        return nil;
+    }
+    return [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:YES];
+}
+
+/*
+ 把另一个输入流压缩成 gzip 的输入流。
+ 每次读取时才从原始流中读取并压缩，内存中只保留一块输入缓冲区和 zlib 的状态，
+ 可以包装 WBMultipartBodyStream 这样的大 body 而不需要把整个 body 读进内存。
+ */
+@interface WBGzipBodyStream : NSInputStream<NSCopying>
+
+- (instancetype)initWithInputStream:(NSInputStream *)inputStream level:(int)level;
+
+@end
+
+@interface WBGzipBodyStream ()
+
+@property (readwrite, nonatomic, assign) NSStreamStatus streamStatus;
+
+@property (readwrite, nonatomic, strong) NSError *streamError;
+
+@property (readwrite, nonatomic, strong) NSInputStream *inputStream;
+
+@property (readwrite, nonatomic, assign) int level;
+
+@property (readwrite, nonatomic, strong) WBInputStreamClient *client;
+
+@end
+
+@implementation WBGzipBodyStream {
+    z_stream _stream;
+    uint8_t *_inputBuffer;
+    BOOL _streamInitialized;
+    BOOL _inputFinished;
+    BOOL _compressionFinished;
+}
+@synthesize delegate;
+@synthesize streamStatus;
+@synthesize streamError;
+
+- (instancetype)initWithInputStream:(NSInputStream *)inputStream level:(int)level{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.inputStream = inputStream;
+    self.level = level;
+    self.client = [[WBInputStreamClient alloc] init];
+    
+    //原始流限速时，令牌补充后把可读事件转发给自己的 client
+    if ([inputStream conformsToProtocol:@protocol(WBRateLimitedInputStream)]) {
+        __weak __typeof(self) weakSelf = self;
+        [(id<WBRateLimitedInputStream>)inputStream setBytesAvailableHandler:^{
+            __strong __typeof(weakSelf) strongSelf = weakSelf;
+            [strongSelf.client signalEvent:kCFStreamEventHasBytesAvailable forStream:strongSelf];
+        }];
+    }
+    return self;
+}
+
+- (void)dealloc{
+    if (_streamInitialized) {
+        deflateEnd(&_stream);
+    }
+    free(_inputBuffer);
+}
+
+- (void)failWithError:(NSError *)error{
+    self.streamError = error ?: [NSError errorWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:nil];
+    self.streamStatus = NSStreamStatusError;
+}
+
+#pragma mark - NSInputStream
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)length{
+    
+    if ([self streamStatus] != NSStreamStatusOpen) {
+        return [self streamStatus] == NSStreamStatusError ? -1 : 0;
+    }
+    if (_compressionFinished) {
+        self.streamStatus = NSStreamStatusAtEnd;
+        return 0;
+    }
+    
+    uInt outputLength = (uInt)MIN(length, (NSUInteger)UINT_MAX);
+    _stream.next_out = buffer;
+    _stream.avail_out = outputLength;
+    
+    while (_stream.avail_out > 0) {
+        if (_stream.avail_in == 0 && !_inputFinished) {
+            //已经有输出并且原始流暂时不可读（限速）时先返回，不阻塞读取线程
+            if (_stream.avail_out < outputLength && ![self inputStreamCanBeRead]) {
+                break;
+            }
+            NSInteger numberOfBytesRead = [self.inputStream read:_inputBuffer maxLength:kWBGzipBodyStreamInputBufferSize];
+            if (numberOfBytesRead < 0) {
+                [self failWithError:self.inputStream.streamError];
+                return -1;
+            }
+            _inputFinished = (numberOfBytesRead == 0);
+            _stream.next_in = _inputBuffer;
+            _stream.avail_in = (uInt)numberOfBytesRead;
+        }
+        
+        int status = deflate(&_stream, _inputFinished ? Z_FINISH : Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            _compressionFinished = YES;
+            break;
+        }
+        if (status != Z_OK && status != Z_BUF_ERROR) {
+            [self failWithError:nil];
+            return -1;
+        }
+    }
+    
+    if ([self isRateLimited]) {
+        //事件驱动的 client 只在收到事件后才会再次读取
+        if (_compressionFinished) {
+            self.streamStatus = NSStreamStatusAtEnd;
+            [self.client signalEvent:kCFStreamEventEndEncountered forStream:self];
+        }else if (_stream.avail_in > 0 || _inputFinished || [self inputStreamCanBeRead]) {
+            //输出缓冲区满了但还有数据（包括最后的 flush），原始流不会再发事件，由自己通知
+            [self.client signalEvent:kCFStreamEventHasBytesAvailable forStream:self];
+        }
+        //否则原始流在令牌补充后通过 bytesAvailableHandler 通知
+    }
+    
+    return (NSInteger)(outputLength - _stream.avail_out);
+}
+
+- (BOOL)getBuffer:(__unused uint8_t **)buffer length:(__unused NSUInteger *)len{
+    return NO;
+}
+
+- (BOOL)hasBytesAvailable{
+    if ([self streamStatus] != NSStreamStatusOpen) {
+        return NO;
+    }
+    //还有没压缩完的输入时一定可以输出数据，否则取决于原始流是否可读
+    if (_stream.avail_in > 0 || _inputFinished) {
+        return YES;
+    }
+    return [self inputStreamCanBeRead];
+}
+
+//原始流限速时才需要事件回调
+- (BOOL)isRateLimited{
+    NSInputStream *inputStream = self.inputStream;
+    return [inputStream conformsToProtocol:@protocol(WBRateLimitedInputStream)] && [(id<WBRateLimitedInputStream>)inputStream isRateLimited];
+}
+
+//原始流读到末尾时 hasBytesAvailable 为 NO，但仍需要读一次拿到结束标记
+- (BOOL)inputStreamCanBeRead{
+    NSStreamStatus status = [self.inputStream streamStatus];
+    return status == NSStreamStatusAtEnd || status == NSStreamStatusError || [self.inputStream hasBytesAvailable];
+}
+
+#pragma mark - NSStream
+
+- (void)open{
+    if (self.streamStatus == NSStreamStatusOpen) {
+        return;
+    }
+    
+    if (!_inputBuffer) {
+        _inputBuffer = malloc(kWBGzipBodyStreamInputBufferSize);
+    }
+    if (_streamInitialized) {
+        deflateEnd(&_stream);
+        _streamInitialized = NO;
+    }
+    memset(&_stream, 0, sizeof(_stream));
+    if (!_inputBuffer || deflateInit2(&_stream, self.level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        [self failWithError:nil];
+        return;
+    }
+    _streamInitialized = YES;
+    _inputFinished = NO;
+    _compressionFinished = NO;
+    
+    [self.inputStream open];
+    self.streamError = nil;
+    self.streamStatus = NSStreamStatusOpen;
+}
+
+- (void)close{
+    [self.inputStream close];
+    if (_streamInitialized) {
+        deflateEnd(&_stream);
+        _streamInitialized = NO;
+    }
+    self.streamStatus = NSStreamStatusClosed;
+}
+
+- (id)propertyForKey:(__unused NSString *)key{
+    return nil;
+}
+
+- (BOOL)setProperty:(__unused id)property forKey:(__unused NSString *)key{
+    return NO;
+}
+
+- (void)scheduleInRunLoop:(__unused NSRunLoop *)aRunLoop forMode:(__unused NSString *)mode{
+}
+
+- (void)removeFromRunLoop:(__unused NSRunLoop *)aRunLoop forMode:(__unused NSString *)mode{
+}
+
+- (void)_scheduleInCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode{
+    [self.client scheduleInRunLoop:aRunLoop forMode:aMode];
+}
+
+- (void)_unscheduleFromCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode{
+    [self.client unscheduleFromRunLoop:aRunLoop forMode:aMode];
+}
+
+- (BOOL)_setCFClientFlags:(CFOptionFlags)inFlags callback:(CFReadStreamClientCallBack)inCallback context:(CFStreamClientContext *)inContext{
+    //原始流不限速时数据总是可读，和之前一样不需要事件回调
+    if (![self isRateLimited]) {
+        return NO;
+    }
+    return [self.client setClientFlags:inFlags callback:inCallback context:inContext];
+}
+
+#pragma mark - NSCopying
+
+- (instancetype)copyWithZone:(NSZone *)zone{
+    //原始流可以拷贝时拷贝一份，重新从头开始压缩
+    NSInputStream *inputStream = self.inputStream;
+    if ([inputStream conformsToProtocol:@protocol(NSCopying)]) {
+        inputStream = [(id<NSCopying>)inputStream copyWithZone:zone];
+    }
+    return [[[self class] allocWithZone:zone] initWithInputStream:inputStream level:self.level];
+}
+
+@end
+
+#pragma mark - WBStreamingMultipartFormData
+@interface WBStreamingMultipartFormData : NSObject<WBMultipartFormData>
+
+- (instancetype)initWithURLRequest:(NSMutableURLRequest *)urlRequest
+                    stringEncoding:(NSStringEncoding)encoding;
+
+- (NSMutableURLRequest *)requestByFinalizingMultipartFormData;
+
+@end
+
+@class WBHTTPBodyPart;
+
+#pragma mark - WBMultipartBodyStream
+
+//限速时每次为 stream 预留的令牌数，和 NSURLSession 每次读取的大小相当
+static NSUInteger const kWBMultipartBodyStreamReservationSize = 32 * 1024;
+
+@interface WBMultipartBodyStream : NSInputStream<NSStreamDelegate, NSCopying, WBRateLimitedInputStream>
+//为 nil 时不限速
+@property (nonatomic, strong) WBUploadRateLimiter *rateLimiter;
+@property (nonatomic, strong) NSInputStream *inputStream;
+@property (nonatomic, assign, readonly) unsigned long long contentLength;
+@property (nonatomic, assign, readonly, getter=isEmpty) BOOL empty;
+//存在长度未知的 part 时为 YES，此时 contentLength 没有意义
+@property (nonatomic, assign, readonly, getter=hasUnknownContentLength) BOOL unknownContentLength;
+//打开时从这个位置开始读取，用于继续上传
+@property (nonatomic, assign) unsigned long long startOffset;
+//每个 part body 读完后回调它的校验和，为 nil 时不计算
+@property (nonatomic, copy) void (^partChecksumHandler)(WBMultipartFormPartChecksum *checksum);
+
+- (instancetype)initWithStringEncoding:(NSStringEncoding)encoding;
+- (void)setInitialAndFinalBoundaries;
+- (void)appendHTTPBodyPart:(WBHTTPBodyPart *)bodyPart;
+
+
+@end
+
+#pragma mark -
+static NSArray *WBHTTPRequestSerializerObservedKeyPaths(){
+    static NSArray *_WBHTTPRequestSerializerObservedKeyPaths = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _WBHTTPRequestSerializerObservedKeyPaths = @[NSStringFromSelector(@selector(allowsCellularAccess)),NSStringFromSelector(@selector(cachePolicy)),NSStringFromSelector(@selector(HTTPShouldHandleCookies)),NSStringFromSelector(@selector(HTTPShouldUsePipelining)),NSStringFromSelector(@selector(networkServiceType)),NSStringFromSelector(@selector(timeoutInterval))];
+    });
+    
+    return _WBHTTPRequestSerializerObservedKeyPaths;
+    
+}
+
+static void *WBHTTPRequestSerializerObserverContext = &WBHTTPRequestSerializerObserverContext;
+
+@interface WBHTTPRequestSerializer()
+
+@property (readwrite, nonatomic, strong) NSMutableSet *mutableObservedChangedKeyPaths;
+
+//不可变的请求头快照，修改时整体替换（copy-on-write），读取时不加锁也不拷贝
+@property (readwrite, atomic, copy) NSDictionary *HTTPRequestHeadersSnapshot;
+
+@property (readwrite, nonatomic, strong) dispatch_queue_t requestHeaderModificationQueue;
+
+@property (readwrite, nonatomic, assign) WBHTTPRequestQueryStringSerializationStyle queryStringSerializationStyle;
+
+@property (readwrite, nonatomic, copy) WBQueryStringSerializationBlock queryStringSerialization;
+
+- (BOOL)serializeParameters:(id)parameters
+                intoRequest:(NSMutableURLRequest *)mutableRequest
+                      error:(NSError * _Nullable __autoreleasing *)error;
+
+- (void)compressHTTPBodyOfRequest:(NSMutableURLRequest *)mutableRequest;
+
+@end
+
+@interface WBHTTPRequestPrototype ()
+
+@property (readwrite, nonatomic, strong) WBHTTPRequestSerializer *requestSerializer;
+
+@property (readwrite, nonatomic, strong) NSURL *baseURL;
+
+@property (readwrite, nonatomic, copy) NSURLRequest *request;
+
+- (instancetype)initWithRequestSerializer:(WBHTTPRequestSerializer *)requestSerializer baseURL:(NSURL *)baseURL;
+
+@end
+
+@implementation WBHTTPRequestSerializer
+
++ (instancetype)serializer{
+    
+    return [[self alloc]init];
+}
+
+- (instancetype)init{
+    
+    self = [super init];
+    if (!self) {
+        return  nil;
+    }
+    
+    self.stringEncoding = NSUTF8StringEncoding;
+    self.HTTPRequestHeadersSnapshot = @{};
+    //只用来串行化对请求头的修改
+    self.requestHeaderModificationQueue = dispatch_queue_create("rquestHeaderModificationQueue", DISPATCH_QUEUE_SERIAL);
+    NSMutableArray *acceptLanguagesComponents = [NSMutableArray array];
+    [[NSLocale preferredLanguages] enumerateObjectsUsingBlock:^(NSString * _Nonnull obj, NSUInteger idx, BOOL * _Nonnull stop) {
+        float q = 1.0f - (idx * 0.1f);
+        [acceptLanguagesComponents addObject:[NSString stringWithFormat:@"%@;q=%0.1g",obj,q]];
+        *stop = q <= 0.5f;
+        
+    }];
+    [self setValue:[acceptLanguagesComponents componentsJoinedByString:@", "] forHTTPHeaderField:@"Accept-Language"];
+    
+    NSString *userAgent = nil;
+    
+#if TARGET_OS_IOS
+    userAgent = [NSString stringWithFormat:@"%@/%@ (%@; iOS %@; Scale/%0.2f)", [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleExecutableKey] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleIdentifierKey], [[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleVersionKey], [[UIDevice currentDevice] model], [[UIDevice currentDevice] systemVersion], [[UIScreen mainScreen] scale]];
+#elif TARGET_OS_TV
+    userAgent = [NSString stringWithFormat:@"%@/%@ (%@; tvOS %@; Scale/%0.2f)", [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleExecutableKey] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleIdentifierKey], [[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleVersionKey], [[UIDevice currentDevice] model], [[UIDevice currentDevice] systemVersion], [[UIScreen mainScreen] scale]];
+#elif TARGET_OS_WATCH
+    userAgent = [NSString stringWithFormat:@"%@/%@ (%@; watchOS %@; Scale/%0.2f)", [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleExecutableKey] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleIdentifierKey], [[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleVersionKey], [[WKInterfaceDevice currentDevice] model], [[WKInterfaceDevice currentDevice] systemVersion], [[WKInterfaceDevice currentDevice] screenScale]];
+#elif defined(__MAC_OS_X_VERSION_MIN_REQUIRED)
+    userAgent = [NSString stringWithFormat:@"%@/%@ (Mac OS X %@)", [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleExecutableKey] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleIdentifierKey], [[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] ?: [[NSBundle mainBundle] infoDictionary][(__bridge NSString *)kCFBundleVersionKey], [[NSProcessInfo processInfo] operatingSystemVersionString]];
+#endif
+    if (userAgent) {
+        if (![userAgent canBeConvertedToEncoding:NSASCIIStringEncoding]) {
+            NSMutableString *mutableUserAgent = [userAgent mutableCopy];
+            if (CFStringTransform((__bridge  CFMutableStringRef)(mutableUserAgent), NULL, (__bridge  CFStringRef)@"Any-Latin; Latin-ASCII; [:^ASCII:] Remove", false)) {
+                userAgent = mutableUserAgent;
+            }
+        }
+        [self setValue:userAgent forHTTPHeaderField:@"User-Agent"];
+    }
+    
+    self.HTTPMethodsEncodingParametersInURI = [NSSet setWithObjects:@"GET",@"HEAD",@"DELETE", nil];
+    self.bodyCompressionThreshold = kWBHTTPRequestBodyCompressionDefaultThreshold;
+    self.mutableObservedChangedKeyPaths = [NSMutableSet set];
+    
+    for (NSString *keyPath in WBHTTPRequestSerializerObservedKeyPaths()) {
+        if ([self respondsToSelector:NSSelectorFromString(keyPath)]) {
+            [self addObserver:self forKeyPath:keyPath options:NSKeyValueObservingOptionNew context:WBHTTPRequestSerializerObserverContext];
+        }
+    }
+    return  self;
+}
+
+- (void)dealloc{
+    for (NSString *keyPath in WBHTTPRequestSerializerObservedKeyPaths()) {
+        if ([self respondsToSelector:NSSelectorFromString(keyPath)]) {
+            [self removeObserver:self forKeyPath:keyPath context:WBHTTPRequestSerializerObserverContext];
+        }
+    }
+}
+
+#pragma mark -
+// 注意：如果手动调用了kvo，则必须实现 automaticallyNotifiesObserversForKey 方法，不然会产生crash
+//一般不会手动去调用willChangeValueForKey、didChangeValueForKey 所以automaticallyNotifiesObserversForKey也不必实现
+- (void)setAllowsCellularAccess:(BOOL)allowsCellularAccess {
+    [self willChangeValueForKey:NSStringFromSelector(@selector(allowsCellularAccess))];
+    _allowsCellularAccess = allowsCellularAccess;
+    [self didChangeValueForKey:NSStringFromSelector(@selector(allowsCellularAccess))];
+}
+
+- (void)setCachePolicy:(NSURLRequestCachePolicy)cachePolicy {
+    [self willChangeValueForKey:NSStringFromSelector(@selector(cachePolicy))];
+    _cachePolicy = cachePolicy;
+    [self didChangeValueForKey:NSStringFromSelector(@selector(cachePolicy))];
+}
+
+- (void)setHTTPShouldHandleCookies:(BOOL)HTTPShouldHandleCookies {
+    [self willChangeValueForKey:NSStringFromSelector(@selector(HTTPShouldHandleCookies))];
+    _HTTPShouldHandleCookies = HTTPShouldHandleCookies;
+    [self didChangeValueForKey:NSStringFromSelector(@selector(HTTPShouldHandleCookies))];
+}
+
+- (void)setHTTPShouldUsePipelining:(BOOL)HTTPShouldUsePipelining {
+    [self willChangeValueForKey:NSStringFromSelector(@selector(HTTPShouldUsePipelining))];
+    _HTTPShouldUsePipelining = HTTPShouldUsePipelining;
+    [self didChangeValueForKey:NSStringFromSelector(@selector(HTTPShouldUsePipelining))];
+}
+
+- (void)setNetworkServiceType:(NSURLRequestNetworkServiceType)networkServiceType {
+    [self willChangeValueForKey:NSStringFromSelector(@selector(networkServiceType))];
+    _networkServiceType = networkServiceType;
+    [self didChangeValueForKey:NSStringFromSelector(@selector(networkServiceType))];
+}
+
+- (void)setTimeoutInterval:(NSTimeInterval)timeoutInterval {
+    [self willChangeValueForKey:NSStringFromSelector(@selector(timeoutInterval))];
+    _timeoutInterval = timeoutInterval;
+    [self didChangeValueForKey:NSStringFromSelector(@selector(timeoutInterval))];
+}
+
+//快照本身不可变，直接返回，不需要进入队列也不需要拷贝
+- (NSDictionary *)HTTPRequestHeaders{
+    
+    return self.HTTPRequestHeadersSnapshot;
+}
+
+- (void)setValue:(NSString *)value forHTTPHeaderField:(NSString *)field{
+    
+    dispatch_sync(self.requestHeaderModificationQueue, ^{
+        NSMutableDictionary *mutableHTTPRequestHeaders = [self.HTTPRequestHeadersSnapshot mutableCopy];
+        [mutableHTTPRequestHeaders setValue:value forKey:field];
+        self.HTTPRequestHeadersSnapshot = mutableHTTPRequestHeaders;
+    });
+}
+
+- (NSString *)valueForHTTPHeaderField:(NSString *)field{
+    
+    return [self.HTTPRequestHeadersSnapshot valueForKey:field];
+}
+
+- (void)setAuthorizationHeaderFieldWithUsername:(NSString *)username password:(NSString *)password{
+    
+    NSData *basicAuthCredentials = [[NSString stringWithFormat:@"%@:%@",username,password] dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *base64AuthCredentials = [basicAuthCredentials base64EncodedStringWithOptions:(NSDataBase64EncodingOptions)0];
+    [self setValue:[NSString stringWithFormat:@"Basic %@",base64AuthCredentials] forHTTPHeaderField:@"Authorization"];
+    
+    
+}
+
+- (void)clearAuthorizationHeader{
+    dispatch_sync(self.requestHeaderModificationQueue, ^{
+        NSMutableDictionary *mutableHTTPRequestHeaders = [self.HTTPRequestHeadersSnapshot mutableCopy];
+        [mutableHTTPRequestHeaders removeObjectForKey:@"Authorization"];
+        self.HTTPRequestHeadersSnapshot = mutableHTTPRequestHeaders;
+    });
+}
+
+#pragma mark -
+- (void)setQueryStringSerializationWithStyle:(WBHTTPRequestQueryStringSerializationStyle)style{
+    
+    self.queryStringSerializationStyle = style;
+    self.queryStringSerialization = nil;
+    
+}
+
+- (void)setQueryStringSerializationWithBlock:(NSString * _Nullable (^)(NSURLRequest * _Nonnull, id _Nonnull, NSError *__autoreleasing  _Nullable * _Nullable))block{
+    
+    self.queryStringSerialization = block;
+}
+
+#pragma mark -
+- (NSMutableURLRequest *)requestWithMethod:(NSString *)method
+                                 URLString:(NSString *)URLString
+                                parameters:(id)parameters
+                                     error:(NSError * _Nullable __autoreleasing *)error{
+    //断言评估一个条件，如果条件为 false ，调用当前线程的断点句柄。
+    NSParameterAssert(method);
+    NSParameterAssert(URLString);
+    NSURL *url = [NSURL URLWithString:URLString];
+    NSParameterAssert(url);
+    NSMutableURLRequest *mutableRequest = [[NSMutableURLRequest alloc]initWithURL:url];
+    mutableRequest.HTTPMethod = method;
+    for (NSString *keyPath in self.mutableObservedChangedKeyPaths) {
+        [mutableRequest setValue:[self valueForKey:keyPath] forKey:keyPath];
+    }
+    
+    //mutableCopy 不管copy的对象是可变还是不可变，都会重新拷贝一份内存
+    //copy 只有当为可变对象时，才会考呗内存，否则，则只会拷贝地址
+    mutableRequest = [[self requestBySerializingRequest:mutableRequest withParameters:parameters error:error] mutableCopy];
+    return  mutableRequest;
+}
+
+- (NSMutableURLRequest *)multipartFormRequestWithMethod:(NSString *)method
+                                              URLString:(NSString *)URLString
+                                             parameters:(NSDictionary<NSString *,id> *)parameters
+                              constructingBodyWithBlock:(void (^)(id<WBMultipartFormData> _Nonnull))block
+                                                  error:(NSError * _Nullable __autoreleasing *)error{
+    NSParameterAssert(method);
+    NSParameterAssert(![method isEqualToString:@"GET"] &&![method isEqualToString:@"HEAD"]);
+    NSMutableURLRequest *mutableRequest = [self requestWithMethod:method URLString:URLString parameters:nil error:error];
+    __block WBStreamingMultipartFormData *fromData = [[WBStreamingMultipartFormData alloc]initWithURLRequest:mutableRequest stringEncoding:NSUTF8StringEncoding];
+    if (parameters) {
+        for (WBQueryStringPair *pair in WBQueryStringPairsFromDictionary(parameters)) {
+            
+            NSData *data = nil;
+            
+            if ([pair.value isKindOfClass:[NSData class]]) {
+                
+                data = pair.value;
+                
+            }else if ([pair.value isEqual:[NSNull null]]){
+                
+                data = [NSData data];
+            }
+            else{
+                
+                data = [[pair.value description] dataUsingEncoding:self.stringEncoding];
+            }
+            if (data) {
+                [fromData appendPartWithFormData:data name:[pair.field description]];
+            }
+        }
+    }
+    
+    //参数之后是调用方添加的文件、data 和流 part
+    if (block) {
+        block(fromData);
+    }
+    
+    NSMutableURLRequest *multipartRequest = [fromData requestByFinalizingMultipartFormData];
+    //body stream 在这里才生成，requestWithMethod 中的压缩不会作用到 multipart 的 body 上
+    [self compressHTTPBodyOfRequest:multipartRequest];
+    return  multipartRequest;
+    
+    
+}
+
+- (NSMutableURLRequest *)requestWithMultipartFormRequest:(NSURLRequest *)request writingStreamContentsToFile:(NSURL *)fileURL completionHandler:(void (^)(NSError * _Nullable))handler{
+    
+    return [self requestWithMultipartFormRequest:request writingStreamContentsToFile:fileURL bufferSize:0 progress:nil completionHandler:handler];
+}
+
+- (NSMutableURLRequest *)requestWithMultipartFormRequest:(NSURLRequest *)request
+                             writingStreamContentsToFile:(NSURL *)fileURL
+                                              bufferSize:(NSUInteger)bufferSize
+                                                progress:(void (^)(NSProgress * _Nonnull))progressBlock
+                                       completionHandler:(void (^)(NSError * _Nullable))handler{
+    NSParameterAssert(request.HTTPBodyStream);
+    NSParameterAssert([fileURL isFileURL]);
+    
+    NSInputStream *inputStream = request.HTTPBodyStream;
+    if (bufferSize == 0) {
+        bufferSize = kWBMultipartFormSpoolDefaultBufferSize;
+    }
+    
+    NSString *contentLength = [request valueForHTTPHeaderField:@"Content-Length"];
+    //不使用 progressWithTotalUnitCount:，避免成为调用线程上 currentProgress 的子进度
+    NSProgress *progress = [NSProgress discreteProgressWithTotalUnitCount:contentLength ? [contentLength longLongValue] : -1];
+    progress.cancellable = YES;
+    
+    //开始写入前在调用线程上先回调一次，调用方可以在写入第一块之前取消
+    if (progressBlock) {
+        progressBlock(progress);
+    }
+    
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        
+        NSError *error = WBSpoolInputStreamToFile(inputStream, fileURL, bufferSize, progress, progressBlock);
+        
+        if (handler) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+               
+                handler(error);
+            });
+        }
+    });
+    
+    NSMutableURLRequest *mutableRequest = [request mutableCopy];
+    mutableRequest.HTTPBodyStream = nil;
+    
+    return  mutableRequest;
+}
+
+- (NSMutableURLRequest *)requestWithMultipartFormRequest:(NSURLRequest *)request
+                                      resumingFromOffset:(unsigned long long)offset
+                                                   error:(NSError * _Nullable __autoreleasing *)error{
+    NSParameterAssert(request);
+    
+    //压缩后的 body 不能按原始 body 的位置继续上传
+    WBMultipartBodyStream *bodyStream = (WBMultipartBodyStream *)request.HTTPBodyStream;
+    if (![bodyStream isKindOfClass:[WBMultipartBodyStream class]] || [bodyStream hasUnknownContentLength] || offset > [bodyStream contentLength]) {
+        if (error) {
+            NSDictionary *userInfo = @{NSLocalizedFailureReasonErrorKey: NSLocalizedStringFromTable(@"The request does not have a multipart body that can be resumed from the requested offset.", @"WBNetworking", nil)};
+            *error = [[NSError alloc] initWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:userInfo];
+        }
+        return nil;
+    }
+    
+    WBMultipartBodyStream *resumedBodyStream = [bodyStream copy];
+    resumedBodyStream.startOffset = offset;
+    
+    unsigned long long contentLength = [bodyStream contentLength];
+    NSMutableURLRequest *mutableRequest = [request mutableCopy];
+    mutableRequest.HTTPBodyStream = resumedBodyStream;
+    //Content-Range 不是请求头的标准用法，告诉服务端从哪里继续的方式（比如 Upload-Offset）由调用方设置
+    [mutableRequest setValue:[NSString stringWithFormat:@"%llu", contentLength - offset] forHTTPHeaderField:@"Content-Length"];
+    return mutableRequest;
+}
+
+#pragma mark - WBURLRequestSerialization
+- (NSURLRequest *)requestBySerializingRequest:(NSURLRequest *)request withParameters:(id)parameters error:(NSError * _Nullable __autoreleasing *)error{
+    
+    
+    NSParameterAssert(request);
     
     NSMutableURLRequest *mutableRequest = [request mutableCopy];
     
-    [self.HTTPRequestHeaders enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, NSString * _Nonnull obj, BOOL * _Nonnull stop) {
-       
-        if (![request valueForHTTPHeaderField:key]) {
-            [mutableRequest setValue:obj forHTTPHeaderField:key];
+    [self.HTTPRequestHeaders enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, NSString * _Nonnull obj, BOOL * _Nonnull stop) {
+       
+        if (![request valueForHTTPHeaderField:key]) {
+            [mutableRequest setValue:obj forHTTPHeaderField:key];
+        }
+    }];
+    
+    if (![self serializeParameters:parameters intoRequest:mutableRequest error:error]) {
+        return nil;
+    }
+    [self compressHTTPBodyOfRequest:mutableRequest];
+    return mutableRequest;
+}
+
+//按 bodyCompression 压缩 body。已经设置了 Content-Encoding 的请求以及小于阈值的 body 保持不变
+- (void)compressHTTPBodyOfRequest:(NSMutableURLRequest *)mutableRequest{
+    
+    if (self.bodyCompression != WBHTTPRequestBodyCompressionGzip || [mutableRequest valueForHTTPHeaderField:@"Content-Encoding"]) {
+        return;
+    }
+    
+    NSData *HTTPBody = mutableRequest.HTTPBody;
+    NSInputStream *HTTPBodyStream = mutableRequest.HTTPBodyStream;
+    if (HTTPBody) {
+        if ([HTTPBody length] < self.bodyCompressionThreshold) {
+            return;
+        }
+        NSData *compressedData = WBGzipCompressedData(HTTPBody, WBGzipCompressionLevelForLength([HTTPBody length], YES));
+        //数据无法压缩得更小时发送原始数据
+        if (!compressedData || [compressedData length] >= [HTTPBody length]) {
+            return;
+        }
+        [mutableRequest setHTTPBody:compressedData];
+        [mutableRequest setValue:nil forHTTPHeaderField:@"Content-Length"];
+    }else if (HTTPBodyStream) {
+        NSString *contentLength = [mutableRequest valueForHTTPHeaderField:@"Content-Length"];
+        if (contentLength && (unsigned long long)[contentLength longLongValue] < self.bodyCompressionThreshold) {
+            return;
+        }
+        int level = WBGzipCompressionLevelForLength((unsigned long long)[contentLength longLongValue], contentLength != nil);
+        [mutableRequest setHTTPBodyStream:[[WBGzipBodyStream alloc] initWithInputStream:HTTPBodyStream level:level]];
+        //压缩后的长度事先无法知道，改为 chunked 传输
+        [mutableRequest setValue:nil forHTTPHeaderField:@"Content-Length"];
+        [mutableRequest setValue:@"chunked" forHTTPHeaderField:@"Transfer-Encoding"];
+    }else{
+        return;
+    }
+    [mutableRequest setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+}
+
+//把参数编码进 mutableRequest（URL 或者 body），请求头已经合并好。子类通过重写这个方法改变参数的编码方式
+- (BOOL)serializeParameters:(id)parameters intoRequest:(NSMutableURLRequest *)mutableRequest error:(NSError * _Nullable __autoreleasing *)error{
+    
+    NSString *query = nil;
+    if (parameters) {
+        if (self.queryStringSerialization) {
+            
+            NSError *serializationError;
+            query = self.queryStringSerialization(mutableRequest,parameters,&serializationError);
+            
+            if (serializationError) {
+                if (error) {
+                    *error = serializationError;
+                }
+                return NO;
+            }
+        }else{
+            
+            switch (self.queryStringSerializationStyle) {
+                case WBHTTPRequestQueryStringSerializationDefaultStyle:
+                case WBHTTPRequestQueryStringSerializationRepeatedKeyStyle:
+                case WBHTTPRequestQueryStringSerializationCommaSeparatedStyle:
+                case WBHTTPRequestQueryStringSerializationDottedKeyStyle:
+                    query = WBQueryStringFromParametersWithStyle(parameters, self.queryStringSerializationStyle);
+                    break;
+                    
+                default:
+                    break;
+            }
+        }
+    }
+    if ([self.HTTPMethodsEncodingParametersInURI containsObject:[[mutableRequest HTTPMethod] uppercaseString]]) {
+        if (query && query.length > 0) {
+            mutableRequest.URL = WBURLByAppendingPercentEscapedQuery(mutableRequest.URL, query);
+        }
+    }else{
+        if (!query) {
+            query = @"";
+        }
+        if (![mutableRequest valueForHTTPHeaderField:@"Content-Type"]) {
+            [mutableRequest setHTTPBody:[query dataUsingEncoding:self.stringEncoding]];
+        }
+        
+    }
+    return YES;
+}
+
+#pragma mark - WBHTTPRequestPrototype
+- (WBHTTPRequestPrototype *)requestPrototypeWithBaseURL:(NSURL *)baseURL{
+    
+    return [[WBHTTPRequestPrototype alloc] initWithRequestSerializer:self baseURL:baseURL];
+}
+#pragma mark - NSKeyValueObserving
++ (BOOL)automaticallyNotifiesObserversForKey:(NSString *)key{
+    
+    if ([WBHTTPRequestSerializerObservedKeyPaths() containsObject:key]) {
+        
+        return  NO;
+    }
+    
+    return [super automaticallyNotifiesObserversForKey:key];
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary<NSKeyValueChangeKey,id> *)change context:(void *)context{
+    
+    if (context == WBHTTPRequestSerializerObserverContext) {
+        if ([change[NSKeyValueChangeNewKey] isEqual:[NSNull null]]) {
+            [self.mutableObservedChangedKeyPaths removeObject:keyPath];
+        }else{
+            [self.mutableObservedChangedKeyPaths addObject:keyPath];
+        }
+    }
+}
+
+
+#pragma mark - NSSecureCoding
++(BOOL)supportsSecureCoding{
+    return  YES;
+}
+
+- (instancetype)initWithCoder:(NSCoder *)coder{
+    self = [self init];
+    if (!self) {
+        return  nil;
+    }
+    
+    self.HTTPRequestHeadersSnapshot = [coder decodeObjectOfClass:[NSDictionary class] forKey:@"mutableHTTPRequestHeaders"] ?: @{};
+    self.queryStringSerializationStyle = (WBHTTPRequestQueryStringSerializationStyle)[[coder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(queryStringSerializationStyle))] unsignedIntegerValue];
+    self.bodyCompression = (WBHTTPRequestBodyCompression)[[coder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(bodyCompression))] unsignedIntegerValue];
+    NSNumber *bodyCompressionThreshold = [coder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(bodyCompressionThreshold))];
+    if (bodyCompressionThreshold) {
+        self.bodyCompressionThreshold = [bodyCompressionThreshold unsignedIntegerValue];
+    }
+    return self;
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder{
+    
+    //保持和之前归档数据相同的 key
+    [coder encodeObject:self.HTTPRequestHeadersSnapshot forKey:@"mutableHTTPRequestHeaders"];
+    
+    [coder encodeObject:@(self.queryStringSerializationStyle) forKey:NSStringFromSelector(@selector(queryStringSerializationStyle))];
+    [coder encodeObject:@(self.bodyCompression) forKey:NSStringFromSelector(@selector(bodyCompression))];
+    [coder encodeObject:@(self.bodyCompressionThreshold) forKey:NSStringFromSelector(@selector(bodyCompressionThreshold))];
+    
+}
+
+#pragma mark - NSCopying
+- (instancetype)copyWithZone:(NSZone *)zone{
+    
+    WBHTTPRequestSerializer *serializer = [[[self class]allocWithZone:zone]init];
+    
+    //快照不可变，两个 serializer 可以安全地共享
+    serializer.HTTPRequestHeadersSnapshot = self.HTTPRequestHeadersSnapshot;
+    serializer.queryStringSerializationStyle = self.queryStringSerializationStyle;
+    serializer.queryStringSerialization = self.queryStringSerialization;
+    serializer.bodyCompression = self.bodyCompression;
+    serializer.bodyCompressionThreshold = self.bodyCompressionThreshold;
+    return serializer;
+}
+
+
+@end
+
+#pragma mark - WBHTTPRequestPrototype
+
+@implementation WBHTTPRequestPrototype
+
+- (instancetype)initWithRequestSerializer:(WBHTTPRequestSerializer *)requestSerializer baseURL:(NSURL *)baseURL{
+    
+    NSParameterAssert(requestSerializer);
+    NSParameterAssert(baseURL);
+    
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.requestSerializer = requestSerializer;
+    self.baseURL = baseURL;
+    
+    //只在这里通过 KVC 应用一次修改过的属性和默认请求头，之后每个请求直接从这个 request 拷贝
+    NSMutableURLRequest *mutableRequest = [[NSMutableURLRequest alloc] initWithURL:baseURL];
+    for (NSString *keyPath in requestSerializer.mutableObservedChangedKeyPaths) {
+        [mutableRequest setValue:[requestSerializer valueForKey:keyPath] forKey:keyPath];
+    }
+    [requestSerializer.HTTPRequestHeaders enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, NSString * _Nonnull obj, BOOL * _Nonnull stop) {
+        [mutableRequest setValue:obj forHTTPHeaderField:key];
+    }];
+    self.request = mutableRequest;
+    
+    return self;
+}
+
+- (NSMutableURLRequest *)requestWithMethod:(NSString *)method
+                                      path:(NSString *)path
+                                parameters:(id)parameters
+                                     error:(NSError * _Nullable __autoreleasing *)error{
+    
+    NSParameterAssert(method);
+    NSURL *url = path.length > 0 ? [NSURL URLWithString:path relativeToURL:self.baseURL] : self.baseURL;
+    NSParameterAssert(url);
+    
+    NSMutableURLRequest *mutableRequest = [self.request mutableCopy];
+    mutableRequest.URL = url;
+    mutableRequest.HTTPMethod = method;
+    
+    if (![self.requestSerializer serializeParameters:parameters intoRequest:mutableRequest error:error]) {
+        return nil;
+    }
+    [self.requestSerializer compressHTTPBodyOfRequest:mutableRequest];
+    return mutableRequest;
+}
+
+@end
+
+#pragma mark -
+static NSString *WBCreateMultipartFormBoundary(){
+    
+    return [NSString stringWithFormat:@"Boundary+%08X%08X",arc4random(),arc4random()];
+}
+
+static NSString * const kWBMultipartFormCRLF = @"\r\n";
+
+static inline NSString * WBMultipartFormInitialBoundary(NSString *boundary) {
+    return [NSString stringWithFormat:@"--%@%@", boundary, kWBMultipartFormCRLF];
+}
+
+static inline NSString * WBMultipartFormEncapsulationBoundary(NSString *boundary){
+    
+    return [NSString stringWithFormat:@"%@--%@%@",kWBMultipartFormCRLF,boundary,kWBMultipartFormCRLF];
+}
+
+static inline NSString * WBMultipartFormFinalBoundary(NSString *boundary){
+    
+    return [NSString stringWithFormat:@"%@--%@--%@",kWBMultipartFormCRLF,boundary,kWBMultipartFormCRLF];
+}
+
+//常见扩展名对应的 MIME 类型，整理自标准的 mime.types 列表，按扩展名的字节序排列以便二分查找。
+//新增条目时保持有序，并且扩展名使用小写
+static const struct {
+    const char *extension;
+    __unsafe_unretained NSString *MIMEType;
+} WBMIMETypeTable[] = {
+    {"3g2", @"video/3gpp2"},
+    {"3gp", @"video/3gpp"},
+    {"7z", @"application/x-7z-compressed"},
+    {"aac", @"audio/aac"},
+    {"aif", @"audio/x-aiff"},
+    {"aiff", @"audio/x-aiff"},
+    {"amr", @"audio/amr"},
+    {"apk", @"application/vnd.android.package-archive"},
+    {"avi", @"video/x-msvideo"},
+    {"avif", @"image/avif"},
+    {"bin", @"application/octet-stream"},
+    {"bmp", @"image/bmp"},
+    {"bz2", @"application/x-bzip2"},
+    {"caf", @"audio/x-caf"},
+    {"css", @"text/css"},
+    {"csv", @"text/csv"},
+    {"doc", @"application/msword"},
+    {"docx", @"application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"epub", @"application/epub+zip"},
+    {"flac", @"audio/flac"},
+    {"gif", @"image/gif"},
+    {"gz", @"application/gzip"},
+    {"heic", @"image/heic"},
+    {"heif", @"image/heif"},
+    {"htm", @"text/html"},
+    {"html", @"text/html"},
+    {"ico", @"image/x-icon"},
+    {"ics", @"text/calendar"},
+    {"ipa", @"application/octet-stream"},
+    {"jpe", @"image/jpeg"},
+    {"jpeg", @"image/jpeg"},
+    {"jpg", @"image/jpeg"},
+    {"js", @"application/javascript"},
+    {"json", @"application/json"},
+    {"key", @"application/x-iwork-keynote-sffkey"},
+    {"m4a", @"audio/mp4"},
+    {"m4v", @"video/x-m4v"},
+    {"md", @"text/markdown"},
+    {"mid", @"audio/midi"},
+    {"midi", @"audio/midi"},
+    {"mkv", @"video/x-matroska"},
+    {"mov", @"video/quicktime"},
+    {"mp3", @"audio/mpeg"},
+    {"mp4", @"video/mp4"},
+    {"mpeg", @"video/mpeg"},
+    {"mpg", @"video/mpeg"},
+    {"numbers", @"application/x-iwork-numbers-sffnumbers"},
+    {"odp", @"application/vnd.oasis.opendocument.presentation"},
+    {"ods", @"application/vnd.oasis.opendocument.spreadsheet"},
+    {"odt", @"application/vnd.oasis.opendocument.text"},
+    {"oga", @"audio/ogg"},
+    {"ogg", @"audio/ogg"},
+    {"ogv", @"video/ogg"},
+    {"otf", @"font/otf"},
+    {"pages", @"application/x-iwork-pages-sffpages"},
+    {"pdf", @"application/pdf"},
+    {"plist", @"application/x-plist"},
+    {"png", @"image/png"},
+    {"ppt", @"application/vnd.ms-powerpoint"},
+    {"pptx", @"application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"rar", @"application/vnd.rar"},
+    {"rtf", @"application/rtf"},
+    {"svg", @"image/svg+xml"},
+    {"swf", @"application/x-shockwave-flash"},
+    {"tar", @"application/x-tar"},
+    {"tif", @"image/tiff"},
+    {"tiff", @"image/tiff"},
+    {"ts", @"video/mp2t"},
+    {"ttf", @"font/ttf"},
+    {"txt", @"text/plain"},
+    {"wav", @"audio/wav"},
+    {"webm", @"video/webm"},
+    {"webp", @"image/webp"},
+    {"wma", @"audio/x-ms-wma"},
+    {"wmv", @"video/x-ms-wmv"},
+    {"woff", @"font/woff"},
+    {"woff2", @"font/woff2"},
+    {"xls", @"application/vnd.ms-excel"},
+    {"xlsx", @"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"xml", @"application/xml"},
+    {"zip", @"application/zip"},
+};
+
+static int WBMIMETypeTableCompare(const void *key, const void *element) {
+    return strcmp((const char *)key, *(const char * const *)element);
+}
+
+//平台 API 查询到的结果的缓存，数量有上限，避免随意的扩展名让缓存无限增长
+static NSUInteger const kWBMIMETypeCacheCountLimit = 256;
+static WBLock WBMIMETypeCacheLock = WB_LOCK_INIT;
+static NSMutableDictionary <NSString *, NSString *> *WBMIMETypeCache = nil;
+
+/*
+ 先在内置的有序表中二分查找，不加锁、不分配内存；
+ 表中没有的扩展名才调用 UTType 查询（只在 Apple 平台上可用），结果缓存起来，之后同样的扩展名不再查询。
+ */
+static NSString * WBContentTypeForPathExtension(NSString *extension){
+    
+    char lowercaseExtension[16];
+    if ([extension getCString:lowercaseExtension maxLength:sizeof(lowercaseExtension) encoding:NSASCIIStringEncoding]) {
+        for (char *character = lowercaseExtension; *character; character++) {
+            if (*character >= 'A' && *character <= 'Z') {
+                *character += 'a' - 'A';
+            }
+        }
+        const void *entry = bsearch(lowercaseExtension, WBMIMETypeTable, sizeof(WBMIMETypeTable) / sizeof(WBMIMETypeTable[0]), sizeof(WBMIMETypeTable[0]), WBMIMETypeTableCompare);
+        if (entry) {
+            return ((const __typeof__(WBMIMETypeTable[0]) *)entry)->MIMEType;
+        }
+    }
+    
+    NSString *cacheKey = [extension lowercaseString];
+    WBLockLock(&WBMIMETypeCacheLock);
+    NSString *contentType = WBMIMETypeCache[cacheKey];
+    WBLockUnlock(&WBMIMETypeCacheLock);
+    if (contentType) {
+        return contentType;
+    }
+    
+#if defined(__APPLE__)
+    NSString *UTI = (__bridge_transfer NSString *)UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge  CFStringRef)extension, NULL);
+    contentType = (__bridge_transfer NSString *)UTTypeCopyPreferredTagWithClass((__bridge  CFStringRef)UTI, kUTTagClassMIMEType);
+#endif
+    if (!contentType) {
+        contentType = @"application/octet-stream";
+    }
+    
+    WBLockLock(&WBMIMETypeCacheLock);
+    if (!WBMIMETypeCache) {
+        WBMIMETypeCache = [NSMutableDictionary dictionary];
+    }
+    if ([WBMIMETypeCache count] < kWBMIMETypeCacheCountLimit) {
+        WBMIMETypeCache[cacheKey] = contentType;
+    }
+    WBLockUnlock(&WBMIMETypeCacheLock);
+    return contentType;
+}
+
+NSUInteger const kWBUploadStream3GSuggestedPacketSize = 1024 * 16;
+NSTimeInterval const kWBUploadStream3GSuggestedDelay = 0.2;
+
+#pragma mark - WBMultipartFormPartChecksum
+
+//CRC32C（Castagnoli）多项式的反转形式
+static uint32_t const WBCRC32CPolynomial = 0x82F63B78;
+
+static uint32_t WBCRC32CUpdate(uint32_t crc, const uint8_t *bytes, size_t length) {
+#if defined(__ARM_FEATURE_CRC32)
+    //arm64 上直接使用 CRC32C 指令，每次处理 8 个字节
+    while (length >= 8) {
+        uint64_t value;
+        memcpy(&value, bytes, sizeof(value));
+        crc = __crc32cd(crc, value);
+        bytes += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = __crc32cb(crc, *bytes++);
+    }
+    return crc;
+#else
+    static uint32_t table[256];
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        for (uint32_t index = 0; index < 256; index++) {
+            uint32_t value = index;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? (value >> 1) ^ WBCRC32CPolynomial : (value >> 1);
+            }
+            table[index] = value;
+        }
+    });
+    while (length-- > 0) {
+        crc = table[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+#endif
+}
+
+@interface WBMultipartFormPartChecksum ()
+
+@property (readwrite, nonatomic, assign) NSUInteger index;
+
+@property (readwrite, nonatomic, copy) NSDictionary <NSString *, NSString *> *headers;
+
+@property (readwrite, nonatomic, assign) unsigned long long bodyOffset;
+
+@property (readwrite, nonatomic, assign) unsigned long long bodyLength;
+
+@property (readwrite, nonatomic, assign) uint32_t CRC32C;
+
+@property (readwrite, nonatomic, copy) NSData *SHA256;
+
+@end
+
+@implementation WBMultipartFormPartChecksum
+
+- (NSString *)description{
+    return [NSString stringWithFormat:@"<%@: %p, index: %lu, bodyOffset: %llu, bodyLength: %llu, CRC32C: %08x, SHA256: %@>", NSStringFromClass([self class]), self, (unsigned long)self.index, self.bodyOffset, self.bodyLength, self.CRC32C, self.SHA256];
+}
+
+@end
+
+#pragma mark - WBMultipartFormFileBatchReport
+
+@interface WBMultipartFormFileBatchReport ()
+
+@property (readwrite, nonatomic, copy) NSArray <NSNumber *> *fileLengths;
+
+@property (readwrite, nonatomic, copy) NSArray <NSData *> *SHA256Digests;
+
+@property (readwrite, nonatomic, assign) unsigned long long totalLength;
+
+@property (readwrite, nonatomic, assign) NSTimeInterval elapsedTime;
+
+@property (readwrite, nonatomic, assign) NSTimeInterval cumulativeFileTime;
+
+@end
+
+@implementation WBMultipartFormFileBatchReport
+
+- (NSString *)description{
+    return [NSString stringWithFormat:@"<%@: %p, files: %lu, totalLength: %llu, elapsedTime: %.3fs, cumulativeFileTime: %.3fs>", NSStringFromClass([self class]), self, (unsigned long)[self.fileLengths count], self.totalLength, self.elapsedTime, self.cumulativeFileTime];
+}
+
+@end
+
+//批量拼接时每个文件的处理结果，由 worker 写入，各自只写自己的下标
+typedef struct {
+    unsigned long long length;
+    int errorCode;
+    uint64_t duration;
+    unsigned char digest[WB_SHA256_DIGEST_LENGTH];
+} WBMultipartFormFileResult;
+
+//每个 worker 读取文件计算 SHA-256 时使用的缓冲区大小
+static size_t const kWBMultipartFormFileHashBufferSize = 256 * 1024;
+
+//获取文件长度，需要时读取整个文件计算 SHA-256；buffer 由 worker 复用
+static void WBMultipartFormExamineFile(NSURL *fileURL, BOOL computesSHA256, uint8_t *buffer, WBMultipartFormFileResult *result) {
+    
+    uint64_t startTime = WBMonotonicTimeNanoseconds();
+    const char *path = [[fileURL path] fileSystemRepresentation];
+    struct stat fileStat;
+    
+    if (!computesSHA256) {
+        if (stat(path, &fileStat) != 0) {
+            result->errorCode = errno;
+        }else{
+            result->length = (unsigned long long)fileStat.st_size;
+        }
+        result->duration = WBMonotonicTimeNanoseconds() - startTime;
+        return;
+    }
+    
+    int fileDescriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0 || fstat(fileDescriptor, &fileStat) != 0) {
+        result->errorCode = errno;
+    }else{
+        result->length = (unsigned long long)fileStat.st_size;
+        WBSHA256Context context;
+        WBSHA256Init(&context);
+        ssize_t numberOfBytesRead;
+        while ((numberOfBytesRead = read(fileDescriptor, buffer, kWBMultipartFormFileHashBufferSize)) != 0) {
+            if (numberOfBytesRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                result->errorCode = errno;
+                break;
+            }
+            WBSHA256Update(&context, buffer, (size_t)numberOfBytesRead);
+        }
+        WBSHA256Final(&context, result->digest);
+    }
+    if (fileDescriptor >= 0) {
+        close(fileDescriptor);
+    }
+    result->duration = WBMonotonicTimeNanoseconds() - startTime;
+}
+
+#pragma mark - WBHTTPBodyPart
+
+//appendPartWithInputStream: 传入 length 为 -1 时，body 的长度未知，需要使用 chunked 方式上传
+static unsigned long long const WBHTTPBodyPartUnknownContentLength = ULLONG_MAX;
+
+//body part 的读取阶段：分隔符 -> 头信息 -> 内容 -> 结束分隔符
+typedef NS_ENUM(NSInteger, WBHTTPBodyPartReadPhase) {
+    WBEncapsulationBoundaryPhase = 1,
+    WBHeaderPhase                = 2,
+    WBBodyPhase                  = 3,
+    WBFinalBoundaryPhase         = 4,
+    WBCompletedPhase             = 5,
+};
+
+@interface WBHTTPBodyPart : NSObject<NSCopying>
+
+@property (nonatomic, assign) NSStringEncoding stringEncoding;
+
+@property (nonatomic, strong) NSDictionary *headers;
+
+@property (nonatomic, copy) NSString *bounday;
+
+@property (nonatomic, strong) id body;
+
+@property (nonatomic, assign) unsigned long long bodyContentLength;
+
+@property (nonatomic, strong) NSInputStream *inputStream;
+
+@property (nonatomic, assign) BOOL hasInitialBounday;
+
+@property (nonatomic, assign) BOOL hasFinalBounday;
+
+@property (nonatomic, readonly, assign, getter=hasByTesAvailable) BOOL bytesAvailable;
+
+@property (nonatomic, readonly, assign) unsigned long long cententLength;
+
+//读取失败时的错误信息
+@property (nonatomic, readonly, strong) NSError *error;
+
+//预先编码好的结束分隔符
+- (NSData *)finalBoundaryData;
+
+- (NSInteger)read:(uint8_t *)buffer
+        maxLength:(NSUInteger)length;
+
+//关闭文件描述符或输入流，并回到初始阶段
+- (void)close;
+
+//是否在读取 body 时计算校验和
+@property (nonatomic, assign) BOOL computesChecksum;
+
+//part 开头到 body 第一个字节的长度
+- (unsigned long long)bodyOffset;
+
+//跳到 part 内的 offset 处，下一次读取从这里开始
+- (BOOL)seekToOffset:(unsigned long long)offset;
+
+//body 读完后返回它的校验和（index 和 bodyOffset 由 stream 填写），取出后清空
+- (WBMultipartFormPartChecksum *)takeChecksum;
+
+@end
+
+
+#pragma mark - WBStreamingMultipartFormData
+
+@interface WBStreamingMultipartFormData()
+
+@property (readwrite, nonatomic, copy) NSMutableURLRequest *request;
+
+@property (readwrite, nonatomic, assign) NSStringEncoding stringEncoding;
+
+@property (readwrite, nonatomic, copy) NSString *boundray;
+
+@property (readwrite, nonatomic, strong) WBMultipartBodyStream *bodyStream;
+
+
+@end
+
+@implementation WBStreamingMultipartFormData
+
+- (instancetype)initWithURLRequest:(NSMutableURLRequest *)urlRequest stringEncoding:(NSStringEncoding)encoding{
+    self = [super init];
+    if (!self) {
+        return  nil;
+    }
+    self.request = urlRequest;
+    self.stringEncoding = encoding;
+    self.boundray = WBCreateMultipartFormBoundary();
+    self.bodyStream = [[WBMultipartBodyStream alloc]initWithStringEncoding:encoding];
+    return self;
+}
+
+- (void)setRequest:(NSMutableURLRequest *)request{
+    _request = [request mutableCopy];
+    
+}
+
+- (BOOL)appendPartWithFileURL:(NSURL *)fileURL name:(NSString *)name error:(NSError * _Nullable __autoreleasing *)error{
+    
+    NSParameterAssert(fileURL);
+    NSParameterAssert(name);
+    NSString *fileName = [fileURL lastPathComponent];
+    NSString *mimeType = WBContentTypeForPathExtension([fileURL pathExtension]);
+    return [self appendPartWithFileURL:fileURL name:name fileName:fileName mimeType:mimeType error:error];
+    
+}
+
+- (BOOL)appendPartWithFileURL:(NSURL *)fileURL name:(NSString *)name fileName:(NSString *)fileName mimeType:(NSString *)mimeType error:(NSError * _Nullable __autoreleasing *)error{
+    
+    NSParameterAssert(fileURL);
+    NSParameterAssert(name);
+    NSParameterAssert(fileName);
+    NSParameterAssert(mimeType);
+    if (![fileURL isFileURL]) {
+        //如果不是地址
+        NSDictionary *userInfo = @{NSLocalizedFailureReasonErrorKey:NSLocalizedStringFromTable(@"Expected URL to be a file URL", @"WBNetworking", nil)};
+        if (error) {
+            *error = [[NSError alloc]initWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorBadURL userInfo:userInfo];
+        }
+        return NO;
+    }
+    
+    NSDictionary *fileAttributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[fileURL path] error:error];
+    //如果地址信息不存在
+    if (!fileAttributes) {
+        return NO;
+    }
+    
+    [self appendPartWithFileURL:fileURL name:name fileName:fileName mimeType:mimeType length:[fileAttributes[NSFileSize] unsignedLongLongValue]];
+    
+    return YES;
+    
+}
+
+- (void)appendPartWithFileURL:(NSURL *)fileURL name:(NSString *)name fileName:(NSString *)fileName mimeType:(NSString *)mimeType length:(unsigned long long)length{
+    
+    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
+    
+    [mutableHeaders setValue:[NSString stringWithFormat:@"form-data;name=\"%@\";filename=\"%@\"",name,fileName] forKey:@"Content-Disposition"];
+    [mutableHeaders setValue:mimeType forKey:@"Content-Type"];
+    
+    WBHTTPBodyPart *bodyPart = [[WBHTTPBodyPart alloc]init];
+    bodyPart.stringEncoding = self.stringEncoding;
+    bodyPart.headers = mutableHeaders;
+    bodyPart.bounday = self.boundray;
+    bodyPart.body = fileURL;
+    bodyPart.bodyContentLength = length;
+    [self.bodyStream appendHTTPBodyPart:bodyPart];
+}
+
+- (WBMultipartFormFileBatchReport *)appendPartsWithFileURLs:(NSArray<NSURL *> *)fileURLs name:(NSString *)name computesSHA256:(BOOL)computesSHA256 maxConcurrentFileCount:(NSUInteger)maxConcurrentFileCount error:(NSError * _Nullable __autoreleasing *)error{
+    
+    NSParameterAssert(fileURLs);
+    NSParameterAssert(name);
+    uint64_t startTime = WBMonotonicTimeNanoseconds();
+    
+    for (NSURL *fileURL in fileURLs) {
+        if (![fileURL isFileURL]) {
+            NSDictionary *userInfo = @{NSLocalizedFailureReasonErrorKey:NSLocalizedStringFromTable(@"Expected URL to be a file URL", @"WBNetworking", nil)};
+            if (error) {
+                *error = [[NSError alloc]initWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorBadURL userInfo:userInfo];
+            }
+            return nil;
+        }
+    }
+    
+    NSUInteger fileCount = [fileURLs count];
+    size_t workerCount = maxConcurrentFileCount ?: [[NSProcessInfo processInfo] activeProcessorCount];
+    workerCount = MAX(MIN(workerCount, (size_t)fileCount), (size_t)1);
+    WBMultipartFormFileResult *results = calloc(MAX(fileCount, (NSUInteger)1), sizeof(WBMultipartFormFileResult));
+    if (!results) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+        }
+        return nil;
+    }
+    
+    //每个 worker 按步长处理一部分文件，worker 数量就是并发上限；dispatch_apply 返回时所有文件都已处理完
+    dispatch_apply(workerCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t worker) {
+        uint8_t *buffer = computesSHA256 ? malloc(kWBMultipartFormFileHashBufferSize) : NULL;
+        for (size_t index = worker; index < fileCount; index += workerCount) {
+            if (computesSHA256 && !buffer) {
+                results[index].errorCode = ENOMEM;
+                continue;
+            }
+            WBMultipartFormExamineFile(fileURLs[index], computesSHA256, buffer, &results[index]);
+        }
+        free(buffer);
+    });
+    
+    for (NSUInteger index = 0; index < fileCount; index++) {
+        if (results[index].errorCode != 0) {
+            if (error) {
+                *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:results[index].errorCode userInfo:@{NSURLErrorKey : fileURLs[index]}];
+            }
+            free(results);
+            return nil;
+        }
+    }
+    
+    NSMutableArray <NSNumber *> *fileLengths = [NSMutableArray arrayWithCapacity:fileCount];
+    NSMutableArray <NSData *> *digests = computesSHA256 ? [NSMutableArray arrayWithCapacity:fileCount] : nil;
+    unsigned long long totalLength = 0;
+    uint64_t cumulativeDuration = 0;
+    for (NSUInteger index = 0; index < fileCount; index++) {
+        NSURL *fileURL = fileURLs[index];
+        [self appendPartWithFileURL:fileURL name:name fileName:[fileURL lastPathComponent] mimeType:WBContentTypeForPathExtension([fileURL pathExtension]) length:results[index].length];
+        
+        [fileLengths addObject:@(results[index].length)];
+        [digests addObject:[NSData dataWithBytes:results[index].digest length:WB_SHA256_DIGEST_LENGTH]];
+        totalLength += results[index].length;
+        cumulativeDuration += results[index].duration;
+    }
+    free(results);
+    
+    WBMultipartFormFileBatchReport *report = [[WBMultipartFormFileBatchReport alloc] init];
+    report.fileLengths = fileLengths;
+    report.SHA256Digests = digests;
+    report.totalLength = totalLength;
+    report.cumulativeFileTime = (NSTimeInterval)cumulativeDuration / NSEC_PER_SEC;
+    report.elapsedTime = (NSTimeInterval)(WBMonotonicTimeNanoseconds() - startTime) / NSEC_PER_SEC;
+    return report;
+}
+
+- (void)appendPartWithInputStream:(NSInputStream *)inputStream name:(NSString *)name fileName:(NSString *)fileName length:(int64_t)length mimeType:(NSString *)mimeType{
+    
+    NSParameterAssert(name);
+    NSParameterAssert(fileName);
+    NSParameterAssert(mimeType);
+    
+    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
+    [mutableHeaders setValue:[NSString stringWithFormat:@"form-data;name=\"%@\";filename=\"%@\"",name,fileName] forKey:@"Content-Disposition"];
+    [mutableHeaders setValue:mimeType forKey:@"Content-Type"];
+    
+    WBHTTPBodyPart *bodyPart = [[WBHTTPBodyPart alloc]init];
+    bodyPart.stringEncoding = self.stringEncoding;
+    bodyPart.headers = mutableHeaders;
+    bodyPart.bounday = self.boundray;
+    bodyPart.inputStream = inputStream;
+    bodyPart.bodyContentLength = length < 0 ? WBHTTPBodyPartUnknownContentLength : (unsigned long long)length;
+    [self.bodyStream appendHTTPBodyPart:bodyPart];
+    
+}
+
+- (void)appendPartWithFileData:(NSData *)data name:(NSString *)name fileName:(NSString *)fileName mimeType:(NSString *)mimeType{
+    
+    NSParameterAssert(name);
+    NSParameterAssert(fileName);
+    NSParameterAssert(mimeType);
+    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
+    [mutableHeaders setValue:[NSString stringWithFormat:@"form-data;name=\"%@\";filename=\"%@\"",name,fileName] forKey:@"Content-Disposition"];
+    [mutableHeaders setValue:mimeType forKey:@"Content-Type"];
+    [self appendPartWithHeaders:mutableHeaders body:data];
+}
+
+- (void)appendPartWithFormData:(NSData *)data name:(NSString *)name{
+    
+    NSParameterAssert(name);
+    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
+    [mutableHeaders setValue:[NSString stringWithFormat:@"form-data;name=\"%@\"",name] forKey:@"Content-Disposition"];
+    [self appendPartWithHeaders:mutableHeaders body:data];
+    
+}
+
+- (void)appendPartWithHeaders:(NSDictionary<NSString *,NSString *> *)headers body:(NSData *)body{
+    
+    NSParameterAssert(body);
+    WBHTTPBodyPart *bodyPart = [[WBHTTPBodyPart alloc]init];
+    bodyPart.stringEncoding = self.stringEncoding;
+    bodyPart.headers = headers;
+    bodyPart.bounday = self.boundray;
+    bodyPart.bodyContentLength = [body length];
+    bodyPart.body = body;
+    [self.bodyStream appendHTTPBodyPart:bodyPart];
+}
+
+- (void)throttleBandwidthWithPacketSize:(NSUInteger)numberOfBytes delay:(NSTimeInterval)delay{
+    
+    //每 delay 秒一个包，换算成每秒的字节数，突发量为一个包
+    if (numberOfBytes == 0 || delay <= 0) {
+        self.bodyStream.rateLimiter = nil;
+        return;
+    }
+    NSUInteger bytesPerSecond = (NSUInteger)MAX((double)numberOfBytes / delay, 1.0);
+    self.bodyStream.rateLimiter = [[WBUploadRateLimiter alloc] initWithBytesPerSecond:bytesPerSecond burstSize:numberOfBytes];
+}
+
+- (void)throttleBandwidthWithRateLimiter:(WBUploadRateLimiter *)rateLimiter{
+    
+    self.bodyStream.rateLimiter = rateLimiter;
+}
+
+- (void)computePartChecksumsWithHandler:(void (^)(WBMultipartFormPartChecksum * _Nonnull))handler{
+    
+    self.bodyStream.partChecksumHandler = handler;
+}
+
+- (NSMutableURLRequest *)requestByFinalizingMultipartFormData{
+    
+    if ([self.bodyStream isEmpty]) {
+        return  self.request;
+    }
+    
+    [self.bodyStream setInitialAndFinalBoundaries];
+    [self.request setHTTPBodyStream:self.bodyStream];
+    
+    [self.request setValue:[NSString stringWithFormat:@"multipart/form-data;boundary=%@",self.boundray ] forHTTPHeaderField:@"Content-Type"];
+    //有长度未知的输入流时无法确定 Content-Length，改为 chunked 传输
+    if ([self.bodyStream hasUnknownContentLength]) {
+        [self.request setValue:nil forHTTPHeaderField:@"Content-Length"];
+        [self.request setValue:@"chunked" forHTTPHeaderField:@"Transfer-Encoding"];
+    }else{
+        [self.request setValue:[NSString stringWithFormat:@"%llu",[self.bodyStream contentLength]] forHTTPHeaderField:@"Content-Length"];
+    }
+    return  self.request;
+}
+
+
+@end
+
+#pragma mark -
+
+@interface WBMultipartBodyStream ()
+
+@property (readwrite, nonatomic, assign) NSStreamStatus streamStatus;
+
+@property (readwrite, nonatomic, strong) NSError *streamError;
+
+@property (readwrite, nonatomic, assign) NSStringEncoding stringEncoding;
+
+@property (readwrite, nonatomic, strong) NSMutableArray *HTTPBodyParts;
+
+@property (readwrite, nonatomic, strong) WBHTTPBodyPart *currentHTTPBodyPart;
+
+//当前带有结束分隔符的 part
+@property (readwrite, nonatomic, weak) WBHTTPBodyPart *finalBoundaryHTTPBodyPart;
+
+@property (readwrite, nonatomic, assign, getter=hasUnknownContentLength) BOOL unknownContentLength;
+
+@property (readwrite, nonatomic, strong) WBInputStreamClient *client;
+
+@end
+
+@implementation WBMultipartBodyStream {
+    //已经向 rateLimiter 注册了唤醒，避免重复注册
+    atomic_bool _waitingForBytes;
+    //hasBytesAvailable 或者唤醒时为这个 stream 预留的令牌，之后的 read: 直接使用，不会被共用 rateLimiter 的其他 stream 取走
+    WBLock _reservationLock;
+    NSUInteger _reservedBytes;
+    //当前正在读取的 body part 下标，只持有一个 part 的读取状态，额外内存与 part 数量无关
+    NSUInteger _currentHTTPBodyPartIndex;
+    //append 时累加的长度，每个 part 都按 encapsulation 分隔符 + 头信息 + body 计算
+    unsigned long long _HTTPBodyPartsContentLength;
+    //已经读出的数据在整个 body 中的位置，以及当前 part 的起始位置
+    unsigned long long _streamOffset;
+    unsigned long long _currentHTTPBodyPartStartOffset;
+}
+@synthesize delegate;
+@synthesize streamStatus;
+@synthesize streamError;
+@synthesize bytesAvailableHandler;
+
+- (instancetype)initWithStringEncoding:(NSStringEncoding)encoding{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.stringEncoding = encoding;
+    self.HTTPBodyParts = [NSMutableArray array];
+    self.client = [[WBInputStreamClient alloc] init];
+    WBLockInit(&_reservationLock);
+    return self;
+}
+
+//append 的 part 都不带首尾分隔符，这里只需要修正第一个和最后一个 part，不需要遍历
+- (void)setInitialAndFinalBoundaries{
+    
+    if ([self.HTTPBodyParts count] > 0) {
+        [[self.HTTPBodyParts firstObject] setHasInitialBounday:YES];
+        
+        WBHTTPBodyPart *lastBodyPart = [self.HTTPBodyParts lastObject];
+        if (self.finalBoundaryHTTPBodyPart != lastBodyPart) {
+            self.finalBoundaryHTTPBodyPart.hasFinalBounday = NO;
+            lastBodyPart.hasFinalBounday = YES;
+            self.finalBoundaryHTTPBodyPart = lastBodyPart;
+        }
+    }
+}
+
+- (void)appendHTTPBodyPart:(WBHTTPBodyPart *)bodyPart{
+    
+    bodyPart.hasInitialBounday = NO;
+    bodyPart.hasFinalBounday = NO;
+    if (bodyPart.bodyContentLength == WBHTTPBodyPartUnknownContentLength) {
+        self.unknownContentLength = YES;
+    }else{
+        //cententLength 会预先编码分隔符和头信息，之后读取时不再重复编码
+        _HTTPBodyPartsContentLength += [bodyPart cententLength];
+    }
+    [self.HTTPBodyParts addObject:bodyPart];
+}
+
+- (BOOL)isEmpty{
+    return [self.HTTPBodyParts count] == 0;
+}
+
+//O(1)：在累加值上减去第一个 part 的开头 CRLF（initial 分隔符比 encapsulation 分隔符少一个 CRLF），再加上结束分隔符
+- (unsigned long long)contentLength{
+    
+    if ([self isEmpty]) {
+        return 0;
+    }
+    WBHTTPBodyPart *lastBodyPart = [self.HTTPBodyParts lastObject];
+    unsigned long long length = _HTTPBodyPartsContentLength;
+    length -= [[kWBMultipartFormCRLF dataUsingEncoding:self.stringEncoding] length];
+    length += [[lastBodyPart finalBoundaryData] length];
+    return length;
+}
+
+#pragma mark - NSInputStream
+
+//直接把各个 part 的数据写入调用方的 buffer，不经过中间缓冲区
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)length{
+    
+    if ([self streamStatus] == NSStreamStatusClosed || [self streamStatus] == NSStreamStatusAtEnd) {
+        return 0;
+    }
+    if ([self streamStatus] == NSStreamStatusError) {
+        return -1;
+    }
+    
+    //限速时只读取取到令牌的字节数，先用预留的令牌。
+    //事件驱动的 client 只在 hasBytesAvailable 为 YES 或者收到可读事件之后读取，这两种情况都已经预留了令牌，这里不会阻塞；
+    //只有没有注册回调、直接同步读取的调用方才会等待令牌
+    WBUploadRateLimiter *rateLimiter = self.rateLimiter;
+    NSUInteger maxLength = length;
+    if (rateLimiter) {
+        maxLength = [self takeReservedBytesUpTo:length];
+        if (maxLength < length) {
+            maxLength += [rateLimiter consumeBytesUpTo:length - maxLength];
+        }
+        if (maxLength == 0) {
+            maxLength = [rateLimiter waitForBytesUpTo:length];
+        }
+    }
+    NSInteger totalNumberOfBytesRead = 0;
+    
+    while ((NSUInteger)totalNumberOfBytesRead < maxLength) {
+        if (!self.currentHTTPBodyPart || ![self.currentHTTPBodyPart hasByTesAvailable]) {
+            [self.currentHTTPBodyPart close];
+            if (_currentHTTPBodyPartIndex >= [self.HTTPBodyParts count]) {
+                self.currentHTTPBodyPart = nil;
+                self.streamStatus = NSStreamStatusAtEnd;
+                break;
+            }
+            self.currentHTTPBodyPart = self.HTTPBodyParts[_currentHTTPBodyPartIndex++];
+            self.currentHTTPBodyPart.computesChecksum = (self.partChecksumHandler != nil);
+            _currentHTTPBodyPartStartOffset = _streamOffset + (unsigned long long)totalNumberOfBytesRead;
+            continue;
+        }
+        
+        NSInteger numberOfBytesRead = [self.currentHTTPBodyPart read:&buffer[totalNumberOfBytesRead] maxLength:maxLength - (NSUInteger)totalNumberOfBytesRead];
+        if (numberOfBytesRead < 0) {
+            self.streamError = self.currentHTTPBodyPart.error;
+            self.streamStatus = NSStreamStatusError;
+            [rateLimiter returnBytes:maxLength - (NSUInteger)totalNumberOfBytesRead];
+            [self returnReservedBytes];
+            return -1;
+        }
+        totalNumberOfBytesRead += numberOfBytesRead;
+        
+        if (self.partChecksumHandler) {
+            [self reportChecksumOfCurrentHTTPBodyPart];
+        }
+    }
+    _streamOffset += (unsigned long long)totalNumberOfBytesRead;
+    
+    if (rateLimiter) {
+        [rateLimiter returnBytes:maxLength - (NSUInteger)totalNumberOfBytesRead];
+        if (self.streamStatus == NSStreamStatusAtEnd) {
+            [self returnReservedBytes];
+            [self.client signalEvent:kCFStreamEventEndEncountered forStream:self];
+        }else{
+            //事件驱动的 client 读完这一块后等待下一个可读事件
+            [self scheduleBytesAvailableEvent];
+        }
+    }
+    
+    return totalNumberOfBytesRead;
+}
+
+- (void)reportChecksumOfCurrentHTTPBodyPart{
+    
+    WBMultipartFormPartChecksum *checksum = [self.currentHTTPBodyPart takeChecksum];
+    if (checksum) {
+        checksum.index = _currentHTTPBodyPartIndex - 1;
+        checksum.bodyOffset = _currentHTTPBodyPartStartOffset + [self.currentHTTPBodyPart bodyOffset];
+        self.partChecksumHandler(checksum);
+    }
+}
+
+#pragma mark - 预留令牌
+
+//已经有预留的令牌，或者能从 rateLimiter 中取到令牌时返回 YES。预留的令牌只会被这个 stream 的 read: 使用
+- (BOOL)reserveBytes{
+    
+    WBLockLock(&_reservationLock);
+    BOOL hasReservedBytes = (_reservedBytes > 0);
+    WBLockUnlock(&_reservationLock);
+    if (hasReservedBytes) {
+        return YES;
+    }
+    NSUInteger granted = [self.rateLimiter consumeBytesUpTo:kWBMultipartBodyStreamReservationSize];
+    if (granted == 0) {
+        return NO;
+    }
+    WBLockLock(&_reservationLock);
+    _reservedBytes += granted;
+    WBLockUnlock(&_reservationLock);
+    return YES;
+}
+
+- (NSUInteger)takeReservedBytesUpTo:(NSUInteger)length{
+    WBLockLock(&_reservationLock);
+    NSUInteger taken = MIN(_reservedBytes, length);
+    _reservedBytes -= taken;
+    WBLockUnlock(&_reservationLock);
+    return taken;
+}
+
+//读完、出错或者关闭时把预留的令牌还给 rateLimiter
+- (void)returnReservedBytes{
+    WBLockLock(&_reservationLock);
+    NSUInteger reservedBytes = _reservedBytes;
+    _reservedBytes = 0;
+    WBLockUnlock(&_reservationLock);
+    [self.rateLimiter returnBytes:reservedBytes];
+}
+
+//rateLimiter 补充令牌后先为自己预留令牌再发送可读事件，令牌被其他 stream 取走时重新等待
+- (void)scheduleBytesAvailableEvent{
+    
+    if (atomic_exchange(&_waitingForBytes, true)) {
+        return;
+    }
+    __weak __typeof(self) weakSelf = self;
+    [self.rateLimiter notifyWhenBytesAvailable:^{
+        __strong __typeof(weakSelf) strongSelf = weakSelf;
+        if (!strongSelf) {
+            return;
+        }
+        atomic_store(&strongSelf->_waitingForBytes, false);
+        if (strongSelf.streamStatus != NSStreamStatusOpen) {
+            return;
+        }
+        if (![strongSelf reserveBytes]) {
+            [strongSelf scheduleBytesAvailableEvent];
+            return;
+        }
+        [strongSelf.client signalEvent:kCFStreamEventHasBytesAvailable forStream:strongSelf];
+        dispatch_block_t bytesAvailableHandler = strongSelf.bytesAvailableHandler;
+        if (bytesAvailableHandler) {
+            bytesAvailableHandler();
+        }
+    }];
+}
+
+- (BOOL)getBuffer:(__unused uint8_t **)buffer length:(__unused NSUInteger *)len{
+    return NO;
+}
+
+- (BOOL)hasBytesAvailable{
+    if ([self streamStatus] != NSStreamStatusOpen) {
+        return NO;
+    }
+    //没有注册回调的调用方无法收到之后的可读事件，只能同步读取
+    if (!self.rateLimiter || (!self.client.hasCallback && !self.bytesAvailableHandler)) {
+        return YES;
+    }
+    //取到的令牌留给接下来的 read:，避免在这里和 read: 之间被其他 stream 取走
+    if ([self reserveBytes]) {
+        return YES;
+    }
+    [self scheduleBytesAvailableEvent];
+    return NO;
+}
+
+#pragma mark - NSStream
+
+- (void)open{
+    if (self.streamStatus == NSStreamStatusOpen) {
+        return;
+    }
+    self.streamStatus = NSStreamStatusOpen;
+    self.streamError = nil;
+    
+    [self setInitialAndFinalBoundaries];
+    _currentHTTPBodyPartIndex = 0;
+    _streamOffset = 0;
+    _currentHTTPBodyPartStartOffset = 0;
+    self.currentHTTPBodyPart = nil;
+    
+    if (self.startOffset > 0 && ![self seekToStartOffset]) {
+        self.streamError = self.streamError ?: [NSError errorWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:@{NSLocalizedFailureReasonErrorKey: NSLocalizedStringFromTable(@"The multipart body cannot be resumed from the requested offset.", @"WBNetworking", nil)}];
+        self.streamStatus = NSStreamStatusError;
+        return;
+    }
+    
+    if (self.rateLimiter) {
+        [self scheduleBytesAvailableEvent];
+    }
+}
+
+- (void)close{
+    [self.currentHTTPBodyPart close];
+    self.currentHTTPBodyPart = nil;
+    self.streamStatus = NSStreamStatusClosed;
+    [self returnReservedBytes];
+}
+
+//把 startOffset 映射到对应的 part 以及 part 内的位置，前面的 part 不会被打开
+- (BOOL)seekToStartOffset{
+    
+    unsigned long long offset = self.startOffset;
+    if (self.unknownContentLength || offset > [self contentLength]) {
+        return NO;
+    }
+    
+    unsigned long long partStartOffset = 0;
+    for (NSUInteger index = 0; index < [self.HTTPBodyParts count]; index++) {
+        WBHTTPBodyPart *bodyPart = self.HTTPBodyParts[index];
+        unsigned long long partLength = [bodyPart cententLength];
+        if (offset < partStartOffset + partLength) {
+            bodyPart.computesChecksum = (self.partChecksumHandler != nil);
+            if (![bodyPart seekToOffset:offset - partStartOffset]) {
+                self.streamError = bodyPart.error;
+                [bodyPart close];
+                return NO;
+            }
+            _currentHTTPBodyPartIndex = index + 1;
+            _currentHTTPBodyPartStartOffset = partStartOffset;
+            _streamOffset = offset;
+            self.currentHTTPBodyPart = bodyPart;
+            return YES;
+        }
+        partStartOffset += partLength;
+    }
+    
+    //正好在末尾，没有剩余的数据
+    _currentHTTPBodyPartIndex = [self.HTTPBodyParts count];
+    _streamOffset = offset;
+    return YES;
+}
+
+- (id)propertyForKey:(__unused NSString *)key{
+    return nil;
+}
+
+- (BOOL)setProperty:(__unused id)property forKey:(__unused NSString *)key{
+    return NO;
+}
+
+- (void)scheduleInRunLoop:(__unused NSRunLoop *)aRunLoop forMode:(__unused NSString *)mode{
+}
+
+- (void)removeFromRunLoop:(__unused NSRunLoop *)aRunLoop forMode:(__unused NSString *)mode{
+}
+
+//NSURLSession 通过 CFReadStream 使用 HTTPBodyStream，需要实现以下私有方法，否则会 crash
+- (void)_scheduleInCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode{
+    [self.client scheduleInRunLoop:aRunLoop forMode:aMode];
+}
+
+- (void)_unscheduleFromCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode{
+    [self.client unscheduleFromRunLoop:aRunLoop forMode:aMode];
+}
+
+- (BOOL)isRateLimited{
+    return self.rateLimiter != nil;
+}
+
+//不限速时数据总是可读，不需要事件回调；限速时记录回调，令牌补充后再通知 CFNetwork 读取
+- (BOOL)_setCFClientFlags:(CFOptionFlags)inFlags callback:(CFReadStreamClientCallBack)inCallback context:(CFStreamClientContext *)inContext{
+    if (!self.rateLimiter) {
+        return NO;
+    }
+    return [self.client setClientFlags:inFlags callback:inCallback context:inContext];
+}
+
+#pragma mark - NSCopying
+//重定向或者认证时 NSURLSession 会重新读取 body，需要返回一个全新读取状态的流
+- (instancetype)copyWithZone:(NSZone *)zone{
+    
+    WBMultipartBodyStream *bodyStreamCopy = [[[self class] allocWithZone:zone] initWithStringEncoding:self.stringEncoding];
+    for (WBHTTPBodyPart *bodyPart in self.HTTPBodyParts) {
+        [bodyStreamCopy appendHTTPBodyPart:[bodyPart copy]];
+    }
+    bodyStreamCopy.rateLimiter = self.rateLimiter;
+    bodyStreamCopy.startOffset = self.startOffset;
+    bodyStreamCopy.partChecksumHandler = self.partChecksumHandler;
+    [bodyStreamCopy setInitialAndFinalBoundaries];
+    return bodyStreamCopy;
+}
+
+@end
+
+#pragma mark -
+
+@interface WBHTTPBodyPart ()
+
+@property (readwrite, nonatomic, strong) NSError *error;
+
+@end
+
+@implementation WBHTTPBodyPart {
+    WBHTTPBodyPartReadPhase _phase;
+    //当前阶段已读取的字节数
+    unsigned long long _phaseReadOffset;
+    //文件类型的 body 直接用 read(2) 读取，避免为每个 part 创建 NSInputStream
+    int _fileDescriptor;
+    //预先编码好的分隔符和头信息，只编码一次
+    NSData *_boundaryData;
+    NSData *_headersData;
+    NSData *_finalBoundaryData;
+    //body 的增量校验和
+    uint32_t _CRC32C;
+    WBSHA256Context _SHA256Context;
+    unsigned long long _checksumLength;
+    WBMultipartFormPartChecksum *_checksum;
+}
+
+- (instancetype)init{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    _phase = WBEncapsulationBoundaryPhase;
+    _fileDescriptor = -1;
+    return self;
+}
+
+- (void)dealloc{
+    [self close];
+}
+
+- (void)setHasInitialBounday:(BOOL)hasInitialBounday{
+    if (_hasInitialBounday != hasInitialBounday) {
+        _hasInitialBounday = hasInitialBounday;
+        _boundaryData = nil;
+    }
+}
+
+- (NSData *)boundaryData{
+    if (!_boundaryData) {
+        NSString *boundary = self.hasInitialBounday ? WBMultipartFormInitialBoundary(self.bounday) : WBMultipartFormEncapsulationBoundary(self.bounday);
+        _boundaryData = [boundary dataUsingEncoding:self.stringEncoding];
+    }
+    return _boundaryData;
+}
+
+- (NSData *)headersData{
+    if (!_headersData) {
+        NSMutableString *headerString = [NSMutableString string];
+        for (NSString *field in [self.headers allKeys]) {
+            [headerString appendFormat:@"%@: %@%@", field, self.headers[field], kWBMultipartFormCRLF];
+        }
+        [headerString appendString:kWBMultipartFormCRLF];
+        _headersData = [headerString dataUsingEncoding:self.stringEncoding];
+    }
+    return _headersData;
+}
+
+- (NSData *)finalBoundaryData{
+    if (!_finalBoundaryData) {
+        _finalBoundaryData = [WBMultipartFormFinalBoundary(self.bounday) dataUsingEncoding:self.stringEncoding];
+    }
+    return _finalBoundaryData;
+}
+
+- (unsigned long long)cententLength{
+    unsigned long long length = 0;
+    length += [[self boundaryData] length];
+    length += [[self headersData] length];
+    if (self.bodyContentLength != WBHTTPBodyPartUnknownContentLength) {
+        length += self.bodyContentLength;
+    }
+    if (self.hasFinalBounday) {
+        length += [[self finalBoundaryData] length];
+    }
+    return length;
+}
+
+- (BOOL)hasByTesAvailable{
+    return _phase != WBCompletedPhase;
+}
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)length{
+    
+    NSInteger totalNumberOfBytesRead = 0;
+    while ((NSUInteger)totalNumberOfBytesRead < length && _phase != WBCompletedPhase) {
+        uint8_t *position = &buffer[totalNumberOfBytesRead];
+        NSUInteger remaining = length - (NSUInteger)totalNumberOfBytesRead;
+        NSInteger numberOfBytesRead = 0;
+        
+        switch (_phase) {
+            case WBEncapsulationBoundaryPhase:
+                numberOfBytesRead = [self readData:[self boundaryData] intoBuffer:position maxLength:remaining];
+                break;
+            case WBHeaderPhase:
+                numberOfBytesRead = [self readData:[self headersData] intoBuffer:position maxLength:remaining];
+                break;
+            case WBBodyPhase:
+                numberOfBytesRead = [self readBodyIntoBuffer:position maxLength:remaining];
+                break;
+            case WBFinalBoundaryPhase:
+                numberOfBytesRead = [self readData:[self finalBoundaryData] intoBuffer:position maxLength:remaining];
+                break;
+            case WBCompletedPhase:
+            default:
+                break;
         }
-    }];
+        
+        if (numberOfBytesRead < 0) {
+            return -1;
+        }
+        totalNumberOfBytesRead += numberOfBytesRead;
+    }
     
-    NSString *query = nil;
-    if (parameters) {
-        if (self.queryStringSerialization) {
-            
-            NSError *serializationError;
-            query = self.queryStringSerialization(request,parameters,&serializationError);
-            
-            if (serializationError) {
-                if (error) {
-                    *error = serializationError;
-                }
-                return nil;
-            }
-        }else{
-            
-            switch (self.queryStringSerializationStyle) {
-                case WBHTTPRequestQueryStringSerializationDefaultStyle:
-                    query = WBQueryStringFromParameters(parameters);
-                    break;
-                    
-                default:
-                    break;
-            }
+    return totalNumberOfBytesRead;
+}
+
+//从内存中的 NSData 直接拷贝到调用方的 buffer，读完后进入下一阶段
+- (NSInteger)readData:(NSData *)data intoBuffer:(uint8_t *)buffer maxLength:(NSUInteger)length{
+    
+    NSUInteger dataLength = [data length];
+    NSUInteger numberOfBytesRead = MIN(dataLength - (NSUInteger)_phaseReadOffset, length);
+    if (numberOfBytesRead > 0) {
+        memcpy(buffer, (const uint8_t *)[data bytes] + _phaseReadOffset, numberOfBytesRead);
+    }
+    _phaseReadOffset += numberOfBytesRead;
+    
+    if (_phaseReadOffset >= dataLength) {
+        [self transitionToNextPhase];
+    }
+    return (NSInteger)numberOfBytesRead;
+}
+
+- (NSInteger)readBodyIntoBuffer:(uint8_t *)buffer maxLength:(NSUInteger)length{
+    
+    NSInteger numberOfBytesRead = [self readBodyContentIntoBuffer:buffer maxLength:length];
+    if (self.computesChecksum) {
+        if (numberOfBytesRead > 0) {
+            [self updateChecksumWithBytes:buffer length:(size_t)numberOfBytesRead];
+        }
+        if (numberOfBytesRead >= 0 && _phase != WBBodyPhase) {
+            [self finishChecksum];
         }
     }
-    if ([self.HTTPMethodsEncodingParametersInURI containsObject:[[request HTTPMethod] uppercaseString]]) {
-        if (query && query.length > 0) {
-            mutableRequest.URL = [NSURL URLWithString:[[mutableRequest.URL absoluteString]stringByAppendingFormat:mutableRequest.URL.query?@"&%@":@"?%@",query]];
+    return numberOfBytesRead;
+}
+
+- (NSInteger)readBodyContentIntoBuffer:(uint8_t *)buffer maxLength:(NSUInteger)length{
+    
+    if ([self.body isKindOfClass:[NSData class]]) {
+        return [self readData:self.body intoBuffer:buffer maxLength:length];
+    }
+    
+    if ([self.body isKindOfClass:[NSURL class]]) {
+        return [self readFileIntoBuffer:buffer maxLength:length];
+    }
+    
+    if (self.inputStream) {
+        if ([self.inputStream streamStatus] == NSStreamStatusNotOpen) {
+            [self.inputStream open];
         }
-    }else{
-        if (!query) {
-            query = @"";
+        NSInteger numberOfBytesRead = [self.inputStream read:buffer maxLength:length];
+        if (numberOfBytesRead < 0) {
+            self.error = self.inputStream.streamError;
+            return -1;
         }
-        if (![mutableRequest valueForHTTPHeaderField:@"Content-Type"]) {
-            [mutableRequest setHTTPBody:[query dataUsingEncoding:self.stringEncoding]];
+        _phaseReadOffset += (unsigned long long)numberOfBytesRead;
+        if (numberOfBytesRead == 0 || [self.inputStream streamStatus] == NSStreamStatusAtEnd) {
+            [self transitionToNextPhase];
         }
-        
+        return numberOfBytesRead;
     }
-    return mutableRequest;
+    
+    [self transitionToNextPhase];
+    return 0;
 }
-#pragma mark - NSKeyValueObserving
-+ (BOOL)automaticallyNotifiesObserversForKey:(NSString *)key{
+
+//文件内容通过 read(2) 直接读到调用方的 buffer 中，只读到 append 时确定的长度，保证和 Content-Length 一致
+- (BOOL)openFileIfNeeded{
+    if (_fileDescriptor < 0) {
+        _fileDescriptor = open([[self.body path] fileSystemRepresentation], O_RDONLY | O_CLOEXEC);
+        if (_fileDescriptor < 0) {
+            self.error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey : self.body}];
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (NSInteger)readFileIntoBuffer:(uint8_t *)buffer maxLength:(NSUInteger)length{
     
-    if ([WBHTTPRequestSerializerObservedKeyPaths() containsObject:key]) {
+    if (![self openFileIfNeeded]) {
+        return -1;
+    }
+    
+    unsigned long long remaining = self.bodyContentLength - _phaseReadOffset;
+    size_t count = (size_t)MIN(remaining, (unsigned long long)length);
+    ssize_t numberOfBytesRead = 0;
+    if (count > 0) {
+        do {
+            numberOfBytesRead = read(_fileDescriptor, buffer, count);
+        } while (numberOfBytesRead < 0 && errno == EINTR);
         
-        return  NO;
+        if (numberOfBytesRead < 0) {
+            self.error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey : self.body}];
+            return -1;
+        }
     }
+    _phaseReadOffset += (unsigned long long)numberOfBytesRead;
     
-    return [super automaticallyNotifiesObserversForKey:key];
+    if (numberOfBytesRead == 0 || _phaseReadOffset >= self.bodyContentLength) {
+        [self transitionToNextPhase];
+    }
+    return (NSInteger)numberOfBytesRead;
 }
 
-- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary<NSKeyValueChangeKey,id> *)change context:(void *)context{
+- (void)transitionToNextPhase{
     
-    if (context == WBHTTPRequestSerializerObserverContext) {
-        if ([change[NSKeyValueChangeNewKey] isEqual:[NSNull null]]) {
-            [self.mutableObservedChangedKeyPaths removeObject:keyPath];
-        }else{
-            [self.mutableObservedChangedKeyPaths addObject:keyPath];
-        }
+    switch (_phase) {
+        case WBEncapsulationBoundaryPhase:
+            _phase = WBHeaderPhase;
+            break;
+        case WBHeaderPhase:
+            _phase = WBBodyPhase;
+            [self resetChecksum];
+            break;
+        case WBBodyPhase:
+            [self closeBody];
+            _phase = self.hasFinalBounday ? WBFinalBoundaryPhase : WBCompletedPhase;
+            break;
+        case WBFinalBoundaryPhase:
+        case WBCompletedPhase:
+        default:
+            _phase = WBCompletedPhase;
+            break;
+    }
+    _phaseReadOffset = 0;
+}
+
+- (void)closeBody{
+    if (_fileDescriptor >= 0) {
+        close(_fileDescriptor);
+        _fileDescriptor = -1;
+    }
+    if (self.inputStream && [self.inputStream streamStatus] != NSStreamStatusNotOpen) {
+        [self.inputStream close];
     }
 }
 
+- (void)close{
+    [self closeBody];
+    _phase = WBEncapsulationBoundaryPhase;
+    _phaseReadOffset = 0;
+}
 
-#pragma mark - NSSecureCoding
-+(BOOL)supportsSecureCoding{
-    return  YES;
+#pragma mark - Resuming
+
+- (unsigned long long)bodyOffset{
+    return [[self boundaryData] length] + [[self headersData] length];
 }
 
-- (instancetype)initWithCoder:(NSCoder *)coder{
-    self = [self init];
-    if (!self) {
-        return  nil;
+//按 分隔符 -> 头信息 -> 内容 -> 结束分隔符 的顺序找到 offset 所在的阶段
+- (BOOL)seekToOffset:(unsigned long long)offset{
+    
+    [self close];
+    
+    unsigned long long boundaryLength = [[self boundaryData] length];
+    if (offset < boundaryLength) {
+        _phaseReadOffset = offset;
+        return YES;
     }
+    offset -= boundaryLength;
+    _phase = WBHeaderPhase;
     
-    self.mutableHTTPRequestHeaders = [[coder decodeObjectOfClass:[NSDictionary class] forKey:NSStringFromSelector(@selector(mutableHTTPRequestHeaders))] mutableCopy];
-    self.queryStringSerializationStyle = (WBHTTPRequestQueryStringSerializationStyle)[[coder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(queryStringSerializationStyle))] unsignedIntegerValue];
-    return self;
+    unsigned long long headersLength = [[self headersData] length];
+    if (offset < headersLength) {
+        _phaseReadOffset = offset;
+        return YES;
+    }
+    offset -= headersLength;
+    _phase = WBBodyPhase;
+    [self resetChecksum];
+    
+    if (self.bodyContentLength == WBHTTPBodyPartUnknownContentLength) {
+        return offset == 0;
+    }
+    if (offset < self.bodyContentLength) {
+        return [self seekBodyToOffset:offset];
+    }
+    offset -= self.bodyContentLength;
+    
+    if (self.hasFinalBounday && offset < [[self finalBoundaryData] length]) {
+        _phase = WBFinalBoundaryPhase;
+        _phaseReadOffset = offset;
+    }else{
+        _phase = WBCompletedPhase;
+    }
+    return YES;
 }
 
-- (void)encodeWithCoder:(NSCoder *)coder{
+//跳过 body 的前 offset 个字节；需要计算校验和时跳过的部分也要计算，保证覆盖整个 body
+- (BOOL)seekBodyToOffset:(unsigned long long)offset{
     
-    dispatch_sync(self.requestHeaderModificationQueue, ^{
-        [coder encodeObject:self.mutableHTTPRequestHeaders forKey:NSStringFromSelector(@selector(mutableHTTPRequestHeaders))];
-    });
+    if ([self.body isKindOfClass:[NSData class]]) {
+        if (self.computesChecksum) {
+            [self updateChecksumWithBytes:[self.body bytes] length:(size_t)offset];
+        }
+        _phaseReadOffset = offset;
+        return YES;
+    }
     
-    [coder encodeObject:@(self.queryStringSerializationStyle) forKey:NSStringFromSelector(@selector(queryStringSerializationStyle))];
+    if ([self.body isKindOfClass:[NSURL class]]) {
+        if (![self openFileIfNeeded]) {
+            return NO;
+        }
+        if (!self.computesChecksum) {
+            if (lseek(_fileDescriptor, (off_t)offset, SEEK_SET) < 0) {
+                self.error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey : self.body}];
+                return NO;
+            }
+            _phaseReadOffset = offset;
+            return YES;
+        }
+    }else if (self.inputStream) {
+        //已经读过的输入流无法回到开头
+        if ([self.inputStream streamStatus] != NSStreamStatusNotOpen) {
+            return NO;
+        }
+        [self.inputStream open];
+        if (!self.computesChecksum && [self.inputStream setProperty:@(offset) forKey:NSStreamFileCurrentOffsetKey]) {
+            _phaseReadOffset = offset;
+            return YES;
+        }
+    }else{
+        return NO;
+    }
+    
+    //文件需要计算校验和，或者输入流不支持 seek 时，读取并丢弃前 offset 个字节
+    uint8_t buffer[16 * 1024];
+    while (_phaseReadOffset < offset) {
+        NSUInteger length = (NSUInteger)MIN((unsigned long long)sizeof(buffer), offset - _phaseReadOffset);
+        NSInteger numberOfBytesRead = [self readBodyIntoBuffer:buffer maxLength:length];
+        if (numberOfBytesRead <= 0 || _phase != WBBodyPhase) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+#pragma mark - Checksum
+
+- (void)resetChecksum{
+    _CRC32C = 0xFFFFFFFF;
+    WBSHA256Init(&_SHA256Context);
+    _checksumLength = 0;
+    _checksum = nil;
+}
+
+- (void)updateChecksumWithBytes:(const uint8_t *)bytes length:(size_t)length{
+    
+    _CRC32C = WBCRC32CUpdate(_CRC32C, bytes, length);
+    _checksumLength += length;
+    WBSHA256Update(&_SHA256Context, bytes, length);
+}
+
+- (void)finishChecksum{
     
+    unsigned char digest[WB_SHA256_DIGEST_LENGTH];
+    WBSHA256Final(&_SHA256Context, digest);
+    
+    WBMultipartFormPartChecksum *checksum = [[WBMultipartFormPartChecksum alloc] init];
+    checksum.headers = self.headers;
+    checksum.bodyLength = _checksumLength;
+    checksum.CRC32C = _CRC32C ^ 0xFFFFFFFF;
+    checksum.SHA256 = [NSData dataWithBytes:digest length:sizeof(digest)];
+    _checksum = checksum;
+}
+
+- (WBMultipartFormPartChecksum *)takeChecksum{
+    WBMultipartFormPartChecksum *checksum = _checksum;
+    _checksum = nil;
+    return checksum;
 }
 
 #pragma mark - NSCopying
+
 - (instancetype)copyWithZone:(NSZone *)zone{
     
-    WBHTTPRequestSerializer *serializer = [[[self class]allocWithZone:zone]init];
-    
-    dispatch_sync(self.requestHeaderModificationQueue, ^{
-        serializer.mutableHTTPRequestHeaders = self.mutableHTTPRequestHeaders;
-    });
-    serializer.queryStringSerializationStyle = self.queryStringSerializationStyle;
-    serializer.queryStringSerialization = self.queryStringSerialization;
-    return serializer;
+    WBHTTPBodyPart *bodyPart = [[[self class] allocWithZone:zone] init];
+    bodyPart.stringEncoding = self.stringEncoding;
+    bodyPart.headers = self.headers;
+    bodyPart.bounday = self.bounday;
+    bodyPart.body = self.body;
+    bodyPart.bodyContentLength = self.bodyContentLength;
+    bodyPart.inputStream = self.inputStream;
+    bodyPart.hasInitialBounday = self.hasInitialBounday;
+    bodyPart.hasFinalBounday = self.hasFinalBounday;
+    return bodyPart;
 }
 
+@end
+
+#pragma mark - WBJSONBodyStream
+
+//每次生成的 JSON 数据块的大小，读取时最多缓存这么多已经编码但还没被读走的数据
+static NSUInteger const kWBJSONBodyStreamChunkSize = 32 * 1024;
+
+//长字符串每次最多转义这么多字节，转义后最多 6 倍，缓冲区的大小和字符串的长度无关
+static NSUInteger const kWBJSONBodyStreamStringChunkSize = 4 * 1024;
 
+//正在写入的数组或字典，按深度复用，分配次数只和最大嵌套深度有关
+@interface WBJSONWriterFrame : NSObject
+@property (nonatomic, strong) id container;
+@property (nonatomic, strong) NSArray *keys;
+@property (nonatomic, assign) NSUInteger index;
+@property (nonatomic, assign) NSUInteger count;
+//字典当前元素的 key 已经写完，下一步写入 ":" 和 value
+@property (nonatomic, assign) BOOL wroteKey;
 @end
 
+@implementation WBJSONWriterFrame
+@end
+
+/*
+ 边读边生成 JSON 的输入流。
+ NSURLSession 每次读取时才继续遍历参数，生成不超过 kWBJSONBodyStreamChunkSize 的数据，
+ 字符串、数字直接以 UTF-8 字节写入缓冲区，不会为每个值生成中间的 NSData，也不会把整个文档放在内存中。
+ */
+@interface WBJSONBodyStream : NSInputStream<NSCopying>
+
+- (instancetype)initWithJSONObject:(id)JSONObject writingOptions:(NSJSONWritingOptions)writingOptions;
+
+@end
+
+@interface WBJSONBodyStream ()
+
+@property (readwrite, nonatomic, assign) NSStreamStatus streamStatus;
+
+@property (readwrite, nonatomic, strong) NSError *streamError;
+
+@property (readwrite, nonatomic, strong) id JSONObject;
+
+@property (readwrite, nonatomic, assign) NSJSONWritingOptions writingOptions;
+
+@property (readwrite, nonatomic, strong) NSMutableArray <WBJSONWriterFrame *> *frames;
+
+@end
+
+@implementation WBJSONBodyStream {
+    WBQueryStringBuffer _pending;
+    size_t _pendingOffset;
+    NSUInteger _depth;
+    BOOL _started;
+    //正在分块写入的字符串，持有 string 和转换出的 data，保证 _stringBytes 有效
+    NSString *_string;
+    NSData *_stringData;
+    const uint8_t *_stringBytes;
+    size_t _stringLength;
+    size_t _stringOffset;
+    BOOL _escapesSlashes;
+}
+@synthesize delegate;
+@synthesize streamStatus;
+@synthesize streamError;
+
+- (instancetype)initWithJSONObject:(id)JSONObject writingOptions:(NSJSONWritingOptions)writingOptions{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.JSONObject = JSONObject;
+    self.writingOptions = writingOptions;
+    self.frames = [NSMutableArray array];
+    return self;
+}
+
+- (void)dealloc{
+    free(_pending.bytes);
+}
+
 #pragma mark -
-static NSString *WBCreateMultipartFormBoundary(){
+
+- (void)writeNewlineAndIndent{
+    if (!(self.writingOptions & NSJSONWritingPrettyPrinted)) {
+        return;
+    }
+    WBQueryStringBufferAppendBytes(&_pending, "\n", 1);
+    for (NSUInteger level = 0; level < _depth; level++) {
+        WBQueryStringBufferAppendBytes(&_pending, "  ", 2);
+    }
+}
+
+//开始写入一个字符串，先写入开头的引号和第一块内容，剩下的内容由之后的 -writeNextToken 继续写入
+- (void)writeString:(NSString *)string{
     
-    return [NSString stringWithFormat:@"Boundary+%08X%08X",arc4random(),arc4random()];
+    size_t length = 0;
+    NSData *UTF8Data = nil;
+    const uint8_t *bytes = WBUTF8BytesForString(string, &length, &UTF8Data);
+    if (!bytes) {
+        UTF8Data = [string dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:YES];
+        bytes = [UTF8Data bytes];
+        length = [UTF8Data length];
+    }
+    _string = string;
+    _stringData = UTF8Data;
+    _stringBytes = bytes;
+    _stringLength = length;
+    _stringOffset = 0;
+    _escapesSlashes = YES;
+#if WB_CAN_USE_AT_AVAILABLE
+    if (@available(iOS 13.0, macOS 10.15, watchOS 6.0, tvOS 13.0, *)) {
+        _escapesSlashes = !(self.writingOptions & NSJSONWritingWithoutEscapingSlashes);
+    }
+#endif
+    
+    WBQueryStringBufferAppendBytes(&_pending, "\"", 1);
+    [self writeStringChunk];
 }
 
-static NSString * const kWBMultipartFormCRLF = @"\r\n";
+//转义字符串接下来的最多 kWBJSONBodyStreamStringChunkSize 个字节，写完时写入结尾的引号。
+//非 ASCII 的字节原样写入，所以从 UTF-8 字符中间分块不会影响结果
+- (void)writeStringChunk{
+    
+    size_t end = MIN(_stringLength, _stringOffset + kWBJSONBodyStreamStringChunkSize);
+    //最坏情况下每个字节转义为 \u00XX
+    WBQueryStringBufferReserve(&_pending, (end - _stringOffset) * 6 + 1);
+    uint8_t *position = _pending.bytes + _pending.length;
+    for (size_t index = _stringOffset; index < end; index++) {
+        uint8_t byte = _stringBytes[index];
+        switch (byte) {
+            case '"':  *position++ = '\\'; *position++ = '"';  break;
+            case '\\': *position++ = '\\'; *position++ = '\\'; break;
+            case '\n': *position++ = '\\'; *position++ = 'n';  break;
+            case '\r': *position++ = '\\'; *position++ = 'r';  break;
+            case '\t': *position++ = '\\'; *position++ = 't';  break;
+            case '\b': *position++ = '\\'; *position++ = 'b';  break;
+            case '\f': *position++ = '\\'; *position++ = 'f';  break;
+            case '/':
+                if (_escapesSlashes) {
+                    *position++ = '\\';
+                }
+                *position++ = '/';
+                break;
+            default:
+                if (byte < 0x20) {
+                    *position++ = '\\'; *position++ = 'u'; *position++ = '0'; *position++ = '0';
+                    *position++ = (uint8_t)WBPercentEscapeHexDigits[byte >> 4];
+                    *position++ = (uint8_t)WBPercentEscapeHexDigits[byte & 0x0F];
+                }else{
+                    *position++ = byte;
+                }
+                break;
+        }
+    }
+    _stringOffset = end;
+    if (_stringOffset == _stringLength) {
+        *position++ = '"';
+        _string = nil;
+        _stringData = nil;
+        _stringBytes = NULL;
+    }
+    _pending.length = (size_t)(position - _pending.bytes);
+}
+
+- (void)writeNumber:(NSNumber *)number{
+    
+    char buffer[64];
+    int length = 0;
+    if ((__bridge CFBooleanRef)number == kCFBooleanTrue) {
+        length = snprintf(buffer, sizeof(buffer), "true");
+    }else if ((__bridge CFBooleanRef)number == kCFBooleanFalse) {
+        length = snprintf(buffer, sizeof(buffer), "false");
+    }else if ([number isKindOfClass:[NSDecimalNumber class]]) {
+        NSString *description = [number description];
+        WBQueryStringBufferAppendBytes(&_pending, [description UTF8String], [description length]);
+        return;
+    }else if (CFNumberIsFloatType((__bridge CFNumberRef)number)) {
+        //找到能够精确还原这个 double 的最短表示
+        double value = [number doubleValue];
+        for (int precision = 15; precision <= 17; precision++) {
+            length = snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+            if (strtod(buffer, NULL) == value) {
+                break;
+            }
+        }
+    }else if (strcmp([number objCType], @encode(unsigned long long)) == 0) {
+        length = snprintf(buffer, sizeof(buffer), "%llu", [number unsignedLongLongValue]);
+    }else{
+        length = snprintf(buffer, sizeof(buffer), "%lld", [number longLongValue]);
+    }
+    WBQueryStringBufferAppendBytes(&_pending, buffer, (size_t)length);
+}
+
+//写入一个值，数组和字典只写入开头的括号并压栈，内容由之后的 -writeNextToken 逐个写入
+- (void)writeValue:(id)value{
+    
+    if ([value isKindOfClass:[NSString class]]) {
+        [self writeString:value];
+    }else if ([value isKindOfClass:[NSNumber class]]) {
+        [self writeNumber:value];
+    }else if ([value isKindOfClass:[NSNull class]]) {
+        WBQueryStringBufferAppendBytes(&_pending, "null", 4);
+    }else if ([value isKindOfClass:[NSArray class]] || [value isKindOfClass:[NSDictionary class]]) {
+        BOOL isDictionary = [value isKindOfClass:[NSDictionary class]];
+        WBQueryStringBufferAppendBytes(&_pending, isDictionary ? "{" : "[", 1);
+        
+        if (_depth == [self.frames count]) {
+            [self.frames addObject:[[WBJSONWriterFrame alloc] init]];
+        }
+        WBJSONWriterFrame *frame = self.frames[_depth++];
+        frame.container = value;
+        frame.index = 0;
+        frame.count = [value count];
+        frame.keys = nil;
+        frame.wroteKey = NO;
+        if (isDictionary) {
+            NSArray *keys = [(NSDictionary *)value allKeys];
+#if WB_CAN_USE_AT_AVAILABLE
+            if (@available(iOS 11.0, macOS 10.13, watchOS 4.0, tvOS 11.0, *)) {
+                if (self.writingOptions & NSJSONWritingSortedKeys) {
+                    keys = [keys sortedArrayUsingSelector:@selector(compare:)];
+                }
+            }
+#endif
+            frame.keys = keys;
+        }
+    }
+}
+
+//写入栈顶容器的下一个元素或者结尾的括号，返回 NO 表示整个文档已经写完
+- (BOOL)writeNextToken{
+    
+    if (_stringBytes) {
+        [self writeStringChunk];
+        return _stringBytes != NULL || _depth > 0;
+    }
+    if (!_started) {
+        _started = YES;
+        [self writeValue:self.JSONObject];
+        return _stringBytes != NULL || _depth > 0;
+    }
+    if (_depth == 0) {
+        return NO;
+    }
+    
+    WBJSONWriterFrame *frame = self.frames[_depth - 1];
+    if (frame.index < frame.count) {
+        //字典的 key 也可能很长，写完 key 之后再写 value
+        if (frame.keys && frame.wroteKey) {
+            if (self.writingOptions & NSJSONWritingPrettyPrinted) {
+                WBQueryStringBufferAppendBytes(&_pending, " : ", 3);
+            }else{
+                WBQueryStringBufferAppendBytes(&_pending, ":", 1);
+            }
+            [self writeValue:((NSDictionary *)frame.container)[frame.keys[frame.index]]];
+            frame.wroteKey = NO;
+            frame.index += 1;
+            return YES;
+        }
+        if (frame.index > 0) {
+            WBQueryStringBufferAppendBytes(&_pending, ",", 1);
+        }
+        [self writeNewlineAndIndent];
+        if (frame.keys) {
+            [self writeString:frame.keys[frame.index]];
+            frame.wroteKey = YES;
+            return YES;
+        }
+        [self writeValue:((NSArray *)frame.container)[frame.index]];
+        frame.index += 1;
+        return YES;
+    }
+    
+    BOOL isDictionary = (frame.keys != nil);
+    BOOL isEmpty = (frame.count == 0);
+    frame.container = nil;
+    frame.keys = nil;
+    _depth -= 1;
+    if (!isEmpty) {
+        [self writeNewlineAndIndent];
+    }
+    WBQueryStringBufferAppendBytes(&_pending, isDictionary ? "}" : "]", 1);
+    return _depth > 0;
+}
+
+#pragma mark - NSInputStream
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)length{
+    
+    if ([self streamStatus] != NSStreamStatusOpen) {
+        return [self streamStatus] == NSStreamStatusError ? -1 : 0;
+    }
+    
+    NSUInteger totalNumberOfBytesRead = 0;
+    while (totalNumberOfBytesRead < length) {
+        if (_pendingOffset == _pending.length) {
+            _pending.length = 0;
+            _pendingOffset = 0;
+            
+            BOOL hasMoreTokens = YES;
+            @try {
+                while (hasMoreTokens && _pending.length < kWBJSONBodyStreamChunkSize) {
+                    hasMoreTokens = [self writeNextToken];
+                }
+            } @catch (NSException *exception) {
+                self.streamError = [NSError errorWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:@{NSLocalizedFailureReasonErrorKey : exception.reason ?: @""}];
+                self.streamStatus = NSStreamStatusError;
+                return -1;
+            }
+            if (_pending.length == 0) {
+                self.streamStatus = NSStreamStatusAtEnd;
+                break;
+            }
+        }
+        
+        NSUInteger numberOfBytesRead = MIN(length - totalNumberOfBytesRead, _pending.length - _pendingOffset);
+        memcpy(buffer + totalNumberOfBytesRead, _pending.bytes + _pendingOffset, numberOfBytesRead);
+        _pendingOffset += numberOfBytesRead;
+        totalNumberOfBytesRead += numberOfBytesRead;
+    }
+    
+    return (NSInteger)totalNumberOfBytesRead;
+}
 
-static inline NSString * WBMultipartFormInitialBoundary(NSString *boundary) {
-    return [NSString stringWithFormat:@"--%@%@", boundary, kWBMultipartFormCRLF];
+- (BOOL)getBuffer:(__unused uint8_t **)buffer length:(__unused NSUInteger *)len{
+    return NO;
 }
 
-static inline NSString * WBMultipartFormEncapsulationBoundary(NSString *boundary){
-    
-    return [NSString stringWithFormat:@"%@--%@%@",kWBMultipartFormCRLF,boundary,kWBMultipartFormCRLF];
+- (BOOL)hasBytesAvailable{
+    return [self streamStatus] == NSStreamStatusOpen;
 }
 
-static inline NSString * WBMultipartFormFinalBoundary(NSString *boundary){
-    
-    return [NSString stringWithFormat:@"%@--%@--%@",kWBMultipartFormCRLF,boundary,kWBMultipartFormCRLF];
+#pragma mark - NSStream
+
+- (void)open{
+    if (self.streamStatus == NSStreamStatusOpen) {
+        return;
+    }
+    self.streamStatus = NSStreamStatusOpen;
+    self.streamError = nil;
+    _pending.length = 0;
+    _pendingOffset = 0;
+    _depth = 0;
+    _started = NO;
+    _string = nil;
+    _stringData = nil;
+    _stringBytes = NULL;
 }
 
-static inline NSString *WBContentTypeForPathExtension(NSString *extension){
-    
-    NSString *UTI = (__bridge_transfer NSString *)UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge  CFStringRef)extension, NULL);
-    NSString *contentType = (__bridge_transfer NSString *)UTTypeCopyPreferredTagWithClass((__bridge  CFStringRef)UTI, kUTTagClassMIMEType);
-    if (!contentType) {
-        return @"application/octet-stream";
-    }else{
-        return contentType;
+- (void)close{
+    self.streamStatus = NSStreamStatusClosed;
+    _string = nil;
+    _stringData = nil;
+    _stringBytes = NULL;
+    for (WBJSONWriterFrame *frame in self.frames) {
+        frame.container = nil;
+        frame.keys = nil;
     }
-    
 }
 
-NSUInteger const KWBUploadStream3GSuggestedPacketSize = 1024 * 16;
-NSTimeInterval const kWBUploadStream3GSuggestedDelay = 0.2;
+- (id)propertyForKey:(__unused NSString *)key{
+    return nil;
+}
 
-#pragma mark - WBHTTPBodyPart
- 
-@interface WBHTTPBodyPart : NSObject
+- (BOOL)setProperty:(__unused id)property forKey:(__unused NSString *)key{
+    return NO;
+}
 
-@property (nonatomic, assign) NSStringEncoding stringEncoding;
+- (void)scheduleInRunLoop:(__unused NSRunLoop *)aRunLoop forMode:(__unused NSString *)mode{
+}
 
-@property (nonatomic, strong) NSDictionary *headers;
+- (void)removeFromRunLoop:(__unused NSRunLoop *)aRunLoop forMode:(__unused NSString *)mode{
+}
 
-@property (nonatomic, copy) NSString *bounday;
+- (void)_scheduleInCFRunLoop:(__unused CFRunLoopRef)aRunLoop forMode:(__unused CFStringRef)aMode{
+}
 
-@property (nonatomic, strong) id body;
+- (void)_unscheduleFromCFRunLoop:(__unused CFRunLoopRef)aRunLoop forMode:(__unused CFStringRef)aMode{
+}
 
-@property (nonatomic, assign) unsigned long long bodyContentLength;
+- (BOOL)_setCFClientFlags:(__unused CFOptionFlags)inFlags callback:(__unused CFReadStreamClientCallBack)inCallback context:(__unused CFStreamClientContext *)inContext{
+    return NO;
+}
 
-@property (nonatomic, strong) NSInputStream *inputStream;
+#pragma mark - NSCopying
 
-@property (nonatomic, assign) BOOL hasInitialBounday;
+- (instancetype)copyWithZone:(NSZone *)zone{
+    return [[[self class] allocWithZone:zone] initWithJSONObject:self.JSONObject writingOptions:self.writingOptions];
+}
 
-@property (nonatomic, assign) BOOL hasFinalBounday;
+@end
 
-@property (nonatomic, readonly, assign, getter=hasByTesAvailable) BOOL bytesAvailable;
+#pragma mark - WBJsonRequestSerializer
 
-@property (nonatomic, readonly, assign) unsigned long long cententLength;
+@implementation WBJsonRequestSerializer
 
-- (NSInteger)read:(uint8_t *)buffer
-        maxLength:(NSUInteger)length;
++ (instancetype)serializer{
+    return [self serializerWithWritingOptions:(NSJSONWritingOptions)0];
+}
 
-@end
++ (instancetype)serializerWithWritingOptions:(NSJSONWritingOptions)writingOptions{
+    
+    WBJsonRequestSerializer *serializer = [[self alloc] init];
+    serializer.writingOptions = writingOptions;
+    return serializer;
+}
 
-#pragma mark - WBMultipartBodyStream
-@interface WBMultipartBodyStream : NSInputStream<NSStreamDelegate>
-@property (nonatomic, assign) NSUInteger numberOfBytesInPacket;
-@property (nonatomic, assign) NSTimeInterval delay;
-@property (nonatomic, strong) NSInputStream *inputStream;
-@property (nonatomic, assign, readonly) unsigned long long contentLength;
-@property (nonatomic, assign, readonly, getter=isEmpty) BOOL empty;
+#pragma mark - WBURLRequestSerialization
 
-- (instancetype)initWithStringEncoding:(NSStringEncoding)encoding;
-- (void)setInitialAndFinalBoundaries;
-- (void)appendHTTPBodyPart:(WBHTTPBodyPart *)bodyPart;
+- (BOOL)serializeParameters:(id)parameters intoRequest:(NSMutableURLRequest *)mutableRequest error:(NSError * _Nullable __autoreleasing *)error{
+    
+    if ([self.HTTPMethodsEncodingParametersInURI containsObject:[[mutableRequest HTTPMethod] uppercaseString]]) {
+        return [super serializeParameters:parameters intoRequest:mutableRequest error:error];
+    }
+    
+    if (![mutableRequest valueForHTTPHeaderField:@"Content-Type"]) {
+        [mutableRequest setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    }
+    if (!parameters) {
+        return YES;
+    }
+    
+    BOOL isContainer = [parameters isKindOfClass:[NSArray class]] || [parameters isKindOfClass:[NSDictionary class]];
+    if (isContainer && ![NSJSONSerialization isValidJSONObject:parameters]) {
+        if (error) {
+            NSDictionary *userInfo = @{NSLocalizedFailureReasonErrorKey: NSLocalizedStringFromTable(@"The `parameters` argument is not valid JSON.", @"WBNetworking", nil)};
+            *error = [[NSError alloc] initWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:userInfo];
+        }
+        return NO;
+    }
+    
+    //顶层是数组或字典时边读边生成 JSON，不在内存中生成完整的文档；长度未知，使用 chunked 传输
+    if (self.streamsHTTPBody && isContainer) {
+        [mutableRequest setHTTPBodyStream:[[WBJSONBodyStream alloc] initWithJSONObject:parameters writingOptions:self.writingOptions]];
+        [mutableRequest setValue:nil forHTTPHeaderField:@"Content-Length"];
+        [mutableRequest setValue:@"chunked" forHTTPHeaderField:@"Transfer-Encoding"];
+        return YES;
+    }
+    
+    NSData *jsonData = [NSJSONSerialization dataWithJSONObject:parameters options:self.writingOptions error:error];
+    if (!jsonData) {
+        return NO;
+    }
+    [mutableRequest setHTTPBody:jsonData];
+    return YES;
+}
 
+#pragma mark - NSSecureCoding
 
-@end
+- (instancetype)initWithCoder:(NSCoder *)decoder{
+    self = [super initWithCoder:decoder];
+    if (!self) {
+        return nil;
+    }
+    self.writingOptions = [[decoder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(writingOptions))] unsignedIntegerValue];
+    self.streamsHTTPBody = [decoder decodeBoolForKey:NSStringFromSelector(@selector(streamsHTTPBody))];
+    return self;
+}
 
-#pragma mark - WBStreamingMultipartFormData
+- (void)encodeWithCoder:(NSCoder *)coder{
+    [super encodeWithCoder:coder];
+    [coder encodeObject:@(self.writingOptions) forKey:NSStringFromSelector(@selector(writingOptions))];
+    [coder encodeBool:self.streamsHTTPBody forKey:NSStringFromSelector(@selector(streamsHTTPBody))];
+}
 
-@interface WBStreamingMultipartFormData()
+#pragma mark - NSCopying
 
-@property (readwrite, nonatomic, copy) NSMutableURLRequest *request;
+- (instancetype)copyWithZone:(NSZone *)zone{
+    WBJsonRequestSerializer *serializer = [super copyWithZone:zone];
+    serializer.writingOptions = self.writingOptions;
+    serializer.streamsHTTPBody = self.streamsHTTPBody;
+    return serializer;
+}
 
-@property (readwrite, nonatomic, assign) NSStringEncoding stringEncoding;
+@end
 
-@property (readwrite, nonatomic, copy) NSString *boundray;
+#pragma mark - MessagePack
 
-@property (readwrite, nonatomic, strong) WBMultipartBodyStream *bodyStream;
+//编码时遇到不支持的类型，计数阶段返回这个值
+static size_t const WBMessagePackInvalidLength = SIZE_MAX;
 
+static inline size_t WBMessagePackHeaderLength(NSUInteger count, NSUInteger fixLimit, BOOL hasEightBitForm) {
+    if (count < fixLimit) {
+        return 1;
+    }else if (hasEightBitForm && count <= UINT8_MAX) {
+        return 2;
+    }else if (count <= UINT16_MAX) {
+        return 3;
+    }
+    return 5;
+}
 
-@end
+static inline BOOL WBMessagePackNumberIsBoolean(NSNumber *number) {
+    return (__bridge CFBooleanRef)number == kCFBooleanTrue || (__bridge CFBooleanRef)number == kCFBooleanFalse;
+}
 
-@implementation WBStreamingMultipartFormData
+//第一遍：只计算编码后的字节数，不分配内存
+static size_t WBMessagePackEncodedLength(id object) {
+    
+    if (!object || [object isKindOfClass:[NSNull class]]) {
+        return 1;
+    }
+    if ([object isKindOfClass:[NSString class]]) {
+        NSUInteger length = [(NSString *)object lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        return WBMessagePackHeaderLength(length, 32, YES) + length;
+    }
+    if ([object isKindOfClass:[NSNumber class]]) {
+        NSNumber *number = object;
+        if (WBMessagePackNumberIsBoolean(number)) {
+            return 1;
+        }
+        if (CFNumberIsFloatType((__bridge CFNumberRef)number)) {
+            return (*[number objCType] == 'f') ? 5 : 9;
+        }
+        if (strcmp([number objCType], @encode(unsigned long long)) == 0) {
+            unsigned long long value = [number unsignedLongLongValue];
+            return value < 128 ? 1 : value <= UINT8_MAX ? 2 : value <= UINT16_MAX ? 3 : value <= UINT32_MAX ? 5 : 9;
+        }
+        long long value = [number longLongValue];
+        if (value >= 0) {
+            return value < 128 ? 1 : value <= UINT8_MAX ? 2 : value <= UINT16_MAX ? 3 : value <= UINT32_MAX ? 5 : 9;
+        }
+        return value >= -32 ? 1 : value >= INT8_MIN ? 2 : value >= INT16_MIN ? 3 : value >= INT32_MIN ? 5 : 9;
+    }
+    if ([object isKindOfClass:[NSData class]]) {
+        NSUInteger length = [(NSData *)object length];
+        return WBMessagePackHeaderLength(length, 0, YES) + length;
+    }
+    if ([object isKindOfClass:[NSDate class]]) {
+        //timestamp 96：ext 8 头部 3 字节 + 4 字节纳秒 + 8 字节秒
+        return 15;
+    }
+    if ([object isKindOfClass:[NSArray class]]) {
+        size_t length = WBMessagePackHeaderLength([object count], 16, NO);
+        for (id element in (NSArray *)object) {
+            size_t elementLength = WBMessagePackEncodedLength(element);
+            if (elementLength == WBMessagePackInvalidLength) {
+                return WBMessagePackInvalidLength;
+            }
+            length += elementLength;
+        }
+        return length;
+    }
+    if ([object isKindOfClass:[NSDictionary class]]) {
+        __block size_t length = WBMessagePackHeaderLength([object count], 16, NO);
+        [(NSDictionary *)object enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+            size_t keyLength = WBMessagePackEncodedLength(key);
+            size_t valueLength = WBMessagePackEncodedLength(value);
+            if (keyLength == WBMessagePackInvalidLength || valueLength == WBMessagePackInvalidLength) {
+                length = WBMessagePackInvalidLength;
+                *stop = YES;
+                return;
+            }
+            length += keyLength + valueLength;
+        }];
+        return length;
+    }
+    return WBMessagePackInvalidLength;
+}
 
-- (instancetype)initWithURLRequest:(NSMutableURLRequest *)urlRequest stringEncoding:(NSStringEncoding)encoding{
-    self = [super init];
-    if (!self) {
-        return  nil;
+static inline uint8_t * WBMessagePackWriteBigEndian(uint8_t *position, uint64_t value, size_t width) {
+    for (size_t index = width; index > 0; index--) {
+        *position++ = (uint8_t)(value >> ((index - 1) * 8));
     }
-    self.request = urlRequest;
-    self.stringEncoding = encoding;
-    self.boundray = WBCreateMultipartFormBoundary();
-    self.bodyStream = [[WBMultipartBodyStream alloc]initWithStringEncoding:encoding];
-    return self;
+    return position;
 }
 
-- (void)setRequest:(NSMutableURLRequest *)request{
-    _request = [request mutableCopy];
-    
+//写入 str / bin / array / map 的头部，fixMarker 为 0 表示该类型没有 fix 形式
+static inline uint8_t * WBMessagePackWriteHeader(uint8_t *position, NSUInteger count, uint8_t fixMarker, NSUInteger fixLimit, uint8_t eightBitMarker, uint8_t sixteenBitMarker, uint8_t thirtyTwoBitMarker) {
+    if (count < fixLimit) {
+        *position++ = (uint8_t)(fixMarker | count);
+    }else if (eightBitMarker && count <= UINT8_MAX) {
+        *position++ = eightBitMarker;
+        *position++ = (uint8_t)count;
+    }else if (count <= UINT16_MAX) {
+        *position++ = sixteenBitMarker;
+        position = WBMessagePackWriteBigEndian(position, count, 2);
+    }else{
+        *position++ = thirtyTwoBitMarker;
+        position = WBMessagePackWriteBigEndian(position, count, 4);
+    }
+    return position;
 }
 
-- (BOOL)appendPartWithFileURL:(NSURL *)fileURL name:(NSString *)name error:(NSError * _Nullable __autoreleasing *)error{
-    
-    NSParameterAssert(fileURL);
-    NSParameterAssert(name);
-    NSString *fileName = [fileURL lastPathComponent];
-    NSString *mimeType = WBContentTypeForPathExtension([fileURL pathExtension]);
-    return [self appendPartWithFileURL:fileURL name:name fileName:fileName mimeType:mimeType error:error];
+static inline uint8_t * WBMessagePackWriteUnsigned(uint8_t *position, unsigned long long value) {
+    if (value < 128) {
+        *position++ = (uint8_t)value;
+    }else if (value <= UINT8_MAX) {
+        *position++ = 0xcc;
+        *position++ = (uint8_t)value;
+    }else if (value <= UINT16_MAX) {
+        *position++ = 0xcd;
+        position = WBMessagePackWriteBigEndian(position, value, 2);
+    }else if (value <= UINT32_MAX) {
+        *position++ = 0xce;
+        position = WBMessagePackWriteBigEndian(position, value, 4);
+    }else{
+        *position++ = 0xcf;
+        position = WBMessagePackWriteBigEndian(position, value, 8);
+    }
+    return position;
+}
+
+//第二遍：直接写入预先分配好的 buffer，长度已在第一遍中算好，这里不再检查越界
+static uint8_t * WBMessagePackWriteObject(uint8_t *position, id object) {
     
+    if (!object || [object isKindOfClass:[NSNull class]]) {
+        *position++ = 0xc0;
+    }else if ([object isKindOfClass:[NSString class]]) {
+        NSString *string = object;
+        NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        position = WBMessagePackWriteHeader(position, length, 0xa0, 32, 0xd9, 0xda, 0xdb);
+        NSUInteger usedLength = 0;
+        [string getBytes:position maxLength:length usedLength:&usedLength encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, [string length]) remainingRange:NULL];
+        position += usedLength;
+    }else if ([object isKindOfClass:[NSNumber class]]) {
+        NSNumber *number = object;
+        if (WBMessagePackNumberIsBoolean(number)) {
+            *position++ = [number boolValue] ? 0xc3 : 0xc2;
+        }else if (CFNumberIsFloatType((__bridge CFNumberRef)number)) {
+            if (*[number objCType] == 'f') {
+                float value = [number floatValue];
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                *position++ = 0xca;
+                position = WBMessagePackWriteBigEndian(position, bits, 4);
+            }else{
+                double value = [number doubleValue];
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                *position++ = 0xcb;
+                position = WBMessagePackWriteBigEndian(position, bits, 8);
+            }
+        }else if (strcmp([number objCType], @encode(unsigned long long)) == 0) {
+            position = WBMessagePackWriteUnsigned(position, [number unsignedLongLongValue]);
+        }else{
+            long long value = [number longLongValue];
+            if (value >= 0) {
+                position = WBMessagePackWriteUnsigned(position, (unsigned long long)value);
+            }else if (value >= -32) {
+                *position++ = (uint8_t)(int8_t)value;
+            }else if (value >= INT8_MIN) {
+                *position++ = 0xd0;
+                *position++ = (uint8_t)(int8_t)value;
+            }else if (value >= INT16_MIN) {
+                *position++ = 0xd1;
+                position = WBMessagePackWriteBigEndian(position, (uint64_t)value, 2);
+            }else if (value >= INT32_MIN) {
+                *position++ = 0xd2;
+                position = WBMessagePackWriteBigEndian(position, (uint64_t)value, 4);
+            }else{
+                *position++ = 0xd3;
+                position = WBMessagePackWriteBigEndian(position, (uint64_t)value, 8);
+            }
+        }
+    }else if ([object isKindOfClass:[NSData class]]) {
+        NSData *data = object;
+        position = WBMessagePackWriteHeader(position, [data length], 0, 0, 0xc4, 0xc5, 0xc6);
+        [data getBytes:position length:[data length]];
+        position += [data length];
+    }else if ([object isKindOfClass:[NSDate class]]) {
+        //timestamp 扩展类型 -1，使用 96 位的形式以支持 1970 年之前的时间
+        double interval = [(NSDate *)object timeIntervalSince1970];
+        double seconds = floor(interval);
+        uint32_t nanoseconds = (uint32_t)MIN((interval - seconds) * 1e9, 999999999.0);
+        *position++ = 0xc7;
+        *position++ = 12;
+        *position++ = 0xff;
+        position = WBMessagePackWriteBigEndian(position, nanoseconds, 4);
+        position = WBMessagePackWriteBigEndian(position, (uint64_t)(int64_t)seconds, 8);
+    }else if ([object isKindOfClass:[NSArray class]]) {
+        position = WBMessagePackWriteHeader(position, [object count], 0x90, 16, 0, 0xdc, 0xdd);
+        for (id element in (NSArray *)object) {
+            position = WBMessagePackWriteObject(position, element);
+        }
+    }else if ([object isKindOfClass:[NSDictionary class]]) {
+        position = WBMessagePackWriteHeader(position, [object count], 0x80, 16, 0, 0xde, 0xdf);
+        __block uint8_t *blockPosition = position;
+        [(NSDictionary *)object enumerateKeysAndObjectsUsingBlock:^(id key, id value, __unused BOOL *stop) {
+            blockPosition = WBMessagePackWriteObject(blockPosition, key);
+            blockPosition = WBMessagePackWriteObject(blockPosition, value);
+        }];
+        position = blockPosition;
+    }
+    return position;
 }
 
-- (BOOL)appendPartWithFileURL:(NSURL *)fileURL name:(NSString *)name fileName:(NSString *)fileName mimeType:(NSString *)mimeType error:(NSError * _Nullable __autoreleasing *)error{
+NSData * WBMessagePackDataFromObject(id object, NSError * __autoreleasing *error) {
     
-    NSParameterAssert(fileURL);
-    NSParameterAssert(name);
-    NSParameterAssert(fileName);
-    NSParameterAssert(mimeType);
-    if (![fileURL isFileURL]) {
-        //如果不是地址
-        NSDictionary *userInfo = @{NSLocalizedFailureReasonErrorKey:NSLocalizedStringFromTable(@"Expected URL to be a file URL", @"WBNetworking", nil)};
+    size_t length = WBMessagePackEncodedLength(object);
+    if (length == WBMessagePackInvalidLength) {
         if (error) {
-            *error = [[NSError alloc]initWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorBadURL userInfo:userInfo];
+            NSDictionary *userInfo = @{NSLocalizedFailureReasonErrorKey: NSLocalizedStringFromTable(@"The `parameters` argument contains a value that cannot be encoded as MessagePack.", @"WBNetworking", nil)};
+            *error = [[NSError alloc] initWithDomain:WBURLRequestSerializationErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:userInfo];
         }
-        return NO;
+        return nil;
     }
     
-    NSDictionary *fileAttributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[fileURL path] error:error];
-    //如果地址信息不存在
-    if (!fileAttributes) {
-        return NO;
+    uint8_t *bytes = malloc(length);
+    if (!bytes) {
+        return nil;
     }
-    
-    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
-    
-    [mutableHeaders setValue:[NSString stringWithFormat:@"form-data;name=\"%@\";filename=\"%@\"",name,fileName] forKey:@"Content-Disposition"];
-    [mutableHeaders setValue:mimeType forKey:@"Content-Type"];
-    
-    WBHTTPBodyPart *bodyPart = [[WBHTTPBodyPart alloc]init];
-    bodyPart.stringEncoding = self.stringEncoding;
-    bodyPart.headers = mutableHeaders;
-    bodyPart.bounday = self.boundray;
-    bodyPart.body = fileURL;
-    bodyPart.bodyContentLength = [fileAttributes[NSFileSize] unsignedLongLongValue];
-    [self.bodyStream appendHTTPBodyPart:bodyPart];
-    
-    return YES;
-    
+    uint8_t *end = WBMessagePackWriteObject(bytes, object);
+    NSCAssert((size_t)(end - bytes) == length, @"MessagePack length mismatch");
+    return [NSData dataWithBytesNoCopy:bytes length:(NSUInteger)(end - bytes) freeWhenDone:YES];
 }
 
-- (void)appendPartWithInputStream:(NSInputStream *)inputStream name:(NSString *)name fileName:(NSString *)fileName length:(int64_t)length mimeType:(NSString *)mimeType{
-    
-    NSParameterAssert(name);
-    NSParameterAssert(fileName);
-    NSParameterAssert(mimeType);
-    
-    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
-    [mutableHeaders setValue:[NSString stringWithFormat:@"from-data;name=\"%@\";filename=\"%@\"",name,fileName] forKey:@"Content-Disposition"];
-    [mutableHeaders setValue:mimeType forKey:@"Content-Type"];
-    
-    WBHTTPBodyPart *bodyPart = [[WBHTTPBodyPart alloc]init];
-    bodyPart.stringEncoding = self.stringEncoding;
-    bodyPart.headers = mutableHeaders;
-    bodyPart.bounday = self.boundray;
-    bodyPart.inputStream = inputStream;
-    bodyPart.bodyContentLength = (unsigned long long) length;
-    [self.bodyStream appendHTTPBodyPart:bodyPart];
-    
-}
+#pragma mark - WBPropertyListRequestSerializer
 
-- (void)appendPartWithFileData:(NSData *)data name:(NSString *)name fileName:(NSString *)fileName mimeType:(NSString *)mimeType{
-    
-    NSParameterAssert(name);
-    NSParameterAssert(fileName);
-    NSParameterAssert(mimeType);
-    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
-    [mutableHeaders setValue:[NSString stringWithFormat:@"form-data;name=\"%@\";filename=\"%@\"",name,fileName] forKey:@"Content-Disposition"];
-    [mutableHeaders setValue:mimeType forKey:@"Content-Type"];
-    [self appendPartWithHeaders:mutableHeaders body:data];
-}
+@implementation WBPropertyListRequestSerializer
 
-- (void)appendPartWithFormData:(NSData *)data name:(NSString *)name{
-    
-    NSParameterAssert(name);
-    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
-    [mutableHeaders setValue:[NSString stringWithFormat:@"form-data;name=\"%@\"",name] forKey:@"Content-Disposition"];
-    [self appendPartWithHeaders:mutableHeaders body:data];
-    
++ (instancetype)serializer{
+    return [self serializerWithFormat:NSPropertyListXMLFormat_v1_0 writeOptions:0];
 }
 
-- (void)appendPartWithHeaders:(NSDictionary<NSString *,NSString *> *)headers body:(NSData *)body{
++ (instancetype)serializerWithFormat:(NSPropertyListFormat)format writeOptions:(NSPropertyListWriteOptions)writeOptions{
     
-    NSParameterAssert(body);
-    WBHTTPBodyPart *bodyPart = [[WBHTTPBodyPart alloc]init];
-    bodyPart.stringEncoding = self.stringEncoding;
-    bodyPart.headers = headers;
-    bodyPart.bounday = self.boundray;
-    bodyPart.bodyContentLength = [body length];
-    bodyPart.body = body;
-    [self.bodyStream appendHTTPBodyPart:bodyPart];
+    WBPropertyListRequestSerializer *serializer = [[self alloc] init];
+    serializer.format = format;
+    serializer.writeOptions = writeOptions;
+    return serializer;
 }
 
-- (void)throttleBandwidthWithPacketSize:(NSUInteger)numberOfBytes delay:(NSTimeInterval)delay{
++ (instancetype)messagePackSerializer{
     
-    self.bodyStream.numberOfBytesInPacket = numberOfBytes;
-    self.bodyStream.delay = delay;
+    WBPropertyListRequestSerializer *serializer = [self serializerWithFormat:NSPropertyListBinaryFormat_v1_0 writeOptions:0];
+    serializer.encoding = WBPropertyListRequestEncodingMessagePack;
+    return serializer;
 }
 
-- (NSMutableURLRequest *)requestByFinalizingMultipartFormData{
+#pragma mark - WBURLRequestSerialization
+
+- (BOOL)serializeParameters:(id)parameters intoRequest:(NSMutableURLRequest *)mutableRequest error:(NSError * _Nullable __autoreleasing *)error{
     
-    if ([self.bodyStream isEmpty]) {
-        return  self.request;
+    if ([self.HTTPMethodsEncodingParametersInURI containsObject:[[mutableRequest HTTPMethod] uppercaseString]]) {
+        return [super serializeParameters:parameters intoRequest:mutableRequest error:error];
     }
     
-    [self.bodyStream setInitialAndFinalBoundaries];
-    [self.request setHTTPBodyStream:self.bodyStream];
+    BOOL usesMessagePack = (self.encoding == WBPropertyListRequestEncodingMessagePack);
+    if (![mutableRequest valueForHTTPHeaderField:@"Content-Type"]) {
+        [mutableRequest setValue:usesMessagePack ? @"application/msgpack" : @"application/x-plist" forHTTPHeaderField:@"Content-Type"];
+    }
+    if (!parameters) {
+        return YES;
+    }
     
-    [self.request setValue:[NSString stringWithFormat:@"multipart/form-data;boundary=%@",self.boundray ] forHTTPHeaderField:@"Content-Type"];
-    [self.request setValue:[NSString stringWithFormat:@"%llu",[self.bodyStream contentLength]] forHTTPHeaderField:@"Content-Length"];
-    return  self.request;
+    NSData *bodyData = nil;
+    if (usesMessagePack) {
+        bodyData = WBMessagePackDataFromObject(parameters, error);
+    }else{
+        bodyData = [NSPropertyListSerialization dataWithPropertyList:parameters format:self.format options:self.writeOptions error:error];
+    }
+    if (!bodyData) {
+        return NO;
+    }
+    [mutableRequest setHTTPBody:bodyData];
+    return YES;
 }
 
+#pragma mark - NSSecureCoding
+
+- (instancetype)initWithCoder:(NSCoder *)decoder{
+    self = [super initWithCoder:decoder];
+    if (!self) {
+        return nil;
+    }
+    self.format = (NSPropertyListFormat)[[decoder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(format))] unsignedIntegerValue];
+    self.writeOptions = [[decoder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(writeOptions))] unsignedIntegerValue];
+    self.encoding = (WBPropertyListRequestEncoding)[[decoder decodeObjectOfClass:[NSNumber class] forKey:NSStringFromSelector(@selector(encoding))] unsignedIntegerValue];
+    return self;
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder{
+    [super encodeWithCoder:coder];
+    [coder encodeObject:@(self.format) forKey:NSStringFromSelector(@selector(format))];
+    [coder encodeObject:@(self.writeOptions) forKey:NSStringFromSelector(@selector(writeOptions))];
+    [coder encodeObject:@(self.encoding) forKey:NSStringFromSelector(@selector(encoding))];
+}
+
+#pragma mark - NSCopying
+
+- (instancetype)copyWithZone:(NSZone *)zone{
+    WBPropertyListRequestSerializer *serializer = [super copyWithZone:zone];
+    serializer.format = self.format;
+    serializer.writeOptions = self.writeOptions;
+    serializer.encoding = self.encoding;
+    return serializer;
+}
 
 @end
 
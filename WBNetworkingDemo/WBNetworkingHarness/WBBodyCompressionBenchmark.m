@@ -0,0 +1,286 @@
+//
+//  WBBodyCompressionBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Checks the opt-in gzip request body compression of WBHTTPRequestSerializer and measures CPU cost against bytes saved:
+//  1. in-memory bodies: at or above `bodyCompressionThreshold` they are gzip-compressed with `Content-Encoding: gzip` and inflate back to the uncompressed body; smaller bodies, bodies that do not shrink and requests with their own Content-Encoding are left alone;
+//  2. multipart bodies: the WBMultipartBodyStream is wrapped in a compressing stream read in small pieces, sent chunked, and inflates back to a body of the uncompressed length with the file in it;
+//  3. CPU vs bytes: for JSON logs, text logs, a form body and random bytes of 1 KB to 4 MB, the compressed size, CPU time per MB and the net time saved on a 1 Mbit/s link at gzip levels 1, 6 and 9 and at the level the serializer picks; then the streaming throughput over a 16 MB multipart body.
+//  检查 WBHTTPRequestSerializer 可选的 gzip 请求体压缩，并测量 CPU 开销和节省的字节数：
+//  1. 内存中的 body：不小于 bodyCompressionThreshold 时使用 gzip 压缩并带上 Content-Encoding: gzip，解压后等于未压缩的 body；更小的 body、压缩后不会变小的 body 和已经设置了 Content-Encoding 的请求保持不变；
+//  2. multipart body：WBMultipartBodyStream 被包装在压缩流中，每次读取一小块，使用 chunked 传输，解压后的长度等于未压缩的长度并且包含文件内容；
+//  3. CPU 与字节数：JSON 日志、文本日志、表单 body 和随机数据，1 KB 到 4 MB，在 gzip 级别 1、6、9 和 serializer 选择的级别下的压缩后大小、每 MB 的 CPU 时间以及在 1 Mbit/s 链路上节省的净时间；以及压缩 16 MB multipart body 时流式压缩的吞吐量。
+//
+//  The serializer source is included directly so that the gzip functions and stream can be measured. 直接包含 serializer 的源文件，以便测量其中的 gzip 函数和压缩流
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      $(ls ../WBNetworking/*.m | grep -v WBURLRequestSeriailzation) WBBodyCompressionBenchmark.m -o /tmp/WBBodyCompressionBenchmark
+//  /tmp/WBBodyCompressionBenchmark
+//
+
+#import <Foundation/Foundation.h>
+#import "../WBNetworking/WBURLRequestSeriailzation.m"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+//慢速移动网络的上行速率，用来把节省的字节数换算成时间
+static double const kWBHarnessLinkBytesPerSecond = 1000.0 * 1000.0 / 8.0;
+
+static NSString * const kWBHarnessURLString = @"https://log.example.com/v1/collect";
+
+//解压 gzip 数据，失败时返回 nil
+static NSData * WBHarnessGunzip(NSData *data) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, MAX_WBITS + 16) != Z_OK) {
+        return nil;
+    }
+    NSMutableData *output = [NSMutableData dataWithLength:MAX([data length] * 4, 4096)];
+    stream.next_in = (Bytef *)[data bytes];
+    stream.avail_in = (uInt)[data length];
+    int status = Z_OK;
+    while (status == Z_OK) {
+        if (stream.total_out == [output length]) {
+            [output increaseLengthBy:[output length]];
+        }
+        stream.next_out = (Bytef *)[output mutableBytes] + stream.total_out;
+        stream.avail_out = (uInt)([output length] - stream.total_out);
+        status = inflate(&stream, Z_NO_FLUSH);
+    }
+    [output setLength:stream.total_out];
+    inflateEnd(&stream);
+    return status == Z_STREAM_END && stream.avail_in == 0 ? output : nil;
+}
+
+//每次最多读取 maxLength 字节，读完整个流
+static NSData * WBHarnessReadStream(NSInputStream *stream, NSUInteger maxLength) {
+    NSMutableData *data = [NSMutableData data];
+    uint8_t *buffer = malloc(maxLength);
+    [stream open];
+    NSInteger length;
+    while ((length = [stream read:buffer maxLength:maxLength]) > 0) {
+        [data appendBytes:buffer length:(NSUInteger)length];
+    }
+    [stream close];
+    free(buffer);
+    return length < 0 ? nil : data;
+}
+
+#pragma mark - 输入
+
+typedef NS_ENUM(NSUInteger, WBHarnessPayload) {
+    WBHarnessPayloadJSONLogs,
+    WBHarnessPayloadTextLogs,
+    WBHarnessPayloadForm,
+    WBHarnessPayloadRandom,
+};
+
+static const char * WBHarnessPayloadName(WBHarnessPayload payload) {
+    switch (payload) {
+        case WBHarnessPayloadJSONLogs:
+            return "JSON logs";
+        case WBHarnessPayloadTextLogs:
+            return "text logs";
+        case WBHarnessPayloadForm:
+            return "form";
+        case WBHarnessPayloadRandom:
+            return "random";
+    }
+    return "";
+}
+
+static NSDictionary * WBHarnessLogEvent(NSUInteger index) {
+    return @{
+        @"level": (index % 7 == 0) ? @"warn" : @"info",
+        @"ts": @(1626307200000LL + (long long)index * 113),
+        @"tag": @[@"network", @"feed", @"player", @"login"][index % 4],
+        @"message": [NSString stringWithFormat:@"request %lu finished in %lu ms with status %d", (unsigned long)(100000 + index), (unsigned long)(20 + index * 7 % 900), index % 11 == 0 ? 500 : 200],
+        @"session": @"8C1E2F0A-5B3D-4E6F-9A1B-2C3D4E5F6A7B",
+    };
+}
+
+//生成大约 length 字节的数据
+static NSData * WBHarnessPayloadData(WBHarnessPayload payload, NSUInteger length) {
+    switch (payload) {
+        case WBHarnessPayloadJSONLogs: {
+            NSMutableArray *events = [NSMutableArray array];
+            NSData *data = [NSData data];
+            //每次加倍事件数直到不短于 length
+            for (NSUInteger count = 1; [data length] < length; count *= 2) {
+                while ([events count] < count) {
+                    [events addObject:WBHarnessLogEvent([events count])];
+                }
+                data = [NSJSONSerialization dataWithJSONObject:events options:0 error:nil];
+            }
+            return data;
+        }
+        case WBHarnessPayloadTextLogs: {
+            NSMutableString *text = [NSMutableString string];
+            for (NSUInteger index = 0; [text length] < length; index++) {
+                NSDictionary *event = WBHarnessLogEvent(index);
+                [text appendFormat:@"%@ [%@] %@: %@\n", event[@"ts"], event[@"level"], event[@"tag"], event[@"message"]];
+            }
+            return [text dataUsingEncoding:NSUTF8StringEncoding];
+        }
+        case WBHarnessPayloadForm: {
+            //和 WBQueryStringFromParameters 一样转义，逐个追加参数，不用每次重新编码整个字典
+            NSMutableString *query = [NSMutableString string];
+            for (NSUInteger index = 0; [query length] < length; index++) {
+                [query appendFormat:@"%@field_%lu=%@", index ? @"&" : @"", (unsigned long)index, WBPercentEscapedStringFromString(WBHarnessLogEvent(index)[@"message"])];
+            }
+            return [query dataUsingEncoding:NSUTF8StringEncoding];
+        }
+        case WBHarnessPayloadRandom: {
+            NSMutableData *data = [NSMutableData dataWithLength:length];
+            arc4random_buf([data mutableBytes], length);
+            return data;
+        }
+    }
+    return nil;
+}
+
+#pragma mark -
+
+static void WBHarnessCheckInMemoryBodies(void) {
+    printf("# in-memory bodies\n");
+    WBHTTPRequestSerializer *plain = [WBHTTPRequestSerializer serializer];
+    WBHTTPRequestSerializer *serializer = [WBHTTPRequestSerializer serializer];
+    serializer.bodyCompression = WBHTTPRequestBodyCompressionGzip;
+
+    NSMutableDictionary *parameters = [NSMutableDictionary dictionary];
+    for (NSUInteger index = 0; index < 100; index++) {
+        parameters[[NSString stringWithFormat:@"field_%lu", (unsigned long)index]] = WBHarnessLogEvent(index)[@"message"];
+    }
+    NSURLRequest *uncompressed = [plain requestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:parameters error:nil];
+    NSURLRequest *compressed = [serializer requestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:parameters error:nil];
+    WBHarnessCheck([[compressed valueForHTTPHeaderField:@"Content-Encoding"] isEqualToString:@"gzip"] && ![compressed valueForHTTPHeaderField:@"Content-Length"], "a %lu byte form body is sent with Content-Encoding: gzip", (unsigned long)[uncompressed.HTTPBody length]);
+    WBHarnessCheck([WBHarnessGunzip(compressed.HTTPBody) isEqualToData:uncompressed.HTTPBody], "it inflates to the uncompressed body (%lu -> %lu bytes)", (unsigned long)[uncompressed.HTTPBody length], (unsigned long)[compressed.HTTPBody length]);
+
+    NSURLRequest *small = [serializer requestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:@{@"a": @"b"} error:nil];
+    WBHarnessCheck(![small valueForHTTPHeaderField:@"Content-Encoding"] && [small.HTTPBody isEqualToData:[@"a=b" dataUsingEncoding:NSUTF8StringEncoding]], "a body below the threshold is left alone");
+
+    serializer.bodyCompressionThreshold = 2;
+    small = [serializer requestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:@{@"a": @"b"} error:nil];
+    WBHarnessCheck(![small valueForHTTPHeaderField:@"Content-Encoding"], "a body that would grow is left alone");
+    serializer.bodyCompressionThreshold = kWBHTTPRequestBodyCompressionDefaultThreshold;
+
+    WBPropertyListRequestSerializer *binary = [WBPropertyListRequestSerializer serializerWithFormat:NSPropertyListBinaryFormat_v1_0 writeOptions:0];
+    binary.bodyCompression = WBHTTPRequestBodyCompressionGzip;
+    NSData *random = WBHarnessPayloadData(WBHarnessPayloadRandom, 64 * 1024);
+    NSURLRequest *incompressible = [binary requestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:@{@"blob": random} error:nil];
+    WBHarnessCheck(![incompressible valueForHTTPHeaderField:@"Content-Encoding"] && [incompressible.HTTPBody length] > [random length], "random bytes are sent uncompressed");
+
+    [serializer setValue:@"br" forHTTPHeaderField:@"Content-Encoding"];
+    NSURLRequest *encoded = [serializer requestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:parameters error:nil];
+    WBHarnessCheck([[encoded valueForHTTPHeaderField:@"Content-Encoding"] isEqualToString:@"br"] && [encoded.HTTPBody isEqualToData:uncompressed.HTTPBody], "a request with its own Content-Encoding is left alone");
+    [serializer setValue:nil forHTTPHeaderField:@"Content-Encoding"];
+
+    NSURLRequest *get = [serializer requestWithMethod:@"GET" URLString:kWBHarnessURLString parameters:parameters error:nil];
+    WBHarnessCheck(!get.HTTPBody && ![get valueForHTTPHeaderField:@"Content-Encoding"], "GET parameters stay in the URL");
+}
+
+static void WBHarnessCheckMultipartBodies(void) {
+    printf("# multipart bodies\n");
+    NSData *file = WBHarnessPayloadData(WBHarnessPayloadTextLogs, 2 * 1024 * 1024);
+    void (^constructingBody)(id<WBMultipartFormData>) = ^(id<WBMultipartFormData> formData) {
+        [formData appendPartWithFileData:file name:@"log" fileName:@"app.log" mimeType:@"text/plain"];
+    };
+    WBHTTPRequestSerializer *plain = [WBHTTPRequestSerializer serializer];
+    WBHTTPRequestSerializer *serializer = [WBHTTPRequestSerializer serializer];
+    serializer.bodyCompression = WBHTTPRequestBodyCompressionGzip;
+
+    NSURLRequest *uncompressed = [plain multipartFormRequestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:@{@"app": @"wb"} constructingBodyWithBlock:constructingBody error:nil];
+    NSURLRequest *compressed = [serializer multipartFormRequestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:@{@"app": @"wb"} constructingBodyWithBlock:constructingBody error:nil];
+    WBHarnessCheck([compressed.HTTPBodyStream isKindOfClass:[WBGzipBodyStream class]], "the body stream is wrapped in a WBGzipBodyStream");
+    WBHarnessCheck([[compressed valueForHTTPHeaderField:@"Content-Encoding"] isEqualToString:@"gzip"] && [[compressed valueForHTTPHeaderField:@"Transfer-Encoding"] isEqualToString:@"chunked"] && ![compressed valueForHTTPHeaderField:@"Content-Length"], "it is sent chunked with Content-Encoding: gzip");
+
+    //每次只读 1 KB，压缩流内部每次从 multipart 流读取固定大小的一块
+    NSData *body = WBHarnessReadStream(compressed.HTTPBodyStream, 1024);
+    NSData *inflated = body ? WBHarnessGunzip(body) : nil;
+    unsigned long long uncompressedLength = (unsigned long long)[[uncompressed valueForHTTPHeaderField:@"Content-Length"] longLongValue];
+    WBHarnessCheck([inflated length] == uncompressedLength && [inflated rangeOfData:file options:0 range:NSMakeRange(0, [inflated length])].location != NSNotFound, "it inflates to %llu bytes with the file in it (%lu bytes on the wire)", uncompressedLength, (unsigned long)[body length]);
+
+    NSURLRequest *small = [serializer multipartFormRequestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:@{@"a": @"b"} constructingBodyWithBlock:nil error:nil];
+    WBHarnessCheck(![small valueForHTTPHeaderField:@"Content-Encoding"] && [small valueForHTTPHeaderField:@"Content-Length"], "a multipart body below the threshold keeps its Content-Length");
+}
+
+static uint64_t WBHarnessThreadCPUTime(void) {
+    return clock_gettime_nsec_np(CLOCK_THREAD_CPUTIME_ID);
+}
+
+static void WBHarnessMeasureCompression(void) {
+    printf("# CPU per MB vs bytes saved; net = time saved at 1 Mbit/s minus CPU time\n");
+    printf("%-10s %8s %6s %10s %7s %10s %10s\n", "payload", "bytes", "level", "gzip", "ratio", "CPU ms/MB", "net ms");
+    for (WBHarnessPayload payload = WBHarnessPayloadJSONLogs; payload <= WBHarnessPayloadRandom; payload++) {
+        for (NSNumber *size in @[@1024, @(16 * 1024), @(256 * 1024), @(4 * 1024 * 1024)]) {
+            NSData *data = WBHarnessPayloadData(payload, [size unsignedIntegerValue]);
+            int pickedLevel = WBGzipCompressionLevelForLength([data length], YES);
+            //-1 是 Z_DEFAULT_COMPRESSION，也就是 6
+            NSArray <NSNumber *> *levels = @[@1, @6, @9, @(pickedLevel)];
+            for (NSUInteger i = 0; i < [levels count]; i++) {
+                int level = [levels[i] intValue];
+                NSUInteger iterations = MAX((NSUInteger)(16 * 1024 * 1024 / [data length]), 4);
+                NSData *compressed = WBGzipCompressedData(data, level);
+                uint64_t start = WBHarnessThreadCPUTime();
+                for (NSUInteger iteration = 0; iteration < iterations; iteration++) {
+                    @autoreleasepool {
+                        WBGzipCompressedData(data, level);
+                    }
+                }
+                double CPUSeconds = (double)(WBHarnessThreadCPUTime() - start) / NSEC_PER_SEC / iterations;
+                double savedSeconds = ((double)[data length] - (double)[compressed length]) / kWBHarnessLinkBytesPerSecond;
+                char levelName[16];
+                snprintf(levelName, sizeof(levelName), "%s%d", i == 3 ? "auto " : "", level == Z_DEFAULT_COMPRESSION ? 6 : level);
+                printf("%-10s %8lu %6s %10lu %6.1f%% %10.2f %10.1f\n", WBHarnessPayloadName(payload), (unsigned long)[data length], levelName, (unsigned long)[compressed length],
+                       100.0 * [compressed length] / [data length], CPUSeconds * 1000 / ([data length] / (1024.0 * 1024.0)), (savedSeconds - CPUSeconds) * 1000);
+                if (i == 3 && payload != WBHarnessPayloadRandom) {
+                    WBHarnessCheck(savedSeconds > CPUSeconds, "%s, %lu bytes: the picked level saves more time on the link than it costs", WBHarnessPayloadName(payload), (unsigned long)[data length]);
+                }
+            }
+        }
+    }
+
+    printf("# streaming a 16 MB multipart body through WBGzipBodyStream\n");
+    NSData *file = WBHarnessPayloadData(WBHarnessPayloadTextLogs, 16 * 1024 * 1024);
+    WBHTTPRequestSerializer *serializer = [WBHTTPRequestSerializer serializer];
+    serializer.bodyCompression = WBHTTPRequestBodyCompressionGzip;
+    NSURLRequest *request = [serializer multipartFormRequestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:nil constructingBodyWithBlock:^(id<WBMultipartFormData> formData) {
+        [formData appendPartWithFileData:file name:@"log" fileName:@"app.log" mimeType:@"text/plain"];
+    } error:nil];
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    uint64_t CPUStart = WBHarnessThreadCPUTime();
+    NSData *body = WBHarnessReadStream(request.HTTPBodyStream, 32 * 1024);
+    double seconds = (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / NSEC_PER_SEC;
+    double CPUSeconds = (double)(WBHarnessThreadCPUTime() - CPUStart) / NSEC_PER_SEC;
+    printf("%lu -> %lu bytes, %.1f MB/s, %.0f ms CPU\n", (unsigned long)[file length], (unsigned long)[body length], [file length] / seconds / (1024 * 1024), CPUSeconds * 1000);
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        WBHarnessCheckInMemoryBodies();
+        WBHarnessCheckMultipartBodies();
+        if (WBHarnessFailures == 0) {
+            WBHarnessMeasureCompression();
+        }
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+//
+//  WBHTTPSessionManagerBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Requests per second and p50/p99 latency of WBHTTPSessionManager against a loopback keep-alive server, with 1 to 256 requests in flight.
+//  WBHTTPSessionManager 对回环 keep-alive 服务器在 1 到 256 个并发请求下的每秒请求数和 p50/p99 延迟。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBLoopbackHTTPServer.m WBHTTPSessionManagerBenchmark.m -o /tmp/WBHTTPSessionManagerBenchmark
+//  /tmp/WBHTTPSessionManagerBenchmark [server delay in ms, default 1] [requests per level, default 4000]
+//
+
+#import <Foundation/Foundation.h>
+#import "WBHTTPSessionManager.h"
+#import "WBLoopbackHTTPServer.h"
+
+static int WBCompareUInt64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+//保持 inFlight 个请求同时进行（闭环），直到完成 count 个请求；返回每个请求的延迟（纳秒）
+static NSData * WBRunRequests(WBHTTPSessionManager *manager, NSUInteger inFlight, NSUInteger count, uint64_t *elapsed) {
+
+    uint64_t *latencies = calloc(count, sizeof(uint64_t));
+    __block NSUInteger started = 0;
+    __block NSUInteger finished = 0;
+    __block NSUInteger failures = 0;
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    dispatch_queue_t completionQueue = manager.completionQueue;
+
+    __block void (^startNext)(void) = nil;
+    void (^startRequest)(void) = ^{
+        NSUInteger index = started++;
+        uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        [manager GET:@"benchmark" parameters:nil completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+            latencies[index] = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+            if (error || [(NSHTTPURLResponse *)response statusCode] != 200) {
+                failures += 1;
+            }
+            finished += 1;
+            if (started < count) {
+                startNext();
+            }else if (finished == count) {
+                dispatch_semaphore_signal(done);
+            }
+        }];
+    };
+    startNext = startRequest;
+
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    dispatch_sync(completionQueue, ^{
+        for (NSUInteger i = 0; i < MIN(inFlight, count); i++) {
+            startRequest();
+        }
+    });
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+    *elapsed = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+    startNext = nil;
+
+    if (failures > 0) {
+        fprintf(stderr, "%lu of %lu requests failed\n", (unsigned long)failures, (unsigned long)count);
+    }
+    return [NSData dataWithBytesNoCopy:latencies length:count * sizeof(uint64_t) freeWhenDone:YES];
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        double delayMilliseconds = argc > 1 ? atof(argv[1]) : 1;
+        NSUInteger count = argc > 2 ? (NSUInteger)strtoul(argv[2], NULL, 10) : 4000;
+
+        NSData *payload = [NSMutableData dataWithLength:512];
+        WBLoopbackHTTPServer *server = [[WBLoopbackHTTPServer alloc] initWithHandler:^NSData *(WBLoopbackHTTPRequest *request) {
+            return payload;
+        }];
+        server.responseDelay = delayMilliseconds / 1000;
+        if (![server start]) {
+            fprintf(stderr, "cannot start the loopback server\n");
+            return 1;
+        }
+
+        //连接数上限放到最大的并发数，由 manager 自己的限制决定同时进行的请求数
+        NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+        configuration.HTTPMaximumConnectionsPerHost = 256;
+        WBHTTPSessionManager *manager = [[WBHTTPSessionManager alloc] initWithBaseURL:server.baseURL sessionConfiguration:configuration];
+        manager.completionQueue = dispatch_queue_create("com.wbnetworking.harness.benchmark", DISPATCH_QUEUE_SERIAL);
+
+        printf("server delay %.1f ms, %lu requests per level\n", delayMilliseconds, (unsigned long)count);
+        printf("%9s %12s %9s %9s %12s\n", "in-flight", "requests/s", "p50 ms", "p99 ms", "connections");
+
+        for (NSUInteger inFlight = 1; inFlight <= 256; inFlight *= 2) {
+            manager.maximumConcurrentRequests = inFlight;
+            manager.maximumConcurrentRequestsPerHost = inFlight;
+
+            //预热：建立这一级需要的连接
+            uint64_t elapsed = 0;
+            WBRunRequests(manager, inFlight, inFlight * 2, &elapsed);
+
+            NSUInteger connections = server.numberOfConnections;
+            NSData *latencyData = WBRunRequests(manager, inFlight, count, &elapsed);
+            connections = server.numberOfConnections - connections;
+
+            uint64_t *latencies = (uint64_t *)[latencyData bytes];
+            qsort(latencies, count, sizeof(uint64_t), WBCompareUInt64);
+            double p50 = (double)latencies[count / 2] / NSEC_PER_MSEC;
+            double p99 = (double)latencies[MIN(count - 1, count * 99 / 100)] / NSEC_PER_MSEC;
+            double requestsPerSecond = (double)count / ((double)elapsed / NSEC_PER_SEC);
+            //预热之后新建的连接数，keep-alive 生效时应为 0
+            printf("%9lu %12.0f %9.2f %9.2f %12lu\n", (unsigned long)inFlight, requestsPerSecond, p50, p99, (unsigned long)connections);
+        }
+
+        [manager invalidateSessionCancelingTasks:YES];
+        [server stop];
+    }
+    return 0;
+}
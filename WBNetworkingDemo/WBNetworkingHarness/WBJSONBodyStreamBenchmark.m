@@ -0,0 +1,170 @@
+//
+//  WBJSONBodyStreamBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  MB/s and peak memory growth of WBJsonRequestSerializer with streamsHTTPBody against one-shot NSJSONSerialization, for 10 MB and 40 MB arrays of records and for a record holding one 20 MB string.
+//  Before timing, it checks that the streamed body parses to the same object as the one-shot body, including strings that are escaped in several chunks and split inside UTF-8 sequences.
+//  WBJsonRequestSerializer 流式生成 body 和 NSJSONSerialization 一次生成的速度和峰值内存增长对比：10 MB、40 MB 的记录数组，以及包含一个 20 MB 字符串的记录。
+//  计时之前先检查流式生成的 body 和一次生成的 body 解析出的对象相同，包括分多块转义、在 UTF-8 字符中间分块的长字符串。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBJSONBodyStreamBenchmark.m -o /tmp/WBJSONBodyStreamBenchmark
+//  /tmp/WBJSONBodyStreamBenchmark
+//
+
+#import <Foundation/Foundation.h>
+#import <mach/mach.h>
+#import <stdatomic.h>
+#import "WBURLRequestSeriailzation.h"
+
+static uint64_t WBPhysicalFootprint(void) {
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.phys_footprint;
+}
+
+static _Atomic(uint64_t) WBPeakFootprint;
+static atomic_bool WBSamplingFootprint;
+
+//在后台线程中每毫秒采样一次 phys_footprint，返回 block 执行期间相对开始时的最大增长
+static uint64_t WBMeasurePeakGrowth(void (^block)(void)) {
+    uint64_t baseline = WBPhysicalFootprint();
+    atomic_store(&WBPeakFootprint, baseline);
+    atomic_store(&WBSamplingFootprint, true);
+    dispatch_semaphore_t finished = dispatch_semaphore_create(0);
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        while (atomic_load(&WBSamplingFootprint)) {
+            uint64_t footprint = WBPhysicalFootprint();
+            if (footprint > atomic_load(&WBPeakFootprint)) {
+                atomic_store(&WBPeakFootprint, footprint);
+            }
+            usleep(1000);
+        }
+        dispatch_semaphore_signal(finished);
+    });
+    block();
+    uint64_t footprint = WBPhysicalFootprint();
+    atomic_store(&WBSamplingFootprint, false);
+    dispatch_semaphore_wait(finished, DISPATCH_TIME_FOREVER);
+    return MAX(atomic_load(&WBPeakFootprint), footprint) - baseline;
+}
+
+static NSURLRequest * WBJSONRequest(id parameters, BOOL streamsHTTPBody) {
+    WBJsonRequestSerializer *serializer = [WBJsonRequestSerializer serializer];
+    serializer.streamsHTTPBody = streamsHTTPBody;
+    NSError *error = nil;
+    NSURLRequest *request = [serializer requestWithMethod:@"POST" URLString:@"http://127.0.0.1/sync" parameters:parameters error:&error];
+    if (!request) {
+        fprintf(stderr, "cannot build the request: %s\n", [[error description] UTF8String]);
+        exit(1);
+    }
+    return request;
+}
+
+//读完 body stream，返回读取的字节数；data 不为 nil 时把读到的数据追加到 data 中
+static unsigned long long WBDrainBodyStream(NSInputStream *stream, NSMutableData *data) {
+    uint8_t buffer[64 * 1024];
+    unsigned long long total = 0;
+    [stream open];
+    NSInteger length;
+    while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0) {
+        [data appendBytes:buffer length:(NSUInteger)length];
+        total += (unsigned long long)length;
+    }
+    if (length < 0) {
+        fprintf(stderr, "read failed: %s\n", [[[stream streamError] description] UTF8String]);
+        exit(1);
+    }
+    [stream close];
+    return total;
+}
+
+static NSString * WBRandomString(NSUInteger length) {
+    //包含需要转义的字符和多字节的 UTF-8 字符
+    static NSString * const alphabet = @"abcdefghijklmnopqrstuvwxyz0123456789 \"\\/\n\t中文émoji😀";
+    NSMutableString *string = [NSMutableString stringWithCapacity:length];
+    while ([string length] < length) {
+        NSRange range = [alphabet rangeOfComposedCharacterSequenceAtIndex:arc4random_uniform((uint32_t)[alphabet length])];
+        [string appendString:[alphabet substringWithRange:range]];
+    }
+    return string;
+}
+
+static NSArray * WBRecords(NSUInteger count) {
+    NSMutableArray *records = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [records addObject:@{
+            @"id": @(i),
+            @"uuid": [[NSUUID UUID] UUIDString],
+            @"title": WBRandomString(40),
+            @"score": @((double)arc4random() / UINT32_MAX),
+            @"tags": @[@"sync", @"record", @(i % 7)],
+            @"deleted": @(i % 11 == 0),
+            @"note": [NSNull null],
+        }];
+    }
+    return records;
+}
+
+static BOOL WBCheckParity(NSString *name, id parameters) {
+    NSMutableData *streamed = [NSMutableData data];
+    WBDrainBodyStream(WBJSONRequest(parameters, YES).HTTPBodyStream, streamed);
+    NSData *oneShot = WBJSONRequest(parameters, NO).HTTPBody;
+    id streamedObject = [NSJSONSerialization JSONObjectWithData:streamed options:0 error:nil];
+    id oneShotObject = [NSJSONSerialization JSONObjectWithData:oneShot options:0 error:nil];
+    BOOL equal = streamedObject && [streamedObject isEqual:oneShotObject];
+    printf("%s %s parity\n", equal ? "ok  " : "FAIL", [name UTF8String]);
+    return equal;
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        NSString *longString = WBRandomString(20 * 1024 * 1024 / 2);
+        NSDictionary *payloads = @{
+            @"10 MB records": WBRecords(50 * 1000),
+            @"40 MB records": WBRecords(200 * 1000),
+            @"20 MB string": @[@{@"id": @1, @"blob": longString}],
+        };
+        NSArray *names = @[@"10 MB records", @"40 MB records", @"20 MB string"];
+
+        BOOL passed = WBCheckParity(@"small records", WBRecords(500));
+        passed = WBCheckParity(@"long string", @{WBRandomString(10000): WBRandomString(100000), @"empty": @""}) && passed;
+        if (!passed) {
+            return 1;
+        }
+
+        printf("%-16s %10s %12s %16s %12s %16s\n", "payload", "MB", "stream MB/s", "stream peak MB", "one-shot MB/s", "one-shot peak MB");
+        for (NSString *name in names) {
+            id parameters = payloads[name];
+            __block unsigned long long length = 0;
+            __block uint64_t streamElapsed = 0;
+            uint64_t streamPeak = WBMeasurePeakGrowth(^{
+                @autoreleasepool {
+                    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+                    length = WBDrainBodyStream(WBJSONRequest(parameters, YES).HTTPBodyStream, nil);
+                    streamElapsed = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+                }
+            });
+            __block uint64_t oneShotElapsed = 0;
+            uint64_t oneShotPeak = WBMeasurePeakGrowth(^{
+                @autoreleasepool {
+                    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+                    WBJSONRequest(parameters, NO);
+                    oneShotElapsed = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+                }
+            });
+            double megabytes = (double)length / (1024 * 1024);
+            printf("%-16s %10.1f %12.0f %16.1f %12.0f %16.1f\n", [name UTF8String], megabytes,
+                   megabytes / ((double)streamElapsed / NSEC_PER_SEC), (double)streamPeak / (1024 * 1024),
+                   megabytes / ((double)oneShotElapsed / NSEC_PER_SEC), (double)oneShotPeak / (1024 * 1024));
+        }
+    }
+    return 0;
+}
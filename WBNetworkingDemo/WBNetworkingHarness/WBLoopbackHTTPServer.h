@@ -0,0 +1,91 @@
+//
+//  WBLoopbackHTTPServer.h
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A request received by `WBLoopbackHTTPServer`. 回环服务器收到的请求
+ */
+@interface WBLoopbackHTTPRequest : NSObject
+
+@property (readonly, nonatomic, copy) NSString *method;
+
+@property (readonly, nonatomic, copy) NSString *path;
+
+/**
+ Header fields, keyed by lowercased name. 请求头，key 为小写
+ */
+@property (readonly, nonatomic, copy) NSDictionary <NSString *, NSString *> *headers;
+
+/**
+ The body, decoded from `Content-Length` or chunked transfer encoding. 按 Content-Length 或 chunked 解码后的 body
+ */
+@property (readonly, nonatomic, copy) NSData *body;
+
+@end
+
+/**
+ A minimal HTTP/1.1 server on `127.0.0.1`, only for the harnesses in this directory. It keeps connections alive, reads `Content-Length` and chunked request bodies, and answers every request with `200 OK` and the data returned by its handler. Each connection is served by its own thread, so a handler may block.
+ 只给这个目录下的 harness 使用的最小 HTTP/1.1 回环服务器。支持 keep-alive、Content-Length 和 chunked 的请求 body，每个请求都返回 200 和 handler 返回的数据。每个连接一个线程，handler 可以阻塞。
+ */
+@interface WBLoopbackHTTPServer : NSObject
+
+- (instancetype)initWithHandler:(nullable NSData * (^)(WBLoopbackHTTPRequest *request))handler NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Injected delay before each response is written, in seconds. `0` by default. 每个响应发出前注入的延迟（秒），默认 0
+ */
+@property (atomic, assign) NSTimeInterval responseDelay;
+
+/**
+ When greater than `0`, the next request whose body is longer than this is cut off: the server reads only this many body bytes, keeps the partial request in `lastDroppedRequest` and closes the connection without answering. Reset to `0` once a connection has been dropped. `0` by default.
+ 大于 0 时，下一个 body 比它长的请求会被中断：服务端只读取这么多 body 字节，把不完整的请求保存在 lastDroppedRequest 中，不响应直接关闭连接。中断一次之后重置为 0，默认 0
+ */
+@property (atomic, assign) unsigned long long dropsConnectionAfterBodyBytes;
+
+/**
+ The last request cut off by `dropsConnectionAfterBodyBytes`. Its body holds the bytes the server actually read. 最近一次被中断的请求，body 为服务端实际读到的数据
+ */
+@property (readonly, atomic, strong, nullable) WBLoopbackHTTPRequest *lastDroppedRequest;
+
+/**
+ The port the server listens on, valid after `-start`. 监听的端口，start 之后有效
+ */
+@property (readonly, nonatomic, assign) uint16_t port;
+
+/**
+ `http://127.0.0.1:<port>/`
+ */
+@property (readonly, nonatomic, strong, nullable) NSURL *baseURL;
+
+/**
+ The number of connections accepted so far, to check keep-alive reuse. 已经接受的连接数，用于检查 keep-alive 是否复用了连接
+ */
+@property (readonly, atomic, assign) NSUInteger numberOfConnections;
+
+/**
+ The number of requests answered so far. 已经响应的请求数
+ */
+@property (readonly, atomic, assign) NSUInteger numberOfRequests;
+
+/**
+ Binds an ephemeral port on `127.0.0.1` and starts accepting connections. 绑定 127.0.0.1 上的随机端口并开始接受连接
+ */
+- (BOOL)start;
+
+/**
+ Stops accepting connections and closes the open ones. 停止接受连接并关闭已有的连接
+ */
+- (void)stop;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,319 @@
+//
+//  WBLoopbackHTTPServer.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+
+#import "WBLoopbackHTTPServer.h"
+
+#import <errno.h>
+#import <pthread.h>
+#import <unistd.h>
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+#import <arpa/inet.h>
+
+@interface WBLoopbackHTTPRequest ()
+@property (readwrite, nonatomic, copy) NSString *method;
+@property (readwrite, nonatomic, copy) NSString *path;
+@property (readwrite, nonatomic, copy) NSDictionary <NSString *, NSString *> *headers;
+@property (readwrite, nonatomic, copy) NSData *body;
+@end
+
+@implementation WBLoopbackHTTPRequest
+@end
+
+//一个连接的读缓冲区
+typedef struct {
+    int fd;
+    uint8_t bytes[64 * 1024];
+    size_t start;
+    size_t end;
+} WBLoopbackConnectionBuffer;
+
+//缓冲区为空时从 socket 读取，返回 NO 表示连接已经关闭
+static BOOL WBLoopbackConnectionFill(WBLoopbackConnectionBuffer *buffer) {
+    if (buffer->start < buffer->end) {
+        return YES;
+    }
+    while (YES) {
+        ssize_t length = read(buffer->fd, buffer->bytes, sizeof(buffer->bytes));
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            return NO;
+        }
+        buffer->start = 0;
+        buffer->end = (size_t)length;
+        return YES;
+    }
+}
+
+//读取以 \r\n 结尾的一行，不包含 \r\n
+static NSString * WBLoopbackConnectionReadLine(WBLoopbackConnectionBuffer *buffer) {
+    NSMutableData *line = [NSMutableData data];
+    while (WBLoopbackConnectionFill(buffer)) {
+        uint8_t *newline = memchr(buffer->bytes + buffer->start, '\n', buffer->end - buffer->start);
+        size_t length = newline ? (size_t)(newline - (buffer->bytes + buffer->start)) : buffer->end - buffer->start;
+        [line appendBytes:buffer->bytes + buffer->start length:length];
+        buffer->start += length;
+        if (newline) {
+            buffer->start += 1;
+            if ([line length] > 0 && ((const uint8_t *)[line bytes])[[line length] - 1] == '\r') {
+                [line setLength:[line length] - 1];
+            }
+            return [[NSString alloc] initWithData:line encoding:NSISOLatin1StringEncoding];
+        }
+    }
+    return nil;
+}
+
+static BOOL WBLoopbackConnectionReadBytes(WBLoopbackConnectionBuffer *buffer, NSMutableData *data, unsigned long long length) {
+    while (length > 0) {
+        if (!WBLoopbackConnectionFill(buffer)) {
+            return NO;
+        }
+        size_t available = (size_t)MIN((unsigned long long)(buffer->end - buffer->start), length);
+        [data appendBytes:buffer->bytes + buffer->start length:available];
+        buffer->start += available;
+        length -= available;
+    }
+    return YES;
+}
+
+static BOOL WBLoopbackConnectionWrite(int fd, const void *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return NO;
+        }
+        bytes = (const uint8_t *)bytes + written;
+        length -= (size_t)written;
+    }
+    return YES;
+}
+
+//读取一个完整的请求，连接关闭或格式错误时返回 nil。dropAfter 大于 0 且 body 更长时只读取 dropAfter 个字节，*dropped 为 YES
+static WBLoopbackHTTPRequest * WBLoopbackConnectionReadRequest(WBLoopbackConnectionBuffer *buffer, unsigned long long dropAfter, BOOL *dropped) {
+
+    NSString *requestLine = WBLoopbackConnectionReadLine(buffer);
+    NSArray <NSString *> *components = [requestLine componentsSeparatedByString:@" "];
+    if ([components count] < 2) {
+        return nil;
+    }
+
+    NSMutableDictionary <NSString *, NSString *> *headers = [NSMutableDictionary dictionary];
+    while (YES) {
+        NSString *line = WBLoopbackConnectionReadLine(buffer);
+        if (!line) {
+            return nil;
+        }
+        if ([line length] == 0) {
+            break;
+        }
+        NSRange separator = [line rangeOfString:@":"];
+        if (separator.location == NSNotFound) {
+            continue;
+        }
+        NSString *name = [[line substringToIndex:separator.location] lowercaseString];
+        headers[name] = [[line substringFromIndex:NSMaxRange(separator)] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    }
+
+    NSMutableData *body = [NSMutableData data];
+    if ([[headers[@"transfer-encoding"] lowercaseString] isEqualToString:@"chunked"]) {
+        while (YES) {
+            NSString *sizeLine = WBLoopbackConnectionReadLine(buffer);
+            if (!sizeLine) {
+                return nil;
+            }
+            unsigned long long size = strtoull([sizeLine UTF8String], NULL, 16);
+            if (size == 0) {
+                //跳过 trailer 直到空行
+                NSString *trailer = nil;
+                while ((trailer = WBLoopbackConnectionReadLine(buffer)) && [trailer length] > 0) {
+                }
+                break;
+            }
+            if (dropAfter > 0 && [body length] + size > dropAfter) {
+                if (!WBLoopbackConnectionReadBytes(buffer, body, dropAfter - [body length])) {
+                    return nil;
+                }
+                *dropped = YES;
+                break;
+            }
+            if (!WBLoopbackConnectionReadBytes(buffer, body, size) || !WBLoopbackConnectionReadLine(buffer)) {
+                return nil;
+            }
+        }
+    }else if (headers[@"content-length"]) {
+        unsigned long long length = strtoull([headers[@"content-length"] UTF8String], NULL, 10);
+        if (dropAfter > 0 && length > dropAfter) {
+            length = dropAfter;
+            *dropped = YES;
+        }
+        if (!WBLoopbackConnectionReadBytes(buffer, body, length)) {
+            return nil;
+        }
+    }
+
+    WBLoopbackHTTPRequest *request = [[WBLoopbackHTTPRequest alloc] init];
+    request.method = components[0];
+    request.path = components[1];
+    request.headers = headers;
+    request.body = body;
+    return request;
+}
+
+@interface WBLoopbackHTTPServer ()
+@property (readwrite, nonatomic, assign) uint16_t port;
+@property (readwrite, nonatomic, strong) NSURL *baseURL;
+@property (readwrite, atomic, assign) NSUInteger numberOfConnections;
+@property (readwrite, atomic, assign) NSUInteger numberOfRequests;
+@property (readwrite, atomic, strong) WBLoopbackHTTPRequest *lastDroppedRequest;
+@property (nonatomic, copy) NSData * (^handler)(WBLoopbackHTTPRequest *request);
+@end
+
+@implementation WBLoopbackHTTPServer {
+    int _listeningSocket;
+    NSMutableSet <NSNumber *> *_connectionSockets;
+}
+
+- (instancetype)initWithHandler:(NSData * _Nullable (^)(WBLoopbackHTTPRequest * _Nonnull))handler{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    _listeningSocket = -1;
+    _connectionSockets = [NSMutableSet set];
+    self.handler = handler;
+    return self;
+}
+
+- (void)dealloc{
+    [self stop];
+}
+
+- (BOOL)start{
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NO;
+    }
+    int reuseAddress = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t addressLength = sizeof(address);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(fd, SOMAXCONN) != 0 ||
+        getsockname(fd, (struct sockaddr *)&address, &addressLength) != 0) {
+        close(fd);
+        return NO;
+    }
+
+    _listeningSocket = fd;
+    self.port = ntohs(address.sin_port);
+    self.baseURL = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%u/", self.port]];
+
+    NSThread *thread = [[NSThread alloc] initWithTarget:self selector:@selector(acceptConnections:) object:@(fd)];
+    thread.name = @"com.wbnetworking.harness.loopback.accept";
+    [thread start];
+    return YES;
+}
+
+- (void)stop{
+    @synchronized (self) {
+        if (_listeningSocket >= 0) {
+            shutdown(_listeningSocket, SHUT_RDWR);
+            close(_listeningSocket);
+            _listeningSocket = -1;
+        }
+        for (NSNumber *connectionSocket in _connectionSockets) {
+            shutdown([connectionSocket intValue], SHUT_RDWR);
+        }
+    }
+}
+
+- (void)acceptConnections:(NSNumber *)listeningSocket{
+
+    while (YES) {
+        int fd = accept([listeningSocket intValue], NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+#ifdef SO_NOSIGPIPE
+        int noSigPipe = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+        @synchronized (self) {
+            [_connectionSockets addObject:@(fd)];
+        }
+        self.numberOfConnections += 1;
+
+        //keep-alive 的连接会阻塞在 read 上，每个连接单独一个线程，不占用 GCD 的线程池
+        NSThread *thread = [[NSThread alloc] initWithTarget:self selector:@selector(serveConnection:) object:@(fd)];
+        [thread start];
+    }
+}
+
+- (void)serveConnection:(NSNumber *)connectionSocket{
+
+    WBLoopbackConnectionBuffer *buffer = calloc(1, sizeof(WBLoopbackConnectionBuffer));
+    buffer->fd = [connectionSocket intValue];
+
+    while (YES) {
+        @autoreleasepool {
+            BOOL dropped = NO;
+            WBLoopbackHTTPRequest *request = WBLoopbackConnectionReadRequest(buffer, self.dropsConnectionAfterBodyBytes, &dropped);
+            if (!request) {
+                break;
+            }
+            if (dropped) {
+                //只中断一个连接
+                self.dropsConnectionAfterBodyBytes = 0;
+                self.lastDroppedRequest = request;
+                break;
+            }
+            NSData *body = self.handler ? self.handler(request) : [NSData data];
+            NSTimeInterval responseDelay = self.responseDelay;
+            if (responseDelay > 0) {
+                usleep((useconds_t)(responseDelay * USEC_PER_SEC));
+            }
+
+            BOOL closesConnection = [[request.headers[@"connection"] lowercaseString] isEqualToString:@"close"];
+            NSString *header = [NSString stringWithFormat:@"HTTP/1.1 %@\r\nContent-Type: application/octet-stream\r\nContent-Length: %lu\r\nConnection: %@\r\n\r\n", body ? @"200 OK" : @"500 Internal Server Error", (unsigned long)[body length], closesConnection ? @"close" : @"keep-alive"];
+            NSData *headerData = [header dataUsingEncoding:NSASCIIStringEncoding];
+            @synchronized (self) {
+                self.numberOfRequests += 1;
+            }
+            if (!WBLoopbackConnectionWrite(buffer->fd, [headerData bytes], [headerData length]) ||
+                !WBLoopbackConnectionWrite(buffer->fd, [body bytes], [body length]) ||
+                closesConnection) {
+                break;
+            }
+        }
+    }
+
+    @synchronized (self) {
+        [_connectionSockets removeObject:connectionSocket];
+    }
+    close(buffer->fd);
+    free(buffer);
+}
+
+@end
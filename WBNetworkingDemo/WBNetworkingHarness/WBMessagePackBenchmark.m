@@ -0,0 +1,549 @@
+//
+//  WBMessagePackBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Round-trip tests for `WBMessagePackDataFromObject` and `WBPropertyListRequestSerializer`, and an encoding size/speed benchmark against the form and JSON serializers on the same telemetry payloads:
+//  1. MessagePack: every format boundary (fixint/uint/int widths, fixstr/str8/16/32, bin8/16/32, fixarray/array16/32, fixmap/map16), float and double, booleans, NSNull, NSDate as the timestamp extension and 2000 random trees are decoded back to equal objects by a decoder written here; a value that cannot be encoded gives an error;
+//  2. the serializer: MessagePack and binary plist bodies decode to the parameters with the right Content-Type, and GET still encodes parameters in the URL;
+//  3. speed and size: body bytes, ns per request and allocations per encode for 1, 20 and 200 events with form, JSON, binary plist and MessagePack.
+//  WBMessagePackDataFromObject 和 WBPropertyListRequestSerializer 的往返测试，以及在相同的埋点数据上和表单、JSON serializer 对比编码大小和速度：
+//  1. MessagePack：每个格式的边界（各种宽度的整数、fixstr/str8/16/32、bin8/16/32、fixarray/array16/32、fixmap/map16）、float 和 double、布尔值、NSNull、作为 timestamp 扩展的 NSDate 以及 2000 个随机对象树，用这里实现的解码器解码后相等；不能编码的值返回错误；
+//  2. serializer：MessagePack 和二进制 plist 的 body 解码后等于参数，Content-Type 正确，GET 仍然把参数编码到 URL 中；
+//  3. 速度和大小：1、20、200 个事件时表单、JSON、二进制 plist 和 MessagePack 的 body 字节数、每个请求的纳秒数和每次编码的内存分配次数。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBMessagePackBenchmark.m -o /tmp/WBMessagePackBenchmark
+//  /tmp/WBMessagePackBenchmark
+//
+
+#import <Foundation/Foundation.h>
+#import <malloc/malloc.h>
+#import <mach/mach.h>
+#import <stdatomic.h>
+#import "WBURLRequestSeriailzation.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+#pragma mark - 统计内存分配次数
+
+static atomic_bool WBHarnessCountsAllocations;
+static _Atomic(uint64_t) WBHarnessAllocationCount;
+static void * (*WBHarnessOriginalMalloc)(struct _malloc_zone_t *zone, size_t size);
+static void * (*WBHarnessOriginalCalloc)(struct _malloc_zone_t *zone, size_t count, size_t size);
+static void * (*WBHarnessOriginalRealloc)(struct _malloc_zone_t *zone, void *pointer, size_t size);
+
+static void * WBHarnessMalloc(struct _malloc_zone_t *zone, size_t size) {
+    if (atomic_load_explicit(&WBHarnessCountsAllocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&WBHarnessAllocationCount, 1, memory_order_relaxed);
+    }
+    return WBHarnessOriginalMalloc(zone, size);
+}
+
+static void * WBHarnessCalloc(struct _malloc_zone_t *zone, size_t count, size_t size) {
+    if (atomic_load_explicit(&WBHarnessCountsAllocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&WBHarnessAllocationCount, 1, memory_order_relaxed);
+    }
+    return WBHarnessOriginalCalloc(zone, count, size);
+}
+
+static void * WBHarnessRealloc(struct _malloc_zone_t *zone, void *pointer, size_t size) {
+    if (atomic_load_explicit(&WBHarnessCountsAllocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&WBHarnessAllocationCount, 1, memory_order_relaxed);
+    }
+    return WBHarnessOriginalRealloc(zone, pointer, size);
+}
+
+//默认 zone 的函数表是只读的，先改为可写再替换
+static BOOL WBHarnessInstallAllocationCounter(void) {
+    malloc_zone_t *zone = malloc_default_zone();
+    if (vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ | VM_PROT_WRITE) != KERN_SUCCESS) {
+        return NO;
+    }
+    WBHarnessOriginalMalloc = zone->malloc;
+    WBHarnessOriginalCalloc = zone->calloc;
+    WBHarnessOriginalRealloc = zone->realloc;
+    zone->malloc = WBHarnessMalloc;
+    zone->calloc = WBHarnessCalloc;
+    zone->realloc = WBHarnessRealloc;
+    return YES;
+}
+
+#pragma mark - MessagePack 解码
+
+typedef struct {
+    const uint8_t *bytes;
+    size_t length;
+    size_t offset;
+} WBMessagePackReader;
+
+//读取 width 个字节的大端整数
+static BOOL WBMessagePackReadBigEndian(WBMessagePackReader *reader, size_t width, uint64_t *value) {
+    if (reader->length - reader->offset < width) {
+        return NO;
+    }
+    uint64_t result = 0;
+    for (size_t index = 0; index < width; index++) {
+        result = (result << 8) | reader->bytes[reader->offset++];
+    }
+    *value = result;
+    return YES;
+}
+
+static id WBMessagePackDecodeObject(WBMessagePackReader *reader);
+
+static id WBMessagePackDecodeBytes(WBMessagePackReader *reader, uint64_t length, BOOL isString) {
+    if (reader->length - reader->offset < length) {
+        return nil;
+    }
+    const uint8_t *bytes = reader->bytes + reader->offset;
+    reader->offset += (size_t)length;
+    if (isString) {
+        return [[NSString alloc] initWithBytes:bytes length:(NSUInteger)length encoding:NSUTF8StringEncoding];
+    }
+    return [NSData dataWithBytes:bytes length:(NSUInteger)length];
+}
+
+static id WBMessagePackDecodeArray(WBMessagePackReader *reader, uint64_t count) {
+    NSMutableArray *array = [NSMutableArray arrayWithCapacity:(NSUInteger)MIN(count, 1024)];
+    for (uint64_t index = 0; index < count; index++) {
+        id element = WBMessagePackDecodeObject(reader);
+        if (!element) {
+            return nil;
+        }
+        [array addObject:element];
+    }
+    return array;
+}
+
+static id WBMessagePackDecodeMap(WBMessagePackReader *reader, uint64_t count) {
+    NSMutableDictionary *dictionary = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger)MIN(count, 1024)];
+    for (uint64_t index = 0; index < count; index++) {
+        id key = WBMessagePackDecodeObject(reader);
+        id value = key ? WBMessagePackDecodeObject(reader) : nil;
+        if (!value) {
+            return nil;
+        }
+        dictionary[key] = value;
+    }
+    return dictionary;
+}
+
+//返回 nil 表示数据不合法，nil 值解码为 NSNull
+static id WBMessagePackDecodeObject(WBMessagePackReader *reader) {
+    uint64_t marker = 0;
+    uint64_t value = 0;
+    if (!WBMessagePackReadBigEndian(reader, 1, &marker)) {
+        return nil;
+    }
+    if (marker <= 0x7f) {
+        return @(marker);
+    }
+    if (marker >= 0xe0) {
+        return @((long long)(int8_t)marker);
+    }
+    if ((marker & 0xe0) == 0xa0) {
+        return WBMessagePackDecodeBytes(reader, marker & 0x1f, YES);
+    }
+    if ((marker & 0xf0) == 0x90) {
+        return WBMessagePackDecodeArray(reader, marker & 0x0f);
+    }
+    if ((marker & 0xf0) == 0x80) {
+        return WBMessagePackDecodeMap(reader, marker & 0x0f);
+    }
+    switch (marker) {
+        case 0xc0:
+            return [NSNull null];
+        case 0xc2:
+            return @NO;
+        case 0xc3:
+            return @YES;
+        case 0xc4:
+        case 0xc5:
+        case 0xc6:
+            return WBMessagePackReadBigEndian(reader, (size_t)1 << (marker - 0xc4), &value) ? WBMessagePackDecodeBytes(reader, value, NO) : nil;
+        case 0xc7: {
+            //只支持 timestamp 96
+            uint64_t length = 0;
+            uint64_t type = 0;
+            uint64_t nanoseconds = 0;
+            uint64_t seconds = 0;
+            if (!WBMessagePackReadBigEndian(reader, 1, &length) || !WBMessagePackReadBigEndian(reader, 1, &type) || length != 12 || type != 0xff ||
+                !WBMessagePackReadBigEndian(reader, 4, &nanoseconds) || !WBMessagePackReadBigEndian(reader, 8, &seconds)) {
+                return nil;
+            }
+            return [NSDate dateWithTimeIntervalSince1970:(double)(int64_t)seconds + (double)nanoseconds / 1e9];
+        }
+        case 0xca: {
+            if (!WBMessagePackReadBigEndian(reader, 4, &value)) {
+                return nil;
+            }
+            uint32_t bits = (uint32_t)value;
+            float result;
+            memcpy(&result, &bits, sizeof(result));
+            return @(result);
+        }
+        case 0xcb: {
+            if (!WBMessagePackReadBigEndian(reader, 8, &value)) {
+                return nil;
+            }
+            double result;
+            memcpy(&result, &value, sizeof(result));
+            return @(result);
+        }
+        case 0xcc:
+        case 0xcd:
+        case 0xce:
+        case 0xcf:
+            return WBMessagePackReadBigEndian(reader, (size_t)1 << (marker - 0xcc), &value) ? @((unsigned long long)value) : nil;
+        case 0xd0:
+        case 0xd1:
+        case 0xd2:
+        case 0xd3: {
+            size_t width = (size_t)1 << (marker - 0xd0);
+            if (!WBMessagePackReadBigEndian(reader, width, &value)) {
+                return nil;
+            }
+            //按宽度做符号扩展
+            unsigned shift = (unsigned)(64 - width * 8);
+            return @((long long)((int64_t)(value << shift) >> shift));
+        }
+        case 0xd9:
+        case 0xda:
+        case 0xdb:
+            return WBMessagePackReadBigEndian(reader, (size_t)1 << (marker - 0xd9), &value) ? WBMessagePackDecodeBytes(reader, value, YES) : nil;
+        case 0xdc:
+        case 0xdd:
+            return WBMessagePackReadBigEndian(reader, (size_t)2 << (marker - 0xdc), &value) ? WBMessagePackDecodeArray(reader, value) : nil;
+        case 0xde:
+        case 0xdf:
+            return WBMessagePackReadBigEndian(reader, (size_t)2 << (marker - 0xde), &value) ? WBMessagePackDecodeMap(reader, value) : nil;
+    }
+    return nil;
+}
+
+//整个 data 必须正好是一个对象
+static id WBMessagePackObjectFromData(NSData *data) {
+    WBMessagePackReader reader = {[data bytes], [data length], 0};
+    id object = WBMessagePackDecodeObject(&reader);
+    return reader.offset == reader.length ? object : nil;
+}
+
+#pragma mark - 输入
+
+static NSString * WBHarnessRandomString(NSUInteger maximumLength) {
+    static NSArray <NSString *> *pieces = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        pieces = @[@"a", @"Z", @"0", @" ", @"_", @"/", @"北", @"京", @"é", @"😀", @"👨‍👩‍👧", @"\n", @"\"", @"\\"];
+    });
+    NSMutableString *string = [NSMutableString string];
+    for (uint32_t i = arc4random_uniform((uint32_t)maximumLength + 1); i > 0; i--) {
+        [string appendString:pieces[arc4random_uniform((uint32_t)[pieces count])]];
+    }
+    return string;
+}
+
+static NSNumber * WBHarnessRandomNumber(void) {
+    //随机的宽度，覆盖每种整数格式，magnitude 总是非负数
+    int64_t magnitude = (int64_t)(((uint64_t)arc4random() << 32 | arc4random()) >> (1 + arc4random_uniform(63)));
+    switch (arc4random_uniform(7)) {
+        case 0:
+            return @(magnitude);
+        case 1:
+            return @(-magnitude);
+        case 2:
+            return @((unsigned long long)magnitude * 2 + arc4random_uniform(2));
+        case 3:
+            return @((double)arc4random() / 3.0 - 1e6);
+        case 4:
+            return @((float)arc4random_uniform(1 << 20) / 64.0f);
+        case 5:
+            return arc4random_uniform(2) ? @YES : @NO;
+        default:
+            return @((int)arc4random_uniform(256) - 128);
+    }
+}
+
+static id WBHarnessRandomObject(NSUInteger depth) {
+    uint32_t choice = arc4random_uniform(depth == 0 ? 6 : 8);
+    switch (choice) {
+        case 0:
+        case 1:
+            return WBHarnessRandomNumber();
+        case 2:
+            //偶尔生成超过 str8 的字符串
+            return WBHarnessRandomString(arc4random_uniform(20) == 0 ? 200 : 20);
+        case 3:
+            return [NSNull null];
+        case 4: {
+            NSMutableData *data = [NSMutableData dataWithLength:arc4random_uniform(arc4random_uniform(20) == 0 ? 70000 : 40)];
+            arc4random_buf([data mutableBytes], [data length]);
+            return data;
+        }
+        case 5:
+            //1/8 秒的整数倍，编码为纳秒时没有误差
+            return [NSDate dateWithTimeIntervalSince1970:((double)arc4random() - (double)UINT32_MAX / 2) / 4.0];
+        case 6: {
+            NSMutableArray *array = [NSMutableArray array];
+            for (uint32_t i = arc4random_uniform(arc4random_uniform(8) == 0 ? 40 : 6); i > 0; i--) {
+                [array addObject:WBHarnessRandomObject(depth - 1)];
+            }
+            return array;
+        }
+        default: {
+            NSMutableDictionary *dictionary = [NSMutableDictionary dictionary];
+            for (uint32_t i = arc4random_uniform(arc4random_uniform(8) == 0 ? 40 : 6); i > 0; i--) {
+                dictionary[WBHarnessRandomString(12)] = WBHarnessRandomObject(depth - 1);
+            }
+            return dictionary;
+        }
+    }
+}
+
+//埋点上报：公共字段加上 eventCount 个事件，只用表单、JSON 和 plist 都能表示的类型
+static NSDictionary * WBHarnessTelemetryPayload(NSUInteger eventCount) {
+    NSMutableArray *events = [NSMutableArray arrayWithCapacity:eventCount];
+    for (NSUInteger i = 0; i < eventCount; i++) {
+        [events addObject:@{
+            @"name": (i % 3 == 0) ? @"page_view" : @"click",
+            @"ts": @(1626307200000LL + (long long)i * 37),
+            @"seq": @(i),
+            @"duration": @(0.125 * (double)(i % 40)),
+            @"page": @"/home/feed",
+            @"network": (i % 2) ? @"wifi" : @"4g",
+            @"ok": @YES,
+            @"props": @{@"position": @(i % 20), @"source": @"recommend", @"item_id": @(880000000 + i), @"exp": @[@"a12", @"b7"]},
+        }];
+    }
+    return @{
+        @"app": @"wb",
+        @"version": @"3.2.0",
+        @"os": @"iOS 14.6",
+        @"device": @"iPhone12,1",
+        @"uid": @(1234567890),
+        @"session": @"8C1E2F0A-5B3D-4E6F-9A1B-2C3D4E5F6A7B",
+        @"events": events,
+    };
+}
+
+#pragma mark -
+
+//长字符串、data 和集合只输出类型和长度
+static NSString * WBHarnessDescription(id object) {
+    if ([object isKindOfClass:[NSString class]]) {
+        return [NSString stringWithFormat:@"string of %lu bytes", (unsigned long)[object lengthOfBytesUsingEncoding:NSUTF8StringEncoding]];
+    }
+    if ([object isKindOfClass:[NSData class]]) {
+        return [NSString stringWithFormat:@"data of %lu bytes", (unsigned long)[object length]];
+    }
+    if ([object isKindOfClass:[NSArray class]]) {
+        return [NSString stringWithFormat:@"array of %lu", (unsigned long)[object count]];
+    }
+    if ([object isKindOfClass:[NSDictionary class]]) {
+        return [NSString stringWithFormat:@"map of %lu", (unsigned long)[object count]];
+    }
+    return [object description];
+}
+
+static void WBHarnessCheckMessagePack(void) {
+    printf("# MessagePack format boundaries\n");
+    NSMutableString *string31 = [NSMutableString string];
+    while ([string31 length] < 31) {
+        [string31 appendString:@"a"];
+    }
+    NSString *string32 = [string31 stringByAppendingString:@"b"];
+    NSString *string256 = [@"" stringByPaddingToLength:256 withString:@"北京" startingAtIndex:0];
+    NSString *string65536 = [@"" stringByPaddingToLength:65536 withString:@"x" startingAtIndex:0];
+    NSMutableArray *array16 = [NSMutableArray array];
+    NSMutableDictionary *map16 = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < 16; i++) {
+        [array16 addObject:@(i)];
+        map16[[NSString stringWithFormat:@"k%lu", (unsigned long)i]] = @(i);
+    }
+    NSMutableArray *array65536 = [NSMutableArray arrayWithCapacity:65536];
+    for (NSUInteger i = 0; i < 65536; i++) {
+        [array65536 addObject:@0];
+    }
+
+    //值、编码后的第一个字节、编码后的长度
+    NSArray <NSArray *> *cases = @[
+        @[@0, @0x00, @1], @[@127, @0x7f, @1], @[@128, @0xcc, @2], @[@255, @0xcc, @2], @[@256, @0xcd, @3], @[@65535, @0xcd, @3],
+        @[@65536, @0xce, @5], @[@(UINT32_MAX), @0xce, @5], @[@((long long)UINT32_MAX + 1), @0xcf, @9], @[@(ULLONG_MAX), @0xcf, @9],
+        @[@(-1), @0xff, @1], @[@(-32), @0xe0, @1], @[@(-33), @0xd0, @2], @[@(INT8_MIN), @0xd0, @2], @[@(INT8_MIN - 1), @0xd1, @3],
+        @[@(INT16_MIN), @0xd1, @3], @[@(INT16_MIN - 1), @0xd2, @5], @[@(INT32_MIN), @0xd2, @5], @[@((long long)INT32_MIN - 1), @0xd3, @9], @[@(LLONG_MIN), @0xd3, @9],
+        @[@1.5f, @0xca, @5], @[@(-0.1), @0xcb, @9], @[@YES, @0xc3, @1], @[@NO, @0xc2, @1], @[[NSNull null], @0xc0, @1],
+        @[@"", @0xa0, @1], @[string31, @0xbf, @32], @[string32, @0xd9, @34], @[string256, @0xda, @(3 + 768)], @[string65536, @0xdb, @(5 + 65536)],
+        @[[NSData data], @0xc4, @2], @[[NSMutableData dataWithLength:256], @0xc5, @(3 + 256)], @[[NSMutableData dataWithLength:65536], @0xc6, @(5 + 65536)],
+        @[[NSDate dateWithTimeIntervalSince1970:1626307200.25], @0xc7, @15], @[[NSDate dateWithTimeIntervalSince1970:-1.5], @0xc7, @15],
+        @[@[], @0x90, @1], @[array16, @0xdc, @(3 + 16)], @[array65536, @0xdd, @(5 + 65536)], @[@{}, @0x80, @1], @[map16, @0xde, @0],
+    ];
+    for (NSArray *testCase in cases) {
+        id object = testCase[0];
+        uint8_t expectedMarker = [testCase[1] unsignedCharValue];
+        NSUInteger expectedLength = [testCase[2] unsignedIntegerValue];
+        NSError *error = nil;
+        NSData *data = WBMessagePackDataFromObject(object, &error);
+        const uint8_t *bytes = [data bytes];
+        BOOL matchesLength = (expectedLength == 0 || [data length] == expectedLength);
+        id decoded = data ? WBMessagePackObjectFromData(data) : nil;
+        WBHarnessCheck(data && bytes[0] == expectedMarker && matchesLength && [decoded isEqual:object], "%s: 0x%02x, %lu bytes", [WBHarnessDescription(object) UTF8String], data ? bytes[0] : 0, (unsigned long)[data length]);
+    }
+
+    NSError *error = nil;
+    NSData *data = WBMessagePackDataFromObject(@{@"a": @[@1, [[NSObject alloc] init]]}, &error);
+    WBHarnessCheck(!data && [error.domain isEqualToString:WBURLRequestSerializationErrorDomain], "a value that cannot be encoded gives an error");
+
+    printf("# MessagePack random trees\n");
+    NSUInteger mismatches = 0;
+    unsigned long long totalLength = 0;
+    for (NSUInteger i = 0; i < 2000; i++) {
+        @autoreleasepool {
+            id object = WBHarnessRandomObject(4);
+            NSData *encoded = WBMessagePackDataFromObject(object, nil);
+            totalLength += [encoded length];
+            if (![WBMessagePackObjectFromData(encoded) isEqual:object]) {
+                mismatches += 1;
+            }
+        }
+    }
+    WBHarnessCheck(mismatches == 0, "2000 random trees (%llu bytes): %lu do not round-trip", totalLength, (unsigned long)mismatches);
+}
+
+static void WBHarnessCheckSerializer(void) {
+    printf("# WBPropertyListRequestSerializer\n");
+    NSDictionary *parameters = WBHarnessTelemetryPayload(20);
+    NSString *URLString = @"https://log.example.com/v1/collect";
+
+    NSError *error = nil;
+    NSURLRequest *request = [[WBPropertyListRequestSerializer messagePackSerializer] requestWithMethod:@"POST" URLString:URLString parameters:parameters error:&error];
+    WBHarnessCheck(!error && [[request valueForHTTPHeaderField:@"Content-Type"] isEqualToString:@"application/msgpack"], "MessagePack: Content-Type is application/msgpack");
+    WBHarnessCheck([WBMessagePackObjectFromData(request.HTTPBody) isEqual:parameters], "MessagePack: the body decodes to the parameters");
+
+    request = [[WBPropertyListRequestSerializer serializerWithFormat:NSPropertyListBinaryFormat_v1_0 writeOptions:0] requestWithMethod:@"POST" URLString:URLString parameters:parameters error:&error];
+    NSPropertyListFormat format = NSPropertyListXMLFormat_v1_0;
+    id propertyList = request.HTTPBody ? [NSPropertyListSerialization propertyListWithData:request.HTTPBody options:NSPropertyListImmutable format:&format error:nil] : nil;
+    WBHarnessCheck(!error && [[request valueForHTTPHeaderField:@"Content-Type"] isEqualToString:@"application/x-plist"], "binary plist: Content-Type is application/x-plist");
+    WBHarnessCheck(format == NSPropertyListBinaryFormat_v1_0 && [propertyList isEqual:parameters], "binary plist: the body is a binary plist of the parameters");
+
+    request = [[WBPropertyListRequestSerializer serializer] requestWithMethod:@"POST" URLString:URLString parameters:parameters error:&error];
+    propertyList = request.HTTPBody ? [NSPropertyListSerialization propertyListWithData:request.HTTPBody options:NSPropertyListImmutable format:&format error:nil] : nil;
+    WBHarnessCheck(format == NSPropertyListXMLFormat_v1_0 && [propertyList isEqual:parameters], "+serializer: the body is an XML plist of the parameters");
+
+    request = [[WBPropertyListRequestSerializer messagePackSerializer] requestWithMethod:@"GET" URLString:URLString parameters:@{@"a": @1} error:&error];
+    WBHarnessCheck(!error && [request.URL.query isEqualToString:@"a=1"] && !request.HTTPBody, "GET keeps the parameters in the URL");
+
+    request = [[WBPropertyListRequestSerializer messagePackSerializer] requestWithMethod:@"POST" URLString:URLString parameters:@{@"a": [[NSObject alloc] init]} error:&error];
+    WBHarnessCheck(!request && error, "a parameter that cannot be encoded fails the request");
+
+    WBPropertyListRequestSerializer *copied = [[WBPropertyListRequestSerializer messagePackSerializer] copy];
+    NSData *archive = [NSKeyedArchiver archivedDataWithRootObject:[WBPropertyListRequestSerializer messagePackSerializer] requiringSecureCoding:YES error:nil];
+    WBPropertyListRequestSerializer *unarchived = archive ? [NSKeyedUnarchiver unarchivedObjectOfClass:[WBPropertyListRequestSerializer class] fromData:archive error:nil] : nil;
+    WBHarnessCheck(copied.encoding == WBPropertyListRequestEncodingMessagePack && unarchived.encoding == WBPropertyListRequestEncodingMessagePack, "the encoding survives copying and archiving");
+}
+
+//返回每次调用的纳秒数，*allocations 为每次调用的平均分配次数
+static double WBHarnessMeasure(NSUInteger iterations, double *allocations, void (^block)(void)) {
+    for (NSUInteger i = 0; i < 20; i++) {
+        @autoreleasepool {
+            block();
+        }
+    }
+    atomic_store(&WBHarnessAllocationCount, 0);
+    atomic_store(&WBHarnessCountsAllocations, true);
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            block();
+        }
+    }
+    atomic_store(&WBHarnessCountsAllocations, false);
+    *allocations = (double)atomic_load(&WBHarnessAllocationCount) / iterations;
+
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            block();
+        }
+    }
+    return (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / iterations;
+}
+
+static void WBHarnessMeasureSpeed(void) {
+    NSArray <NSString *> *names = @[@"form", @"JSON", @"binary plist", @"MessagePack"];
+    NSArray <WBHTTPRequestSerializer *> *serializers = @[
+        [WBHTTPRequestSerializer serializer],
+        [WBJsonRequestSerializer serializer],
+        [WBPropertyListRequestSerializer serializerWithFormat:NSPropertyListBinaryFormat_v1_0 writeOptions:0],
+        [WBPropertyListRequestSerializer messagePackSerializer],
+    ];
+    NSString *URLString = @"https://log.example.com/v1/collect";
+
+    printf("# body bytes and ns per POST request\n");
+    printf("%-8s %-14s %10s %9s %9s %12s %10s\n", "events", "encoding", "bytes", "vs form", "vs JSON", "ns", "MB/s");
+    for (NSNumber *eventCount in @[@1, @20, @200]) {
+        NSDictionary *parameters = WBHarnessTelemetryPayload([eventCount unsignedIntegerValue]);
+        NSUInteger iterations = MAX(20000 / [eventCount unsignedIntegerValue], 200);
+        NSMutableArray <NSNumber *> *lengths = [NSMutableArray array];
+        for (NSUInteger i = 0; i < [serializers count]; i++) {
+            WBHTTPRequestSerializer *serializer = serializers[i];
+            NSUInteger length = [[serializer requestWithMethod:@"POST" URLString:URLString parameters:parameters error:nil].HTTPBody length];
+            [lengths addObject:@(length)];
+            double allocations = 0;
+            double nanoseconds = WBHarnessMeasure(iterations, &allocations, ^{
+                [serializer requestWithMethod:@"POST" URLString:URLString parameters:parameters error:nil];
+            });
+            printf("%-8lu %-14s %10lu %8.0f%% %8.0f%% %12.0f %10.1f\n", (unsigned long)[eventCount unsignedIntegerValue], [names[i] UTF8String], (unsigned long)length,
+                   100.0 * length / [lengths[0] doubleValue], 100.0 * length / [[[serializers[1] requestWithMethod:@"POST" URLString:URLString parameters:parameters error:nil] HTTPBody] length], nanoseconds, (double)length / nanoseconds * 1000);
+        }
+        WBHarnessCheck([lengths[3] unsignedIntegerValue] < [lengths[1] unsignedIntegerValue] && [lengths[3] unsignedIntegerValue] < [lengths[0] unsignedIntegerValue], "%lu events: MessagePack is %.0f%% smaller than form and %.0f%% smaller than JSON", (unsigned long)[eventCount unsignedIntegerValue],
+                       100.0 - 100.0 * [lengths[3] doubleValue] / [lengths[0] doubleValue], 100.0 - 100.0 * [lengths[3] doubleValue] / [lengths[1] doubleValue]);
+    }
+
+    printf("# allocations per WBMessagePackDataFromObject call\n");
+    double smallAllocations = 0;
+    double largeAllocations = 0;
+    NSDictionary *small = WBHarnessTelemetryPayload(20);
+    NSDictionary *large = WBHarnessTelemetryPayload(200);
+    double smallNanoseconds = WBHarnessMeasure(2000, &smallAllocations, ^{
+        WBMessagePackDataFromObject(small, nil);
+    });
+    double largeNanoseconds = WBHarnessMeasure(200, &largeAllocations, ^{
+        WBMessagePackDataFromObject(large, nil);
+    });
+    printf("20 events: %.1f allocations, %.0f ns; 200 events: %.1f allocations, %.0f ns\n", smallAllocations, smallNanoseconds, largeAllocations, largeNanoseconds);
+    //200 个事件有 3000 多个对象，分配次数不应该随对象数增长
+    WBHarnessCheck(largeAllocations <= smallAllocations + 2, "allocations do not grow with the number of objects");
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        if (!WBHarnessInstallAllocationCounter()) {
+            fprintf(stderr, "cannot wrap the default malloc zone\n");
+            return 1;
+        }
+        WBHarnessCheckMessagePack();
+        WBHarnessCheckSerializer();
+        if (WBHarnessFailures == 0) {
+            WBHarnessMeasureSpeed();
+        }
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
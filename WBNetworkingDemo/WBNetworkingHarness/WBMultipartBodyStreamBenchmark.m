@@ -0,0 +1,167 @@
+//
+//  WBMultipartBodyStreamBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Throughput and memory of WBMultipartBodyStream for photo batches built with `-multipartFormRequestWithMethod:URLString:parameters:constructingBodyWithBlock:error:`.
+//  - photo batches of 20 MB and 50 MB (3 MB per photo) are read through HTTPBodyStream and compared with reading the same files directly with read(2);
+//  - forms of 10 to 5000 small file parts show how the memory growth while reading depends on the part count.
+//  Files are written just before they are read, so both sides read from the page cache.
+//  用 multipartFormRequestWithMethod 构造照片批量上传的 body，测量 WBMultipartBodyStream 的读取速度和内存：
+//  20 MB 和 50 MB 的照片批次（每张 3 MB）和直接 read(2) 同样的文件对比；10 到 5000 个小文件 part 的表单用来观察读取时内存增长和 part 数量的关系。文件刚写入，两边都从 page cache 读取。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBMultipartBodyStreamBenchmark.m -o /tmp/WBMultipartBodyStreamBenchmark
+//  /tmp/WBMultipartBodyStreamBenchmark [read buffer in KB, default 256]
+//
+
+#import <Foundation/Foundation.h>
+#import <mach/mach.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import "WBURLRequestSeriailzation.h"
+
+static uint64_t WBPhysicalFootprint(void) {
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.phys_footprint;
+}
+
+static NSArray <NSURL *> * WBWriteFiles(NSURL *directory, NSUInteger count, NSUInteger length) {
+    NSMutableArray *fileURLs = [NSMutableArray arrayWithCapacity:count];
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    for (NSUInteger i = 0; i < count; i++) {
+        arc4random_buf([data mutableBytes], length);
+        NSURL *fileURL = [directory URLByAppendingPathComponent:[NSString stringWithFormat:@"IMG_%04lu.JPG", (unsigned long)i]];
+        [data writeToURL:fileURL atomically:NO];
+        [fileURLs addObject:fileURL];
+    }
+    return fileURLs;
+}
+
+static NSURLRequest * WBPhotoBatchRequest(NSArray <NSURL *> *fileURLs) {
+    NSError *error = nil;
+    NSURLRequest *request = [[WBHTTPRequestSerializer serializer] multipartFormRequestWithMethod:@"POST" URLString:@"http://127.0.0.1/upload" parameters:@{@"album": @"benchmark"} constructingBodyWithBlock:^(id<WBMultipartFormData> formData) {
+        for (NSURL *fileURL in fileURLs) {
+            [formData appendPartWithFileURL:fileURL name:@"photos[]" error:nil];
+        }
+    } error:&error];
+    if (!request) {
+        fprintf(stderr, "cannot build the request: %s\n", [[error description] UTF8String]);
+        exit(1);
+    }
+    return request;
+}
+
+//读完整个 body，返回读取的字节数，peakGrowth 为读取期间 phys_footprint 的最大增长
+static unsigned long long WBDrainBodyStream(NSInputStream *stream, uint8_t *buffer, NSUInteger bufferLength, uint64_t *elapsed, uint64_t *peakGrowth) {
+    uint64_t baseline = WBPhysicalFootprint();
+    uint64_t peak = baseline;
+    unsigned long long total = 0;
+    NSUInteger reads = 0;
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    [stream open];
+    while (YES) {
+        NSInteger length = [stream read:buffer maxLength:bufferLength];
+        if (length <= 0) {
+            if (length < 0) {
+                fprintf(stderr, "read failed: %s\n", [[[stream streamError] description] UTF8String]);
+                exit(1);
+            }
+            break;
+        }
+        total += (unsigned long long)length;
+        if (++reads % 64 == 0) {
+            peak = MAX(peak, WBPhysicalFootprint());
+        }
+    }
+    [stream close];
+    *elapsed = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+    *peakGrowth = MAX(peak, WBPhysicalFootprint()) - baseline;
+    return total;
+}
+
+static unsigned long long WBReadFiles(NSArray <NSURL *> *fileURLs, uint8_t *buffer, NSUInteger bufferLength, uint64_t *elapsed) {
+    unsigned long long total = 0;
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSURL *fileURL in fileURLs) {
+        int fd = open([fileURL fileSystemRepresentation], O_RDONLY);
+        ssize_t length;
+        while ((length = read(fd, buffer, bufferLength)) > 0) {
+            total += (unsigned long long)length;
+        }
+        close(fd);
+    }
+    *elapsed = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+    return total;
+}
+
+static double WBMegabytesPerSecond(unsigned long long bytes, uint64_t nanoseconds) {
+    return (double)bytes / (1024 * 1024) / ((double)nanoseconds / NSEC_PER_SEC);
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        NSUInteger bufferLength = (argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : 256) * 1024;
+        uint8_t *buffer = malloc(bufferLength);
+        NSURL *directory = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]] isDirectory:YES];
+        [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+
+        printf("read buffer %lu KB\n", (unsigned long)bufferLength / 1024);
+        printf("%-10s %8s %12s %12s %8s %14s\n", "batch", "photos", "stream MB/s", "read(2) MB/s", "ratio", "peak growth KB");
+        for (NSNumber *megabytes in @[@20, @50]) {
+            NSUInteger photoCount = ([megabytes unsignedIntegerValue] + 2) / 3;
+            NSURL *batchDirectory = [directory URLByAppendingPathComponent:[megabytes stringValue]];
+            [[NSFileManager defaultManager] createDirectoryAtURL:batchDirectory withIntermediateDirectories:YES attributes:nil error:nil];
+            NSArray <NSURL *> *fileURLs = WBWriteFiles(batchDirectory, photoCount, 3 * 1024 * 1024);
+
+            //各跑三次取最快的一次
+            double streamSpeed = 0;
+            double fileSpeed = 0;
+            uint64_t peakGrowth = 0;
+            for (NSUInteger run = 0; run < 3; run++) {
+                @autoreleasepool {
+                    NSURLRequest *request = WBPhotoBatchRequest(fileURLs);
+                    uint64_t elapsed = 0;
+                    uint64_t growth = 0;
+                    unsigned long long length = WBDrainBodyStream(request.HTTPBodyStream, buffer, bufferLength, &elapsed, &growth);
+                    if (length != (unsigned long long)[[request valueForHTTPHeaderField:@"Content-Length"] longLongValue]) {
+                        fprintf(stderr, "read %llu bytes, Content-Length is %s\n", length, [[request valueForHTTPHeaderField:@"Content-Length"] UTF8String]);
+                        return 1;
+                    }
+                    streamSpeed = MAX(streamSpeed, WBMegabytesPerSecond(length, elapsed));
+                    peakGrowth = MAX(peakGrowth, growth);
+
+                    length = WBReadFiles(fileURLs, buffer, bufferLength, &elapsed);
+                    fileSpeed = MAX(fileSpeed, WBMegabytesPerSecond(length, elapsed));
+                }
+            }
+            printf("%-10s %8lu %12.0f %12.0f %8.2f %14llu\n", [[NSString stringWithFormat:@"%@ MB", megabytes] UTF8String], (unsigned long)photoCount, streamSpeed, fileSpeed, streamSpeed / fileSpeed, peakGrowth / 1024);
+        }
+
+        //part 数量增加时，读取期间的内存增长应该保持不变
+        printf("\n%-10s %12s %14s\n", "parts", "stream MB/s", "peak growth KB");
+        NSURL *smallDirectory = [directory URLByAppendingPathComponent:@"small"];
+        [[NSFileManager defaultManager] createDirectoryAtURL:smallDirectory withIntermediateDirectories:YES attributes:nil error:nil];
+        NSArray <NSURL *> *smallFileURLs = WBWriteFiles(smallDirectory, 5000, 4 * 1024);
+        for (NSNumber *partCount in @[@10, @100, @1000, @5000]) {
+            @autoreleasepool {
+                NSURLRequest *request = WBPhotoBatchRequest([smallFileURLs subarrayWithRange:NSMakeRange(0, [partCount unsignedIntegerValue])]);
+                uint64_t elapsed = 0;
+                uint64_t growth = 0;
+                unsigned long long length = WBDrainBodyStream(request.HTTPBodyStream, buffer, bufferLength, &elapsed, &growth);
+                printf("%-10lu %12.0f %14llu\n", (unsigned long)[partCount unsignedIntegerValue], WBMegabytesPerSecond(length, elapsed), growth / 1024);
+            }
+        }
+
+        free(buffer);
+        [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+    }
+    return 0;
+}
@@ -0,0 +1,250 @@
+//
+//  WBMultipartFileBatchBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Checks `-[WBMultipartFormData appendPartsWithFileURLs:name:computesSHA256:maxConcurrentFileCount:error:]` and measures how form construction time grows with the file count:
+//  1. the report has the length and SHA-256 of every file in order, and the form is byte for byte the one built by calling `-appendPartWithFileURL:name:error:` for each file;
+//  2. a missing file or a non-file URL fails the whole batch with an error for that URL and appends no part;
+//  3. timing: 25 to 400 files of 256 KB, with and without SHA-256, appended one by one on the calling thread and in one batch on 1, 4 and all processors. Time per file should stay flat as the file count grows, and the batch should beat the serial loop when it hashes.
+//  检查批量拼接文件的接口，并测量构造表单的耗时随文件数量的变化：
+//  1. 返回的报告中按顺序包含每个文件的长度和 SHA-256，构造的表单和逐个调用 appendPartWithFileURL:name:error: 的结果逐字节相同；
+//  2. 文件不存在或者不是文件 URL 时整批失败，返回对应 URL 的错误，不拼接任何 part；
+//  3. 耗时：25 到 400 个 256 KB 的文件，计算和不计算 SHA-256，在调用线程上逐个拼接，以及分别在 1、4 个和全部处理器上批量拼接。每个文件的耗时应该不随文件数量增长，计算 SHA-256 时批量拼接应该比逐个拼接快。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBMultipartFileBatchBenchmark.m -o /tmp/WBMultipartFileBatchBenchmark
+//  /tmp/WBMultipartFileBatchBenchmark
+//
+
+#import <Foundation/Foundation.h>
+#import <CommonCrypto/CommonDigest.h>
+#import "WBURLRequestSeriailzation.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+static NSString * const kWBHarnessURLString = @"https://upload.example.com/v1/photos";
+
+static NSUInteger const kWBHarnessFileLength = 256 * 1024;
+
+//在 directory 中生成 count 个随机内容的文件
+static NSArray <NSURL *> * WBHarnessCreateFiles(NSURL *directory, NSUInteger count, NSUInteger length) {
+    NSMutableArray <NSURL *> *fileURLs = [NSMutableArray arrayWithCapacity:count];
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    for (NSUInteger index = 0; index < count; index++) {
+        arc4random_buf([data mutableBytes], length);
+        NSURL *fileURL = [directory URLByAppendingPathComponent:[NSString stringWithFormat:@"IMG_%04lu.jpg", (unsigned long)index]];
+        if (![data writeToURL:fileURL atomically:NO]) {
+            return nil;
+        }
+        [fileURLs addObject:fileURL];
+    }
+    return fileURLs;
+}
+
+static NSData * WBHarnessSHA256(NSData *data) {
+    NSMutableData *digest = [NSMutableData dataWithLength:CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256([data bytes], (CC_LONG)[data length], [digest mutableBytes]);
+    return digest;
+}
+
+static NSData * WBHarnessReadStream(NSInputStream *stream) {
+    NSMutableData *data = [NSMutableData data];
+    uint8_t buffer[64 * 1024];
+    [stream open];
+    NSInteger length;
+    while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0) {
+        [data appendBytes:buffer length:(NSUInteger)length];
+    }
+    [stream close];
+    return data;
+}
+
+//读出整个 body，把随机生成的 boundary 替换成固定的字符串，以便比较两个请求
+static NSData * WBHarnessBodyWithoutBoundary(NSURLRequest *request) {
+    NSString *contentType = [request valueForHTTPHeaderField:@"Content-Type"];
+    NSString *boundary = [[contentType componentsSeparatedByString:@"boundary="] lastObject];
+    NSData *body = WBHarnessReadStream(request.HTTPBodyStream);
+    NSData *boundaryData = [boundary dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *replacement = [[@"" stringByPaddingToLength:[boundary length] withString:@"B" startingAtIndex:0] dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *result = [body mutableCopy];
+    NSRange range = NSMakeRange(0, [result length]);
+    while ((range = [result rangeOfData:boundaryData options:0 range:range]).location != NSNotFound) {
+        [result replaceBytesInRange:range withBytes:[replacement bytes]];
+        range = NSMakeRange(NSMaxRange(range), [result length] - NSMaxRange(range));
+    }
+    return result;
+}
+
+static NSURLRequest * WBHarnessBatchRequest(NSArray <NSURL *> *fileURLs, BOOL computesSHA256, NSUInteger maxConcurrentFileCount, WBMultipartFormFileBatchReport **report, NSError **error) {
+    __block WBMultipartFormFileBatchReport *batchReport = nil;
+    __block NSError *batchError = nil;
+    NSURLRequest *request = [[WBHTTPRequestSerializer serializer] multipartFormRequestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:nil constructingBodyWithBlock:^(id<WBMultipartFormData> formData) {
+        NSError *appendError = nil;
+        batchReport = [formData appendPartsWithFileURLs:fileURLs name:@"photos" computesSHA256:computesSHA256 maxConcurrentFileCount:maxConcurrentFileCount error:&appendError];
+        batchError = appendError;
+    } error:nil];
+    if (report) {
+        *report = batchReport;
+    }
+    if (error) {
+        *error = batchError;
+    }
+    return request;
+}
+
+#pragma mark -
+
+static void WBHarnessCheckBatch(NSURL *directory) {
+    printf("# the batch builds the same form\n");
+    NSArray <NSURL *> *fileURLs = WBHarnessCreateFiles(directory, 20, 64 * 1024);
+
+    WBMultipartFormFileBatchReport *report = nil;
+    NSError *error = nil;
+    NSURLRequest *batchRequest = WBHarnessBatchRequest(fileURLs, YES, 4, &report, &error);
+    BOOL lengthsMatch = ([report.fileLengths count] == [fileURLs count]);
+    BOOL digestsMatch = ([report.SHA256Digests count] == [fileURLs count]);
+    for (NSUInteger index = 0; index < [fileURLs count] && lengthsMatch && digestsMatch; index++) {
+        NSData *data = [NSData dataWithContentsOfURL:fileURLs[index]];
+        lengthsMatch = ([report.fileLengths[index] unsignedLongLongValue] == [data length]);
+        digestsMatch = [report.SHA256Digests[index] isEqualToData:WBHarnessSHA256(data)];
+    }
+    WBHarnessCheck(report && !error, "20 files appended");
+    WBHarnessCheck(lengthsMatch && report.totalLength == 20 * 64 * 1024, "the report has every file length in order");
+    WBHarnessCheck(digestsMatch, "the report has every SHA-256 digest in order");
+    WBHarnessCheck(report.elapsedTime > 0 && report.cumulativeFileTime > 0, "elapsed %.2f ms, %.2f ms summed over workers", report.elapsedTime * 1000, report.cumulativeFileTime * 1000);
+
+    WBMultipartFormFileBatchReport *unhashedReport = nil;
+    WBHarnessBatchRequest(fileURLs, NO, 1, &unhashedReport, nil);
+    WBHarnessCheck([unhashedReport.fileLengths isEqualToArray:report.fileLengths] && !unhashedReport.SHA256Digests, "without SHA-256 the lengths are the same and there are no digests");
+
+    NSURLRequest *serialRequest = [[WBHTTPRequestSerializer serializer] multipartFormRequestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:nil constructingBodyWithBlock:^(id<WBMultipartFormData> formData) {
+        for (NSURL *fileURL in fileURLs) {
+            [formData appendPartWithFileURL:fileURL name:@"photos" error:nil];
+        }
+    } error:nil];
+    WBHarnessCheck([[batchRequest valueForHTTPHeaderField:@"Content-Length"] isEqualToString:[serialRequest valueForHTTPHeaderField:@"Content-Length"]], "Content-Length %s, the same as one append per file", [[batchRequest valueForHTTPHeaderField:@"Content-Length"] UTF8String]);
+    WBHarnessCheck([WBHarnessBodyWithoutBoundary(batchRequest) isEqualToData:WBHarnessBodyWithoutBoundary(serialRequest)], "the body is the same as one append per file");
+
+    printf("# a file that cannot be read fails the batch\n");
+    NSURLRequest *emptyRequest = [[WBHTTPRequestSerializer serializer] multipartFormRequestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:nil constructingBodyWithBlock:nil error:nil];
+    NSMutableArray <NSURL *> *missing = [fileURLs mutableCopy];
+    NSURL *missingURL = [directory URLByAppendingPathComponent:@"missing.jpg"];
+    [missing insertObject:missingURL atIndex:10];
+    report = nil;
+    error = nil;
+    NSURLRequest *failedRequest = WBHarnessBatchRequest(missing, YES, 4, &report, &error);
+    WBHarnessCheck(!report && [error.userInfo[NSURLErrorKey] isEqual:missingURL], "a missing file: %s %ld for that URL", [error.domain UTF8String], (long)error.code);
+    WBHarnessCheck([WBHarnessReadStream(failedRequest.HTTPBodyStream) length] == [WBHarnessReadStream(emptyRequest.HTTPBodyStream) length], "no part is appended");
+
+    NSMutableArray <NSURL *> *remote = [fileURLs mutableCopy];
+    [remote addObject:[NSURL URLWithString:@"https://example.com/photo.jpg"]];
+    report = nil;
+    error = nil;
+    WBHarnessBatchRequest(remote, NO, 0, &report, &error);
+    WBHarnessCheck(!report && error.code == NSURLErrorBadURL, "a non-file URL fails with NSURLErrorBadURL");
+}
+
+//在调用线程上逐个拼接，computesSHA256 时再逐个读文件计算 SHA-256，返回耗时（秒）
+static NSTimeInterval WBHarnessSerialAppend(NSArray <NSURL *> *fileURLs, BOOL computesSHA256) {
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    [[WBHTTPRequestSerializer serializer] multipartFormRequestWithMethod:@"POST" URLString:kWBHarnessURLString parameters:nil constructingBodyWithBlock:^(id<WBMultipartFormData> formData) {
+        for (NSURL *fileURL in fileURLs) {
+            [formData appendPartWithFileURL:fileURL name:@"photos" error:nil];
+            if (computesSHA256) {
+                @autoreleasepool {
+                    WBHarnessSHA256([NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:nil]);
+                }
+            }
+        }
+    } error:nil];
+    return (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / NSEC_PER_SEC;
+}
+
+//三次中最快的一次
+static NSTimeInterval WBHarnessBest(NSTimeInterval (^measure)(void)) {
+    NSTimeInterval best = DBL_MAX;
+    for (NSUInteger run = 0; run < 3; run++) {
+        best = MIN(best, measure());
+    }
+    return best;
+}
+
+static void WBHarnessMeasureScaling(NSURL *directory) {
+    NSUInteger processorCount = [[NSProcessInfo processInfo] activeProcessorCount];
+    printf("# ms per file, %lu processors\n", (unsigned long)processorCount);
+    printf("%-6s %-7s %10s %10s %10s %10s %12s\n", "files", "SHA-256", "serial", "batch x1", "batch x4", "batch auto", "concurrency");
+
+    NSArray <NSURL *> *allFileURLs = WBHarnessCreateFiles(directory, 400, kWBHarnessFileLength);
+    for (NSNumber *computesSHA256 in @[@NO, @YES]) {
+        double firstPerFile = 0;
+        double lastPerFile = 0;
+        double lastSpeedup = 0;
+        for (NSNumber *fileCount in @[@25, @50, @100, @200, @400]) {
+            NSArray <NSURL *> *fileURLs = [allFileURLs subarrayWithRange:NSMakeRange(0, [fileCount unsignedIntegerValue])];
+            BOOL hashes = [computesSHA256 boolValue];
+            NSTimeInterval serial = WBHarnessBest(^NSTimeInterval{
+                return WBHarnessSerialAppend(fileURLs, hashes);
+            });
+            NSTimeInterval batch[3];
+            __block WBMultipartFormFileBatchReport *autoReport = nil;
+            NSArray <NSNumber *> *concurrencies = @[@1, @4, @0];
+            for (NSUInteger i = 0; i < [concurrencies count]; i++) {
+                batch[i] = WBHarnessBest(^NSTimeInterval{
+                    WBMultipartFormFileBatchReport *report = nil;
+                    WBHarnessBatchRequest(fileURLs, hashes, [concurrencies[i] unsignedIntegerValue], &report, nil);
+                    autoReport = report;
+                    return report.elapsedTime;
+                });
+            }
+            double count = [fileCount doubleValue];
+            printf("%-6lu %-7s %10.3f %10.3f %10.3f %10.3f %11.1fx\n", (unsigned long)[fileCount unsignedIntegerValue], hashes ? "yes" : "no",
+                   serial * 1000 / count, batch[0] * 1000 / count, batch[1] * 1000 / count, batch[2] * 1000 / count, autoReport.cumulativeFileTime / autoReport.elapsedTime);
+            if (!firstPerFile) {
+                firstPerFile = batch[2] / count;
+            }
+            lastPerFile = batch[2] / count;
+            lastSpeedup = serial / batch[2];
+        }
+        WBHarnessCheck(lastPerFile <= firstPerFile * 2, "%s SHA-256: %.3f ms per file for 400 files, %.3f ms for 25", [computesSHA256 boolValue] ? "with" : "without", lastPerFile * 1000, firstPerFile * 1000);
+        if ([computesSHA256 boolValue] && processorCount >= 4) {
+            WBHarnessCheck(lastSpeedup >= 1.5, "hashing 400 files in a batch is %.1fx faster than one by one", lastSpeedup);
+        }
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+        [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+        NSURL *checkDirectory = [directory URLByAppendingPathComponent:@"check"];
+        NSURL *scalingDirectory = [directory URLByAppendingPathComponent:@"scaling"];
+        [[NSFileManager defaultManager] createDirectoryAtURL:checkDirectory withIntermediateDirectories:YES attributes:nil error:nil];
+        [[NSFileManager defaultManager] createDirectoryAtURL:scalingDirectory withIntermediateDirectories:YES attributes:nil error:nil];
+
+        WBHarnessCheckBatch(checkDirectory);
+        if (WBHarnessFailures == 0) {
+            WBHarnessMeasureScaling(scalingDirectory);
+        }
+        [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,230 @@
+//
+//  WBMultipartResumeHarness.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Uploads a multipart body with form, data and file parts to a loopback server that drops the connection after N body bytes, then resumes it with `-requestWithMultipartFormRequest:resumingFromOffset:error:` from the byte count the server actually received. N is swept around and inside every part. For each drop it checks that:
+//  - the upload fails, and the server kept exactly N bytes, a prefix of the full body;
+//  - the resumed upload carries the rest of the body, with a matching Content-Length, the caller's Upload-Offset and no Content-Range, so that both pieces together are the full body;
+//  - every part body that ends after the resume offset is reported by `-computePartChecksumsWithHandler:` with the same CRC32C, SHA-256 and offsets as an uninterrupted upload, and those digests match the bytes the server received.
+//  把包含表单、data 和文件 part 的 multipart body 上传到在收到 N 个 body 字节后断开连接的回环服务器，再从服务端实际收到的字节数用 requestWithMultipartFormRequest:resumingFromOffset:error: 继续上传，N 取每个 part 前后和中间的多个位置。
+//  检查上传失败且服务端正好保存了完整 body 的前 N 个字节；继续上传的是剩余部分，Content-Length 正确，保留 Upload-Offset，没有 Content-Range，两段合起来就是完整的 body；
+//  继续上传的位置之后结束的每个 part 的 CRC32C、SHA-256 和位置都和不中断的上传相同，也和服务端收到的数据一致。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBLoopbackHTTPServer.m WBMultipartResumeHarness.m -o /tmp/WBMultipartResumeHarness
+//  /tmp/WBMultipartResumeHarness
+//
+
+#import <Foundation/Foundation.h>
+#import <CommonCrypto/CommonDigest.h>
+#import "WBURLRequestSeriailzation.h"
+#import "WBLoopbackHTTPServer.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+//逐位计算的 CRC32C，作为对照
+static uint32_t WBHarnessCRC32C(const uint8_t *bytes, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static NSData * WBHarnessSHA256(const uint8_t *bytes, size_t length) {
+    NSMutableData *digest = [NSMutableData dataWithLength:CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(bytes, (CC_LONG)length, [digest mutableBytes]);
+    return digest;
+}
+
+static NSData * WBHarnessRandomData(NSUInteger length) {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    arc4random_buf([data mutableBytes], length);
+    return data;
+}
+
+//同步发送请求，返回服务端收到的请求；上传失败时返回 nil，error 为上传的错误。
+//每次都用新的 session，被中断的请求不会在复用的 keep-alive 连接上被自动重试
+static WBLoopbackHTTPRequest * WBHarnessSend(NSURLRequest *request, NSMutableArray <WBLoopbackHTTPRequest *> *receivedRequests, NSError * __autoreleasing *error) {
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:[NSURLSessionConfiguration ephemeralSessionConfiguration]];
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    __block NSError *taskError = nil;
+    [[session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        taskError = error;
+        dispatch_semaphore_signal(done);
+    }] resume];
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+    [session finishTasksAndInvalidate];
+    WBLoopbackHTTPRequest *received = nil;
+    @synchronized (receivedRequests) {
+        received = [receivedRequests lastObject];
+        [receivedRequests removeAllObjects];
+    }
+    if (error) {
+        *error = taskError;
+    }
+    return taskError ? nil : received;
+}
+
+static NSArray <WBMultipartFormPartChecksum *> * WBHarnessTakeChecksums(NSMutableArray <WBMultipartFormPartChecksum *> *checksums) {
+    @synchronized (checksums) {
+        NSArray <WBMultipartFormPartChecksum *> *taken = [checksums copy];
+        [checksums removeAllObjects];
+        return taken;
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        NSMutableArray <WBLoopbackHTTPRequest *> *receivedRequests = [NSMutableArray array];
+        WBLoopbackHTTPServer *server = [[WBLoopbackHTTPServer alloc] initWithHandler:^NSData *(WBLoopbackHTTPRequest *request) {
+            @synchronized (receivedRequests) {
+                [receivedRequests addObject:request];
+            }
+            return [NSData data];
+        }];
+        if (![server start]) {
+            fprintf(stderr, "cannot start the loopback server\n");
+            return 1;
+        }
+
+        NSURL *fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]]];
+        [WBHarnessRandomData(1024 * 1024 + 7) writeToURL:fileURL atomically:YES];
+
+        //所有上传共用同一个 handler，按上传的顺序依次收集
+        NSMutableArray <WBMultipartFormPartChecksum *> *checksums = [NSMutableArray array];
+        NSData *data = WBHarnessRandomData(200 * 1024 + 3);
+        NSURLRequest *request = [[WBHTTPRequestSerializer serializer] multipartFormRequestWithMethod:@"POST" URLString:[[server.baseURL URLByAppendingPathComponent:@"upload"] absoluteString] parameters:@{@"key": @"value"} constructingBodyWithBlock:^(id<WBMultipartFormData> formData) {
+            [formData appendPartWithFormData:[@"form" dataUsingEncoding:NSUTF8StringEncoding] name:@"form"];
+            [formData appendPartWithFileData:data name:@"data" fileName:@"data.bin" mimeType:@"application/octet-stream"];
+            [formData appendPartWithFileURL:fileURL name:@"file" error:nil];
+            [formData computePartChecksumsWithHandler:^(WBMultipartFormPartChecksum *checksum) {
+                @synchronized (checksums) {
+                    [checksums addObject:checksum];
+                }
+            }];
+        } error:nil];
+
+        //不中断地上传一次作为对照。每次上传都用 offset 为 0 的副本，和原请求读到的是同样的 body
+        printf("# uninterrupted upload\n");
+        NSError *error = nil;
+        WBLoopbackHTTPRequest *full = WBHarnessSend([[WBHTTPRequestSerializer serializer] requestWithMultipartFormRequest:request resumingFromOffset:0 error:&error], receivedRequests, &error);
+        NSData *fullBody = full.body;
+        NSArray <WBMultipartFormPartChecksum *> *fullChecksums = WBHarnessTakeChecksums(checksums);
+        WBHarnessCheck(fullBody && [fullChecksums count] == 4, "full body %lu bytes, %lu part checksums", (unsigned long)[fullBody length], (unsigned long)[fullChecksums count]);
+        if (!fullBody || [fullChecksums count] != 4) {
+            printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+            return 1;
+        }
+        unsigned long long fullLength = [fullBody length];
+
+        for (WBMultipartFormPartChecksum *checksum in fullChecksums) {
+            BOOL inside = checksum.bodyOffset + checksum.bodyLength <= fullLength;
+            const uint8_t *bytes = (const uint8_t *)[fullBody bytes] + checksum.bodyOffset;
+            WBHarnessCheck(inside && checksum.CRC32C == WBHarnessCRC32C(bytes, (size_t)checksum.bodyLength), "part %lu: CRC32C matches the received bytes", (unsigned long)checksum.index);
+            WBHarnessCheck(inside && [checksum.SHA256 isEqualToData:WBHarnessSHA256(bytes, (size_t)checksum.bodyLength)], "part %lu: SHA-256 matches the received bytes", (unsigned long)checksum.index);
+        }
+
+        //在 boundary、part 头、part body 的开头、中间和结尾附近断开连接
+        NSMutableOrderedSet <NSNumber *> *dropPoints = [NSMutableOrderedSet orderedSetWithArray:@[@1, @(fullLength - 1)]];
+        for (WBMultipartFormPartChecksum *checksum in fullChecksums) {
+            unsigned long long start = checksum.bodyOffset;
+            unsigned long long end = start + checksum.bodyLength;
+            for (NSNumber *dropPoint in @[@(start - 1), @(start), @(start + 1), @(start + checksum.bodyLength / 2), @(end - 1), @(end), @(end + 1)]) {
+                if ([dropPoint unsignedLongLongValue] > 0 && [dropPoint unsignedLongLongValue] < fullLength) {
+                    [dropPoints addObject:dropPoint];
+                }
+            }
+        }
+        [dropPoints sortUsingComparator:^NSComparisonResult(NSNumber *a, NSNumber *b) {
+            return [a compare:b];
+        }];
+
+        WBLoopbackHTTPRequest *previousDropped = nil;
+        for (NSNumber *dropPoint in dropPoints) {
+            unsigned long long dropAfter = [dropPoint unsignedLongLongValue];
+            printf("# dropped after %llu bytes\n", dropAfter);
+
+            server.dropsConnectionAfterBodyBytes = dropAfter;
+            WBLoopbackHTTPRequest *received = WBHarnessSend([[WBHTTPRequestSerializer serializer] requestWithMultipartFormRequest:request resumingFromOffset:0 error:&error], receivedRequests, &error);
+            WBHarnessCheck(!received && error, "the interrupted upload failed: %s", [[error localizedDescription] UTF8String]);
+            //客户端在断开时可能已经读完了更多的 part，报告的校验值同样要和完整上传一致
+            for (WBMultipartFormPartChecksum *checksum in WBHarnessTakeChecksums(checksums)) {
+                WBMultipartFormPartChecksum *fullChecksum = fullChecksums[checksum.index];
+                WBHarnessCheck(checksum.CRC32C == fullChecksum.CRC32C && [checksum.SHA256 isEqualToData:fullChecksum.SHA256], "part %lu read before the drop has the full upload's digests", (unsigned long)checksum.index);
+            }
+
+            WBLoopbackHTTPRequest *dropped = server.lastDroppedRequest;
+            if (!dropped || dropped == previousDropped) {
+                WBHarnessCheck(NO, "the server did not drop the connection");
+                continue;
+            }
+            previousDropped = dropped;
+            //从服务端实际保存的字节数继续，而不是客户端已经发出的字节数
+            unsigned long long offset = [dropped.body length];
+            WBHarnessCheck(offset == dropAfter && [dropped.body isEqualToData:[fullBody subdataWithRange:NSMakeRange(0, (NSUInteger)offset)]], "the server kept the first %llu bytes of the body", offset);
+
+            NSMutableURLRequest *resumedRequest = [[WBHTTPRequestSerializer serializer] requestWithMultipartFormRequest:request resumingFromOffset:offset error:&error];
+            if (!resumedRequest) {
+                WBHarnessCheck(NO, "resume from %llu: %s", offset, [[error description] UTF8String]);
+                continue;
+            }
+            //续传协议由调用方决定，这里用 Upload-Offset
+            [resumedRequest setValue:[@(offset) stringValue] forHTTPHeaderField:@"Upload-Offset"];
+
+            received = WBHarnessSend(resumedRequest, receivedRequests, &error);
+            NSArray <WBMultipartFormPartChecksum *> *resumedChecksums = WBHarnessTakeChecksums(checksums);
+            WBHarnessCheck(received != nil, "resumed upload from %llu finished: %s", offset, error ? [[error localizedDescription] UTF8String] : "no error");
+            if (!received) {
+                continue;
+            }
+
+            NSMutableData *joinedBody = [dropped.body mutableCopy];
+            [joinedBody appendData:received.body];
+            WBHarnessCheck([joinedBody isEqualToData:fullBody], "dropped and resumed pieces join into the full body (%lu + %lu bytes)", (unsigned long)[dropped.body length], (unsigned long)[received.body length]);
+            WBHarnessCheck([received.headers[@"content-length"] longLongValue] == (long long)(fullLength - offset), "Content-Length is %s", [received.headers[@"content-length"] UTF8String]);
+            WBHarnessCheck(received.headers[@"content-range"] == nil, "no Content-Range was sent");
+            WBHarnessCheck([received.headers[@"upload-offset"] isEqualToString:[@(offset) stringValue]], "Upload-Offset is kept");
+
+            NSMutableIndexSet *reportedIndexes = [NSMutableIndexSet indexSet];
+            for (WBMultipartFormPartChecksum *checksum in resumedChecksums) {
+                WBMultipartFormPartChecksum *fullChecksum = fullChecksums[checksum.index];
+                [reportedIndexes addIndex:checksum.index];
+                WBHarnessCheck(checksum.CRC32C == fullChecksum.CRC32C && [checksum.SHA256 isEqualToData:fullChecksum.SHA256], "part %lu has the full upload's digests", (unsigned long)checksum.index);
+                WBHarnessCheck(checksum.bodyOffset == fullChecksum.bodyOffset && checksum.bodyLength == fullChecksum.bodyLength, "part %lu has the full upload's offsets", (unsigned long)checksum.index);
+            }
+            for (WBMultipartFormPartChecksum *fullChecksum in fullChecksums) {
+                if (fullChecksum.bodyOffset + fullChecksum.bodyLength > offset) {
+                    WBHarnessCheck([reportedIndexes containsIndex:fullChecksum.index], "part %lu, which ends after the offset, was reported", (unsigned long)fullChecksum.index);
+                }
+            }
+        }
+
+        [server stop];
+        [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
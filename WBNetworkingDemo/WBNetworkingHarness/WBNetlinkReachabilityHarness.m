@@ -0,0 +1,93 @@
+//
+//  WBNetlinkReachabilityHarness.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Prints every status WBNetlinkReachabilityBackend reports for the default route and for the given IPv4 addresses, one line per change: "<target> <status>".
+//  On SIGTERM or SIGINT it prints "messages <n>" with the number of netlink messages received and exits. Driven by WBNetlinkReachabilityHarness.sh.
+//  打印 WBNetlinkReachabilityBackend 对默认路由和参数中 IPv4 地址报告的每个状态，每行 "<target> <status>"。
+//  收到 SIGTERM 或 SIGINT 时打印收到的 netlink 消息数量 "messages <n>" 后退出。由 WBNetlinkReachabilityHarness.sh 驱动。
+//
+//  Linux with GNUstep and libdispatch:
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang $(gnustep-config --objc-flags) -fobjc-arc -fblocks -I ../WBNetworking \
+//      ../WBNetworking/WBNetworkReachabilityMonitor.m ../WBNetworking/WBNetlinkReachabilityBackend.m WBNetlinkReachabilityHarness.m \
+//      $(gnustep-config --base-libs) -ldispatch -o /tmp/WBNetlinkReachabilityHarness
+//  sudo ./WBNetlinkReachabilityHarness.sh /tmp/WBNetlinkReachabilityHarness
+//
+
+#import <Foundation/Foundation.h>
+#import <arpa/inet.h>
+#import <signal.h>
+#import <stdio.h>
+#import "WBNetworkReachabilityMonitor.h"
+#import "WBNetlinkReachabilityBackend.h"
+
+static const char * WBStatusName(WBNetworkReachabilityStatus status) {
+    switch (status) {
+        case WBNetworkReachabilityStatusNotReachable:
+            return "NotReachable";
+        case WBNetworkReachabilityStatusReachableViaWWAN:
+            return "WWAN";
+        case WBNetworkReachabilityStatusReachableWiFi:
+            return "WiFi";
+        case WBNetworkReachabilityStatusUnknown:
+        default:
+            return "Unknown";
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        setvbuf(stdout, NULL, _IOLBF, 0);
+
+        WBNetlinkReachabilityBackend *backend = [[WBNetlinkReachabilityBackend alloc] init];
+        WBNetworkReachabilityMonitor *monitor = [[WBNetworkReachabilityMonitor alloc] initWithBackend:backend];
+        dispatch_queue_t queue = dispatch_queue_create("com.wbnetworking.harness.netlink", DISPATCH_QUEUE_SERIAL);
+
+        NSMutableArray *observers = [NSMutableArray array];
+        [observers addObject:[monitor addObserverForTarget:[WBNetworkReachabilityTarget defaultRouteTarget] queue:queue usingBlock:^(WBNetworkReachabilityStatus status) {
+            printf("default %s\n", WBStatusName(status));
+        }]];
+
+        for (int i = 1; i < argc; i++) {
+            struct sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            if (inet_pton(AF_INET, argv[i], &address.sin_addr) != 1) {
+                fprintf(stderr, "not an IPv4 address: %s\n", argv[i]);
+                return 2;
+            }
+            NSString *label = @(argv[i]);
+            WBNetworkReachabilityTarget *target = [WBNetworkReachabilityTarget targetWithAddress:(const struct sockaddr *)&address];
+            [observers addObject:[monitor addObserverForTarget:target queue:queue usingBlock:^(WBNetworkReachabilityStatus status) {
+                printf("%s %s\n", [label UTF8String], WBStatusName(status));
+            }]];
+        }
+
+        //信号在队列中处理，打印统计后退出
+        signal(SIGTERM, SIG_IGN);
+        signal(SIGINT, SIG_IGN);
+        NSMutableArray *signalSources = [NSMutableArray array];
+        for (int i = 0; i < 2; i++) {
+            dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, (uintptr_t)(i == 0 ? SIGTERM : SIGINT), 0, queue);
+            dispatch_source_set_event_handler(source, ^{
+                for (id observer in observers) {
+                    [monitor removeObserver:observer];
+                }
+                printf("messages %lu\n", (unsigned long)backend.numberOfNetlinkMessages);
+                exit(0);
+            });
+            dispatch_resume(source);
+            [signalSources addObject:source];
+        }
+
+        dispatch_async(queue, ^{
+            printf("ready\n");
+        });
+        dispatch_main();
+    }
+    return 0;
+}
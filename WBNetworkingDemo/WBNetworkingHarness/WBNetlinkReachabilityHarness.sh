@@ -0,0 +1,119 @@
+#!/bin/sh
+#
+#  WBNetlinkReachabilityHarness.sh
+#  WBNetworkingDemo
+#
+#  Created by 58 on 2021/7/15.
+#
+#  Runs WBNetlinkReachabilityHarness in a fresh network namespace and changes links and routes around it with veth pairs, checking the status reported after each step.
+#  在新的 network namespace 中运行 WBNetlinkReachabilityHarness，用 veth 修改网卡和路由，检查每一步之后报告的状态。
+#
+#  Needs root and iproute2. Build the harness as described in WBNetlinkReachabilityHarness.m, then:
+#  sudo ./WBNetlinkReachabilityHarness.sh /tmp/WBNetlinkReachabilityHarness
+#
+
+set -eu
+
+HARNESS=${1:?usage: $0 /path/to/WBNetlinkReachabilityHarness}
+NS=wbnetlink$$
+LOG=$(mktemp)
+PID=
+FAILURES=0
+
+cleanup() {
+    if [ -n "$PID" ]; then
+        kill "$PID" 2>/dev/null || true
+    fi
+    ip netns del "$NS" 2>/dev/null || true
+    rm -f "$LOG"
+}
+trap cleanup EXIT
+
+run() {
+    ip netns exec "$NS" "$@"
+}
+
+# expect <target> <status>：等待 target 最后一次报告的状态变为 status，最多 5 秒
+expect() {
+    i=0
+    last=
+    while [ $i -lt 50 ]; do
+        last=$(grep "^$1 " "$LOG" | tail -n 1 | cut -d ' ' -f 2)
+        if [ "$last" = "$2" ]; then
+            echo "ok   $1 $2"
+            return 0
+        fi
+        sleep 0.1
+        i=$((i + 1))
+    done
+    echo "FAIL $1: expected $2, last reported ${last:-nothing}"
+    FAILURES=$((FAILURES + 1))
+}
+
+ip netns add "$NS"
+run ip link set lo up
+
+run "$HARNESS" 10.200.0.2 10.201.0.2 >"$LOG" 2>&1 &
+PID=$!
+
+echo "# only loopback: nothing is reachable"
+expect default NotReachable
+expect 10.200.0.2 NotReachable
+expect 10.201.0.2 NotReachable
+
+echo "# veth0 up with 10.200.0.1/24: the subnet is reachable, there is no default route yet"
+run ip link add veth0 type veth peer name veth1
+run ip addr add 10.200.0.1/24 dev veth0
+run ip link set veth1 up
+run ip link set veth0 up
+expect 10.200.0.2 WiFi
+expect default NotReachable
+
+echo "# default route through veth0"
+run ip route add default via 10.200.0.254 dev veth0
+expect default WiFi
+
+echo "# peer down: veth0 loses its carrier while its routes stay"
+run ip link set veth1 down
+expect 10.200.0.2 NotReachable
+expect default NotReachable
+
+echo "# peer up again"
+run ip link set veth1 up
+expect 10.200.0.2 WiFi
+expect default WiFi
+
+echo "# wwan0 with 10.201.0.1/24 is reported as WWAN"
+run ip link add wwan0 type veth peer name wwan0p
+run ip addr add 10.201.0.1/24 dev wwan0
+run ip link set wwan0p up
+run ip link set wwan0 up
+expect 10.201.0.2 WWAN
+
+echo "# a burst of 20 carrier flaps settles on the final state"
+i=0
+while [ $i -lt 20 ]; do
+    run ip link set veth1 down
+    run ip link set veth1 up
+    i=$((i + 1))
+done
+expect default WiFi
+expect 10.200.0.2 WiFi
+
+echo "# deleting veth0 removes its subnet and the default route"
+run ip link del veth0
+expect 10.200.0.2 NotReachable
+expect default NotReachable
+expect 10.201.0.2 WWAN
+
+kill -TERM "$PID" 2>/dev/null || true
+wait "$PID" || true
+PID=
+grep '^messages ' "$LOG" || true
+echo "# $(grep -c -v -e '^messages ' -e '^ready' "$LOG") status lines"
+
+if [ "$FAILURES" -ne 0 ]; then
+    echo "$FAILURES failed"
+    exit 1
+fi
+echo "all passed"
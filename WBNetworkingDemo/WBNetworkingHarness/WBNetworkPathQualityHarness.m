@@ -0,0 +1,204 @@
+//
+//  WBNetworkPathQualityHarness.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Exercises the path-quality prober of WBNetworkReachabilityManager:
+//  1. the quality tiers, the EWMA of round-trip time and loss, and the probe backoff, with fixed samples;
+//  2. the TCP connect probe against loopback listeners: a fast listener, a closed port, a listener whose accept queue is full (the dropped SYN is retransmitted after about a second, which injects the delay), and `localhost` when only 127.0.0.1 listens;
+//  3. the manager end to end: Good while the listener is up, Poor once it goes away, and back to Moderate after it returns.
+//  测试 WBNetworkReachabilityManager 的链路质量探测：1. 用固定的样本检查质量分级、往返时间和丢包率的 EWMA 以及退避；
+//  2. 对回环地址上的监听 socket 进行 TCP 连接探测（正常监听、关闭的端口、accept 队列已满时 SYN 被丢弃约 1 秒后重传用来注入延迟、只监听 127.0.0.1 时探测 localhost）；
+//  3. 端到端检查 manager：监听时为 Good，关闭后变为 Poor，恢复后回到 Moderate。
+//
+//  The manager source is included directly so that its static functions can be tested. 直接包含 manager 的源文件，以便测试其中的 static 函数
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -fobjc-arc -I ../WBNetworking -framework Foundation -framework SystemConfiguration WBNetworkPathQualityHarness.m -o /tmp/WBNetworkPathQualityHarness
+//  /tmp/WBNetworkPathQualityHarness
+//
+
+#import <Foundation/Foundation.h>
+#import "../WBNetworking/WBNetworkReachabilityManager.m"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+static BOOL WBHarnessIsClose(double a, double b) {
+    return fabs(a - b) < 1e-9;
+}
+
+//在 127.0.0.1 上监听，port 为 0 时使用随机端口；返回监听的 fd，*port 为实际端口
+static int WBHarnessListen(uint16_t *port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuseAddress = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(*port);
+    socklen_t addressLength = sizeof(address);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, backlog) != 0) {
+        close(fd);
+        return -1;
+    }
+    getsockname(fd, (struct sockaddr *)&address, &addressLength);
+    *port = ntohs(address.sin_port);
+    return fd;
+}
+
+//在 probeQueue 以外的地方等待 manager 的链路质量变为 quality
+static BOOL WBHarnessWaitForQuality(WBNetworkReachabilityManager *manager, WBNetworkPathQuality quality, NSTimeInterval timeout) {
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:timeout];
+    while ([deadline timeIntervalSinceNow] > 0) {
+        if (manager.pathQuality == quality) {
+            return YES;
+        }
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    return manager.pathQuality == quality;
+}
+
+static void WBHarnessCheckTiers(void) {
+    printf("# quality tiers\n");
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(0.05, 0) == WBNetworkPathQualityGood, "50 ms, no loss is Good");
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(0.15, 0.049) == WBNetworkPathQualityGood, "150 ms, 4.9%% loss is Good");
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(0.151, 0) == WBNetworkPathQualityModerate, "151 ms is Moderate");
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(0.05, 0.05) == WBNetworkPathQualityModerate, "5%% loss is Moderate");
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(0.6, 0.199) == WBNetworkPathQualityModerate, "600 ms, 19.9%% loss is Moderate");
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(0.601, 0) == WBNetworkPathQualityPoor, "601 ms is Poor");
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(0.05, 0.2) == WBNetworkPathQualityPoor, "20%% loss is Poor");
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(-1, 1) == WBNetworkPathQualityPoor, "no successful sample is Poor");
+}
+
+static void WBHarnessCheckSmoothingAndBackoff(void) {
+    printf("# EWMA and backoff (alpha %.1f, interval 30 s, cap %.0fx)\n", kWBNetworkPathQualitySmoothingFactor, kWBNetworkPathQualityMaximumBackoff);
+
+    WBNetworkPathProbe *probe = [[WBNetworkPathProbe alloc] init];
+    [probe recordRoundTripTime:0.1 interval:30];
+    WBHarnessCheck(WBHarnessIsClose(probe.smoothedRoundTripTime, 0.1) && probe.lossRate == 0 && probe.backoff == 30, "the first sample is taken as is");
+    [probe recordRoundTripTime:0.2 interval:30];
+    WBHarnessCheck(WBHarnessIsClose(probe.smoothedRoundTripTime, 0.12), "the second sample moves the RTT by alpha: %.3f", probe.smoothedRoundTripTime);
+    [probe recordRoundTripTime:-1 interval:30];
+    WBHarnessCheck(WBHarnessIsClose(probe.smoothedRoundTripTime, 0.12) && WBHarnessIsClose(probe.lossRate, 0.2), "a loss keeps the RTT and raises the loss rate to %.2f", probe.lossRate);
+    WBHarnessCheck(probe.backoff == 60, "a loss doubles the interval: %.0f s", probe.backoff);
+    [probe recordRoundTripTime:-1 interval:30];
+    [probe recordRoundTripTime:-1 interval:30];
+    WBHarnessCheck(probe.backoff == 240, "three losses back off to 240 s: %.0f s", probe.backoff);
+    [probe recordRoundTripTime:-1 interval:30];
+    WBHarnessCheck(probe.backoff == 240, "the backoff is capped at 8x: %.0f s", probe.backoff);
+    [probe recordRoundTripTime:0.1 interval:30];
+    WBHarnessCheck(probe.backoff == 30, "a success resets the interval");
+
+    //丢包率从 1 开始按 0.8 衰减，第 7 次成功后低于 5%
+    WBNetworkPathProbe *lossyProbe = [[WBNetworkPathProbe alloc] init];
+    [lossyProbe recordRoundTripTime:-1 interval:30];
+    WBHarnessCheck(lossyProbe.lossRate == 1 && lossyProbe.smoothedRoundTripTime == 0, "a first loss gives a loss rate of 1 and no RTT");
+    NSUInteger successes = 0;
+    while (WBNetworkPathQualityForMetrics(lossyProbe.smoothedRoundTripTime, lossyProbe.lossRate) != WBNetworkPathQualityGood && successes < 100) {
+        [lossyProbe recordRoundTripTime:0.01 interval:30];
+        successes += 1;
+    }
+    WBHarnessCheck(successes == 14, "recovering from a loss rate of 1 to Good takes 14 fast successes: %lu", (unsigned long)successes);
+}
+
+static void WBHarnessCheckConnectProbe(void) {
+    printf("# TCP connect probe on loopback\n");
+
+    uint16_t port = 0;
+    int listener = WBHarnessListen(&port, SOMAXCONN);
+    NSTimeInterval roundTripTime = WBTCPConnectRoundTripTime(@"127.0.0.1", @(port), 1);
+    WBHarnessCheck(roundTripTime >= 0 && roundTripTime < 0.05, "a listening port connects: %.3f ms", roundTripTime * 1000);
+
+    //只监听了 127.0.0.1，localhost 先解析出的 ::1 会被拒绝，需要继续尝试下一个地址
+    roundTripTime = WBTCPConnectRoundTripTime(@"localhost", @(port), 1);
+    WBHarnessCheck(roundTripTime >= 0, "localhost falls through to 127.0.0.1: %.3f ms", roundTripTime * 1000);
+    close(listener);
+
+    roundTripTime = WBTCPConnectRoundTripTime(@"127.0.0.1", @(port), 1);
+    WBHarnessCheck(roundTripTime < 0, "a closed port counts as a loss");
+
+    //accept 队列满了之后新的 SYN 被丢弃，客户端约 1 秒后重传，相当于注入了延迟
+    uint16_t fullPort = 0;
+    int fullListener = WBHarnessListen(&fullPort, 1);
+    int queued[8];
+    for (int i = 0; i < 8; i++) {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_len = sizeof(address);
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(fullPort);
+        queued[i] = socket(AF_INET, SOCK_STREAM, 0);
+        fcntl(queued[i], F_SETFL, O_NONBLOCK);
+        connect(queued[i], (struct sockaddr *)&address, sizeof(address));
+    }
+    usleep(100 * 1000);
+    roundTripTime = WBTCPConnectRoundTripTime(@"127.0.0.1", @(fullPort), 3);
+    WBNetworkPathProbe *probe = [[WBNetworkPathProbe alloc] init];
+    [probe recordRoundTripTime:roundTripTime interval:30];
+    WBHarnessCheck(roundTripTime < 0 || roundTripTime > 0.5, "a full accept queue delays the connect: %.0f ms", roundTripTime * 1000);
+    WBHarnessCheck(WBNetworkPathQualityForMetrics(probe.smoothedRoundTripTime, probe.lossRate) == WBNetworkPathQualityPoor, "and the path is Poor");
+    for (int i = 0; i < 8; i++) {
+        close(queued[i]);
+    }
+    close(fullListener);
+}
+
+static void WBHarnessCheckManager(void) {
+    printf("# manager end to end\n");
+
+    uint16_t port = 0;
+    int listener = WBHarnessListen(&port, SOMAXCONN);
+
+    WBNetworkReachabilityManager *manager = [WBNetworkReachabilityManager manager];
+    __block NSUInteger changes = 0;
+    [manager setPathQualityChangeBlock:^(WBNetworkPathQuality quality) {
+        changes += 1;
+    }];
+    manager.pathQualityProbeInterval = 1;
+    manager.pathQualityProbeTimeout = 0.5;
+    manager.pathQualityProbeURLs = @[[NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%u/", port]]];
+    [manager startMonitoring];
+
+    WBHarnessCheck(WBHarnessWaitForQuality(manager, WBNetworkPathQualityGood, 5), "Good while the listener is up (RTT %.3f ms)", manager.smoothedRoundTripTime * 1000);
+
+    close(listener);
+    WBHarnessCheck(WBHarnessWaitForQuality(manager, WBNetworkPathQualityPoor, 5), "Poor after the listener goes away (loss %.2f)", manager.pathLossRate);
+
+    //退避之后的下一次探测成功，丢包率降到 20% 以下
+    listener = WBHarnessListen(&port, SOMAXCONN);
+    WBHarnessCheck(listener >= 0 && WBHarnessWaitForQuality(manager, WBNetworkPathQualityModerate, 10), "Moderate after the listener returns (loss %.2f)", manager.pathLossRate);
+    WBHarnessCheck(changes >= 3, "the change block saw every change: %lu", (unsigned long)changes);
+
+    [manager stopMonitoring];
+    close(listener);
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        WBHarnessCheckTiers();
+        WBHarnessCheckSmoothingAndBackoff();
+        WBHarnessCheckConnectProbe();
+        WBHarnessCheckManager();
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,189 @@
+//
+//  WBPercentEscapeBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Compares `WBPercentEscapedStringFromString` with the previous implementation, which built an NSMutableCharacterSet per call and escaped the string in batches of 50 composed characters:
+//  1. parity: both give the same result for every printable ASCII character and for random ASCII, CJK and emoji strings, including ZWJ sequences and flags that span a batch boundary;
+//  2. speed: nanoseconds per call and the speedup for ASCII, CJK and emoji-heavy inputs of 16, 128 and 1024 UTF-16 units.
+//  对比 WBPercentEscapedStringFromString 和之前每次创建 NSMutableCharacterSet、按 50 个字符分批转义的实现：
+//  1. 每个可打印 ASCII 字符以及随机的 ASCII、中文和 emoji 字符串（包括跨越分批边界的 ZWJ 序列和国旗）的结果相同；2. ASCII、中文和 emoji 为主的 16、128、1024 个 UTF-16 单元的输入，每次调用的纳秒数和加速比。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBPercentEscapeBenchmark.m -o /tmp/WBPercentEscapeBenchmark
+//  /tmp/WBPercentEscapeBenchmark
+//
+
+#import <Foundation/Foundation.h>
+#import "WBURLRequestSeriailzation.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+#pragma mark - 之前的实现
+
+static NSString * WBLegacyPercentEscapedStringFromString(NSString *string) {
+    static NSString * const kAFCharactersGeneralDelimitersToEncode = @":#[]@"; // does not include "?" or "/" due to RFC 3986 - Section 3.4
+    static NSString * const kAFCharactersSubDelimitersToEncode = @"!$&'()*+,;=";
+
+    NSMutableCharacterSet * allowedCharacterSet = [[NSCharacterSet URLQueryAllowedCharacterSet] mutableCopy];
+    [allowedCharacterSet removeCharactersInString:[kAFCharactersGeneralDelimitersToEncode stringByAppendingString:kAFCharactersSubDelimitersToEncode]];
+
+    static NSUInteger const batchSize = 50;
+
+    NSUInteger index = 0;
+    NSMutableString *escaped = @"".mutableCopy;
+
+    while (index < string.length) {
+        NSUInteger length = MIN(string.length - index, batchSize);
+        NSRange range = NSMakeRange(index, length);
+
+        // To avoid breaking up character sequences such as 👴🏻👮🏽
+        range = [string rangeOfComposedCharacterSequencesForRange:range];
+
+        NSString *substring = [string substringWithRange:range];
+        NSString *encoded = [substring stringByAddingPercentEncodingWithAllowedCharacters:allowedCharacterSet];
+        [escaped appendString:encoded];
+
+        index += range.length;
+    }
+
+    return escaped;
+}
+
+#pragma mark - 输入
+
+typedef NS_ENUM(NSUInteger, WBHarnessAlphabet) {
+    WBHarnessAlphabetASCII,
+    WBHarnessAlphabetCJK,
+    WBHarnessAlphabetEmoji,
+};
+
+static const char * WBHarnessAlphabetName(WBHarnessAlphabet alphabet) {
+    switch (alphabet) {
+        case WBHarnessAlphabetASCII:
+            return "ASCII";
+        case WBHarnessAlphabetCJK:
+            return "CJK";
+        case WBHarnessAlphabetEmoji:
+            return "emoji";
+    }
+    return "";
+}
+
+//生成长度约为 length 个 UTF-16 单元的字符串，不会截断组合字符
+static NSString * WBHarnessRandomString(WBHarnessAlphabet alphabet, NSUInteger length) {
+    static NSArray <NSString *> *emoji = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        emoji = @[@"😀", @"👴🏻", @"👮🏽", @"👨‍👩‍👧‍👦", @"🇨🇳", @"🏳️‍🌈", @"❤️", @"1️⃣"];
+    });
+
+    NSMutableString *string = [NSMutableString stringWithCapacity:length + 16];
+    while ([string length] < length) {
+        uint32_t choice = arc4random_uniform(10);
+        if (alphabet == WBHarnessAlphabetCJK && choice < 8) {
+            unichar character = (unichar)(0x4E00 + arc4random_uniform(0x9FFF - 0x4E00));
+            [string appendString:[NSString stringWithCharacters:&character length:1]];
+        }else if (alphabet == WBHarnessAlphabetEmoji && choice < 6) {
+            [string appendString:emoji[arc4random_uniform((uint32_t)[emoji count])]];
+        }else{
+            //查询参数中常见的 ASCII，包括需要转义的分隔符
+            static const char ASCII[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-._~ /?:#[]@!$&'()*+,;=%\"<>";
+            [string appendFormat:@"%c", ASCII[arc4random_uniform(sizeof(ASCII) - 1)]];
+        }
+    }
+    return string;
+}
+
+#pragma mark -
+
+static void WBHarnessCheckParity(void) {
+    printf("# parity with the previous implementation\n");
+
+    NSUInteger mismatches = 0;
+    for (unichar character = 0x20; character < 0x7F; character++) {
+        NSString *string = [NSString stringWithCharacters:&character length:1];
+        if (![WBPercentEscapedStringFromString(string) isEqualToString:WBLegacyPercentEscapedStringFromString(string)]) {
+            mismatches += 1;
+            printf("     '%c': %s, previously %s\n", (char)character, [WBPercentEscapedStringFromString(string) UTF8String], [WBLegacyPercentEscapedStringFromString(string) UTF8String]);
+        }
+    }
+    WBHarnessCheck(mismatches == 0, "printable ASCII characters: %lu differ", (unsigned long)mismatches);
+
+    for (WBHarnessAlphabet alphabet = WBHarnessAlphabetASCII; alphabet <= WBHarnessAlphabetEmoji; alphabet++) {
+        mismatches = 0;
+        for (NSUInteger i = 0; i < 2000; i++) {
+            @autoreleasepool {
+                NSString *string = WBHarnessRandomString(alphabet, arc4random_uniform(300));
+                if (![WBPercentEscapedStringFromString(string) isEqualToString:WBLegacyPercentEscapedStringFromString(string)]) {
+                    mismatches += 1;
+                }
+            }
+        }
+        WBHarnessCheck(mismatches == 0, "2000 random %s strings: %lu differ", WBHarnessAlphabetName(alphabet), (unsigned long)mismatches);
+    }
+
+    WBHarnessCheck([WBPercentEscapedStringFromString(@"") isEqualToString:@""], "the empty string stays empty");
+    NSString *unescaped = @"already-safe_string.~/?";
+    WBHarnessCheck([WBPercentEscapedStringFromString(unescaped) isEqualToString:unescaped], "a string without characters to escape is returned unchanged");
+}
+
+//返回每次调用的纳秒数
+static double WBHarnessMeasure(NSArray <NSString *> *strings, NSString * (*escape)(NSString *)) {
+    NSUInteger iterations = MAX(200000 / [[strings firstObject] length], 200);
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            for (NSString *string in strings) {
+                escape(string);
+            }
+        }
+    }
+    return (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / (iterations * [strings count]);
+}
+
+static void WBHarnessMeasureSpeed(void) {
+    printf("# ns per call\n");
+    printf("%-8s %8s %12s %12s %8s\n", "input", "length", "previous", "byte table", "speedup");
+    for (WBHarnessAlphabet alphabet = WBHarnessAlphabetASCII; alphabet <= WBHarnessAlphabetEmoji; alphabet++) {
+        for (NSNumber *length in @[@16, @128, @1024]) {
+            NSMutableArray <NSString *> *strings = [NSMutableArray array];
+            for (NSUInteger i = 0; i < 16; i++) {
+                [strings addObject:WBHarnessRandomString(alphabet, [length unsignedIntegerValue])];
+            }
+            //预热
+            WBHarnessMeasure(@[[strings firstObject]], WBPercentEscapedStringFromString);
+            double legacy = WBHarnessMeasure(strings, WBLegacyPercentEscapedStringFromString);
+            double table = WBHarnessMeasure(strings, WBPercentEscapedStringFromString);
+            printf("%-8s %8lu %12.0f %12.0f %7.1fx\n", WBHarnessAlphabetName(alphabet), (unsigned long)[length unsignedIntegerValue], legacy, table, legacy / table);
+        }
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        WBHarnessCheckParity();
+        if (WBHarnessFailures == 0) {
+            WBHarnessMeasureSpeed();
+        }
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,230 @@
+//
+//  WBPinnedCertificatesHarness.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Checks that `-[WBSecurityPolicy setPinnedCertificates:]` no longer derives the pins on the calling thread, and that `+certificatesInBundle:` scans a bundle only once. It uses the certificates written by WBSecurityPolicyBenchmarkCerts.sh:
+//  1. setting 50 pins returns in a fraction of the time the previous synchronous derivation took (one SecTrustEvaluate per certificate), and the first evaluation waits for the background work;
+//  2. evaluations right after setting the pins, from one thread or eight, in public-key and certificate mode, always see the pins that were set last, including when matching and unmatched pin sets are swapped back and forth;
+//  3. `+certificatesInBundle:` returns the same set for a bundle of .cer files, and the second call is served from the cache.
+//  检查 setPinnedCertificates: 不再在调用线程上生成 pin，以及 certificatesInBundle: 对每个 bundle 只扫描一次。使用 WBSecurityPolicyBenchmarkCerts.sh 生成的证书：
+//  1. 设置 50 个 pin 的耗时只是之前同步生成（每个证书一次 SecTrustEvaluate）的一小部分，第一次评估会等待后台完成；
+//  2. 设置 pin 之后立即评估，无论是一个线程还是八个线程、公钥模式还是证书模式，总是使用最后一次设置的 pin，包括匹配和不匹配的 pin 来回切换时；
+//  3. certificatesInBundle: 对一个包含 .cer 文件的 bundle 返回相同的集合，第二次调用使用缓存。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  ./WBSecurityPolicyBenchmarkCerts.sh /tmp/WBSecurityPolicyBenchmarkCerts
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security \
+//      ../WBNetworking/WBSecurityPolicy.m WBPinnedCertificatesHarness.m -o /tmp/WBPinnedCertificatesHarness
+//  /tmp/WBPinnedCertificatesHarness /tmp/WBSecurityPolicyBenchmarkCerts
+//
+
+#import <Foundation/Foundation.h>
+#import <Security/Security.h>
+#import <stdatomic.h>
+#import "WBSecurityPolicy.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+static NSString * const kWBHarnessDomain = @"bench.wbnetworking.test";
+
+static NSData * WBHarnessReadCertificate(NSString *directory, NSString *name) {
+    NSData *data = [NSData dataWithContentsOfFile:[directory stringByAppendingPathComponent:name]];
+    if (!data) {
+        fprintf(stderr, "cannot read %s, run WBSecurityPolicyBenchmarkCerts.sh first\n", [name UTF8String]);
+        exit(1);
+    }
+    return data;
+}
+
+//之前 setPinnedCertificates: 对每个证书做的事情：单独创建 SecTrustRef 并评估，取出公钥
+static id WBLegacyPublicKeyForCertificateData(NSData *certificateData) {
+    SecCertificateRef certificate = SecCertificateCreateWithData(NULL, (__bridge CFDataRef)certificateData);
+    SecPolicyRef policy = SecPolicyCreateBasicX509();
+    SecTrustRef trust = NULL;
+    id publicKey = nil;
+    if (certificate && SecTrustCreateWithCertificates((__bridge CFArrayRef)@[(__bridge id)certificate], policy, &trust) == errSecSuccess) {
+        SecTrustResultType result;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+        if (SecTrustEvaluate(trust, &result) == errSecSuccess) {
+            publicKey = (__bridge_transfer id)SecTrustCopyPublicKey(trust);
+        }
+#pragma clang diagnostic pop
+    }
+    if (trust) {
+        CFRelease(trust);
+    }
+    if (certificate) {
+        CFRelease(certificate);
+    }
+    CFRelease(policy);
+    return publicKey;
+}
+
+static double WBHarnessMicroseconds(uint64_t start) {
+    return (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / NSEC_PER_USEC;
+}
+
+//每次评估都重新做，不使用缓存的结果
+static WBSecurityPolicy * WBHarnessPolicy(WBSSLPinningMode mode, NSSet <NSData *> *pinnedCertificates) {
+    WBSecurityPolicy *policy = [WBSecurityPolicy policyWithPinningMode:mode withPinnedCertificates:pinnedCertificates];
+    policy.trustEvaluationCacheTTL = 0;
+    return policy;
+}
+
+//评估会修改 SecTrustRef 的策略和锚点，每次评估都用新的 SecTrustRef，系统评估时以测试用的根证书为锚点
+static SecTrustRef WBHarnessCreateServerTrust(NSArray *chain) {
+    SecTrustRef serverTrust = NULL;
+    SecPolicyRef policy = SecPolicyCreateSSL(true, (__bridge CFStringRef)kWBHarnessDomain);
+    if (SecTrustCreateWithCertificates((__bridge CFArrayRef)chain, policy, &serverTrust) != errSecSuccess) {
+        fprintf(stderr, "cannot create the server trust\n");
+        exit(1);
+    }
+    CFRelease(policy);
+    SecTrustSetAnchorCertificates(serverTrust, (__bridge CFArrayRef)@[[chain lastObject]]);
+    return serverTrust;
+}
+
+static BOOL WBHarnessEvaluate(WBSecurityPolicy *policy, NSArray *chain) {
+    SecTrustRef serverTrust = WBHarnessCreateServerTrust(chain);
+    BOOL isTrusted = [policy evaluateServerTrust:serverTrust forDomain:kWBHarnessDomain];
+    CFRelease(serverTrust);
+    return isTrusted;
+}
+
+static atomic_uint WBHarnessWrongResults;
+
+static void WBHarnessCheckPinnedCertificates(NSArray *chain, NSSet <NSData *> *matching, NSSet <NSData *> *unmatched) {
+    printf("# setPinnedCertificates: does not block\n");
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSData *certificateData in matching) {
+        WBLegacyPublicKeyForCertificateData(certificateData);
+    }
+    double legacy = WBHarnessMicroseconds(start);
+
+    WBSecurityPolicy *policy = WBHarnessPolicy(WBSSLPinningModePublicKey, nil);
+    start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    policy.pinnedCertificates = matching;
+    double setter = WBHarnessMicroseconds(start);
+    SecTrustRef firstTrust = WBHarnessCreateServerTrust(chain);
+    SecTrustRef laterTrust = WBHarnessCreateServerTrust(chain);
+    start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    BOOL firstResult = [policy evaluateServerTrust:firstTrust forDomain:kWBHarnessDomain];
+    double firstEvaluation = WBHarnessMicroseconds(start);
+    start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    [policy evaluateServerTrust:laterTrust forDomain:kWBHarnessDomain];
+    double laterEvaluation = WBHarnessMicroseconds(start);
+    CFRelease(firstTrust);
+    CFRelease(laterTrust);
+    printf("%lu pins: previous derivation %.0f us, setter %.0f us, first evaluation %.0f us, later evaluation %.0f us\n", (unsigned long)[matching count], legacy, setter, firstEvaluation, laterEvaluation);
+    WBHarnessCheck(setter * 10 < legacy, "the setter takes %.1f%% of the previous derivation", 100.0 * setter / legacy);
+    WBHarnessCheck(firstResult, "the first evaluation waits for the pins and matches");
+
+    printf("# evaluations see the pins set last\n");
+    NSArray <NSNumber *> *modes = @[@(WBSSLPinningModePublicKey), @(WBSSLPinningModeCertificate)];
+    for (NSNumber *mode in modes) {
+        const char *name = [mode unsignedIntegerValue] == WBSSLPinningModePublicKey ? "public key" : "certificate";
+        WBHarnessCheck(WBHarnessEvaluate(WBHarnessPolicy([mode unsignedIntegerValue], matching), chain), "%s: the pins with the root match right after they are set", name);
+        WBHarnessCheck(!WBHarnessEvaluate(WBHarnessPolicy([mode unsignedIntegerValue], unmatched), chain), "%s: unrelated pins do not match right after they are set", name);
+
+        //来回切换，后台可能还在生成上一组 pin
+        NSUInteger wrong = 0;
+        WBSecurityPolicy *swappedPolicy = WBHarnessPolicy([mode unsignedIntegerValue], nil);
+        for (NSUInteger i = 0; i < 200; i++) {
+            BOOL matchesLast = arc4random_uniform(2);
+            swappedPolicy.pinnedCertificates = matchesLast ? unmatched : matching;
+            swappedPolicy.pinnedCertificates = matchesLast ? matching : unmatched;
+            if (WBHarnessEvaluate(swappedPolicy, chain) != matchesLast) {
+                wrong += 1;
+            }
+        }
+        WBHarnessCheck(wrong == 0, "%s: 200 swaps of the pin set, %lu evaluations used an earlier set", name, (unsigned long)wrong);
+
+        //八个线程在设置之后立即评估
+        WBSecurityPolicy *sharedPolicy = WBHarnessPolicy([mode unsignedIntegerValue], nil);
+        atomic_store(&WBHarnessWrongResults, 0);
+        for (NSUInteger round = 0; round < 20; round++) {
+            BOOL matches = (round % 2 == 0);
+            sharedPolicy.pinnedCertificates = matches ? matching : unmatched;
+            dispatch_apply(8, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t iteration) {
+                if (WBHarnessEvaluate(sharedPolicy, chain) != matches) {
+                    atomic_fetch_add(&WBHarnessWrongResults, 1);
+                }
+            });
+        }
+        WBHarnessCheck(atomic_load(&WBHarnessWrongResults) == 0, "%s: 20 rounds of 8 concurrent evaluations, %u wrong", name, atomic_load(&WBHarnessWrongResults));
+    }
+
+    WBSecurityPolicy *copiedPolicy = [WBHarnessPolicy(WBSSLPinningModePublicKey, matching) copy];
+    WBHarnessCheck(WBHarnessEvaluate(copiedPolicy, chain), "a copy derives its own pins");
+}
+
+static void WBHarnessCheckBundleScan(NSSet <NSData *> *certificates) {
+    printf("# certificatesInBundle: scans once\n");
+    NSString *bundlePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[[NSUUID UUID] UUIDString] stringByAppendingPathExtension:@"bundle"]];
+    [[NSFileManager defaultManager] createDirectoryAtPath:bundlePath withIntermediateDirectories:YES attributes:nil error:nil];
+    NSUInteger index = 0;
+    for (NSData *certificate in certificates) {
+        [certificate writeToFile:[bundlePath stringByAppendingPathComponent:[NSString stringWithFormat:@"pin-%02lu.cer", (unsigned long)index++]] atomically:NO];
+    }
+    NSBundle *bundle = [NSBundle bundleWithPath:bundlePath];
+
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    NSSet <NSData *> *scanned = [WBSecurityPolicy certificatesInBundle:bundle];
+    double firstScan = WBHarnessMicroseconds(start);
+    start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    NSSet <NSData *> *cached = [WBSecurityPolicy certificatesInBundle:bundle];
+    double secondScan = WBHarnessMicroseconds(start);
+    printf("first scan %.0f us, second %.1f us\n", firstScan, secondScan);
+    WBHarnessCheck([scanned isEqualToSet:certificates], "the %lu .cer files are returned", (unsigned long)[scanned count]);
+    WBHarnessCheck(cached == scanned && secondScan < firstScan, "the second call is served from the cache");
+    WBHarnessCheck([[WBSecurityPolicy certificatesInBundle:[NSBundle bundleWithPath:bundlePath]] isEqualToSet:certificates], "another NSBundle for the same path uses the same entry");
+
+    [[NSFileManager defaultManager] removeItemAtPath:bundlePath error:nil];
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        if (argc < 2) {
+            fprintf(stderr, "usage: %s <certificate directory>\n", argv[0]);
+            return 2;
+        }
+        NSString *directory = @(argv[1]);
+
+        NSMutableArray *chain = [NSMutableArray array];
+        for (NSUInteger i = 0; i < 4; i++) {
+            NSData *data = WBHarnessReadCertificate(directory, [NSString stringWithFormat:@"chain-%lu.der", (unsigned long)i]);
+            [chain addObject:(__bridge_transfer id)SecCertificateCreateWithData(NULL, (__bridge CFDataRef)data)];
+        }
+        //49 个无关的证书，加上根证书共 50 个 pin
+        NSMutableSet <NSData *> *matching = [NSMutableSet set];
+        for (NSUInteger i = 1; i <= 49; i++) {
+            [matching addObject:WBHarnessReadCertificate(directory, [NSString stringWithFormat:@"pin-%02lu.der", (unsigned long)i])];
+        }
+        NSSet <NSData *> *unmatched = [matching copy];
+        [matching addObject:WBHarnessReadCertificate(directory, @"chain-3.der")];
+
+        WBHarnessCheckPinnedCertificates(chain, matching, unmatched);
+        WBHarnessCheckBundleScan(matching);
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
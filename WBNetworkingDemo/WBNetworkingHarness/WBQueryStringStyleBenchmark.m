@@ -0,0 +1,383 @@
+//
+//  WBQueryStringStyleBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Checks every `WBHTTPRequestQueryStringSerializationStyle` of the single-buffer encoder against a slow reference encoder written here, and measures each style:
+//  1. parity: fixed cases (nested dictionaries, arrays, sets, NSNull, empty arrays, arrays of dictionaries, reserved and non-ASCII characters) and 2000 random parameter trees per style;
+//  2. the default style still equals the WBQueryStringPairsFromDictionary pairs joined with "&", and `-setQueryStringSerializationWithStyle:` reaches GET URLs and form bodies;
+//  3. speed: ns per call and MB/s of output per style, and a whole GET request with the built-in style against the same encoding through `-setQueryStringSerializationWithBlock:`.
+//  用这里实现的一个慢速参考编码器检查单缓冲区编码器的每一种查询字符串风格，并测量每种风格的速度：
+//  1. 固定用例（嵌套字典、数组、NSSet、NSNull、空数组、字典数组、保留字符和非 ASCII 字符）以及每种风格 2000 个随机参数树的结果相同；
+//  2. 默认风格仍然等于 WBQueryStringPairsFromDictionary 的结果用 "&" 连接，setQueryStringSerializationWithStyle: 对 GET 的 URL 和表单 body 生效；
+//  3. 每种风格每次调用的纳秒数和输出的 MB/s，以及内置风格和通过 setQueryStringSerializationWithBlock: 做同样编码时构造整个 GET 请求的耗时。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBQueryStringStyleBenchmark.m -o /tmp/WBQueryStringStyleBenchmark
+//  /tmp/WBQueryStringStyleBenchmark
+//
+
+#import <Foundation/Foundation.h>
+#import "WBURLRequestSeriailzation.h"
+
+//没有在头文件中声明，默认风格之前的实现
+FOUNDATION_EXPORT NSArray * WBQueryStringPairsFromDictionary(NSDictionary *dictionary);
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+static WBHTTPRequestQueryStringSerializationStyle const kWBHarnessStyles[] = {
+    WBHTTPRequestQueryStringSerializationDefaultStyle,
+    WBHTTPRequestQueryStringSerializationRepeatedKeyStyle,
+    WBHTTPRequestQueryStringSerializationCommaSeparatedStyle,
+    WBHTTPRequestQueryStringSerializationDottedKeyStyle,
+};
+
+static const char * WBHarnessStyleName(WBHTTPRequestQueryStringSerializationStyle style) {
+    switch (style) {
+        case WBHTTPRequestQueryStringSerializationDefaultStyle:
+            return "default";
+        case WBHTTPRequestQueryStringSerializationRepeatedKeyStyle:
+            return "repeated key";
+        case WBHTTPRequestQueryStringSerializationCommaSeparatedStyle:
+            return "comma";
+        case WBHTTPRequestQueryStringSerializationDottedKeyStyle:
+            return "dotted key";
+    }
+    return "";
+}
+
+#pragma mark - 参考实现
+
+/*
+ 逐层拼出未转义的 key（a[b][]、a.b），到叶子时再整体转义，每个 pair 是一个 NSString，最后用 "&" 连接。
+ "["、"]" 转义后就是 %5B、%5D，"." 不需要转义，所以和编码器逐段转义 key 的结果应该相同。
+ */
+static NSArray * WBReferenceSortedObjects(id<NSFastEnumeration> objects) {
+    NSMutableArray *array = [NSMutableArray array];
+    for (id object in objects) {
+        [array addObject:object];
+    }
+    return [array sortedArrayUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"description" ascending:YES selector:@selector(compare:)]]];
+}
+
+static BOOL WBReferenceIsCollection(id value) {
+    return [value isKindOfClass:[NSDictionary class]] || [value isKindOfClass:[NSArray class]] || [value isKindOfClass:[NSSet class]];
+}
+
+static void WBReferenceAppendPairs(NSMutableArray <NSString *> *pairs, NSString *key, id value, WBHTTPRequestQueryStringSerializationStyle style) {
+    if ([value isKindOfClass:[NSDictionary class]]) {
+        for (id nestedKey in WBReferenceSortedObjects(value)) {
+            NSString *nestedKeyPath = nil;
+            if (!key) {
+                nestedKeyPath = [nestedKey description];
+            }else if (style == WBHTTPRequestQueryStringSerializationDottedKeyStyle) {
+                nestedKeyPath = [NSString stringWithFormat:@"%@.%@", key, nestedKey];
+            }else{
+                nestedKeyPath = [NSString stringWithFormat:@"%@[%@]", key, nestedKey];
+            }
+            WBReferenceAppendPairs(pairs, nestedKeyPath, value[nestedKey], style);
+        }
+    } else if ([value isKindOfClass:[NSArray class]]) {
+        BOOL containsCollection = NO;
+        for (id nestedValue in value) {
+            containsCollection = containsCollection || WBReferenceIsCollection(nestedValue);
+        }
+        if (style == WBHTTPRequestQueryStringSerializationCommaSeparatedStyle && !containsCollection) {
+            if ([value count] == 0) {
+                return;
+            }
+            NSMutableArray <NSString *> *escapedValues = [NSMutableArray array];
+            for (id nestedValue in value) {
+                [escapedValues addObject:[nestedValue isEqual:[NSNull null]] ? @"" : WBPercentEscapedStringFromString([nestedValue description])];
+            }
+            [pairs addObject:[NSString stringWithFormat:@"%@=%@", WBPercentEscapedStringFromString(key), [escapedValues componentsJoinedByString:@","]]];
+            return;
+        }
+        BOOL repeatsKey = (style == WBHTTPRequestQueryStringSerializationRepeatedKeyStyle || style == WBHTTPRequestQueryStringSerializationDottedKeyStyle);
+        for (id nestedValue in value) {
+            WBReferenceAppendPairs(pairs, repeatsKey ? key : [key stringByAppendingString:@"[]"], nestedValue, style);
+        }
+    } else if ([value isKindOfClass:[NSSet class]]) {
+        for (id object in WBReferenceSortedObjects(value)) {
+            WBReferenceAppendPairs(pairs, key, object, style);
+        }
+    } else if ([value isEqual:[NSNull null]]) {
+        [pairs addObject:WBPercentEscapedStringFromString(key)];
+    } else {
+        [pairs addObject:[NSString stringWithFormat:@"%@=%@", WBPercentEscapedStringFromString(key), WBPercentEscapedStringFromString([value description])]];
+    }
+}
+
+static NSString * WBReferenceQueryString(NSDictionary *parameters, WBHTTPRequestQueryStringSerializationStyle style) {
+    NSMutableArray <NSString *> *pairs = [NSMutableArray array];
+    WBReferenceAppendPairs(pairs, nil, parameters, style);
+    return [pairs componentsJoinedByString:@"&"];
+}
+
+//WBQueryStringPairsFromDictionary 的结果用 "&" 连接，也就是之前默认风格的做法。WBQueryStringPair 没有公开，通过 KVC 读取 field 和 value，和它的 URLEncodedStringValue 一样转义
+static NSString * WBLegacyQueryString(NSDictionary *parameters) {
+    NSMutableArray <NSString *> *pairs = [NSMutableArray array];
+    for (id pair in WBQueryStringPairsFromDictionary(parameters)) {
+        id field = [pair valueForKey:@"field"];
+        id value = [pair valueForKey:@"value"];
+        if (!value || [value isEqual:[NSNull null]]) {
+            [pairs addObject:WBPercentEscapedStringFromString([field description])];
+        }else{
+            [pairs addObject:[NSString stringWithFormat:@"%@=%@", WBPercentEscapedStringFromString([field description]), WBPercentEscapedStringFromString([value description])]];
+        }
+    }
+    return [pairs componentsJoinedByString:@"&"];
+}
+
+#pragma mark - 输入
+
+static NSString * WBHarnessRandomKey(void) {
+    static NSArray <NSString *> *keys = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        keys = @[@"a", @"b", @"id", @"page", @"q", @"city", @"城市", @"a b", @"a&b", @"x=y", @"k[0]", @"dotted.key", @"😀", @"Z", @"_"];
+    });
+    return keys[arc4random_uniform((uint32_t)[keys count])];
+}
+
+static id WBHarnessRandomScalar(void) {
+    switch (arc4random_uniform(6)) {
+        case 0:
+            return @(arc4random_uniform(100000));
+        case 1:
+            return @((double)arc4random_uniform(1000) / 8);
+        case 2:
+            return [NSNull null];
+        case 3:
+            return @"北京 朝阳";
+        case 4:
+            return @"a,b&c=d?e/f#g";
+        default:
+            return [NSString stringWithFormat:@"v%u", arc4random_uniform(1000)];
+    }
+}
+
+static id WBHarnessRandomValue(NSUInteger depth) {
+    uint32_t choice = depth == 0 ? 0 : arc4random_uniform(6);
+    switch (choice) {
+        case 3: {
+            NSMutableDictionary *dictionary = [NSMutableDictionary dictionary];
+            for (uint32_t i = arc4random_uniform(4); i > 0; i--) {
+                dictionary[WBHarnessRandomKey()] = WBHarnessRandomValue(depth - 1);
+            }
+            return dictionary;
+        }
+        case 4: {
+            NSMutableArray *array = [NSMutableArray array];
+            for (uint32_t i = arc4random_uniform(4); i > 0; i--) {
+                //大多数数组只有普通值，以便覆盖逗号风格的两种分支
+                [array addObject:arc4random_uniform(4) == 0 ? WBHarnessRandomValue(depth - 1) : WBHarnessRandomScalar()];
+            }
+            return array;
+        }
+        case 5: {
+            NSMutableSet *set = [NSMutableSet set];
+            for (uint32_t i = arc4random_uniform(4); i > 0; i--) {
+                [set addObject:WBHarnessRandomScalar()];
+            }
+            return set;
+        }
+        default:
+            return WBHarnessRandomScalar();
+    }
+}
+
+static NSDictionary * WBHarnessRandomParameters(void) {
+    NSMutableDictionary *parameters = [NSMutableDictionary dictionary];
+    for (uint32_t i = 1 + arc4random_uniform(6); i > 0; i--) {
+        parameters[WBHarnessRandomKey()] = WBHarnessRandomValue(3);
+    }
+    //偶尔混入数字 key，按 description 排序
+    if (arc4random_uniform(4) == 0) {
+        parameters[@(arc4random_uniform(20))] = WBHarnessRandomScalar();
+    }
+    return parameters;
+}
+
+//接近真实请求的参数：普通值、一个筛选数组、一个嵌套的位置字典
+static NSDictionary * WBHarnessTypicalParameters(void) {
+    return @{
+        @"q": @"coffee 咖啡",
+        @"page": @3,
+        @"size": @20,
+        @"sort": @"distance",
+        @"city": @"北京",
+        @"filters": @[@"open_now", @"delivery", @"rating>4"],
+        @"tags": [NSSet setWithObjects:@"wifi", @"quiet", @"outdoor", nil],
+        @"location": @{@"lat": @39.9042, @"lng": @116.4074, @"radius": @1500},
+        @"user": @{@"id": @"10086", @"channel": @"app", @"ab": @[@"exp_a", @"exp_b"]},
+        @"debug": [NSNull null],
+    };
+}
+
+#pragma mark -
+
+static void WBHarnessCheckParity(void) {
+    printf("# fixed cases\n");
+    NSDictionary *parameters = @{@"a": @[@1, @2], @"b": @{@"c": @3}};
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(parameters, WBHTTPRequestQueryStringSerializationDefaultStyle) isEqualToString:@"a%5B%5D=1&a%5B%5D=2&b%5Bc%5D=3"], "default: a[]=1&a[]=2&b[c]=3");
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(parameters, WBHTTPRequestQueryStringSerializationRepeatedKeyStyle) isEqualToString:@"a=1&a=2&b%5Bc%5D=3"], "repeated key: a=1&a=2&b[c]=3");
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(parameters, WBHTTPRequestQueryStringSerializationCommaSeparatedStyle) isEqualToString:@"a=1,2&b%5Bc%5D=3"], "comma: a=1,2&b[c]=3");
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(parameters, WBHTTPRequestQueryStringSerializationDottedKeyStyle) isEqualToString:@"a=1&a=2&b.c=3"], "dotted key: a=1&a=2&b.c=3");
+
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(@{@"a": @[@"x,y", [NSNull null], @"中"]}, WBHTTPRequestQueryStringSerializationCommaSeparatedStyle) isEqualToString:@"a=x%2Cy,,%E4%B8%AD"], "comma: commas inside values are escaped, NSNull is an empty value");
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(@{@"a": @[], @"b": @1}, WBHTTPRequestQueryStringSerializationCommaSeparatedStyle) isEqualToString:@"b=1"], "comma: an empty array is left out");
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(@{@"a": @[@{@"b": @1}, @2]}, WBHTTPRequestQueryStringSerializationCommaSeparatedStyle) isEqualToString:@"a%5B%5D%5Bb%5D=1&a%5B%5D=2"], "comma: an array of dictionaries falls back to the default style");
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(@{@"a": @{@"b": @{@"c": @[@1]}}}, WBHTTPRequestQueryStringSerializationDottedKeyStyle) isEqualToString:@"a.b.c=1"], "dotted key: deep nesting");
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(@{@"a": [NSNull null], @"b c": @"d&e"}, WBHTTPRequestQueryStringSerializationRepeatedKeyStyle) isEqualToString:@"a&b%20c=d%26e"], "NSNull leaves out \"=\", reserved characters are escaped");
+    WBHarnessCheck([WBQueryStringFromParametersWithStyle(@{}, WBHTTPRequestQueryStringSerializationDottedKeyStyle) isEqualToString:@""], "empty parameters give an empty string");
+
+    NSArray <NSDictionary *> *fixtures = @[
+        parameters,
+        WBHarnessTypicalParameters(),
+        @{@"a": @[@[@1, @2], @[@3]], @"b": [NSSet setWithObjects:@"y", @"x", @10, @9, nil]},
+        @{@"城市": @{@"名字": @[@"北京", @"上海"]}, @"😀": @"🇨🇳"},
+        @{@"k[0]": @{@"x.y": @[[NSNull null], @{@"z": [NSNull null]}]}},
+        @{@1: @"one", @"2": @"string two", @3: @[@"three"]},
+    ];
+    for (size_t s = 0; s < sizeof(kWBHarnessStyles) / sizeof(kWBHarnessStyles[0]); s++) {
+        WBHTTPRequestQueryStringSerializationStyle style = kWBHarnessStyles[s];
+        NSUInteger mismatches = 0;
+        for (NSDictionary *fixture in fixtures) {
+            NSString *query = WBQueryStringFromParametersWithStyle(fixture, style);
+            NSString *reference = WBReferenceQueryString(fixture, style);
+            if (![query isEqualToString:reference]) {
+                mismatches += 1;
+                printf("     %s\n     reference %s\n", [query UTF8String], [reference UTF8String]);
+            }
+        }
+        WBHarnessCheck(mismatches == 0, "%s: %lu fixtures, %lu differ from the reference", WBHarnessStyleName(style), (unsigned long)[fixtures count], (unsigned long)mismatches);
+    }
+
+    printf("# random parameter trees\n");
+    for (size_t s = 0; s < sizeof(kWBHarnessStyles) / sizeof(kWBHarnessStyles[0]); s++) {
+        WBHTTPRequestQueryStringSerializationStyle style = kWBHarnessStyles[s];
+        NSUInteger mismatches = 0;
+        NSUInteger legacyMismatches = 0;
+        for (NSUInteger i = 0; i < 2000; i++) {
+            @autoreleasepool {
+                NSDictionary *random = WBHarnessRandomParameters();
+                NSString *query = WBQueryStringFromParametersWithStyle(random, style);
+                if (![query isEqualToString:WBReferenceQueryString(random, style)]) {
+                    if (mismatches == 0) {
+                        printf("     %s\n     reference %s\n", [query UTF8String], [WBReferenceQueryString(random, style) UTF8String]);
+                    }
+                    mismatches += 1;
+                }
+                if (style == WBHTTPRequestQueryStringSerializationDefaultStyle && ![query isEqualToString:WBLegacyQueryString(random)]) {
+                    legacyMismatches += 1;
+                }
+            }
+        }
+        WBHarnessCheck(mismatches == 0, "%s: 2000 random trees, %lu differ from the reference", WBHarnessStyleName(style), (unsigned long)mismatches);
+        if (style == WBHTTPRequestQueryStringSerializationDefaultStyle) {
+            WBHarnessCheck(legacyMismatches == 0, "default: 2000 random trees, %lu differ from the joined WBQueryStringPairsFromDictionary pairs", (unsigned long)legacyMismatches);
+        }
+    }
+}
+
+static void WBHarnessCheckSerializer(void) {
+    printf("# the serializer uses the style\n");
+    NSDictionary *parameters = WBHarnessTypicalParameters();
+    for (size_t s = 0; s < sizeof(kWBHarnessStyles) / sizeof(kWBHarnessStyles[0]); s++) {
+        WBHTTPRequestQueryStringSerializationStyle style = kWBHarnessStyles[s];
+        NSString *expected = WBQueryStringFromParametersWithStyle(parameters, style);
+        WBHTTPRequestSerializer *serializer = [WBHTTPRequestSerializer serializer];
+        [serializer setQueryStringSerializationWithStyle:style];
+
+        NSError *error = nil;
+        NSURLRequest *request = [serializer requestWithMethod:@"GET" URLString:@"https://api.example.com/v1/search" parameters:parameters error:&error];
+        WBHarnessCheck(!error && [request.URL.percentEncodedQuery isEqualToString:expected], "%s: GET query", WBHarnessStyleName(style));
+
+        request = [serializer requestWithMethod:@"POST" URLString:@"https://api.example.com/v1/search" parameters:parameters error:&error];
+        NSString *body = [[NSString alloc] initWithData:request.HTTPBody encoding:NSUTF8StringEncoding];
+        WBHarnessCheck(!error && [body isEqualToString:expected], "%s: form body", WBHarnessStyleName(style));
+    }
+}
+
+//返回每次调用的纳秒数
+static double WBHarnessMeasure(NSUInteger iterations, void (^block)(void)) {
+    for (NSUInteger i = 0; i < 100; i++) {
+        @autoreleasepool {
+            block();
+        }
+    }
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            block();
+        }
+    }
+    return (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / iterations;
+}
+
+static void WBHarnessMeasureSpeed(void) {
+    NSDictionary *parameters = WBHarnessTypicalParameters();
+
+    printf("# encoding the same 10 parameters, ns per call\n");
+    printf("%-14s %8s %12s %12s %10s %8s\n", "style", "bytes", "reference", "encoder", "MB/s", "speedup");
+    for (size_t s = 0; s < sizeof(kWBHarnessStyles) / sizeof(kWBHarnessStyles[0]); s++) {
+        WBHTTPRequestQueryStringSerializationStyle style = kWBHarnessStyles[s];
+        NSUInteger length = [WBQueryStringFromParametersWithStyle(parameters, style) length];
+        double reference = WBHarnessMeasure(50000, ^{
+            WBReferenceQueryString(parameters, style);
+        });
+        double encoder = WBHarnessMeasure(50000, ^{
+            WBQueryStringFromParametersWithStyle(parameters, style);
+        });
+        printf("%-14s %8lu %12.0f %12.0f %10.1f %7.1fx\n", WBHarnessStyleName(style), (unsigned long)length, reference, encoder, (double)length / encoder * 1000, reference / encoder);
+    }
+
+    printf("# whole GET request, built-in style vs the same encoding through a block\n");
+    printf("%-14s %12s %12s\n", "style", "block ns", "built-in ns");
+    for (size_t s = 0; s < sizeof(kWBHarnessStyles) / sizeof(kWBHarnessStyles[0]); s++) {
+        WBHTTPRequestQueryStringSerializationStyle style = kWBHarnessStyles[s];
+        WBHTTPRequestSerializer *builtIn = [WBHTTPRequestSerializer serializer];
+        [builtIn setQueryStringSerializationWithStyle:style];
+        WBHTTPRequestSerializer *custom = [WBHTTPRequestSerializer serializer];
+        [custom setQueryStringSerializationWithBlock:^NSString *(NSURLRequest *request, id blockParameters, NSError *__autoreleasing *error) {
+            return WBQueryStringFromParametersWithStyle(blockParameters, style);
+        }];
+        double blockNanoseconds = WBHarnessMeasure(50000, ^{
+            [custom requestWithMethod:@"GET" URLString:@"https://api.example.com/v1/search" parameters:parameters error:nil];
+        });
+        double builtInNanoseconds = WBHarnessMeasure(50000, ^{
+            [builtIn requestWithMethod:@"GET" URLString:@"https://api.example.com/v1/search" parameters:parameters error:nil];
+        });
+        printf("%-14s %12.0f %12.0f\n", WBHarnessStyleName(style), blockNanoseconds, builtInNanoseconds);
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        WBHarnessCheckParity();
+        WBHarnessCheckSerializer();
+        if (WBHarnessFailures == 0) {
+            WBHarnessMeasureSpeed();
+        }
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,293 @@
+//
+//  WBReachabilityCoalescingHarness.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Exercises how WBNetworkReachabilityManager coalesces reachability events, by feeding flags to its reachability queue the way the SCNetworkReachability callback does:
+//  1. repeated identical statuses are counted as raw events but delivered once, to observers on their own queue and to the status block, property and notification on the main queue;
+//  2. a flap inside statusChangeCoalescingInterval that settles back on the delivered status delivers nothing, one that settles elsewhere delivers only the latest status once the window ends, and an interval of 0 delivers every change;
+//  3. a burst of 2000 random callbacks over about a second delivers at most one status per window and ends on the last status; the raw vs delivered counts are printed;
+//  4. removed observers are not called, stopMonitoring drops a status still waiting for its window, and a restart delivers the current status again.
+//  测试 WBNetworkReachabilityManager 合并网络状态变化，按 SCNetworkReachability 回调的方式向 reachabilityQueue 提交 flags：
+//  1. 重复的相同状态计入收到的回调次数，但只发出一次：观察者在自己的队列中收到，状态 block、属性和通知在主线程中收到；
+//  2. 合并窗口内来回变化又回到已发出的状态时不发出，变成其他状态时在窗口结束后只发出最新的状态，窗口为 0 时每次变化都发出；
+//  3. 约一秒内 2000 次随机回调，每个窗口最多发出一次，最后停在最后一次的状态，并打印收到和发出的次数；
+//  4. 移除的观察者不再被调用，stopMonitoring 丢弃还在等待窗口结束的状态，重新开始监控时再次发出当前状态。
+//
+//  The manager source is included directly so that its private queue and flag handling can be driven. 直接包含 manager 的源文件，以便直接驱动其中的队列和 flags 处理
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -fobjc-arc -I ../WBNetworking -framework Foundation -framework SystemConfiguration WBReachabilityCoalescingHarness.m -o /tmp/WBReachabilityCoalescingHarness
+//  /tmp/WBReachabilityCoalescingHarness
+//
+
+#import <Foundation/Foundation.h>
+#import "../WBNetworking/WBNetworkReachabilityManager.m"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+@interface WBNetworkReachabilityManager (WBHarness)
+- (void)handleReachabilityFlags:(SCNetworkReachabilityFlags)flags;
+@end
+
+//macOS 上只有 WiFi 和 NotReachable 两种可达状态
+static SCNetworkReachabilityFlags const kWBHarnessReachable = kSCNetworkReachabilityFlagsReachable;
+static SCNetworkReachabilityFlags const kWBHarnessNotReachable = 0;
+
+static void *kWBHarnessObserverQueueKey = &kWBHarnessObserverQueueKey;
+
+//在一个串行队列中记录观察者收到的状态和时间，只在这个队列中访问
+@interface WBHarnessObserver : NSObject
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) NSMutableArray <NSNumber *> *statuses;
+@property (nonatomic, strong) NSMutableArray <NSNumber *> *times;
+@property (nonatomic, assign) NSUInteger callsOffQueue;
+@property (nonatomic, strong) id token;
+- (instancetype)initWithManager:(WBNetworkReachabilityManager *)manager;
+- (NSArray <NSNumber *> *)receivedStatuses;
+- (NSArray <NSNumber *> *)receivedTimes;
+@end
+
+@implementation WBHarnessObserver
+
+- (instancetype)initWithManager:(WBNetworkReachabilityManager *)manager{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.queue = dispatch_queue_create("com.wbnetworking.harness.observer", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(self.queue, kWBHarnessObserverQueueKey, (__bridge void *)self, NULL);
+    self.statuses = [NSMutableArray array];
+    self.times = [NSMutableArray array];
+    __weak __typeof(self) weakSelf = self;
+    self.token = [manager addReachabilityStatusObserverWithQueue:self.queue usingBlock:^(WBNetworkReachabilityStatus status) {
+        __strong __typeof(weakSelf) strongSelf = weakSelf;
+        if (dispatch_get_specific(kWBHarnessObserverQueueKey) != (__bridge void *)strongSelf || [NSThread isMainThread]) {
+            strongSelf.callsOffQueue += 1;
+        }
+        [strongSelf.statuses addObject:@(status)];
+        [strongSelf.times addObject:@(clock_gettime_nsec_np(CLOCK_UPTIME_RAW))];
+    }];
+    return self;
+}
+
+- (NSArray <NSNumber *> *)receivedStatuses{
+    __block NSArray *statuses;
+    dispatch_sync(self.queue, ^{
+        statuses = [self.statuses copy];
+    });
+    return statuses;
+}
+
+- (NSArray <NSNumber *> *)receivedTimes{
+    __block NSArray *times;
+    dispatch_sync(self.queue, ^{
+        times = [self.times copy];
+    });
+    return times;
+}
+
+@end
+
+static WBNetworkReachabilityManager * WBHarnessLoopbackManager(NSTimeInterval coalescingInterval) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    WBNetworkReachabilityManager *manager = [WBNetworkReachabilityManager managerForAddress:&address];
+    manager.statusChangeCoalescingInterval = coalescingInterval;
+    return manager;
+}
+
+//和 SCNetworkReachability 的回调一样，在 reachabilityQueue 中处理
+static void WBHarnessSendFlags(WBNetworkReachabilityManager *manager, SCNetworkReachabilityFlags flags) {
+    dispatch_async(manager.reachabilityQueue, ^{
+        [manager handleReachabilityFlags:flags];
+    });
+}
+
+//等待 reachabilityQueue 处理完已提交的回调，再等待观察者队列处理完已发出的状态
+static void WBHarnessFlush(WBNetworkReachabilityManager *manager, WBHarnessObserver *observer) {
+    dispatch_sync(manager.reachabilityQueue, ^{});
+    dispatch_sync(observer.queue, ^{});
+}
+
+static void WBHarnessRunMainLoop(NSTimeInterval duration) {
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:duration]];
+}
+
+static BOOL WBHarnessWaitForStatusCount(WBHarnessObserver *observer, NSUInteger count, NSTimeInterval timeout) {
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:timeout];
+    while ([deadline timeIntervalSinceNow] > 0) {
+        if ([[observer receivedStatuses] count] >= count) {
+            return YES;
+        }
+        WBHarnessRunMainLoop(0.05);
+    }
+    return [[observer receivedStatuses] count] >= count;
+}
+
+static void WBHarnessCheckIdenticalStatuses(void) {
+    printf("# identical statuses\n");
+    WBNetworkReachabilityManager *manager = WBHarnessLoopbackManager(0.2);
+    WBHarnessObserver *observer = [[WBHarnessObserver alloc] initWithManager:manager];
+    __block NSUInteger blockCalls = 0;
+    __block NSUInteger blockCallsOffMain = 0;
+    [manager setReeachabilityStatusChangeBlock:^(WBNetworkReachabilityStatus status) {
+        blockCalls += 1;
+        blockCallsOffMain += [NSThread isMainThread] ? 0 : 1;
+    }];
+    __block NSUInteger notifications = 0;
+    id notificationToken = [[NSNotificationCenter defaultCenter] addObserverForName:WBNetworkingReachabilityDidChangeNotification object:manager queue:nil usingBlock:^(NSNotification *note) {
+        notifications += 1;
+    }];
+
+    for (NSUInteger i = 0; i < 100; i++) {
+        WBHarnessSendFlags(manager, kWBHarnessReachable);
+    }
+    WBHarnessFlush(manager, observer);
+    WBHarnessRunMainLoop(0.1);
+    WBHarnessCheck(manager.rawReachabilityEventCount == 100 && manager.deliveredReachabilityEventCount == 1, "100 identical callbacks: raw %lu, delivered %lu", (unsigned long)manager.rawReachabilityEventCount, (unsigned long)manager.deliveredReachabilityEventCount);
+    WBHarnessCheck([[observer receivedStatuses] isEqualToArray:@[@(WBNetworkReachabilityStatusReachableWiFi)]] && observer.callsOffQueue == 0, "the observer got WiFi once, on its own queue");
+    WBHarnessCheck(blockCalls == 1 && blockCallsOffMain == 0 && notifications == 1 && manager.networkReachabilityStatus == WBNetworkReachabilityStatusReachableWiFi, "the status block, notification and property changed once, on the main thread");
+
+    [[NSNotificationCenter defaultCenter] removeObserver:notificationToken];
+}
+
+static void WBHarnessCheckWindow(void) {
+    printf("# coalescing window (0.2 s)\n");
+    WBNetworkReachabilityManager *manager = WBHarnessLoopbackManager(0.2);
+    WBHarnessObserver *observer = [[WBHarnessObserver alloc] initWithManager:manager];
+    WBHarnessSendFlags(manager, kWBHarnessReachable);
+    WBHarnessFlush(manager, observer);
+
+    //窗口内来回变化，最后回到 WiFi
+    for (NSUInteger i = 0; i < 10; i++) {
+        WBHarnessSendFlags(manager, i % 2 == 0 ? kWBHarnessNotReachable : kWBHarnessReachable);
+    }
+    WBHarnessFlush(manager, observer);
+    usleep(350 * 1000);
+    WBHarnessFlush(manager, observer);
+    WBHarnessCheck([[observer receivedStatuses] count] == 1 && manager.deliveredReachabilityEventCount == 1, "a flap that settles back on WiFi delivers nothing (raw %lu)", (unsigned long)manager.rawReachabilityEventCount);
+
+    //窗口已经过去，第一次变化立即发出
+    WBHarnessSendFlags(manager, kWBHarnessNotReachable);
+    WBHarnessFlush(manager, observer);
+    WBHarnessCheck([[[observer receivedStatuses] lastObject] isEqual:@(WBNetworkReachabilityStatusNotReachable)], "a change after the window is delivered right away");
+
+    //窗口内变化，最后停在 WiFi，窗口结束后只发出 WiFi
+    WBHarnessSendFlags(manager, kWBHarnessReachable);
+    WBHarnessSendFlags(manager, kWBHarnessNotReachable);
+    WBHarnessSendFlags(manager, kWBHarnessReachable);
+    WBHarnessFlush(manager, observer);
+    WBHarnessCheck([[observer receivedStatuses] count] == 2, "a change inside the window is held");
+    usleep(350 * 1000);
+    WBHarnessFlush(manager, observer);
+    NSArray <NSNumber *> *statuses = [observer receivedStatuses];
+    NSArray <NSNumber *> *times = [observer receivedTimes];
+    NSArray *expected = @[@(WBNetworkReachabilityStatusReachableWiFi), @(WBNetworkReachabilityStatusNotReachable), @(WBNetworkReachabilityStatusReachableWiFi)];
+    double gap = [times count] == 3 ? (double)([times[2] unsignedLongLongValue] - [times[1] unsignedLongLongValue]) / NSEC_PER_MSEC : 0;
+    WBHarnessCheck([statuses isEqualToArray:expected], "only the latest status is delivered once the window ends");
+    WBHarnessCheck(gap >= 190, "%.0f ms after the previous delivery", gap);
+
+    printf("# no coalescing window\n");
+    WBNetworkReachabilityManager *immediateManager = WBHarnessLoopbackManager(0);
+    WBHarnessObserver *immediateObserver = [[WBHarnessObserver alloc] initWithManager:immediateManager];
+    for (NSUInteger i = 0; i < 50; i++) {
+        WBHarnessSendFlags(immediateManager, i % 2 == 0 ? kWBHarnessReachable : kWBHarnessNotReachable);
+        WBHarnessSendFlags(immediateManager, i % 2 == 0 ? kWBHarnessReachable : kWBHarnessNotReachable);
+    }
+    WBHarnessFlush(immediateManager, immediateObserver);
+    WBHarnessCheck(immediateManager.rawReachabilityEventCount == 100 && immediateManager.deliveredReachabilityEventCount == 50 && [[immediateObserver receivedStatuses] count] == 50, "50 changes sent twice each: raw %lu, delivered %lu", (unsigned long)immediateManager.rawReachabilityEventCount, (unsigned long)immediateManager.deliveredReachabilityEventCount);
+}
+
+static void WBHarnessCheckBurst(void) {
+    printf("# handover burst\n");
+    NSTimeInterval interval = 0.25;
+    WBNetworkReachabilityManager *manager = WBHarnessLoopbackManager(interval);
+    WBHarnessObserver *observer = [[WBHarnessObserver alloc] initWithManager:manager];
+    __block NSUInteger mainThreadHops = 0;
+    [manager setReeachabilityStatusChangeBlock:^(WBNetworkReachabilityStatus status) {
+        mainThreadHops += 1;
+    }];
+
+    NSUInteger callbacks = 2000;
+    SCNetworkReachabilityFlags lastFlags = kWBHarnessNotReachable;
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSUInteger i = 0; i < callbacks; i++) {
+        lastFlags = arc4random_uniform(2) ? kWBHarnessReachable : kWBHarnessNotReachable;
+        WBHarnessSendFlags(manager, lastFlags);
+        usleep(500);
+    }
+    double elapsed = (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / NSEC_PER_SEC;
+    usleep((useconds_t)(interval * 1.5 * USEC_PER_SEC));
+    WBHarnessFlush(manager, observer);
+    WBHarnessRunMainLoop(0.1);
+
+    NSUInteger delivered = manager.deliveredReachabilityEventCount;
+    //第一次立即发出，之后每个窗口最多一次，循环结束后还有一个窗口
+    NSUInteger bound = (NSUInteger)ceil(elapsed / interval) + 2;
+    WBNetworkReachabilityStatus lastStatus = lastFlags == kWBHarnessReachable ? WBNetworkReachabilityStatusReachableWiFi : WBNetworkReachabilityStatusNotReachable;
+    printf("%lu callbacks over %.2f s: raw %lu, delivered %lu, main thread hops %lu\n", (unsigned long)callbacks, elapsed, (unsigned long)manager.rawReachabilityEventCount, (unsigned long)delivered, (unsigned long)mainThreadHops);
+    WBHarnessCheck(manager.rawReachabilityEventCount == callbacks, "every callback is counted as raw");
+    WBHarnessCheck(delivered >= 1 && delivered <= bound, "at most one delivery per window: %lu <= %lu", (unsigned long)delivered, (unsigned long)bound);
+    WBHarnessCheck([[[observer receivedStatuses] lastObject] isEqual:@(lastStatus)] && manager.networkReachabilityStatus == lastStatus, "the observer and the property end on the last status");
+    WBHarnessCheck([[observer receivedStatuses] count] == delivered && mainThreadHops == delivered, "the observer and the main thread are reached once per delivery");
+}
+
+static void WBHarnessCheckRemovalAndRestart(void) {
+    printf("# removal, stop and restart\n");
+    WBNetworkReachabilityManager *manager = WBHarnessLoopbackManager(0.2);
+    WBHarnessObserver *observer = [[WBHarnessObserver alloc] initWithManager:manager];
+    WBHarnessObserver *removedObserver = [[WBHarnessObserver alloc] initWithManager:manager];
+    [manager removeReachabilityStatusObserver:removedObserver.token];
+    WBHarnessSendFlags(manager, kWBHarnessReachable);
+    WBHarnessFlush(manager, observer);
+    WBHarnessFlush(manager, removedObserver);
+    WBHarnessCheck([[observer receivedStatuses] count] == 1 && [[removedObserver receivedStatuses] count] == 0, "a removed observer is not called");
+
+    //窗口内的变化在 stopMonitoring 之后不再发出
+    WBHarnessSendFlags(manager, kWBHarnessNotReachable);
+    WBHarnessFlush(manager, observer);
+    [manager stopMonitoring];
+    usleep(350 * 1000);
+    WBHarnessFlush(manager, observer);
+    WBHarnessCheck([[observer receivedStatuses] count] == 1 && manager.deliveredReachabilityEventCount == 1, "stopMonitoring drops the status waiting for its window");
+
+    //回环地址总是可达，重新开始监控时再次发出当前状态
+    [manager startMonitoring];
+    WBHarnessCheck(WBHarnessWaitForStatusCount(observer, 2, 3), "startMonitoring delivers the first probe");
+    NSNumber *probed = [[observer receivedStatuses] lastObject];
+    [manager stopMonitoring];
+    [manager startMonitoring];
+    WBHarnessCheck(WBHarnessWaitForStatusCount(observer, 3, 3) && [[[observer receivedStatuses] lastObject] isEqual:probed], "a restart delivers the same status again");
+    [manager stopMonitoring];
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        WBHarnessCheckIdenticalStatuses();
+        WBHarnessCheckWindow();
+        WBHarnessCheckBurst();
+        WBHarnessCheckRemovalAndRestart();
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
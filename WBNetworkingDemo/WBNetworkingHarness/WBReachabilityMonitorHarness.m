@@ -0,0 +1,462 @@
+//
+//  WBReachabilityMonitorHarness.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Exercises WBNetworkReachabilityMonitor through a fake WBNetworkReachabilityBackend whose statuses the harness sets:
+//  1. 30 hosts watched by 4 observers each under differently cased names, plus two addresses watched twice, start exactly one backend observation per unique target, on the monitor's queue;
+//  2. a status reaches every observer of its target, and only them, on each observer's own queue; unchanged statuses are dropped, and a late observer gets the current status right away;
+//  3. the observation stops with the last observer of its target and not before, a stale backend callback after that is ignored, and a target the backend cannot observe is handled;
+//  4. observers added and removed from 8 threads at once leave no observation behind, and the fan-out cost per delivery is printed.
+//  通过一个假的 WBNetworkReachabilityBackend 测试 WBNetworkReachabilityMonitor，状态由 harness 设置：
+//  1. 30 个域名，每个由 4 个观察者用不同的大小写添加，再加上两个各添加两次的地址，每个不同的 target 只在 monitor 的队列中开始一次后端监控；
+//  2. 状态只通知给这个 target 的每个观察者，在观察者自己的队列中调用；状态没有变化时不通知，后添加的观察者立即收到当前状态；
+//  3. target 的最后一个观察者移除时才停止后端监控，之后后端过期的回调被忽略，后端无法监控的 target 也能正常处理；
+//  4. 8 个线程同时添加和移除观察者后不会遗留后端监控，并打印每次通知的耗时。
+//
+//  macOS:
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -fobjc-arc -I ../WBNetworking -framework Foundation -framework SystemConfiguration \
+//      ../WBNetworking/WBNetworkReachabilityManager.m ../WBNetworking/WBNetworkReachabilityMonitor.m WBReachabilityMonitorHarness.m -o /tmp/WBReachabilityMonitorHarness
+//  /tmp/WBReachabilityMonitorHarness
+//
+//  Linux with GNUstep and libdispatch:
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang $(gnustep-config --objc-flags) -fobjc-arc -fblocks -I ../WBNetworking \
+//      ../WBNetworking/WBNetworkReachabilityMonitor.m ../WBNetworking/WBNetlinkReachabilityBackend.m WBReachabilityMonitorHarness.m \
+//      $(gnustep-config --base-libs) -ldispatch -o /tmp/WBReachabilityMonitorHarness
+//  /tmp/WBReachabilityMonitorHarness
+//
+
+#import <Foundation/Foundation.h>
+#import <arpa/inet.h>
+#import <stdatomic.h>
+#import <time.h>
+#import "WBNetworkReachabilityMonitor.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+static uint64_t WBHarnessNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+}
+
+#pragma mark - 假的后端
+
+//假的后端中的一次监控，handler 只在 queue 中调用
+@interface WBHarnessObservation : NSObject
+@property (nonatomic, strong) WBNetworkReachabilityTarget *target;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) void (^handler)(WBNetworkReachabilityStatus status);
+@property (atomic, assign) BOOL stopped;
+@end
+
+@implementation WBHarnessObservation
+@end
+
+//记录每次开始和停止，状态由 harness 通过 setStatus:forTarget: 设置
+@interface WBHarnessBackend : NSObject <WBNetworkReachabilityBackend>
+@property (nonatomic, strong) NSMutableArray <WBHarnessObservation *> *observations;
+@property (nonatomic, assign) NSUInteger starts;
+@property (nonatomic, assign) NSUInteger stops;
+//不在 monitor 队列中调用、或者重复停止同一个监控的次数
+@property (nonatomic, assign) NSUInteger callsOffQueue;
+//这个域名返回 nil，表示无法监控
+@property (nonatomic, copy) NSString *unobservableHost;
+- (NSUInteger)numberOfStartsForTarget:(WBNetworkReachabilityTarget *)target;
+- (WBHarnessObservation *)activeObservationForTarget:(WBNetworkReachabilityTarget *)target;
+- (void)setStatus:(WBNetworkReachabilityStatus)status forTarget:(WBNetworkReachabilityTarget *)target;
+@end
+
+@implementation WBHarnessBackend {
+    dispatch_queue_t _monitorQueue;
+}
+
+- (instancetype)init{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.observations = [NSMutableArray array];
+    return self;
+}
+
+//两个方法都必须在 monitor 的串行队列中调用，第一次调用时记住这个队列
+- (void)checkQueue:(dispatch_queue_t)queue{
+    if (queue && !_monitorQueue) {
+        _monitorQueue = queue;
+    }
+    if (strcmp(dispatch_queue_get_label(DISPATCH_CURRENT_QUEUE_LABEL), dispatch_queue_get_label(_monitorQueue)) != 0) {
+        self.callsOffQueue += 1;
+    }
+}
+
+- (id)startObservingTarget:(WBNetworkReachabilityTarget *)target queue:(dispatch_queue_t)queue handler:(void (^)(WBNetworkReachabilityStatus))handler{
+    @synchronized (self) {
+        [self checkQueue:queue];
+        if ([target.host isEqualToString:self.unobservableHost]) {
+            return nil;
+        }
+        WBHarnessObservation *observation = [[WBHarnessObservation alloc] init];
+        observation.target = target;
+        observation.queue = queue;
+        observation.handler = handler;
+        [self.observations addObject:observation];
+        self.starts += 1;
+        return observation;
+    }
+}
+
+- (void)stopObservingWithToken:(id)token{
+    @synchronized (self) {
+        [self checkQueue:nil];
+        WBHarnessObservation *observation = token;
+        if (![observation isKindOfClass:[WBHarnessObservation class]] || observation.stopped) {
+            self.callsOffQueue += 1;
+            return;
+        }
+        observation.stopped = YES;
+        self.stops += 1;
+    }
+}
+
+- (NSUInteger)numberOfStartsForTarget:(WBNetworkReachabilityTarget *)target{
+    @synchronized (self) {
+        NSUInteger count = 0;
+        for (WBHarnessObservation *observation in self.observations) {
+            count += [observation.target isEqual:target] ? 1 : 0;
+        }
+        return count;
+    }
+}
+
+- (WBHarnessObservation *)activeObservationForTarget:(WBNetworkReachabilityTarget *)target{
+    @synchronized (self) {
+        for (WBHarnessObservation *observation in self.observations) {
+            if (!observation.stopped && [observation.target isEqual:target]) {
+                return observation;
+            }
+        }
+        return nil;
+    }
+}
+
+//和真正的后端一样，在 monitor 的队列中调用 handler
+- (void)setStatus:(WBNetworkReachabilityStatus)status forTarget:(WBNetworkReachabilityTarget *)target{
+    WBHarnessObservation *observation = [self activeObservationForTarget:target];
+    dispatch_async(observation.queue, ^{
+        if (!observation.stopped) {
+            observation.handler(status);
+        }
+    });
+}
+
+@end
+
+#pragma mark - 观察者
+
+//在自己的串行队列中记录收到的状态
+@interface WBHarnessRecorder : NSObject
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) NSMutableArray <NSNumber *> *statuses;
+@property (nonatomic, assign) NSUInteger callsOffQueue;
+@property (nonatomic, strong) id token;
+- (instancetype)initWithMonitor:(WBNetworkReachabilityMonitor *)monitor target:(WBNetworkReachabilityTarget *)target;
+- (NSArray <NSNumber *> *)receivedStatuses;
+@end
+
+static void *kWBHarnessRecorderQueueKey = &kWBHarnessRecorderQueueKey;
+
+@implementation WBHarnessRecorder
+
+- (instancetype)initWithMonitor:(WBNetworkReachabilityMonitor *)monitor target:(WBNetworkReachabilityTarget *)target{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    self.queue = dispatch_queue_create("com.wbnetworking.harness.recorder", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(self.queue, kWBHarnessRecorderQueueKey, (__bridge void *)self, NULL);
+    self.statuses = [NSMutableArray array];
+    __weak __typeof(self) weakSelf = self;
+    self.token = [monitor addObserverForTarget:target queue:self.queue usingBlock:^(WBNetworkReachabilityStatus status) {
+        __strong __typeof(weakSelf) strongSelf = weakSelf;
+        if (dispatch_get_specific(kWBHarnessRecorderQueueKey) != (__bridge void *)strongSelf) {
+            strongSelf.callsOffQueue += 1;
+        }
+        [strongSelf.statuses addObject:@(status)];
+    }];
+    return self;
+}
+
+- (NSArray <NSNumber *> *)receivedStatuses{
+    __block NSArray *statuses;
+    dispatch_sync(self.queue, ^{
+        statuses = [self.statuses copy];
+    });
+    return statuses;
+}
+
+@end
+
+//statusForTarget: 同步到 monitor 的队列，之前提交的回调都已处理；再等待每个观察者的队列
+static void WBHarnessFlush(WBNetworkReachabilityMonitor *monitor, NSArray <WBHarnessRecorder *> *recorders) {
+    [monitor statusForTarget:[WBNetworkReachabilityTarget defaultRouteTarget]];
+    for (WBHarnessRecorder *recorder in recorders) {
+        dispatch_sync(recorder.queue, ^{});
+    }
+}
+
+static WBNetworkReachabilityTarget * WBHarnessAddressTarget(int family, const char *string) {
+    if (family == AF_INET6) {
+        struct sockaddr_in6 address;
+        memset(&address, 0, sizeof(address));
+#if defined(__APPLE__)
+        address.sin6_len = sizeof(address);
+#endif
+        address.sin6_family = AF_INET6;
+        inet_pton(AF_INET6, string, &address.sin6_addr);
+        return [WBNetworkReachabilityTarget targetWithAddress:(const struct sockaddr *)&address];
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+#if defined(__APPLE__)
+    address.sin_len = sizeof(address);
+#endif
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, string, &address.sin_addr);
+    return [WBNetworkReachabilityTarget targetWithAddress:(const struct sockaddr *)&address];
+}
+
+//把域名中的字母按 variant 的二进制位改成大写
+static NSString * WBHarnessCasedHost(NSUInteger index, NSUInteger variant) {
+    NSMutableString *host = [NSMutableString stringWithFormat:@"host-%02lu.example.com", (unsigned long)index];
+    for (NSUInteger i = 0; i < [host length]; i++) {
+        if ((variant >> (i % 4)) & 1) {
+            [host replaceCharactersInRange:NSMakeRange(i, 1) withString:[[host substringWithRange:NSMakeRange(i, 1)] uppercaseString]];
+        }
+    }
+    return host;
+}
+
+static BOOL WBHarnessAllReceived(NSArray <WBHarnessRecorder *> *recorders, NSArray <NSNumber *> *expected) {
+    for (WBHarnessRecorder *recorder in recorders) {
+        if (![[recorder receivedStatuses] isEqualToArray:expected] || recorder.callsOffQueue > 0) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+#pragma mark - 检查
+
+static void WBHarnessCheckTargets(void) {
+    printf("# target equality\n");
+    WBNetworkReachabilityTarget *lower = [WBNetworkReachabilityTarget targetWithHost:@"api.example.com"];
+    WBNetworkReachabilityTarget *upper = [WBNetworkReachabilityTarget targetWithHost:@"API.Example.COM"];
+    WBHarnessCheck([lower isEqual:upper] && [lower hash] == [upper hash], "host names are compared case-insensitively");
+    WBHarnessCheck(![lower isEqual:[WBNetworkReachabilityTarget targetWithHost:@"api.example.org"]], "different hosts are different targets");
+    WBHarnessCheck([WBHarnessAddressTarget(AF_INET, "127.0.0.1") isEqual:WBHarnessAddressTarget(AF_INET, "127.0.0.1")], "equal IPv4 addresses are equal targets");
+    WBHarnessCheck(![WBHarnessAddressTarget(AF_INET, "127.0.0.1") isEqual:WBHarnessAddressTarget(AF_INET, "127.0.0.2")], "different IPv4 addresses are different targets");
+    WBHarnessCheck(![WBHarnessAddressTarget(AF_INET6, "::1") isEqual:WBHarnessAddressTarget(AF_INET, "127.0.0.1")], "IPv6 and IPv4 loopback are different targets");
+    WBHarnessCheck(![[WBNetworkReachabilityTarget targetWithHost:@"127.0.0.1"] isEqual:WBHarnessAddressTarget(AF_INET, "127.0.0.1")], "a host name is never equal to an address");
+    WBHarnessCheck([[WBNetworkReachabilityTarget defaultRouteTarget] isEqual:WBHarnessAddressTarget(AF_INET6, "::")], "the default route is the unspecified IPv6 address");
+}
+
+static void WBHarnessCheckMultiplexing(void) {
+    printf("# one observation per target\n");
+    WBHarnessBackend *backend = [[WBHarnessBackend alloc] init];
+    backend.unobservableHost = @"unobservable.invalid";
+    WBNetworkReachabilityMonitor *monitor = [[WBNetworkReachabilityMonitor alloc] initWithBackend:backend];
+
+    NSUInteger hostCount = 30;
+    NSMutableArray <WBNetworkReachabilityTarget *> *targets = [NSMutableArray array];
+    NSMutableArray <NSMutableArray <WBHarnessRecorder *> *> *recordersByTarget = [NSMutableArray array];
+    for (NSUInteger i = 0; i < hostCount; i++) {
+        [targets addObject:[WBNetworkReachabilityTarget targetWithHost:WBHarnessCasedHost(i, 0)]];
+        NSMutableArray *recorders = [NSMutableArray array];
+        for (NSUInteger variant = 0; variant < 4; variant++) {
+            [recorders addObject:[[WBHarnessRecorder alloc] initWithMonitor:monitor target:[WBNetworkReachabilityTarget targetWithHost:WBHarnessCasedHost(i, variant * 5)]]];
+        }
+        [recordersByTarget addObject:recorders];
+    }
+    //每个地址分别创建两次 target
+    int families[] = {AF_INET, AF_INET6};
+    const char *addresses[] = {"127.0.0.1", "::1"};
+    for (NSUInteger i = 0; i < 2; i++) {
+        NSMutableArray *recorders = [NSMutableArray array];
+        [recorders addObject:[[WBHarnessRecorder alloc] initWithMonitor:monitor target:WBHarnessAddressTarget(families[i], addresses[i])]];
+        [recorders addObject:[[WBHarnessRecorder alloc] initWithMonitor:monitor target:WBHarnessAddressTarget(families[i], addresses[i])]];
+        [targets addObject:WBHarnessAddressTarget(families[i], addresses[i])];
+        [recordersByTarget addObject:recorders];
+    }
+    NSMutableArray <WBHarnessRecorder *> *allRecorders = [NSMutableArray array];
+    for (NSArray *recorders in recordersByTarget) {
+        [allRecorders addObjectsFromArray:recorders];
+    }
+
+    WBHarnessFlush(monitor, allRecorders);
+    BOOL startedOnce = YES;
+    for (WBNetworkReachabilityTarget *target in targets) {
+        startedOnce = startedOnce && [backend numberOfStartsForTarget:target] == 1;
+    }
+    WBHarnessCheck(backend.starts == [targets count] && monitor.numberOfObservedTargets == [targets count] && startedOnce, "%lu observers of %lu targets start %lu observations", (unsigned long)[allRecorders count], (unsigned long)[targets count], (unsigned long)backend.starts);
+    WBHarnessCheck(backend.callsOffQueue == 0, "the backend is called on the monitor's queue");
+    WBHarnessCheck(WBHarnessAllReceived(allRecorders, @[]), "no status is delivered before the backend reports one");
+
+    printf("# fan-out\n");
+    for (WBNetworkReachabilityTarget *target in targets) {
+        [backend setStatus:WBNetworkReachabilityStatusReachableWiFi forTarget:target];
+    }
+    WBHarnessFlush(monitor, allRecorders);
+    NSArray *wifi = @[@(WBNetworkReachabilityStatusReachableWiFi)];
+    WBHarnessCheck(WBHarnessAllReceived(allRecorders, wifi), "every observer gets WiFi once, on its own queue");
+
+    for (WBNetworkReachabilityTarget *target in targets) {
+        [backend setStatus:WBNetworkReachabilityStatusReachableWiFi forTarget:target];
+    }
+    WBHarnessFlush(monitor, allRecorders);
+    WBHarnessCheck(WBHarnessAllReceived(allRecorders, wifi), "an unchanged status is dropped");
+
+    [backend setStatus:WBNetworkReachabilityStatusNotReachable forTarget:targets[7]];
+    WBHarnessFlush(monitor, allRecorders);
+    NSMutableArray *others = [allRecorders mutableCopy];
+    [others removeObjectsInArray:recordersByTarget[7]];
+    WBHarnessCheck(WBHarnessAllReceived(recordersByTarget[7], @[@(WBNetworkReachabilityStatusReachableWiFi), @(WBNetworkReachabilityStatusNotReachable)]) && WBHarnessAllReceived(others, wifi), "a change reaches only the observers of its target");
+    WBHarnessCheck([monitor statusForTarget:[WBNetworkReachabilityTarget targetWithHost:@"HOST-07.example.com"]] == WBNetworkReachabilityStatusNotReachable, "statusForTarget: returns the last status");
+
+    WBHarnessRecorder *lateRecorder = [[WBHarnessRecorder alloc] initWithMonitor:monitor target:targets[7]];
+    WBHarnessFlush(monitor, @[lateRecorder]);
+    WBHarnessCheck([[lateRecorder receivedStatuses] isEqualToArray:@[@(WBNetworkReachabilityStatusNotReachable)]] && backend.starts == [targets count], "a late observer gets the current status without a new observation");
+
+    //queue 为 nil 时在主队列中调用
+    __block NSUInteger mainQueueCalls = 0;
+    __block NSUInteger mainQueueCallsOffMain = 0;
+    id mainQueueObserver = [monitor addObserverForTarget:targets[0] queue:nil usingBlock:^(WBNetworkReachabilityStatus status) {
+        mainQueueCalls += 1;
+        mainQueueCallsOffMain += [NSThread isMainThread] ? 0 : 1;
+    }];
+    WBHarnessFlush(monitor, @[]);
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    WBHarnessCheck(mainQueueCalls == 1 && mainQueueCallsOffMain == 0, "a nil queue means the main queue");
+    [monitor removeObserver:mainQueueObserver];
+
+    printf("# removal\n");
+    NSArray <WBHarnessRecorder *> *recorders = recordersByTarget[3];
+    WBHarnessObservation *observation = [backend activeObservationForTarget:targets[3]];
+    for (NSUInteger i = 0; i < 3; i++) {
+        [monitor removeObserver:recorders[i].token];
+    }
+    WBHarnessFlush(monitor, recorders);
+    WBHarnessCheck(backend.stops == 0 && !observation.stopped, "the observation outlives all but the last observer");
+    [backend setStatus:WBNetworkReachabilityStatusNotReachable forTarget:targets[3]];
+    WBHarnessFlush(monitor, recorders);
+    WBHarnessCheck([[recorders[0] receivedStatuses] count] == 1 && [[recorders[3] receivedStatuses] count] == 2, "removed observers are not called, the remaining one is");
+
+    [monitor removeObserver:recorders[3].token];
+    WBHarnessFlush(monitor, recorders);
+    WBHarnessCheck(backend.stops == 1 && observation.stopped && monitor.numberOfObservedTargets == [targets count] - 1, "the last observer stops the observation");
+    WBHarnessCheck([monitor statusForTarget:targets[3]] == WBNetworkReachabilityStatusUnknown, "a target no longer observed is Unknown");
+
+    //后端停止之前已经提交的回调
+    dispatch_async(observation.queue, ^{
+        observation.handler(WBNetworkReachabilityStatusReachableWiFi);
+    });
+    WBHarnessFlush(monitor, recorders);
+    WBHarnessCheck([[recorders[3] receivedStatuses] count] == 2, "a stale backend callback is ignored");
+
+    WBHarnessRecorder *returningRecorder = [[WBHarnessRecorder alloc] initWithMonitor:monitor target:targets[3]];
+    WBHarnessFlush(monitor, @[returningRecorder]);
+    WBHarnessCheck([backend numberOfStartsForTarget:targets[3]] == 2 && [[returningRecorder receivedStatuses] count] == 0, "observing it again starts a new observation, with no status yet");
+
+    printf("# unobservable target\n");
+    WBNetworkReachabilityTarget *unobservable = [WBNetworkReachabilityTarget targetWithHost:@"unobservable.invalid"];
+    WBHarnessRecorder *unobservableRecorder = [[WBHarnessRecorder alloc] initWithMonitor:monitor target:unobservable];
+    WBHarnessFlush(monitor, @[unobservableRecorder]);
+    WBHarnessCheck([monitor statusForTarget:unobservable] == WBNetworkReachabilityStatusUnknown && [[unobservableRecorder receivedStatuses] count] == 0, "a target the backend rejects stays Unknown");
+    NSUInteger stops = backend.stops;
+    [monitor removeObserver:unobservableRecorder.token];
+    WBHarnessFlush(monitor, @[]);
+    WBHarnessCheck(backend.stops == stops && backend.callsOffQueue == 0, "removing its observer does not stop anything");
+}
+
+static void WBHarnessCheckConcurrentObservers(void) {
+    printf("# concurrent add and remove\n");
+    WBHarnessBackend *backend = [[WBHarnessBackend alloc] init];
+    WBNetworkReachabilityMonitor *monitor = [[WBNetworkReachabilityMonitor alloc] initWithBackend:backend];
+
+    dispatch_apply(8, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t thread) {
+        NSMutableArray *tokens = [NSMutableArray array];
+        for (NSUInteger i = 0; i < 500; i++) {
+            WBNetworkReachabilityTarget *target = [WBNetworkReachabilityTarget targetWithHost:WBHarnessCasedHost(arc4random_uniform(10), arc4random_uniform(16))];
+            [tokens addObject:[monitor addObserverForTarget:target queue:nil usingBlock:^(WBNetworkReachabilityStatus status) {}]];
+            if ([tokens count] > 5) {
+                NSUInteger index = arc4random_uniform((uint32_t)[tokens count]);
+                [monitor removeObserver:tokens[index]];
+                [tokens removeObjectAtIndex:index];
+            }
+        }
+        for (id token in tokens) {
+            [monitor removeObserver:token];
+        }
+    });
+    WBHarnessFlush(monitor, @[]);
+    WBHarnessCheck(monitor.numberOfObservedTargets == 0 && backend.starts == backend.stops && backend.starts >= 10, "4000 adds from 8 threads: %lu starts, %lu stops, %lu targets left", (unsigned long)backend.starts, (unsigned long)backend.stops, (unsigned long)monitor.numberOfObservedTargets);
+    WBHarnessCheck(backend.callsOffQueue == 0, "the backend is only called on the monitor's queue");
+}
+
+static void WBHarnessMeasureFanOut(void) {
+    printf("# fan-out cost\n");
+    WBHarnessBackend *backend = [[WBHarnessBackend alloc] init];
+    WBNetworkReachabilityMonitor *monitor = [[WBNetworkReachabilityMonitor alloc] initWithBackend:backend];
+    WBNetworkReachabilityTarget *target = [WBNetworkReachabilityTarget targetWithHost:@"api.example.com"];
+
+    NSUInteger observerCount = 30;
+    NSUInteger changes = 2000;
+    NSMutableArray <WBHarnessRecorder *> *recorders = [NSMutableArray array];
+    for (NSUInteger i = 0; i < observerCount; i++) {
+        [recorders addObject:[[WBHarnessRecorder alloc] initWithMonitor:monitor target:target]];
+    }
+    WBHarnessFlush(monitor, recorders);
+
+    NSMutableArray <NSNumber *> *expected = [NSMutableArray array];
+    uint64_t start = WBHarnessNow();
+    for (NSUInteger i = 0; i < changes; i++) {
+        WBNetworkReachabilityStatus status = i % 2 == 0 ? WBNetworkReachabilityStatusReachableWiFi : WBNetworkReachabilityStatusNotReachable;
+        [backend setStatus:status forTarget:target];
+        [expected addObject:@(status)];
+    }
+    WBHarnessFlush(monitor, recorders);
+    double elapsed = (double)(WBHarnessNow() - start);
+    printf("%lu changes to %lu observers: %.0f ns per delivery, %.0f deliveries/s\n", (unsigned long)changes, (unsigned long)observerCount, elapsed / (changes * observerCount), (changes * observerCount) / (elapsed / NSEC_PER_SEC));
+    WBHarnessCheck(WBHarnessAllReceived(recorders, expected), "every observer got all %lu changes in order", (unsigned long)changes);
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        WBHarnessCheckTargets();
+        WBHarnessCheckMultiplexing();
+        WBHarnessCheckConcurrentObservers();
+        if (WBHarnessFailures == 0) {
+            WBHarnessMeasureFanOut();
+        }
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
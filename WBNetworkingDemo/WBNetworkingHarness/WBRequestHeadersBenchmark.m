@@ -0,0 +1,204 @@
+//
+//  WBRequestHeadersBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Requests built per second by 1, 4 and 16 threads sharing one WBHTTPRequestSerializer, with the immutable header snapshot and with the previous header store.
+//  The previous store is reproduced by a subclass: a concurrent queue, `dispatch_sync` plus a copy of the dictionary on every read, and `dispatch_barrier_sync` on every write.
+//  Every run also has a thread that changes a header every millisecond. The harness checks that every request carries all the default headers, and that a header set between two requests is visible in the second one.
+//  1、4、16 个线程共用一个 WBHTTPRequestSerializer 时每秒构造的请求数，对比不可变的请求头快照和之前的实现。
+//  之前的实现用子类还原：并发队列，每次读取都 dispatch_sync 并拷贝字典，每次修改都 dispatch_barrier_sync。每次运行时另有一个线程每毫秒修改一次请求头；检查每个请求都带有全部默认请求头，两个请求之间设置的请求头在第二个请求中可见。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBRequestHeadersBenchmark.m -o /tmp/WBRequestHeadersBenchmark
+//  /tmp/WBRequestHeadersBenchmark [seconds per run, default 1]
+//
+
+#import <Foundation/Foundation.h>
+#import <stdatomic.h>
+#import "WBURLRequestSeriailzation.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+#pragma mark - 之前的请求头存储
+
+@interface WBLegacyHeadersRequestSerializer : WBHTTPRequestSerializer
+@end
+
+@implementation WBLegacyHeadersRequestSerializer {
+    NSMutableDictionary *_legacyHTTPRequestHeaders;
+    dispatch_queue_t _legacyRequestHeaderModificationQueue;
+}
+
+- (instancetype)init{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    //super 的 init 中设置的默认请求头
+    _legacyHTTPRequestHeaders = [[super HTTPRequestHeaders] mutableCopy];
+    _legacyRequestHeaderModificationQueue = dispatch_queue_create("rquestHeaderModificationQueue", DISPATCH_QUEUE_CONCURRENT);
+    return self;
+}
+
+- (NSDictionary *)HTTPRequestHeaders{
+    NSDictionary __block *value;
+    dispatch_sync(_legacyRequestHeaderModificationQueue, ^{
+        value = [NSDictionary dictionaryWithDictionary:self->_legacyHTTPRequestHeaders];
+    });
+    return value;
+}
+
+- (void)setValue:(NSString *)value forHTTPHeaderField:(NSString *)field{
+    if (!_legacyRequestHeaderModificationQueue) {
+        [super setValue:value forHTTPHeaderField:field];
+        return;
+    }
+    dispatch_barrier_sync(_legacyRequestHeaderModificationQueue, ^{
+        [self->_legacyHTTPRequestHeaders setValue:value forKey:field];
+    });
+}
+
+- (NSString *)valueForHTTPHeaderField:(NSString *)field{
+    NSString __block *value;
+    dispatch_sync(_legacyRequestHeaderModificationQueue, ^{
+        value = [self->_legacyHTTPRequestHeaders valueForKey:field];
+    });
+    return value;
+}
+
+- (void)clearAuthorizationHeader{
+    dispatch_barrier_sync(_legacyRequestHeaderModificationQueue, ^{
+        [self->_legacyHTTPRequestHeaders removeObjectForKey:@"Authorization"];
+    });
+}
+
+@end
+
+#pragma mark -
+
+static NSUInteger const kWBHarnessDefaultHeaderCount = 12;
+
+static WBHTTPRequestSerializer * WBHarnessSerializer(Class serializerClass) {
+    WBHTTPRequestSerializer *serializer = [[serializerClass alloc] init];
+    for (NSUInteger i = 0; i < kWBHarnessDefaultHeaderCount; i++) {
+        [serializer setValue:[NSString stringWithFormat:@"value-%lu", (unsigned long)i] forHTTPHeaderField:[NSString stringWithFormat:@"X-Default-%lu", (unsigned long)i]];
+    }
+    [serializer setAuthorizationHeaderFieldWithUsername:@"user" password:@"password"];
+    return serializer;
+}
+
+static BOOL WBHarnessHasDefaultHeaders(NSURLRequest *request) {
+    for (NSUInteger i = 0; i < kWBHarnessDefaultHeaderCount; i++) {
+        if (![[request valueForHTTPHeaderField:[NSString stringWithFormat:@"X-Default-%lu", (unsigned long)i]] isEqualToString:[NSString stringWithFormat:@"value-%lu", (unsigned long)i]]) {
+            return NO;
+        }
+    }
+    return [request valueForHTTPHeaderField:@"Authorization"] != nil;
+}
+
+static atomic_bool WBHarnessRunning;
+static atomic_ulong WBHarnessBuiltRequests;
+static atomic_ulong WBHarnessIncompleteRequests;
+
+//threadCount 个线程在 seconds 秒内构造请求，返回每秒构造的请求数；*incomplete 为缺少默认请求头的请求数
+static double WBHarnessRequestsPerSecond(WBHTTPRequestSerializer *serializer, NSUInteger threadCount, NSTimeInterval seconds, NSUInteger *incomplete) {
+    atomic_store(&WBHarnessBuiltRequests, 0);
+    atomic_store(&WBHarnessIncompleteRequests, 0);
+    dispatch_group_t group = dispatch_group_create();
+    atomic_store(&WBHarnessRunning, true);
+
+    for (NSUInteger i = 0; i < threadCount; i++) {
+        dispatch_group_enter(group);
+        NSThread *thread = [[NSThread alloc] initWithBlock:^{
+            NSDictionary *parameters = @{@"q": @"search", @"page": @2, @"filters": @[@"new", @"nearby"]};
+            unsigned long count = 0;
+            unsigned long incompleteCount = 0;
+            while (atomic_load(&WBHarnessRunning)) {
+                @autoreleasepool {
+                    NSURLRequest *request = [serializer requestWithMethod:@"GET" URLString:@"https://api.example.com/v1/search" parameters:parameters error:nil];
+                    if (!WBHarnessHasDefaultHeaders(request)) {
+                        incompleteCount += 1;
+                    }
+                    count += 1;
+                }
+            }
+            atomic_fetch_add(&WBHarnessBuiltRequests, count);
+            atomic_fetch_add(&WBHarnessIncompleteRequests, incompleteCount);
+            dispatch_group_leave(group);
+        }];
+        [thread start];
+    }
+
+    //写线程每毫秒修改一次请求头
+    dispatch_group_enter(group);
+    NSThread *writer = [[NSThread alloc] initWithBlock:^{
+        NSUInteger generation = 0;
+        while (atomic_load(&WBHarnessRunning)) {
+            [serializer setValue:[NSString stringWithFormat:@"%lu", (unsigned long)generation++] forHTTPHeaderField:@"X-Generation"];
+            usleep(1000);
+        }
+        dispatch_group_leave(group);
+    }];
+    [writer start];
+
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    [NSThread sleepForTimeInterval:seconds];
+    atomic_store(&WBHarnessRunning, false);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    double elapsed = (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / NSEC_PER_SEC;
+
+    *incomplete = (NSUInteger)atomic_load(&WBHarnessIncompleteRequests);
+    return (double)atomic_load(&WBHarnessBuiltRequests) / elapsed;
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        NSTimeInterval seconds = argc > 1 ? strtod(argv[1], NULL) : 1;
+
+        printf("# header changes are visible to the next request\n");
+        for (Class serializerClass in @[[WBHTTPRequestSerializer class], [WBLegacyHeadersRequestSerializer class]]) {
+            WBHTTPRequestSerializer *serializer = WBHarnessSerializer(serializerClass);
+            const char *name = [NSStringFromClass(serializerClass) UTF8String];
+            NSURLRequest *request = [serializer requestWithMethod:@"GET" URLString:@"https://api.example.com/" parameters:nil error:nil];
+            WBHarnessCheck(WBHarnessHasDefaultHeaders(request) && ![request valueForHTTPHeaderField:@"X-Changed"], "%s: default headers only", name);
+            [serializer setValue:@"1" forHTTPHeaderField:@"X-Changed"];
+            request = [serializer requestWithMethod:@"GET" URLString:@"https://api.example.com/" parameters:nil error:nil];
+            WBHarnessCheck([[request valueForHTTPHeaderField:@"X-Changed"] isEqualToString:@"1"] && [[serializer valueForHTTPHeaderField:@"X-Changed"] isEqualToString:@"1"], "%s: a new header is sent", name);
+            [serializer clearAuthorizationHeader];
+            request = [serializer requestWithMethod:@"GET" URLString:@"https://api.example.com/" parameters:nil error:nil];
+            WBHarnessCheck(![request valueForHTTPHeaderField:@"Authorization"], "%s: a cleared Authorization header is not sent", name);
+        }
+
+        printf("# requests built per second, one writer changing a header every ms\n");
+        printf("%-8s %14s %14s %8s\n", "threads", "previous", "snapshot", "speedup");
+        for (NSNumber *threadCount in @[@1, @4, @16]) {
+            NSUInteger legacyIncomplete = 0;
+            NSUInteger snapshotIncomplete = 0;
+            double legacy = WBHarnessRequestsPerSecond(WBHarnessSerializer([WBLegacyHeadersRequestSerializer class]), [threadCount unsignedIntegerValue], seconds, &legacyIncomplete);
+            double snapshot = WBHarnessRequestsPerSecond(WBHarnessSerializer([WBHTTPRequestSerializer class]), [threadCount unsignedIntegerValue], seconds, &snapshotIncomplete);
+            printf("%-8lu %14.0f %14.0f %7.2fx\n", (unsigned long)[threadCount unsignedIntegerValue], legacy, snapshot, snapshot / legacy);
+            WBHarnessCheck(snapshotIncomplete == 0 && legacyIncomplete == 0, "%lu threads: every request has all default headers", (unsigned long)[threadCount unsignedIntegerValue]);
+        }
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
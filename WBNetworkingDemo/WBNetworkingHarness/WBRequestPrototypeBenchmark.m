@@ -0,0 +1,191 @@
+//
+//  WBRequestPrototypeBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Allocations and time per request for `-[WBHTTPRequestSerializer requestWithMethod:URLString:parameters:error:]` against `-[WBHTTPRequestPrototype requestWithMethod:path:parameters:error:]`, with a serializer that has a changed timeout, cache policy, cellular and cookie setting and ten default headers.
+//  Before measuring, it checks that both build the same request. The target is at least 3x fewer allocations per request without parameters.
+//  Allocations are counted by wrapping malloc, calloc and realloc of the default malloc zone while a request is built.
+//  对比 serializer 的 requestWithMethod:URLString:parameters:error: 和请求原型的 requestWithMethod:path:parameters:error: 每个请求的内存分配次数和耗时，serializer 修改了超时、缓存策略、蜂窝数据和 cookie 设置，并有 10 个默认请求头。
+//  测量之前先检查两者构造的请求相同。目标是没有参数时每个请求的分配次数至少减少到 1/3。分配次数通过替换默认 malloc zone 的 malloc、calloc、realloc 统计。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      ../WBNetworking/*.m WBRequestPrototypeBenchmark.m -o /tmp/WBRequestPrototypeBenchmark
+//  /tmp/WBRequestPrototypeBenchmark
+//
+
+#import <Foundation/Foundation.h>
+#import <malloc/malloc.h>
+#import <mach/mach.h>
+#import <stdatomic.h>
+#import "WBURLRequestSeriailzation.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+#pragma mark - 统计内存分配次数
+
+static atomic_bool WBHarnessCountsAllocations;
+static _Atomic(uint64_t) WBHarnessAllocationCount;
+static void * (*WBHarnessOriginalMalloc)(struct _malloc_zone_t *zone, size_t size);
+static void * (*WBHarnessOriginalCalloc)(struct _malloc_zone_t *zone, size_t count, size_t size);
+static void * (*WBHarnessOriginalRealloc)(struct _malloc_zone_t *zone, void *pointer, size_t size);
+
+static void * WBHarnessMalloc(struct _malloc_zone_t *zone, size_t size) {
+    if (atomic_load_explicit(&WBHarnessCountsAllocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&WBHarnessAllocationCount, 1, memory_order_relaxed);
+    }
+    return WBHarnessOriginalMalloc(zone, size);
+}
+
+static void * WBHarnessCalloc(struct _malloc_zone_t *zone, size_t count, size_t size) {
+    if (atomic_load_explicit(&WBHarnessCountsAllocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&WBHarnessAllocationCount, 1, memory_order_relaxed);
+    }
+    return WBHarnessOriginalCalloc(zone, count, size);
+}
+
+static void * WBHarnessRealloc(struct _malloc_zone_t *zone, void *pointer, size_t size) {
+    if (atomic_load_explicit(&WBHarnessCountsAllocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&WBHarnessAllocationCount, 1, memory_order_relaxed);
+    }
+    return WBHarnessOriginalRealloc(zone, pointer, size);
+}
+
+//默认 zone 的函数表是只读的，先改为可写再替换
+static BOOL WBHarnessInstallAllocationCounter(void) {
+    malloc_zone_t *zone = malloc_default_zone();
+    if (vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ | VM_PROT_WRITE) != KERN_SUCCESS) {
+        return NO;
+    }
+    WBHarnessOriginalMalloc = zone->malloc;
+    WBHarnessOriginalCalloc = zone->calloc;
+    WBHarnessOriginalRealloc = zone->realloc;
+    zone->malloc = WBHarnessMalloc;
+    zone->calloc = WBHarnessCalloc;
+    zone->realloc = WBHarnessRealloc;
+    return YES;
+}
+
+#pragma mark -
+
+static NSString * const kWBHarnessBaseURLString = @"https://api.example.com/v1/";
+
+static WBHTTPRequestSerializer * WBHarnessSerializer(void) {
+    WBHTTPRequestSerializer *serializer = [WBHTTPRequestSerializer serializer];
+    serializer.timeoutInterval = 15;
+    serializer.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    serializer.allowsCellularAccess = NO;
+    serializer.HTTPShouldHandleCookies = NO;
+    for (NSUInteger i = 0; i < 10; i++) {
+        [serializer setValue:[NSString stringWithFormat:@"value-%lu", (unsigned long)i] forHTTPHeaderField:[NSString stringWithFormat:@"X-Default-%lu", (unsigned long)i]];
+    }
+    return serializer;
+}
+
+static BOOL WBHarnessRequestsAreEqual(NSURLRequest *request, NSURLRequest *otherRequest) {
+    return [[request.URL absoluteString] isEqualToString:[otherRequest.URL absoluteString]] &&
+        [request.HTTPMethod isEqualToString:otherRequest.HTTPMethod] &&
+        [request.allHTTPHeaderFields isEqualToDictionary:otherRequest.allHTTPHeaderFields] &&
+        (request.HTTPBody == otherRequest.HTTPBody || [request.HTTPBody isEqualToData:otherRequest.HTTPBody]) &&
+        request.timeoutInterval == otherRequest.timeoutInterval &&
+        request.cachePolicy == otherRequest.cachePolicy &&
+        request.allowsCellularAccess == otherRequest.allowsCellularAccess &&
+        request.HTTPShouldHandleCookies == otherRequest.HTTPShouldHandleCookies;
+}
+
+//返回每个请求的平均分配次数，*nanoseconds 为每个请求的平均耗时
+static double WBHarnessMeasure(NSUInteger iterations, uint64_t *nanoseconds, void (^build)(void)) {
+    //预热，让缓存和延迟初始化的对象不计入
+    for (NSUInteger i = 0; i < 100; i++) {
+        @autoreleasepool {
+            build();
+        }
+    }
+    atomic_store(&WBHarnessAllocationCount, 0);
+    atomic_store(&WBHarnessCountsAllocations, true);
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            build();
+        }
+    }
+    atomic_store(&WBHarnessCountsAllocations, false);
+    double allocations = (double)atomic_load(&WBHarnessAllocationCount) / iterations;
+
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            build();
+        }
+    }
+    *nanoseconds = (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / iterations;
+    return allocations;
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        if (!WBHarnessInstallAllocationCounter()) {
+            fprintf(stderr, "cannot wrap the default malloc zone\n");
+            return 1;
+        }
+
+        WBHTTPRequestSerializer *serializer = WBHarnessSerializer();
+        WBHTTPRequestPrototype *prototype = [serializer requestPrototypeWithBaseURL:[NSURL URLWithString:kWBHarnessBaseURLString]];
+
+        NSArray <NSString *> *names = @[@"GET, no parameters", @"GET, 4 parameters", @"POST, 4 parameters"];
+        NSArray <NSString *> *methods = @[@"GET", @"GET", @"POST"];
+        NSDictionary *parameters = @{@"q": @"coffee", @"page": @3, @"city": @"北京", @"sort": @"distance"};
+        NSArray *parameterSets = @[[NSNull null], parameters, parameters];
+
+        printf("# the prototype builds the same requests\n");
+        for (NSUInteger i = 0; i < [names count]; i++) {
+            id requestParameters = parameterSets[i] == [NSNull null] ? nil : parameterSets[i];
+            NSURLRequest *request = [serializer requestWithMethod:methods[i] URLString:[kWBHarnessBaseURLString stringByAppendingString:@"search"] parameters:requestParameters error:nil];
+            NSURLRequest *prototypeRequest = [prototype requestWithMethod:methods[i] path:@"search" parameters:requestParameters error:nil];
+            WBHarnessCheck(WBHarnessRequestsAreEqual(request, prototypeRequest), "%s", [names[i] UTF8String]);
+        }
+        [serializer setValue:@"late" forHTTPHeaderField:@"X-Late"];
+        WBHarnessCheck(![[prototype requestWithMethod:@"GET" path:@"search" parameters:nil error:nil] valueForHTTPHeaderField:@"X-Late"], "headers set after the prototype was built are not sent by it");
+        serializer = WBHarnessSerializer();
+
+        printf("# allocations and ns per request\n");
+        printf("%-20s %12s %12s %8s %12s %12s\n", "request", "serializer", "prototype", "ratio", "serializer ns", "prototype ns");
+        for (NSUInteger i = 0; i < [names count]; i++) {
+            NSString *method = methods[i];
+            id requestParameters = parameterSets[i] == [NSNull null] ? nil : parameterSets[i];
+            NSString *URLString = [kWBHarnessBaseURLString stringByAppendingString:@"search"];
+            uint64_t serializerNanoseconds = 0;
+            uint64_t prototypeNanoseconds = 0;
+            double serializerAllocations = WBHarnessMeasure(20000, &serializerNanoseconds, ^{
+                [serializer requestWithMethod:method URLString:URLString parameters:requestParameters error:nil];
+            });
+            double prototypeAllocations = WBHarnessMeasure(20000, &prototypeNanoseconds, ^{
+                [prototype requestWithMethod:method path:@"search" parameters:requestParameters error:nil];
+            });
+            double ratio = serializerAllocations / MAX(prototypeAllocations, 1);
+            printf("%-20s %12.1f %12.1f %7.1fx %12llu %12llu\n", [names[i] UTF8String], serializerAllocations, prototypeAllocations, ratio, serializerNanoseconds, prototypeNanoseconds);
+            if (i == 0) {
+                WBHarnessCheck(ratio >= 3, "at least 3x fewer allocations without parameters");
+            }
+        }
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
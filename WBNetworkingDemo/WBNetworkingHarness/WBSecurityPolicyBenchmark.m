@@ -0,0 +1,206 @@
+//
+//  WBSecurityPolicyBenchmark.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Time per evaluation of WBSSLPinningModePublicKey with 50 pins against a 4-certificate chain. The only matching pin is the root, so every certificate in the chain is checked.
+//  - legacy: the previous matching, one SecTrustEvaluate per chain certificate plus a nested loop of key comparisons (SecItemExport on macOS);
+//  - SPKI set: -evaluateServerTrust:forDomain: without system trust evaluation, only the SHA-256 of each subjectPublicKeyInfo and a set lookup;
+//  - full, cache off / cache on: -evaluateServerTrust:forDomain: with system trust evaluation against the benchmark root.
+//  50 个 pin、4 级证书链时 WBSSLPinningModePublicKey 每次评估的耗时。唯一匹配的 pin 是根证书，链上每个证书都会被检查。
+//  legacy 是之前的做法：链上每个证书一次 SecTrustEvaluate，再两层循环比较公钥；SPKI set 只计算 subjectPublicKeyInfo 的 SHA-256 并在集合中查找；full 包括系统的信任评估，分别关闭和打开评估结果缓存。
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  ./WBSecurityPolicyBenchmarkCerts.sh /tmp/WBSecurityPolicyBenchmarkCerts
+//  clang -O2 -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security \
+//      ../WBNetworking/WBSecurityPolicy.m WBSecurityPolicyBenchmark.m -o /tmp/WBSecurityPolicyBenchmark
+//  /tmp/WBSecurityPolicyBenchmark /tmp/WBSecurityPolicyBenchmarkCerts [evaluations, default 2000]
+//
+
+#import <Foundation/Foundation.h>
+#import <Security/Security.h>
+#import <AssertMacros.h>
+#import "WBSecurityPolicy.h"
+
+static NSString * const kWBBenchmarkDomain = @"bench.wbnetworking.test";
+
+#pragma mark - 之前的公钥匹配
+
+#if TARGET_OS_OSX
+static NSData * WBLegacySecKeyGetData(SecKeyRef key) {
+    CFDataRef data = NULL;
+    __Require_noErr_Quiet(SecItemExport(key, kSecFormatUnknown, kSecItemPemArmour, NULL, &data), _out);
+    return (__bridge_transfer NSData *)data;
+_out:
+    if (data) {
+        CFRelease(data);
+    }
+    return nil;
+}
+#endif
+
+static BOOL WBLegacySecKeyIsEqualToKey(SecKeyRef key1, SecKeyRef key2) {
+#if TARGET_OS_OSX
+    return [WBLegacySecKeyGetData(key1) isEqual:WBLegacySecKeyGetData(key2)];
+#else
+    return [(__bridge id)key1 isEqual:(__bridge id)key2];
+#endif
+}
+
+//为一个证书单独创建 SecTrustRef 并评估，取出公钥
+static id WBLegacyPublicKeyForCertificate(SecCertificateRef certificate) {
+    id publicKey = nil;
+    SecPolicyRef policy = SecPolicyCreateBasicX509();
+    SecCertificateRef someCertificates[] = {certificate};
+    CFArrayRef certificates = CFArrayCreate(NULL, (const void **)someCertificates, 1, NULL);
+    SecTrustRef trust = NULL;
+    SecTrustResultType result;
+
+    __Require_noErr_Quiet(SecTrustCreateWithCertificates(certificates, policy, &trust), _out);
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    __Require_noErr_Quiet(SecTrustEvaluate(trust, &result), _out);
+    publicKey = (__bridge_transfer id)SecTrustCopyPublicKey(trust);
+#pragma clang diagnostic pop
+
+_out:
+    if (trust) {
+        CFRelease(trust);
+    }
+    CFRelease(certificates);
+    CFRelease(policy);
+    return publicKey;
+}
+
+static BOOL WBLegacyServerTrustMatchesPinnedPublicKeys(SecTrustRef serverTrust, NSArray *pinnedPublicKeys) {
+    NSInteger trustedPublicKeyCount = 0;
+    CFIndex certificateCount = SecTrustGetCertificateCount(serverTrust);
+    for (CFIndex i = 0; i < certificateCount; i++) {
+        id trustChainPublicKey = WBLegacyPublicKeyForCertificate(SecTrustGetCertificateAtIndex(serverTrust, i));
+        for (id pinnedPublicKey in pinnedPublicKeys) {
+            if (WBLegacySecKeyIsEqualToKey((__bridge SecKeyRef)trustChainPublicKey, (__bridge SecKeyRef)pinnedPublicKey)) {
+                trustedPublicKeyCount += 1;
+            }
+        }
+    }
+    return trustedPublicKeyCount > 0;
+}
+
+#pragma mark -
+
+static NSData * WBReadCertificate(NSString *directory, NSString *name) {
+    NSData *data = [NSData dataWithContentsOfFile:[directory stringByAppendingPathComponent:name]];
+    if (!data) {
+        fprintf(stderr, "cannot read %s, run WBSecurityPolicyBenchmarkCerts.sh first\n", [name UTF8String]);
+        exit(1);
+    }
+    return data;
+}
+
+//执行 count 次，返回每次的平均耗时（微秒）。结果和 expected 不同时退出
+static double WBMeasure(const char *name, NSUInteger count, BOOL expected, BOOL (^evaluation)(void)) {
+    //预热
+    for (NSUInteger i = 0; i < MIN(count, 20); i++) {
+        if (evaluation() != expected) {
+            fprintf(stderr, "%s: expected %s\n", name, expected ? "YES" : "NO");
+            exit(1);
+        }
+    }
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSUInteger i = 0; i < count; i++) {
+        @autoreleasepool {
+            evaluation();
+        }
+    }
+    double microseconds = (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / NSEC_PER_USEC / count;
+    printf("%-22s %12.1f\n", name, microseconds);
+    return microseconds;
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        if (argc < 2) {
+            fprintf(stderr, "usage: %s <certificate directory> [evaluations]\n", argv[0]);
+            return 2;
+        }
+        NSString *directory = @(argv[1]);
+        NSUInteger count = argc > 2 ? (NSUInteger)strtoul(argv[2], NULL, 10) : 2000;
+
+        NSMutableArray *chain = [NSMutableArray array];
+        for (NSUInteger i = 0; i < 4; i++) {
+            NSData *data = WBReadCertificate(directory, [NSString stringWithFormat:@"chain-%lu.der", (unsigned long)i]);
+            [chain addObject:(__bridge_transfer id)SecCertificateCreateWithData(NULL, (__bridge CFDataRef)data)];
+        }
+        NSData *rootData = WBReadCertificate(directory, @"chain-3.der");
+
+        //49 个无关的证书加上根证书，共 50 个 pin
+        NSMutableSet <NSData *> *pinnedCertificates = [NSMutableSet set];
+        for (NSUInteger i = 1; i <= 49; i++) {
+            [pinnedCertificates addObject:WBReadCertificate(directory, [NSString stringWithFormat:@"pin-%02lu.der", (unsigned long)i])];
+        }
+        NSSet <NSData *> *unmatchedPinnedCertificates = [pinnedCertificates copy];
+        [pinnedCertificates addObject:rootData];
+
+        SecTrustRef serverTrust = NULL;
+        SecPolicyRef policy = SecPolicyCreateSSL(true, (__bridge CFStringRef)kWBBenchmarkDomain);
+        if (SecTrustCreateWithCertificates((__bridge CFArrayRef)chain, policy, &serverTrust) != errSecSuccess) {
+            fprintf(stderr, "cannot create the server trust\n");
+            return 1;
+        }
+        CFRelease(policy);
+        //系统评估时以基准测试的根证书为锚点
+        SecTrustSetAnchorCertificates(serverTrust, (__bridge CFArrayRef)@[chain[3]]);
+
+        //之前在 setPinnedCertificates: 中预先取出每个 pin 的公钥
+        NSMutableArray *legacyPinnedPublicKeys = [NSMutableArray array];
+        for (NSData *data in pinnedCertificates) {
+            SecCertificateRef certificate = SecCertificateCreateWithData(NULL, (__bridge CFDataRef)data);
+            id publicKey = WBLegacyPublicKeyForCertificate(certificate);
+            CFRelease(certificate);
+            if (publicKey) {
+                [legacyPinnedPublicKeys addObject:publicKey];
+            }
+        }
+
+        WBSecurityPolicy *pinOnlyPolicy = [WBSecurityPolicy policyWithPinningMode:WBSSLPinningModePublicKey withPinnedCertificates:pinnedCertificates];
+        pinOnlyPolicy.allowInvalidCertificates = YES;
+        pinOnlyPolicy.validatesDomainName = NO;
+        pinOnlyPolicy.trustEvaluationCacheTTL = 0;
+
+        WBSecurityPolicy *unmatchedPolicy = [WBSecurityPolicy policyWithPinningMode:WBSSLPinningModePublicKey withPinnedCertificates:unmatchedPinnedCertificates];
+        unmatchedPolicy.allowInvalidCertificates = YES;
+        unmatchedPolicy.validatesDomainName = NO;
+        unmatchedPolicy.trustEvaluationCacheTTL = 0;
+
+        WBSecurityPolicy *uncachedPolicy = [WBSecurityPolicy policyWithPinningMode:WBSSLPinningModePublicKey withPinnedCertificates:pinnedCertificates];
+        uncachedPolicy.trustEvaluationCacheTTL = 0;
+
+        WBSecurityPolicy *cachedPolicy = [WBSecurityPolicy policyWithPinningMode:WBSSLPinningModePublicKey withPinnedCertificates:pinnedCertificates];
+
+        printf("%lu pins, %lu certificates in the chain, %lu evaluations\n", (unsigned long)[pinnedCertificates count], (unsigned long)[chain count], (unsigned long)count);
+        printf("%-22s %12s\n", "", "us/evaluation");
+
+        double legacy = WBMeasure("legacy", count, YES, ^BOOL{
+            return WBLegacyServerTrustMatchesPinnedPublicKeys(serverTrust, legacyPinnedPublicKeys);
+        });
+        double pinOnly = WBMeasure("SPKI set", count, YES, ^BOOL{
+            return [pinOnlyPolicy evaluateServerTrust:serverTrust forDomain:kWBBenchmarkDomain];
+        });
+        WBMeasure("SPKI set, no match", count, NO, ^BOOL{
+            return [unmatchedPolicy evaluateServerTrust:serverTrust forDomain:kWBBenchmarkDomain];
+        });
+        WBMeasure("full, cache off", count, YES, ^BOOL{
+            return [uncachedPolicy evaluateServerTrust:serverTrust forDomain:kWBBenchmarkDomain];
+        });
+        WBMeasure("full, cache on", count, YES, ^BOOL{
+            return [cachedPolicy evaluateServerTrust:serverTrust forDomain:kWBBenchmarkDomain];
+        });
+
+        printf("pin matching speedup %.1fx\n", legacy / pinOnly);
+        printf("cache hits %lu, misses %lu\n", (unsigned long)cachedPolicy.trustEvaluationCacheHitCount, (unsigned long)cachedPolicy.trustEvaluationCacheMissCount);
+        CFRelease(serverTrust);
+    }
+    return 0;
+}
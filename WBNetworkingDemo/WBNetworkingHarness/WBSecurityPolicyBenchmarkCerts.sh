@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+#  WBSecurityPolicyBenchmarkCerts.sh
+#  WBNetworkingDemo
+#
+#  Created by 58 on 2021/7/15.
+#
+#  Writes the DER certificates used by WBSecurityPolicyBenchmark into a directory:
+#  - chain-0.der … chain-3.der: a 4-certificate chain for bench.wbnetworking.test (leaf, two intermediates, root);
+#  - pin-01.der … pin-49.der: 49 unrelated self-signed certificates that fill the pin set up to 50 together with the root.
+#  为 WBSecurityPolicyBenchmark 生成 DER 证书：bench.wbnetworking.test 的 4 级证书链（叶子、两级中间证书、根证书），以及 49 个无关的自签名证书，和根证书一起组成 50 个 pin。
+#
+#  ./WBSecurityPolicyBenchmarkCerts.sh /tmp/WBSecurityPolicyBenchmarkCerts
+#
+
+set -eu
+
+DIR=${1:?usage: $0 /path/to/output/directory}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+mkdir -p "$DIR"
+
+cat >"$WORK/ext.cnf" <<EOF
+[ca]
+basicConstraints = critical, CA:true
+keyUsage = critical, keyCertSign, cRLSign
+subjectKeyIdentifier = hash
+authorityKeyIdentifier = keyid
+
+[leaf]
+basicConstraints = critical, CA:false
+keyUsage = critical, digitalSignature, keyEncipherment
+extendedKeyUsage = serverAuth
+subjectAltName = DNS:bench.wbnetworking.test
+subjectKeyIdentifier = hash
+authorityKeyIdentifier = keyid
+EOF
+
+key() {
+    openssl genpkey -algorithm RSA -pkeyopt rsa_keygen_bits:2048 -out "$WORK/$1.key" 2>/dev/null
+}
+
+# sign <name> <issuer> <extension section> <subject> <days>
+sign() {
+    key "$1"
+    openssl req -new -key "$WORK/$1.key" -subj "$4" -out "$WORK/$1.csr"
+    openssl x509 -req -in "$WORK/$1.csr" -CA "$WORK/$2.pem" -CAkey "$WORK/$2.key" -set_serial "0x$(openssl rand -hex 8)" \
+        -days "$5" -sha256 -extfile "$WORK/ext.cnf" -extensions "$3" -out "$WORK/$1.pem" 2>/dev/null
+}
+
+key root
+openssl req -new -x509 -key "$WORK/root.key" -subj "/CN=WBNetworking Benchmark Root" -days 825 -sha256 \
+    -config "$WORK/ext.cnf" -extensions ca -out "$WORK/root.pem" 2>/dev/null
+sign int1 root ca "/CN=WBNetworking Benchmark Intermediate 1" 825
+sign int2 int1 ca "/CN=WBNetworking Benchmark Intermediate 2" 825
+# 叶子证书的有效期不超过 398 天，满足系统对 TLS 服务器证书的要求
+sign leaf int2 leaf "/CN=bench.wbnetworking.test" 397
+
+openssl x509 -in "$WORK/leaf.pem" -outform DER -out "$DIR/chain-0.der"
+openssl x509 -in "$WORK/int2.pem" -outform DER -out "$DIR/chain-1.der"
+openssl x509 -in "$WORK/int1.pem" -outform DER -out "$DIR/chain-2.der"
+openssl x509 -in "$WORK/root.pem" -outform DER -out "$DIR/chain-3.der"
+
+i=1
+while [ $i -le 49 ]; do
+    name=$(printf 'pin-%02d' $i)
+    key "$name"
+    openssl req -new -x509 -key "$WORK/$name.key" -subj "/CN=WBNetworking Benchmark Pin $i" -days 825 -sha256 \
+        -config "$WORK/ext.cnf" -extensions ca -outform DER -out "$DIR/$name.der" 2>/dev/null
+    i=$((i + 1))
+done
+
+echo "wrote $(ls "$DIR" | grep -c '\.der$') certificates to $DIR"
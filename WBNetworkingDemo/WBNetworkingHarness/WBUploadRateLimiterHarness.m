@@ -0,0 +1,186 @@
+//
+//  WBUploadRateLimiterHarness.m
+//  WBNetworkingDemo
+//
+//  Created by 58 on 2021/7/15.
+//
+//  Uploads multipart bodies throttled by a shared WBUploadRateLimiter to a loopback server through NSURLSession, and compares the achieved throughput with the target:
+//  1. one upload and four concurrent uploads sharing one limiter, at 128 KB/s, 512 KB/s and 2 MB/s;
+//  2. the same through the gzip body stream, which reads the throttled multipart stream;
+//  3. raising the rate in the middle of an upload wakes the waiting streams at once.
+//  In every case the reading thread must never wait for tokens: NSURLSession reads only after `hasBytesAvailable` or a stream event, and both reserve tokens first.
+//  通过 NSURLSession 把共用一个 WBUploadRateLimiter 限速的 multipart body 上传到回环服务器，对比实际速率和目标速率：
+//  1. 单个上传和共用一个 limiter 的 4 个并发上传，目标速率 128 KB/s、512 KB/s、2 MB/s；2. 同样的上传经过 gzip 压缩流；3. 上传过程中提高速率，等待中的 stream 立即被唤醒。
+//  所有情况下读取线程都不能等待令牌：NSURLSession 只在 hasBytesAvailable 为 YES 或者收到可读事件后读取，这两种情况都会先预留令牌。
+//
+//  The serializer source is included directly so that the limiter's private methods can be counted. 直接包含 serializer 的源文件，以便统计 limiter 私有方法的调用次数
+//
+//  cd WBNetworkingDemo/WBNetworkingHarness
+//  clang -fobjc-arc -I ../WBNetworking -framework Foundation -framework Security -framework SystemConfiguration -framework CoreServices -lz \
+//      $(ls ../WBNetworking/*.m | grep -v WBURLRequestSeriailzation) WBLoopbackHTTPServer.m WBUploadRateLimiterHarness.m -o /tmp/WBUploadRateLimiterHarness
+//  /tmp/WBUploadRateLimiterHarness
+//
+
+#import <Foundation/Foundation.h>
+#import <objc/runtime.h>
+#import "../WBNetworking/WBURLRequestSeriailzation.m"
+#import "WBLoopbackHTTPServer.h"
+
+static NSUInteger WBHarnessFailures = 0;
+
+#define WBHarnessCheck(condition, ...) do { \
+    if (condition) { \
+        printf("ok   "); \
+    } else { \
+        printf("FAIL "); \
+        WBHarnessFailures += 1; \
+    } \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+} while (0)
+
+//-waitForBytesUpTo: 被调用的次数，也就是读取线程阻塞等待令牌的次数
+static atomic_uint WBHarnessBlockingWaits;
+
+static void WBHarnessCountBlockingWaits(void) {
+    Method method = class_getInstanceMethod([WBUploadRateLimiter class], @selector(waitForBytesUpTo:));
+    NSUInteger (*originalImplementation)(id, SEL, NSUInteger) = (NSUInteger (*)(id, SEL, NSUInteger))method_getImplementation(method);
+    method_setImplementation(method, imp_implementationWithBlock(^NSUInteger(id limiter, NSUInteger length) {
+        atomic_fetch_add(&WBHarnessBlockingWaits, 1);
+        return originalImplementation(limiter, @selector(waitForBytesUpTo:), length);
+    }));
+}
+
+static NSURLRequest * WBHarnessThrottledRequest(NSURL *URL, NSData *data, WBUploadRateLimiter *rateLimiter, BOOL compresses) {
+    WBHTTPRequestSerializer *serializer = [WBHTTPRequestSerializer serializer];
+    if (compresses) {
+        serializer.bodyCompression = WBHTTPRequestBodyCompressionGzip;
+    }
+    return [serializer multipartFormRequestWithMethod:@"POST" URLString:[URL absoluteString] parameters:nil constructingBodyWithBlock:^(id<WBMultipartFormData> formData) {
+        [formData appendPartWithFileData:data name:@"file" fileName:@"upload.bin" mimeType:@"application/octet-stream"];
+        [formData throttleBandwidthWithRateLimiter:rateLimiter];
+    } error:nil];
+}
+
+//同时上传 requests，全部完成后返回耗时（秒）
+static NSTimeInterval WBHarnessUpload(NSURLSession *session, NSArray <NSURLRequest *> *requests, void (^whileUploading)(void)) {
+    dispatch_group_t group = dispatch_group_create();
+    __block NSUInteger failures = 0;
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    for (NSURLRequest *request in requests) {
+        dispatch_group_enter(group);
+        [[session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+            if (error) {
+                @synchronized (requests) {
+                    failures += 1;
+                }
+            }
+            dispatch_group_leave(group);
+        }] resume];
+    }
+    if (whileUploading) {
+        whileUploading();
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    NSTimeInterval elapsed = (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start) / NSEC_PER_SEC;
+    WBHarnessCheck(failures == 0, "%lu uploads finished without errors", (unsigned long)[requests count]);
+    return elapsed;
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+
+        WBHarnessCountBlockingWaits();
+
+        __block unsigned long long receivedBytes = 0;
+        NSObject *receivedBytesLock = [[NSObject alloc] init];
+        WBLoopbackHTTPServer *server = [[WBLoopbackHTTPServer alloc] initWithHandler:^NSData *(WBLoopbackHTTPRequest *request) {
+            @synchronized (receivedBytesLock) {
+                receivedBytes += [request.body length];
+            }
+            return [NSData data];
+        }];
+        if (![server start]) {
+            fprintf(stderr, "cannot start the loopback server\n");
+            return 1;
+        }
+        NSURL *URL = [server.baseURL URLByAppendingPathComponent:@"upload"];
+        NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+        configuration.HTTPMaximumConnectionsPerHost = 8;
+        NSURLSession *session = [NSURLSession sessionWithConfiguration:configuration];
+
+        printf("# achieved vs target throughput\n");
+        for (NSNumber *compresses in @[@NO, @YES]) {
+            for (NSNumber *rate in @[@(128 * 1024), @(512 * 1024), @(2 * 1024 * 1024)]) {
+                for (NSNumber *streamCount in @[@1, @4]) {
+                    NSUInteger bytesPerSecond = [rate unsignedIntegerValue];
+                    WBUploadRateLimiter *rateLimiter = [[WBUploadRateLimiter alloc] initWithBytesPerSecond:bytesPerSecond burstSize:0];
+                    //总共约 4 秒的数据。随机数据压缩后几乎不会变小，限速作用在压缩前读取的字节上
+                    NSUInteger length = bytesPerSecond * 4 / [streamCount unsignedIntegerValue];
+                    NSMutableData *data = [NSMutableData dataWithLength:length];
+                    arc4random_buf([data mutableBytes], length);
+
+                    NSMutableArray *requests = [NSMutableArray array];
+                    unsigned long long bodyLength = 0;
+                    for (NSUInteger i = 0; i < [streamCount unsignedIntegerValue]; i++) {
+                        NSURLRequest *request = WBHarnessThrottledRequest(URL, data, rateLimiter, [compresses boolValue]);
+                        [requests addObject:request];
+                        //压缩后的请求没有 Content-Length，按原始数据计算
+                        bodyLength += [compresses boolValue] ? length : (unsigned long long)[[request valueForHTTPHeaderField:@"Content-Length"] longLongValue];
+                    }
+
+                    atomic_store(&WBHarnessBlockingWaits, 0);
+                    NSTimeInterval elapsed = WBHarnessUpload(session, requests, nil);
+                    //开始时桶是满的，最初的 burst 不受速率限制
+                    double burst = MAX((double)bytesPerSecond / 4.0, (double)kWBUploadRateLimiterMinimumGrant);
+                    double achieved = ((double)bodyLength - burst) / elapsed;
+                    double ratio = achieved / (double)bytesPerSecond;
+                    WBHarnessCheck(ratio > 0.9 && ratio < 1.1, "%s%4lu KB/s x%lu: achieved %.0f KB/s (%.2f of target)", [compresses boolValue] ? "gzip " : "", (unsigned long)bytesPerSecond / 1024, (unsigned long)[streamCount unsignedIntegerValue], achieved / 1024, ratio);
+                    WBHarnessCheck(atomic_load(&WBHarnessBlockingWaits) == 0, "the reading thread waited for tokens %u times", atomic_load(&WBHarnessBlockingWaits));
+                }
+            }
+        }
+
+        printf("# raising the rate wakes waiting streams\n");
+        {
+            WBUploadRateLimiter *rateLimiter = [[WBUploadRateLimiter alloc] initWithBytesPerSecond:16 * 1024 burstSize:0];
+            NSMutableData *data = [NSMutableData dataWithLength:2 * 1024 * 1024];
+            arc4random_buf([data mutableBytes], [data length]);
+            atomic_store(&WBHarnessBlockingWaits, 0);
+            //16 KB/s 需要两分钟，1 秒后提高到 8 MB/s，应该在 2 秒内完成
+            NSTimeInterval elapsed = WBHarnessUpload(session, @[WBHarnessThrottledRequest(URL, data, rateLimiter, NO)], ^{
+                [NSThread sleepForTimeInterval:1];
+                rateLimiter.bytesPerSecond = 8 * 1024 * 1024;
+            });
+            WBHarnessCheck(elapsed < 2, "finished %.2f s after the start", elapsed);
+            WBHarnessCheck(atomic_load(&WBHarnessBlockingWaits) == 0, "the reading thread waited for tokens %u times", atomic_load(&WBHarnessBlockingWaits));
+        }
+
+        printf("# a reader without stream callbacks still reads the whole body\n");
+        {
+            WBUploadRateLimiter *rateLimiter = [[WBUploadRateLimiter alloc] initWithBytesPerSecond:1024 * 1024 burstSize:0];
+            NSMutableData *data = [NSMutableData dataWithLength:512 * 1024];
+            NSURLRequest *request = WBHarnessThrottledRequest(URL, data, rateLimiter, NO);
+            NSInputStream *stream = request.HTTPBodyStream;
+            uint8_t buffer[16 * 1024];
+            unsigned long long total = 0;
+            NSInteger length;
+            [stream open];
+            while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0) {
+                total += (unsigned long long)length;
+            }
+            [stream close];
+            WBHarnessCheck(total == (unsigned long long)[[request valueForHTTPHeaderField:@"Content-Length"] longLongValue], "read %llu bytes synchronously", total);
+        }
+
+        [session invalidateAndCancel];
+        [server stop];
+        printf("received %llu bytes\n", receivedBytes);
+    }
+    if (WBHarnessFailures > 0) {
+        printf("%lu failed\n", (unsigned long)WBHarnessFailures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}